@@ -0,0 +1,40 @@
+#include <pendule_pi/pendule_cpp.hpp>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <cmath>
+
+
+bool ok{true};
+
+void sigintHandler(int signo) {
+  ok = false;
+}
+
+
+int main(int argc, char** argv) {
+  std::signal(SIGINT, sigintHandler);
+  const std::string uri = argc > 1 ? argv[1] : "tcp://localhost";
+  pendule_pi::PenduleCpp pendulum(uri, 5);
+
+  // Same LQR as in the 'lqr' example, but evaluated by the interface at each
+  // period: the client only has to refresh it once in a while. Gains are
+  // ordered as the state: position, angle, linear and angular velocity.
+  const std::array<double,4> gains{-127.45880662905581, 2234.654627319883, -822.638944546691, 437.1177135919267};
+  const std::array<double,4> setpoint{0.0, M_PI, 0.0, 0.0};
+  // Outside of +/- 0.1rad around the upright position, the motor is off.
+  const std::array<double,4> limits{0.0, 0.1, 0.0, 0.0};
+
+  while(ok) {
+    pendulum.readState(pendulum.BLOCKING);
+    pendulum.sendFeedbackLaw(gains, setpoint, limits, 0, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+
+  pendulum.sendCommand(0);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+  return EXIT_SUCCESS;
+}
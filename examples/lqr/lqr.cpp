@@ -1,5 +1,6 @@
 #include <pendule_pi/pendule_cpp.hpp>
 #include <csignal>
+#include <string>
 #include <thread>
 #include <cmath>
 
@@ -20,9 +21,11 @@ double normalize(double angle) {
 }
 
 
-int main() {
+int main(int argc, char** argv) {
   std::signal(SIGINT, sigintHandler);
-  pendule_pi::PenduleCpp pendulum(5);
+  // Use, e.g., "shm://pendule" when running on the same host as the interface.
+  const std::string uri = argc > 1 ? argv[1] : "tcp://localhost";
+  pendule_pi::PenduleCpp pendulum(uri, 5);
 
   int pwm = 0;
   const double MAX_ANGLE = 0.1;
@@ -0,0 +1,52 @@
+#include <pendule_pi/controller_api.hpp>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+
+/// LQR stabilization around the upright position, run inside the low-level interface.
+/** Build it as a shared library, then set in `pendule_pi_config.yaml`:
+  * ```yaml
+  * controller:
+  *   path: /path/to/liblqr_plugin.so
+  *   parameters: "-127.4588 -822.6389 2234.6546 437.1177"  # kp kpd kt ktd (optional)
+  *   budget_us: 200
+  * ```
+  */
+class LqrPlugin : public pendule_pi::Controller {
+public:
+  LqrPlugin(const std::string& parameters) {
+    if(!parameters.empty()) {
+      std::istringstream iss(parameters);
+      if(!(iss >> kp_ >> kpd_ >> kt_ >> ktd_))
+        throw std::invalid_argument("expected 4 gains: kp kpd kt ktd");
+    }
+  }
+
+  int step(const pendule_pi_controller_state& state) override {
+    const double et = normalize(state.angle - M_PI);
+    if(std::fabs(et) > MAX_ANGLE)
+      return 0;
+    const double pwm = - kp_ * state.position - kt_ * et - kpd_ * state.linvel - ktd_ * state.angvel;
+    return static_cast<int>(std::clamp(pwm, -MAX_PWM, MAX_PWM));
+  }
+
+private:
+  static constexpr double MAX_ANGLE = 0.1;
+  static constexpr double MAX_PWM = 255;
+  double kp_{-127.45880662905581};
+  double kpd_{-822.638944546691};
+  double kt_{2234.654627319883};
+  double ktd_{437.1177135919267};
+
+  static double normalize(double angle) {
+    while(angle > M_PI)
+      angle -= 2*M_PI;
+    while(angle < -M_PI)
+      angle += 2*M_PI;
+    return angle;
+  }
+};
+
+PENDULE_PI_EXPORT_CONTROLLER(LqrPlugin, "LQR (plugin)")
@@ -0,0 +1,127 @@
+/** @file backend.hpp
+  * @brief Header file for the Backend class and its pigpio implementation.
+  */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pigpio.h>
+
+namespace pigpio {
+
+/// Abstract access to the GPIO functionalities used by this library.
+/** All hardware classes (Encoder, Switch, Motor...) as well as timing
+  * utilities (Rate, Timer...) never call pigpio's global functions directly.
+  * They go through the currently active backend instead, which can be
+  * retrieved via backend(). By default, the active backend is a
+  * PigpioBackend, which simply forwards calls to the real library. Other
+  * implementations, such as SimulatedBackend, allow to run the library
+  * without a Raspberry Pi.
+  *
+  * The methods mimic the pigpio functions with the same name (*e.g.*,
+  * setMode() behaves as `gpioSetMode()`), including their return values: a
+  * negative value means that the call failed. This makes them compatible
+  * with the PiGPIO_RUN and PiGPIO_RUN_VOID macros:
+  * ```c++
+  * PiGPIO_RUN_VOID(pigpio::backend().setMode, 10, PI_OUTPUT);
+  * ```
+  *
+  * The active backend can be changed with Backend::select(), or more
+  * conveniently by passing it to an ActivationToken.
+  */
+class Backend {
+public:
+  /// Initialize the state used by extendTick().
+  Backend();
+
+  virtual ~Backend() = default;
+
+  // Prevent the user from making copies of a Backend.
+  Backend(const Backend&) = delete;
+  Backend& operator=(const Backend&) = delete;
+
+  /// Equivalent of `gpioInitialise()`.
+  virtual int initialise() = 0;
+  /// Equivalent of `gpioTerminate()`.
+  virtual void terminate() = 0;
+  /// Equivalent of `gpioSetMode()`.
+  virtual int setMode(unsigned gpio, unsigned mode) = 0;
+  /// Equivalent of `gpioSetPullUpDown()`.
+  virtual int setPullUpDown(unsigned gpio, unsigned pud) = 0;
+  /// Equivalent of `gpioRead()`.
+  virtual int read(unsigned gpio) = 0;
+  /// Equivalent of `gpioRead_Bits_0_31()`.
+  virtual std::uint32_t readBits0to31() = 0;
+  /// Equivalent of `gpioWrite()`.
+  virtual int write(unsigned gpio, unsigned level) = 0;
+  /// Equivalent of `gpioPWM()`.
+  virtual int pwm(unsigned gpio, unsigned dutycycle) = 0;
+  /// Equivalent of `gpioSetAlertFuncEx()`.
+  virtual int setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata) = 0;
+  /// Equivalent of `gpioSetGetSamplesFuncEx()`.
+  virtual int setGetSamplesFuncEx(gpioGetSamplesFuncEx_t f, std::uint32_t bits, void* userdata) = 0;
+  /// Equivalent of `gpioTick()`.
+  virtual std::uint32_t tick() = 0;
+  /// Block the calling thread until tick() reaches the given value.
+  /** There is no pigpio equivalent: this is used by Rate to avoid
+    * busy-waiting. Implementations may wake up slightly late, but never
+    * early.
+    * @param tick time to wait for, in microseconds. It is interpreted as
+    *   being in the past if `tick-tick() >= 2^31`, in which case the method
+    *   returns immediately.
+    */
+  virtual void sleepUntil(std::uint32_t tick) = 0;
+
+  /// Extend a tick to 64 bits, see Clock.
+  /** The backend keeps a 64 bits reference time, which is moved forward
+    * (with a single compare-and-swap) each time a tick is more than 2^30
+    * microseconds ahead of it. Ticks are interpreted relatively to the
+    * reference, so extending a tick costs an atomic load in most cases.
+    * @param tick a tick that is less than 2^31 microseconds away from the
+    *   last extended one.
+    * @return the same time, in microseconds, on 64 bits.
+    */
+  std::uint64_t extendTick(std::uint32_t tick) noexcept;
+
+  /// Access the currently active backend.
+  static Backend& active();
+
+  /// Change the active backend.
+  /** @param backend the backend to be used from now on. If `nullptr`, the
+    *   default PigpioBackend is restored.
+    * @return the previously active backend.
+    * @warning Hardware objects do not remember the backend that was active
+    *   when they were created: change the backend only when no such objects
+    *   exist.
+    */
+  static Backend* select(Backend* backend);
+
+private:
+  static Backend* active_backend; ///< Currently active backend (nullptr means default).
+  std::atomic<std::uint64_t> tick_reference_; ///< Reference used by extendTick() (0 until the first call).
+};
+
+
+/// Backend that forwards all calls to the pigpio library.
+class PigpioBackend : public Backend {
+public:
+  int initialise() override;
+  void terminate() override;
+  int setMode(unsigned gpio, unsigned mode) override;
+  int setPullUpDown(unsigned gpio, unsigned pud) override;
+  int read(unsigned gpio) override;
+  std::uint32_t readBits0to31() override;
+  int write(unsigned gpio, unsigned level) override;
+  int pwm(unsigned gpio, unsigned dutycycle) override;
+  int setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata) override;
+  int setGetSamplesFuncEx(gpioGetSamplesFuncEx_t f, std::uint32_t bits, void* userdata) override;
+  std::uint32_t tick() override;
+  /// Sleep with `clock_nanosleep()`, using an absolute deadline on `CLOCK_MONOTONIC`.
+  void sleepUntil(std::uint32_t tick) override;
+};
+
+
+/// Shortcut for Backend::active().
+inline Backend& backend() { return Backend::active(); }
+
+} // end of namespace pigpio
@@ -0,0 +1,136 @@
+/** @file burst_sampler.hpp
+  * @brief Header file for the BurstSampler class.
+  */
+#pragma once
+
+#include <pendule_pi/encoder.hpp>
+#include <pendule_pi/wire_format.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Samples the encoders at a high rate, from the timestamps of their edges.
+/** Identification needs the encoder readings at several kHz, while the
+  * control loop runs at a few tens of Hz. Polling the encoders that fast
+  * would require another real-time thread. This class reconstructs the
+  * readings instead: since the step counters only change at edges, and
+  * every Encoder::Edge carries its time and the counter right after it, the
+  * reading at any time is the counter of the last edge that preceded it.
+  *
+  * Pendule::update() forwards the edges it drains (see
+  * Pendule::setBurstSampler()); once per period, sample() then fills a
+  * wire::Burst message with the readings on a regular time grid. Edges are
+  * delivered by pigpio with some latency, so the grid lags the current time
+  * by a fixed delay: readings are only produced once all the edges that
+  * precede them arrived.
+  *
+  * ```c++
+  * pendule_pi::BurstSampler sampler(500, 5000); // 2kHz, 5ms delay
+  * sampler.reset(pigpio::Clock::ticks(), position_steps, angle_steps, 0);
+  * pendule.setBurstSampler(&sampler);
+  * // at each period, after Pendule::update():
+  * while(sampler.sample(pigpio::Clock::ticks(), burst)) {
+  *   publish(burst); // full: send it, and continue with an empty one
+  *   burst.count = 0;
+  * }
+  * ```
+  *
+  * All methods but statistics() must be called by the same thread. They
+  * never allocate.
+  */
+class BurstSampler {
+public:
+  /// Largest number of edges of each encoder waiting to be sampled.
+  static constexpr std::size_t EDGE_CAPACITY = 4 * Encoder::EDGE_BUFFER_SIZE;
+
+  /// Largest number of PWM changes waiting to be sampled.
+  static constexpr std::size_t PWM_CAPACITY = 64;
+
+  /// Statistics collected since the creation of the sampler.
+  struct Statistics {
+    std::uint64_t samples; ///< Number of samples produced.
+    std::uint64_t late; ///< Number of edges received after the sample that should have seen them.
+    std::uint64_t dropped; ///< Number of edges dropped because too many were waiting.
+  };
+
+  /// Create a sampler, that produces no sample until reset() is called.
+  /** @param period_us time between two samples, in microseconds.
+    * @param delay_us lag of the samples behind the current time, in
+    *   microseconds. It should exceed the latency of the edges.
+    */
+  BurstSampler(
+    unsigned int period_us,
+    unsigned int delay_us
+  );
+
+  // Prevent the user from making copies of a BurstSampler.
+  BurstSampler(const BurstSampler&) = delete;
+  BurstSampler& operator=(const BurstSampler&) = delete;
+
+  /// Start sampling from the given time, forgetting the edges received so far.
+  /** @param now_us time of the first sample, in microseconds (see pigpio::Clock).
+    * @param position_steps current step counter of the position encoder.
+    * @param angle_steps current step counter of the angle encoder.
+    * @param pwm PWM currently applied.
+    */
+  void reset(std::uint64_t now_us, int position_steps, int angle_steps, int pwm);
+
+  /// Register an edge of the position encoder.
+  inline void addPositionEdge(const Encoder::Edge& edge) { addEdge(position_edges_, edge); }
+
+  /// Register an edge of the angle encoder.
+  inline void addAngleEdge(const Encoder::Edge& edge) { addEdge(angle_edges_, edge); }
+
+  /// Register the PWM applied from the given time (nothing happens if it did not change).
+  void setPwm(std::uint64_t time_us, int pwm);
+
+  /// Append the samples that can be produced to a burst message.
+  /** Samples are produced up to `now_us - delay_us`, and appended after
+    * the first `burst.count` ones. The other fields of the message are not
+    * modified.
+    * @param now_us current time, in microseconds (see pigpio::Clock).
+    * @param burst message to be filled.
+    * @return `true` if the message is full and more samples are available:
+    *   send it, empty it, and call this method again.
+    */
+  bool sample(std::uint64_t now_us, wire::Burst& burst);
+
+  /// Time between two samples, in microseconds.
+  inline unsigned int period() const { return period_us_; }
+
+  /// Read the statistics.
+  Statistics statistics() const;
+
+private:
+  /// A PWM applied from a given time.
+  struct PwmChange {
+    std::uint64_t time_us; ///< Time from which the PWM is applied.
+    int pwm; ///< Applied PWM.
+  };
+
+  const unsigned int period_us_; ///< See period().
+  const unsigned int delay_us_; ///< Lag of the samples behind the current time.
+  bool started_; ///< Set by reset().
+  std::uint64_t next_us_; ///< Time of the next sample.
+  int position_steps_; ///< Step counter of the position encoder at the last sample.
+  int angle_steps_; ///< Step counter of the angle encoder at the last sample.
+  int pwm_; ///< PWM at the last sample.
+  std::vector<Encoder::Edge> position_edges_; ///< Edges of the position encoder waiting to be sampled.
+  std::vector<Encoder::Edge> angle_edges_; ///< Edges of the angle encoder waiting to be sampled.
+  std::vector<PwmChange> pwm_changes_; ///< PWM changes waiting to be sampled.
+  std::atomic<std::uint64_t> samples_; ///< See Statistics::samples.
+  std::atomic<std::uint64_t> late_; ///< See Statistics::late.
+  std::atomic<std::uint64_t> dropped_; ///< See Statistics::dropped.
+
+  /// Store an edge, unless the buffer is full.
+  void addEdge(std::vector<Encoder::Edge>& edges, const Encoder::Edge& edge);
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+}
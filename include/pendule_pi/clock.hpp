@@ -0,0 +1,63 @@
+/** @file clock.hpp
+  * @brief Header file for the Clock class.
+  */
+#pragma once
+
+#include <pendule_pi/backend.hpp>
+#include <chrono>
+#include <cstdint>
+
+namespace pigpio {
+
+/// 64 bits monotonic clock, in microseconds, based on the ticks of the active backend.
+/** The ticks returned by `gpioTick()` are 32 bits values, which wrap around
+  * every ~72 minutes. Differences between two ticks remain correct as long
+  * as they are computed with unsigned arithmetic, but absolute times (*e.g.*,
+  * published timestamps) jump backward at each wrap. This class extends
+  * ticks to 64 bits (see Backend::extendTick()), without locks, so that
+  * times can be compared and subtracted over days of uptime.
+  *
+  * It satisfies the requirements of the standard *Clock* concept, so that
+  * it can be used with `std::chrono`:
+  * ```c++
+  * auto start = pigpio::Clock::now();
+  * // ...
+  * auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(pigpio::Clock::now() - start);
+  * ```
+  *
+  * The epoch is the first tick ever extended by the backend: at the
+  * beginning, 64 bits times are equal to 32 bits ticks.
+  *
+  * @warning The extension is correct only if the clock is read (or a tick is
+  *   extended) at least once every 2^30 microseconds, *i.e.*, ~17 minutes.
+  *   Any control loop using Rate or Timer does it much more often.
+  */
+class Clock {
+public:
+  using rep = std::int64_t; ///< Type of the number of ticks.
+  using period = std::micro; ///< Duration of a tick.
+  using duration = std::chrono::duration<rep,period>; ///< Durations measured by this clock.
+  using time_point = std::chrono::time_point<Clock>; ///< Times given by this clock.
+  static constexpr bool is_steady = true; ///< The clock never goes backward.
+
+  /// Current time.
+  static inline time_point now() noexcept { return fromTicks(ticks()); }
+
+  /// Current time, in microseconds.
+  static inline std::uint64_t ticks() noexcept { return extend(backend().tick()); }
+
+  /// Extend a tick given by the backend (*e.g.*, the timestamp of a GPIO alert) to 64 bits.
+  /** @param tick a tick that is less than 2^31 microseconds away from the
+    *   last time the clock was read.
+    * @return the same time, in microseconds, on 64 bits.
+    */
+  static inline std::uint64_t extend(std::uint32_t tick) noexcept { return backend().extendTick(tick); }
+
+  /// Convert a 64 bits time in microseconds to a time point.
+  static inline time_point fromTicks(std::uint64_t ticks) noexcept { return time_point(duration(static_cast<rep>(ticks))); }
+
+  /// Convert a time point to a 64 bits time in microseconds.
+  static inline std::uint64_t toTicks(time_point t) noexcept { return static_cast<std::uint64_t>(t.time_since_epoch().count()); }
+};
+
+} // end of namespace pigpio
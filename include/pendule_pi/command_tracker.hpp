@@ -0,0 +1,132 @@
+/** @file command_tracker.hpp
+  * @brief Header file for the CommandTracker class.
+  */
+#pragma once
+
+#include <pendule_pi/histogram.hpp>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace pendule_pi {
+
+/// Tracks the age of the commands received by the low-level interface.
+/** Each published state gets a sequence number, which the client echoes in
+  * the command it computes from that state (see wire::Command). Knowing when
+  * each state was published, the tracker measures the end-to-end latency of
+  * the control loop (publication of a state to application of the command
+  * computed from it) and its staleness (number of states published in
+  * between), and enforces deadlines:
+  *   - a command answering a state older than the maximum age is *stale*: it
+  *     is either dropped or applied but counted, depending on the policy;
+  *   - an accepted command expires when the state it answers becomes older
+  *     than the maximum age, after which the motor must be stopped.
+  *
+  * ```c++
+  * pendule_pi::CommandTracker tracker(100000); // 100ms
+  * // at each tick:
+  * state.header.sequence = tracker.published(now);
+  * // ...
+  * if(tracker.received(command.state_sequence, pigpio::Clock::ticks()))
+  *   pwm = command.pwm;
+  * if(!tracker.valid(pigpio::Clock::ticks()))
+  *   pwm = 0;
+  * ```
+  *
+  * Commands without sequence number (*e.g.*, text messages) can be
+  * registered with receivedUntracked(): they expire after the maximum age
+  * counted from their reception.
+  *
+  * All methods but statistics() must be called by the same thread.
+  */
+class CommandTracker {
+public:
+  /// Number of published states whose times are remembered.
+  static constexpr std::size_t HISTORY_SIZE = 256;
+
+  /// What to do with stale commands.
+  enum class StalePolicy {
+    Drop, ///< Ignore them: the previous command remains in effect until it expires.
+    Flag ///< Apply them, as if they had no sequence number, but count them as stale.
+  };
+
+  /// Statistics collected since the last reset.
+  struct Statistics {
+    std::uint64_t commands; ///< Number of commands received.
+    std::uint64_t stale; ///< Number of stale commands (including those answering unknown states).
+    std::uint64_t expired; ///< Number of times the command in effect expired.
+    Histogram::Summary latency_us; ///< Time between the publication of a state and the reception of the command answering it, in microseconds.
+    Histogram::Summary staleness; ///< Number of states published between a state and the reception of the command answering it.
+  };
+
+  /// Create a tracker.
+  /** @param max_age_us age of a state (in microseconds) above which the
+    *   commands answering it are stale.
+    * @param policy what to do with stale commands.
+    */
+  explicit CommandTracker(
+    std::uint64_t max_age_us,
+    StalePolicy policy = StalePolicy::Drop
+  );
+
+  // Prevent the user from making copies of a CommandTracker.
+  CommandTracker(const CommandTracker&) = delete;
+  CommandTracker& operator=(const CommandTracker&) = delete;
+
+  /// Register the publication of a state.
+  /** @param time_us time of the state, in microseconds (see pigpio::Clock).
+    * @return the sequence number to be sent with the state.
+    */
+  std::uint32_t published(std::uint64_t time_us);
+
+  /// Register the reception of a command.
+  /** @param state_sequence sequence number echoed by the command.
+    * @param now_us current time, in microseconds (see pigpio::Clock).
+    * @return `true` if the command must be applied.
+    */
+  bool received(std::uint32_t state_sequence, std::uint64_t now_us);
+
+  /// Register the reception of a command without sequence number.
+  /** @param now_us current time, in microseconds (see pigpio::Clock).
+    */
+  void receivedUntracked(std::uint64_t now_us);
+
+  /// Tells if the last command applied has not expired yet.
+  /** @param now_us current time, in microseconds (see pigpio::Clock).
+    * @return `false` if no command was applied, or if it expired.
+    */
+  bool valid(std::uint64_t now_us);
+
+  /// Maximum age of a state, in microseconds.
+  inline std::uint64_t maxAge() const { return max_age_us_; }
+
+  /// What to do with stale commands.
+  inline StalePolicy policy() const { return policy_; }
+
+  /// Read the statistics collected since the last reset.
+  Statistics statistics() const;
+
+  /// Forget the statistics.
+  void resetStatistics();
+
+private:
+  const std::uint64_t max_age_us_; ///< See maxAge().
+  const StalePolicy policy_; ///< See policy().
+  std::array<std::uint64_t,HISTORY_SIZE> times_; ///< Times of the last published states, indexed by sequence number.
+  std::uint32_t next_sequence_; ///< Sequence number of the next published state.
+  bool has_command_; ///< Tells if a command is in effect.
+  std::uint64_t deadline_us_; ///< Time at which the command in effect expires.
+  std::atomic<std::uint64_t> commands_; ///< See Statistics::commands.
+  std::atomic<std::uint64_t> stale_; ///< See Statistics::stale.
+  std::atomic<std::uint64_t> expired_; ///< See Statistics::expired.
+  Histogram latency_us_; ///< See Statistics::latency_us.
+  Histogram staleness_; ///< See Statistics::staleness.
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+}
@@ -0,0 +1,115 @@
+/** @file controller_api.hpp
+  * @brief Binary interface of the controller plugins loaded by the low-level interface.
+  */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/// Version of the plugin interface, increased each time it changes.
+#define PENDULE_PI_CONTROLLER_ABI_VERSION 1
+
+extern "C" {
+
+/// State given to a controller at each step.
+/** Plain C structure, so that its layout does not depend on the compiler
+  * used to build the plugin.
+  */
+struct pendule_pi_controller_state {
+  std::uint64_t time_us; ///< Hardware time, in microseconds (see pigpio::Clock).
+  std::uint32_t sequence; ///< Index of the step.
+  std::uint32_t reserved; ///< Always 0.
+  double period; ///< Control period [s].
+  double position; ///< Filtered position of the cart [m].
+  double angle; ///< Filtered angle of the pendulum [rad].
+  double linvel; ///< Filtered linear velocity of the cart [m/s].
+  double angvel; ///< Filtered angular velocity of the pendulum [rad/s].
+};
+
+/// Functions exported by a controller plugin.
+/** A plugin is a shared library exporting a function named
+  * `pendule_pi_controller` (see pendule_pi_controller_entry), which returns a
+  * pointer to a static instance of this structure. No C++ object and no
+  * exception ever crosses the boundary, so that the plugin and the interface
+  * can be built with different compilers or standard libraries.
+  *
+  * Plugins written in C++ should use PENDULE_PI_EXPORT_CONTROLLER instead of
+  * filling this structure by hand.
+  */
+struct pendule_pi_controller_api {
+  std::uint32_t abi_version; ///< Must be PENDULE_PI_CONTROLLER_ABI_VERSION.
+  const char* name; ///< Human-readable name of the controller.
+  /// Create an instance of the controller.
+  /** @param parameters string given in the configuration of the interface.
+    * @return the instance, or a null pointer on failure.
+    */
+  void* (*init)(const char* parameters);
+  /// Compute the command.
+  /** It is called by the control thread, at each period: it should neither
+    * block nor allocate memory.
+    * @param instance value returned by init().
+    * @param state current state of the pendulum.
+    * @param[out] pwm PWM to be applied, between -255 and 255 (values outside are saturated).
+    * @return 0 on success. Any other value means that the command must not
+    *   be applied.
+    */
+  int (*step)(void* instance, const pendule_pi_controller_state* state, int* pwm);
+  /// Destroy an instance returned by init().
+  void (*shutdown)(void* instance);
+};
+
+/// Type of the function exported by plugins, under the name `pendule_pi_controller`.
+typedef const pendule_pi_controller_api* (*pendule_pi_controller_entry)(void);
+
+}
+
+namespace pendule_pi {
+
+/// Convenience base class for controller plugins written in C++.
+/** ```c++
+  * class MyController : public pendule_pi::Controller {
+  * public:
+  *   MyController(const std::string& parameters) { ... }
+  *   int step(const pendule_pi_controller_state& state) override { return ...; }
+  * };
+  * PENDULE_PI_EXPORT_CONTROLLER(MyController, "my controller")
+  * ```
+  * The constructor receives the parameters given in the configuration of
+  * the interface. Exceptions thrown by the constructor or by step() are
+  * caught by the generated functions and reported as failures.
+  */
+class Controller {
+public:
+  virtual ~Controller() = default;
+  /// Compute the PWM to be applied in the given state.
+  virtual int step(const pendule_pi_controller_state& state) = 0;
+};
+
+}
+
+/// Export a class derived from pendule_pi::Controller as a controller plugin.
+/** @param CLASS name of the class. It must have a constructor taking a
+  *   `const std::string&`.
+  * @param NAME human-readable name of the controller.
+  */
+#define PENDULE_PI_EXPORT_CONTROLLER(CLASS, NAME) \
+  extern "C" { \
+  static void* pendule_pi_controller_init(const char* parameters) { \
+    try { return static_cast<pendule_pi::Controller*>(new CLASS(std::string(parameters != nullptr ? parameters : ""))); } \
+    catch(...) { return nullptr; } \
+  } \
+  static int pendule_pi_controller_step(void* instance, const pendule_pi_controller_state* state, int* pwm) { \
+    try { *pwm = static_cast<pendule_pi::Controller*>(instance)->step(*state); return 0; } \
+    catch(...) { return -1; } \
+  } \
+  static void pendule_pi_controller_shutdown(void* instance) { \
+    delete static_cast<pendule_pi::Controller*>(instance); \
+  } \
+  __attribute__((visibility("default"))) const pendule_pi_controller_api* pendule_pi_controller(void) { \
+    static const pendule_pi_controller_api api = { \
+      PENDULE_PI_CONTROLLER_ABI_VERSION, NAME, \
+      pendule_pi_controller_init, pendule_pi_controller_step, pendule_pi_controller_shutdown \
+    }; \
+    return &api; \
+  } \
+  }
@@ -0,0 +1,104 @@
+/** @file controller_plugin.hpp
+  * @brief Header file for the ControllerPlugin class.
+  */
+#pragma once
+
+#include <pendule_pi/controller_api.hpp>
+#include <pendule_pi/histogram.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace pendule_pi {
+
+/// Controller loaded from a shared library, and run by the control thread.
+/** The library must implement the interface described in
+  * controller_api.hpp. Running the controller in the process of the
+  * interface removes any transport between the state and the command.
+  *
+  * Each step is supervised: its execution time is measured and compared with
+  * a budget. If the step fails (*e.g.*, an exception was thrown in the
+  * plugin) or exceeds the budget, its output is discarded and the PWM is 0.
+  * A PWM outside of `[-MAX_PWM,MAX_PWM]` is saturated.
+  *
+  * ```c++
+  * pendule_pi::ControllerPlugin controller("./liblqr_plugin.so", "", 500);
+  * // at each period:
+  * pendule.setCommand(controller.step(state));
+  * ```
+  */
+class ControllerPlugin {
+public:
+  /// Largest absolute value of the PWM returned by step().
+  static constexpr int MAX_PWM = 255;
+
+  /// Statistics collected since the last reset.
+  struct Statistics {
+    std::uint64_t steps; ///< Number of calls to step().
+    std::uint64_t overruns; ///< Number of steps whose output was discarded because they exceeded the budget.
+    std::uint64_t failures; ///< Number of steps whose output was discarded because the plugin reported a failure.
+    std::uint64_t saturations; ///< Number of steps whose PWM was saturated to `[-MAX_PWM,MAX_PWM]`.
+    Histogram::Summary execution_us; ///< Execution times, in microseconds.
+  };
+
+  /// Load a plugin and create an instance of its controller.
+  /** @param path path of the shared library.
+    * @param parameters string passed to the initialization function of the
+    *   plugin.
+    * @param budget_us execution time above which the output of a step is
+    *   discarded, in microseconds. Use 0 for no budget.
+    * @throw std::runtime_error if the library cannot be loaded, does not
+    *   export a compatible interface, or if the initialization fails.
+    */
+  ControllerPlugin(
+    const std::string& path,
+    const std::string& parameters,
+    unsigned int budget_us
+  );
+
+  /// Destroy the controller, and unload the library.
+  ~ControllerPlugin();
+
+  // Prevent the user from making copies of a ControllerPlugin.
+  ControllerPlugin(const ControllerPlugin&) = delete;
+  ControllerPlugin& operator=(const ControllerPlugin&) = delete;
+
+  /// Name given by the plugin.
+  inline const std::string& name() const { return name_; }
+
+  /// Execution time budget of a step, in microseconds (0 if none).
+  inline unsigned int budget() const { return budget_us_; }
+
+  /// Run one step of the controller.
+  /** @param state current state of the pendulum.
+    * @return the PWM computed by the controller, saturated to
+    *   `[-MAX_PWM,MAX_PWM]`, or 0 if the step failed or exceeded the budget.
+    */
+  int step(const pendule_pi_controller_state& state) noexcept;
+
+  /// Read the statistics collected since the last reset.
+  Statistics statistics() const;
+
+  /// Forget the statistics.
+  /** @warning This must be called by the thread that calls step(). */
+  void resetStatistics();
+
+private:
+  void* library_; ///< Handle returned by `dlopen()`.
+  const pendule_pi_controller_api* api_; ///< Functions exported by the plugin.
+  void* instance_; ///< Instance of the controller.
+  std::string name_; ///< See name().
+  const unsigned int budget_us_; ///< See budget().
+  std::atomic<std::uint64_t> steps_; ///< See Statistics::steps.
+  std::atomic<std::uint64_t> overruns_; ///< See Statistics::overruns.
+  std::atomic<std::uint64_t> failures_; ///< See Statistics::failures.
+  std::atomic<std::uint64_t> saturations_; ///< See Statistics::saturations.
+  Histogram execution_us_; ///< See Statistics::execution_us.
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+}
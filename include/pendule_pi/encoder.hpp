@@ -3,14 +3,50 @@
   */
 #pragma once
 
+#include <pendule_pi/spsc_ring.hpp>
+#include <pendule_pi/velocity_estimator.hpp>
+#include <pendule_pi/threshold_engine.hpp>
+#include <array>
+#include <cstdint>
 #include <vector>
-#include <functional>
+#include <atomic>
+#include <utility>
 
 namespace pendule_pi {
 
 /// Class that handles a simple two-phases rotatory encoder.
 class Encoder {
 public:
+  /// Information about a single level change on one of the phases.
+  struct Edge {
+    std::uint64_t tick; ///< Time of the edge, in microseconds, extended to 64 bits (see pigpio::Clock).
+    int steps; ///< Step counter right after the edge was processed.
+    int direction; ///< Direction associated to the edge (+1, -1 or 0 if no step was detected).
+  };
+
+  /// Counters describing the quality of the signal read on the phases.
+  /** @see diagnostics() */
+  struct Diagnostics {
+    unsigned int edges; ///< Number of level changes processed.
+    unsigned int illegal_transitions; ///< Both phases changed at once: at least one step was lost, in an unknown direction.
+    unsigned int lost_edges; ///< A phase was reported at the level it already had: an edge was missed in between.
+    unsigned int min_interval_us; ///< Shortest time between two consecutive edges (`UINT_MAX` until two edges are seen).
+    unsigned int peak_edge_rate; ///< Highest edge rate measured over windows of at least RATE_WINDOW_US, in edges per second.
+    bool near_sampling_limit; ///< Set when two edges were closer than SAMPLING_MARGIN sampling periods.
+  };
+
+  /// Maximum number of edges that can be buffered between two calls to drainEdges().
+  static constexpr std::size_t EDGE_BUFFER_SIZE = 1024;
+
+  /// Duration of the windows used to measure the edge rate, in microseconds.
+  static constexpr unsigned int RATE_WINDOW_US = 1000;
+
+  /// Default sampling period of pigpio, in microseconds.
+  static constexpr unsigned int DEFAULT_SAMPLING_PERIOD_US = 5;
+
+  /// Minimum distance between edges, in sampling periods, below which Diagnostics::near_sampling_limit is set.
+  static constexpr unsigned int SAMPLING_MARGIN = 4;
+
   /// Constructor, performs the setup of the gpio.
   /** This class allows to handle a rotatory encoder, assuming that it uses two
     * phases in phase quadrature.
@@ -29,62 +65,117 @@ public:
   /// Puts the two GPIO pins into high impedance mode.
   virtual ~Encoder();
 
+  /// Pin connected to the first phase.
+  inline int pinA() const { return pin_a_; }
+  /// Pin connected to the second phase.
+  inline int pinB() const { return pin_b_; }
+
+  /// Enable or disable the GPIO alerts that update the encoder.
+  /** Alerts are enabled upon construction. They can be disabled when the
+    * levels of the phases are provided by other means, *e.g.*, by a
+    * SampleDecoder calling processLevels().
+    * @param enable if true, register the alert callbacks on both phases.
+    *   Otherwise, unregister them.
+    */
+  void useAlerts(bool enable);
+
+  /// Update the encoder given the current levels of both phases.
+  /** This is what the GPIO alerts do internally. It is meant to be used when
+    * alerts are disabled (see useAlerts()). If neither level changed since the
+    * last update, this method has no effect.
+    * @param a current level of the first phase.
+    * @param b current level of the second phase.
+    * @param tick time at which the levels were sampled, in microseconds.
+    * @warning Do not call this method concurrently with itself or with the
+    *   alerts.
+    */
+  void processLevels(bool a, bool b, unsigned int tick);
+
   /// Access the current step counter.
   /** @note To provide the highest possible resolution, this class counts the
     * times **any** phase changes state. This means that the number of steps
     * per revolution will correspond to **four times** those reported on the
     * datasheet.
     */
-  inline const int& steps() const { return steps_; }
+  inline int steps() const { return steps_.load(std::memory_order_relaxed); }
   /// Access the current motor direction.
-  inline const int& direction() const { return direction_; }
-
-  /// Add callbacks to be executed when reaching safety thresholds.
-  /** @param lower_threshold lower safety threshold below which lower_cb should
-    *   be called.
-    * @param upper_threshold upper safety threshold beyond which upper_cb
-    *   should be called.
-    * @param lower_cb function to be executed when the position becomes smaller
-    *   or equal to lower_threshold. It can be nullptr, in which case no
-    *   callback is executed.
-    * @param upper_cb function to be executed when the position becomes greater
-    *   or equal to upper_threshold. It can be nullptr, in which case no
-    *   callback is executed.
-    * @warning The thresholds upper_threshold and lower_threshold are
-    *   absolutely arbitrary. As an example, there is no need for the lower
-    *   threshold to be smaller than the upper one. But be careful: with great
-    *   power comes great responsibility!
-    */
-  void setSafetyCallbacks(
-    int lower_threshold,
-    int upper_threshold,
-    std::function<void(void)> lower_cb,
-    std::function<void(void)> upper_cb
-  );
+  inline int direction() const { return direction_.load(std::memory_order_relaxed); }
 
-  /// Add callbacks to be executed when reaching safety thresholds.
-  /** Like
-    * setSafetyCallbacks(int,int,std::function<void(void)>,std::function<void(void)>)
-    * but using the same callback for both the lower and the upper thresholds.
-    * @param lower_threshold lower safety threshold below which cb should be
-    *   called.
-    * @param upper_threshold upper safety threshold beyond which cb should be
-    *   called.
-    * @param cb function to be executed when the position becomes either smaller
-    *   (or equal) to lower_threshold or  greater (or equal) to upper_threshold.
-    *   It can be nullptr, in which case no callback is executed.
+  /// Process all edges registered since the last call.
+  /** Each time one of the phases changes level, an Edge is pushed into an
+    * internal lock-free buffer. This method allows to retrieve all edges
+    * that have been stored since the last call, from the oldest to the newest.
+    * Drained edges are also forwarded to the internal VelocityEstimator, so
+    * that velocity() keeps working no matter who consumes the buffer.
+    * @param f callable with signature `void(const Edge&)`.
+    * @return the number of processed edges.
+    * @warning The buffer is single-consumer: do not call this method (or its
+    *   overloads, or velocity()) from more than one thread. If nobody drains
+    *   the buffer, new edges are discarded once it is full (see
+    *   droppedEdges()).
     */
-  inline void setSafetyCallbacks(
-    int lower_threshold,
-    int upper_threshold,
-    std::function<void(void)> cb
-  )
-  {
-    setSafetyCallbacks(lower_threshold, upper_threshold, cb, cb);
+  template<class F>
+  inline std::size_t drainEdges(F&& f) {
+    return edges_.consume([&](const Edge& edge) {
+      // The estimator only uses differences: 32 bits ticks are enough
+      if(edge.direction != 0)
+        velocity_estimator_.addEdge(static_cast<unsigned int>(edge.tick), edge.steps);
+      f(edge);
+    });
   }
 
-  /// Remove previously assigned callbacks.
-  void removeSafetyCallbacks();
+  /// Append all edges registered since the last call to the given vector.
+  /** @param edges vector where new edges are appended.
+    * @return the number of appended edges.
+    * @see drainEdges(F&&)
+    */
+  std::size_t drainEdges(std::vector<Edge>& edges);
+
+  /// Estimate the current velocity from the timing of the last edges.
+  /** This method drains the edge buffer (see drainEdges()) and then queries
+    * the internal VelocityEstimator.
+    * @param now current time in microseconds, as returned by `gpioTick()`.
+    * @return the velocity of the encoder, in steps per second.
+    */
+  double velocity(unsigned int now);
+
+  /// Access the estimator used by velocity(), *e.g.*, to change its parameters.
+  inline VelocityEstimator& velocityEstimator() { return velocity_estimator_; }
+
+  /// Number of edges that were discarded because the edge buffer was full.
+  inline unsigned int droppedEdges() const { return dropped_edges_.load(std::memory_order_relaxed); }
+
+  /// Get a copy of the signal integrity counters.
+  /** These counters allow to tell if steps might have been lost, *e.g.*, due
+    * to noisy wiring or to edges that are too fast for the sampling rate of
+    * pigpio. The latter only sees levels every few microseconds (see
+    * setSamplingPeriod()): if both phases change between two samples, the
+    * transition is illegal and the step is not counted.
+    * @note The fields are read one by one, and they might thus be slightly
+    *   inconsistent with each other.
+    */
+  Diagnostics diagnostics() const;
+
+  /// Reset all signal integrity counters.
+  /** @note Updates performed concurrently by the GPIO thread might be lost. */
+  void resetDiagnostics();
+
+  /// Set the sampling period used by pigpio, in microseconds.
+  /** This value is only used to evaluate Diagnostics::near_sampling_limit.
+    * It should match the `-s` option of the pigpio daemon, or the value
+    * passed to `gpioCfgClock()` (5 microseconds by default).
+    * @param us sampling period, in microseconds.
+    */
+  inline void setSamplingPeriod(unsigned int us) { sampling_period_us_.store(us, std::memory_order_relaxed); }
+
+  /// Access the zones used to react to the position of the encoder.
+  /** The engine is updated after each edge, by the thread that decodes the
+    * encoder. Callbacks associated to zones are thus executed by that thread
+    * (usually the one of pigpio), and they should be short.
+    */
+  inline ThresholdEngine& thresholds() { return thresholds_; }
+  /// Read-only access to the zones used to react to the position of the encoder.
+  inline const ThresholdEngine& thresholds() const { return thresholds_; }
 
 private:
   /// "Table" that allows to tell the direction of rotation.
@@ -121,42 +212,60 @@ private:
     * given a null value so that they do not produce any effect.
     *
     * The lookup table above is stored in this variable, in the form of a
-    * vector. To read it, it is sufficient to pass as index the number obtained
-    * by reading the quadruple of pin values as a binary number. As an example,
-    * consider the case in which the encoder transitions from `(0,1)` to
-    * `(0,0)`. The four digits altogether form the binary number `0100`,
-    * corresponding to 4. The direction corresponding to this transition is
-    * thus available at `ENCODER_TABLE[4]`.
+    * compile-time array. To read it, it is sufficient to pass as index the
+    * number obtained by reading the quadruple of pin values as a binary
+    * number. As an example, consider the case in which the encoder
+    * transitions from `(0,1)` to `(0,0)`. The four digits altogether form the
+    * binary number `0100`, corresponding to 4. The direction corresponding to
+    * this transition is thus available at `ENCODER_TABLE[4]`. Since the index
+    * is built from four bits, it can never be out of range.
     */
-  static const std::vector<int> ENCODER_TABLE;
+  static constexpr std::array<std::int8_t,16> ENCODER_TABLE = {{
+    0, 1, -1, 0, -1, 0, 0, 1, 1, 0, 0, -1, 0, -1, 1, 0
+  }};
 
   /// Convert pin levels into the correct index to be passed to ENCODER_TABLE.
-  /** @param a current level of the first phase.
-    * @param b current level of the second phase.
-    * @param past_a past level of the first phase.
-    * @param past_b past level of the second phase.
+  /** @param past_state past levels of the phases, in the form `(a'<<1)|b'`.
+    * @param state current levels of the phases, in the form `(a<<1)|b`.
     * @return an index to be used inside ENCODER_TABLE which tells in which
     *   direction the encoder is rotating.
     */
-  static int encode(
-    bool a,
-    bool b,
-    bool past_a,
-    bool past_b
-  );
+  static constexpr unsigned int encode(
+    unsigned int past_state,
+    unsigned int state
+  )
+  {
+    return ((past_state << 2) | state) & 0xF;
+  }
 
   int pin_a_; ///< Pin the first wire of the encoder is connected to.
   int pin_b_; ///< Pin the second wire of the encoder is connected to.
-  bool a_current_; ///< Current voltage level on pin_a_.
-  bool b_current_; ///< Current voltage level on pin_b_.
-  bool a_past_; ///< Past voltage level on pin_a_.
-  bool b_past_; ///< Past voltage level on pin_b_.
-  int steps_; ///< Current number of encoder steps.
-  int direction_; ///< Current rotation direction.
-  int lower_threshold_; ///< Lower threshold below which lower_cb_ should be executed.
-  int upper_threshold_; ///< Upper threshold beyond which upper_cb_ should be executed.
-  std::function<void(void)> lower_cb_; ///< Callback to be executed whenver the position becomes less than lower_threshold_.
-  std::function<void(void)> upper_cb_; ///< Callback to be executed whenver the position becomes more than upper_threshold_.
+  unsigned int state_; ///< Current voltage levels of the phases, in the form `(a<<1)|b`.
+  std::atomic<int> steps_; ///< Current number of encoder steps.
+  std::atomic<int> direction_; ///< Current rotation direction.
+  SpscRing<Edge,EDGE_BUFFER_SIZE> edges_; ///< Edges waiting to be processed by drainEdges().
+  std::atomic<unsigned int> dropped_edges_; ///< Number of edges that did not fit inside edges_.
+  VelocityEstimator velocity_estimator_; ///< Estimator fed with the edges extracted from edges_.
+  std::atomic<unsigned int> n_edges_; ///< See Diagnostics::edges.
+  std::atomic<unsigned int> illegal_transitions_; ///< See Diagnostics::illegal_transitions.
+  std::atomic<unsigned int> lost_edges_; ///< See Diagnostics::lost_edges.
+  std::atomic<unsigned int> min_interval_us_; ///< See Diagnostics::min_interval_us.
+  std::atomic<unsigned int> peak_edge_rate_; ///< See Diagnostics::peak_edge_rate.
+  std::atomic<bool> near_sampling_limit_; ///< See Diagnostics::near_sampling_limit.
+  std::atomic<unsigned int> sampling_period_us_; ///< Sampling period of pigpio, see setSamplingPeriod().
+  unsigned int last_tick_; ///< Time of the last edge.
+  unsigned int window_start_; ///< Start of the current window used to measure the edge rate.
+  unsigned int window_edges_; ///< Number of edges in the current window.
+  ThresholdEngine thresholds_; ///< Zones updated after each edge.
+
+  /// Decode the transition from the current levels to the given ones.
+  /** Updates the levels, the step counter, the direction and the signal
+    * integrity counters, pushes the corresponding edge into the buffer and
+    * updates the zones.
+    * @param state new levels of the phases, in the form `(a<<1)|b`.
+    * @param tick time of the transition, in microseconds.
+    */
+  void decode(unsigned int state, unsigned int tick);
 
   /// Function called whenever one of the pins changes level.
   /** @param gpio the pin that just changed its level.
@@ -166,8 +275,8 @@ private:
     *   Remember that, due to integer arithmetics, it is still safe to get
     *   elasped times doing `tick_now-tick_previous` even if `tick_now`
     *   overflowed.
-    * @todo Perhaps remove the internal pin check that throws an exception?
-    * @todo Perhaps change ENCODER_TABLE.at(i) for ENCODER_TABLE[i]?
+    * @note This method runs on the pigpio thread and never throws: if `gpio`
+    *   is not one of the two phases, it is treated as pin_b_.
     */
   void pulse(
     int gpio,
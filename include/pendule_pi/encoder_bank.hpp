@@ -0,0 +1,205 @@
+/** @file encoder_bank.hpp
+  * @brief Header file for the EncoderBank class.
+  */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Decodes several two-phases encoders at once from a single level word.
+/** An Encoder decodes its own pair of pins, one edge at a time. When many
+  * encoders are connected to the same board, this class decodes all of them
+  * together, starting from the levels of pins 0 to 31 packed into a single
+  * 32 bits word (the format of `gpioRead_Bits_0_31()` and of pigpio samples).
+  *
+  * Decoding is done with a handful of bitwise operations performed on the
+  * whole word, so that its cost does not depend on the number of channels.
+  * Only channels that actually moved are then visited to update their
+  * counters. The direction rule is the same as in Encoder: given a single
+  * phase change from `(a',b')` to `(a,b)`, the encoder moved forward if
+  * `a' != b` and backward otherwise. Transitions where both phases changed
+  * at once are illegal: they do not affect the step counter, but they are
+  * counted (see illegalTransitions()).
+  *
+  * ```c++
+  * pendule_pi::EncoderBank bank({{20,21}, {23,24}, {16,26}});
+  * // Levels are updated by GPIO alerts, or by calling process(), update(),
+  * // or via a SampleDecoder (see SampleDecoder::addEncoderBank()).
+  * pendule_pi::EncoderBank::Snapshot snapshot;
+  * bank.snapshot(snapshot); // all channels, at the same instant
+  * ```
+  *
+  * Counters are published through a sequence lock: snapshot() returns the
+  * counters of all channels as they were after the same level word.
+  * @warning Only pins 0 to 31 can be used, and all pins must be distinct.
+  */
+class EncoderBank {
+public:
+  /// Pins `(a,b)` of a single channel.
+  using PinPair = std::pair<int,int>;
+
+  /// Consistent copy of the counters of all channels.
+  struct Snapshot {
+    unsigned int tick; ///< Time of the last processed level word, in microseconds.
+    std::vector<int> steps; ///< Step counter of each channel.
+    std::vector<unsigned int> illegal_transitions; ///< Illegal transitions of each channel.
+  };
+
+  /// Constructor, performs the setup of all pins.
+  /** @param channels list of pin pairs, one per encoder. The order defines
+    *   the index of each channel.
+    * @param use_alerts if true, register GPIO alerts on all pins so that the
+    *   bank updates itself (see useAlerts()).
+    */
+  explicit EncoderBank(
+    const std::vector<PinPair>& channels,
+    bool use_alerts=true
+  );
+
+  // Prevent the user from making copies of an EncoderBank.
+  EncoderBank(const EncoderBank&) = delete;
+  EncoderBank& operator=(const EncoderBank&) = delete;
+
+  /// Puts all GPIO pins into high impedance mode.
+  virtual ~EncoderBank();
+
+  /// Number of decoded encoders.
+  inline std::size_t size() const { return channels_.size(); }
+
+  /// Pins of the given channel.
+  inline const PinPair& channel(std::size_t idx) const { return channels_[idx]; }
+
+  /// Bits of all pins used by the bank.
+  inline std::uint32_t pinMask() const { return mask_a_ | mask_b_; }
+
+  /// Enable or disable the GPIO alerts that update the bank.
+  /** @param enable if true, register an alert callback on all pins.
+    *   Otherwise, unregister them.
+    */
+  void useAlerts(bool enable);
+
+  /// Decode a new level word.
+  /** @param levels levels of pins 0 to 31, bit `i` being the level of pin `i`.
+    * @param tick time at which the levels were sampled, in microseconds.
+    * @return the number of channels that made a step.
+    * @warning Do not call this method concurrently with itself, with update()
+    *   or with the alerts.
+    */
+  unsigned int process(std::uint32_t levels, unsigned int tick);
+
+  /// Read all pins at once and decode them.
+  /** This is a shortcut for `process(backend().readBits0to31(), backend().tick())`,
+    * useful to poll the encoders when alerts are disabled.
+    */
+  void update();
+
+  /// Current step counter of a channel.
+  /** @note As in Encoder, steps are counted on both edges of both phases. */
+  inline int steps(std::size_t idx) const { return steps_[idx].load(std::memory_order_relaxed); }
+
+  /// Direction of the last step of a channel (+1 or -1, 0 if it never moved).
+  inline int direction(std::size_t idx) const { return directions_[idx].load(std::memory_order_relaxed); }
+
+  /// Number of illegal transitions (both phases changed at once) seen on a channel.
+  inline unsigned int illegalTransitions(std::size_t idx) const { return illegal_[idx].load(std::memory_order_relaxed); }
+
+  /// Copy the counters of all channels, consistently.
+  /** @param snapshot structure to be filled. Its vectors are resized only if
+    *   needed, so that reusing the same structure does not allocate.
+    */
+  void snapshot(Snapshot& snapshot) const;
+
+  /// Bit-parallel core of the decoder.
+  /** This function works on "lane" words, in which each bit represents a
+    * channel (more precisely, the position of its pin `a`).
+    * @param past_a past levels of all `a` phases.
+    * @param past_b past levels of all `b` phases.
+    * @param a current levels of all `a` phases.
+    * @param b current levels of all `b` phases.
+    * @param[out] forward lanes that made a step forward.
+    * @param[out] backward lanes that made a step backward.
+    * @param[out] illegal lanes in which both phases changed.
+    */
+  static inline void decode(
+    std::uint32_t past_a,
+    std::uint32_t past_b,
+    std::uint32_t a,
+    std::uint32_t b,
+    std::uint32_t& forward,
+    std::uint32_t& backward,
+    std::uint32_t& illegal
+  )
+  {
+    const std::uint32_t changed_a = a ^ past_a;
+    const std::uint32_t changed_b = b ^ past_b;
+    const std::uint32_t moved = changed_a ^ changed_b;
+    const std::uint32_t fwd = past_a ^ b;
+    forward = moved & fwd;
+    backward = moved & ~fwd;
+    illegal = changed_a & changed_b;
+  }
+
+private:
+  /// Channels whose `b` pin is at the same distance from their `a` pin.
+  /** Aligning the `b` phases onto the `a` phases requires one shift per
+    * group. With the usual wiring (pin `b` next to pin `a`) there is only
+    * one group.
+    */
+  struct ShiftGroup {
+    unsigned int right; ///< Right shift to be applied to the level word.
+    unsigned int left; ///< Left shift to be applied to the level word.
+    std::uint32_t mask; ///< Bits of the `a` pins of the channels in the group.
+  };
+
+  std::vector<PinPair> channels_; ///< Pins of each channel.
+  std::vector<ShiftGroup> groups_; ///< Groups used to align `b` phases onto `a` phases.
+  std::uint32_t mask_a_; ///< Bits of all `a` pins.
+  std::uint32_t mask_b_; ///< Bits of all `b` pins.
+  std::int8_t lane_channel_[32]; ///< Channel associated to each lane (-1 if none).
+  std::uint32_t levels_; ///< Last known level word (used by the alerts).
+  std::uint32_t past_a_; ///< Lane word of the `a` phases at the last update.
+  std::uint32_t past_b_; ///< Lane word of the `b` phases at the last update.
+  std::vector<std::atomic<int>> steps_; ///< Step counter of each channel.
+  std::vector<std::atomic<int>> directions_; ///< Last direction of each channel.
+  std::vector<std::atomic<unsigned int>> illegal_; ///< Illegal transitions of each channel.
+  std::atomic<unsigned int> tick_; ///< Time of the last processed level word.
+  std::atomic<unsigned int> sequence_; ///< Sequence lock: odd while counters are being modified.
+
+  /// Extract the lane words from a level word.
+  /** @param levels levels of pins 0 to 31.
+    * @param[out] a lane word of the `a` phases.
+    * @param[out] b lane word of the `b` phases.
+    */
+  void lanes(std::uint32_t levels, std::uint32_t& a, std::uint32_t& b) const;
+
+  /// Function called whenever one of the pins changes level.
+  /** @param gpio the pin that just changed its level.
+    * @param level the current pin level.
+    * @param tick time elapsed since boot (in microseconds).
+    */
+  void pulse(
+    int gpio,
+    int level,
+    unsigned int tick
+  );
+
+  /// Static wrapper to call pulse.
+  /** @param gpio the pin that just changed its level.
+    * @param level the current pin level.
+    * @param tick time elapsed since boot (in microseconds).
+    * @param THIS a pointer to an EncoderBank. Named `THIS` simply because it
+    *   tries to mimic the `this` pointer.
+    */
+  static void pulseStatic(
+    int gpio,
+    int level,
+    unsigned int tick,
+    void* THIS
+  );
+};
+
+}
@@ -0,0 +1,119 @@
+/** @file feedback_law.hpp
+  * @brief Header file for the FeedbackLaw class.
+  */
+#pragma once
+
+#include <pendule_pi/wire_format.hpp>
+#include <atomic>
+#include <cstdint>
+
+namespace pendule_pi {
+
+/// State-feedback law uploaded by a client, and evaluated by the low-level interface.
+/** Instead of sending one PWM per state, a client can upload the gains
+  * \f$K\f$ and the setpoint \f$x_{ref}\f$ of a linear law (see
+  * wire::FeedbackLaw). The interface then computes
+  * \f$u = -K(x - x_{ref})\f$ at each period, from its own filtered state,
+  * until the next command: the control bandwidth no longer depends on the
+  * round trips between the client and the interface.
+  *
+  * The law is only used inside a validity region, defined by the largest
+  * absolute error allowed on each coordinate. Outside of it, the PWM given
+  * with the law is applied instead.
+  *
+  * ```c++
+  * pendule_pi::FeedbackLaw law;
+  * law.load(received_law, pigpio::Clock::ticks());
+  * // at each period:
+  * if(law.loaded())
+  *   pwm = law.active(pigpio::Clock::ticks(), command_valid) ? law.evaluate(x, theta, v, omega) : 0;
+  * ```
+  *
+  * All methods but statistics() must be called by the same thread.
+  */
+class FeedbackLaw {
+public:
+  /// Largest PWM computed by the law, in absolute value.
+  static constexpr int MAX_PWM = 255;
+
+  /// Statistics collected since the last reset.
+  struct Statistics {
+    std::uint64_t uploads; ///< Number of laws loaded.
+    std::uint64_t evaluations; ///< Number of calls to evaluate().
+    std::uint64_t fallbacks; ///< Number of evaluations outside the validity region.
+    std::uint64_t expired; ///< Number of laws that expired before being replaced.
+  };
+
+  /// Create an object with no law loaded.
+  FeedbackLaw();
+
+  // Prevent the user from making copies of a FeedbackLaw.
+  FeedbackLaw(const FeedbackLaw&) = delete;
+  FeedbackLaw& operator=(const FeedbackLaw&) = delete;
+
+  /// Tells if a law received from a client can be loaded.
+  /** @return `false` if any of its parameters is not finite, or if a limit
+    *   is negative.
+    */
+  static bool isValid(const wire::FeedbackLaw& law);
+
+  /// Load a law, replacing the previous one.
+  /** @param law the law, which should pass isValid().
+    * @param now_us current time, in microseconds (see pigpio::Clock).
+    */
+  void load(const wire::FeedbackLaw& law, std::uint64_t now_us);
+
+  /// Forget the law, *e.g.*, when a PWM command is received.
+  inline void unload() { loaded_ = false; }
+
+  /// Tells if a law is loaded.
+  inline bool loaded() const { return loaded_; }
+
+  /// Tells if the law is still in effect, and unload it otherwise.
+  /** A law with a lifetime expires once its lifetime elapsed since its
+    * reception. A law without lifetime expires as a PWM command would, *i.e.*,
+    * when the CommandTracker says so.
+    * @param now_us current time, in microseconds (see pigpio::Clock).
+    * @param command_valid result of CommandTracker::valid().
+    * @return `false` if no law is loaded, or if it expired.
+    */
+  bool active(std::uint64_t now_us, bool command_valid);
+
+  /// Move the position setpoint of the law, *e.g.*, along a Trajectory.
+  /** The setpoint is overwritten by the next law loaded.
+    * @param position new position setpoint [m].
+    * @param linvel new linear velocity setpoint [m/s].
+    */
+  inline void moveSetpoint(double position, double linvel) {
+    law_.setpoint[0] = position;
+    law_.setpoint[2] = linvel;
+  }
+
+  /// Compute the PWM in the given state.
+  /** @return the PWM of the law, rounded and saturated to MAX_PWM, or the
+    *   fallback PWM if the state is outside the validity region.
+    */
+  int evaluate(double position, double angle, double linvel, double angvel);
+
+  /// Read the statistics collected since the last reset.
+  Statistics statistics() const;
+
+  /// Forget the statistics.
+  void resetStatistics();
+
+private:
+  wire::FeedbackLaw law_; ///< Law in effect.
+  bool loaded_; ///< See loaded().
+  std::uint64_t deadline_us_; ///< Time at which a law with a lifetime expires.
+  std::atomic<std::uint64_t> uploads_; ///< See Statistics::uploads.
+  std::atomic<std::uint64_t> evaluations_; ///< See Statistics::evaluations.
+  std::atomic<std::uint64_t> fallbacks_; ///< See Statistics::fallbacks.
+  std::atomic<std::uint64_t> expired_; ///< See Statistics::expired.
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+}
@@ -0,0 +1,211 @@
+/** @file flight_recorder.hpp
+  * @brief Header file for the FlightRecorder class.
+  */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Records every iteration of the control loop, and saves the records to files.
+/** The control thread writes one fixed-size Record per iteration into a
+  * *ring* holding the last Parameters::ring_seconds of data. The ring is a
+  * POSIX shared memory object (`/dev/shm/<Parameters::ring_name>`): it lives
+  * in RAM (tmpfs), so that the kernel never writes it back to a storage
+  * device, and it is locked and populated beforehand. Writing a record is
+  * thus a plain memory copy: it never blocks on I/O, allocates, or issues a
+  * system call. Since it is mapped, the ring can be read by other processes,
+  * and it survives a crash of the interface (until the next start, or a
+  * reboot).
+  *
+  * A background thread, which leaves the real-time scheduler of the control
+  * thread, performs all the file I/O, in Parameters::directory:
+  *   - copies the new records to *archive* files
+  *     (`flight_<date>-<time>_<index>.rec`), starting a new file each time
+  *     the current one reaches Parameters::file_mb, and removing the oldest
+  *     ones beyond Parameters::max_files;
+  *   - after a call to trigger() (*e.g.*, on an emergency stop), writes the
+  *     last Parameters::snapshot_seconds of data to a *snapshot* file
+  *     (`snapshot_<date>-<time>_<index>.rec`).
+  *
+  * All files start with a 64-bytes FileHeader, followed by records. Both are
+  * packed, little-endian structures without padding, so that they can be
+  * read directly with numpy:
+  * ```python
+  * header = numpy.fromfile(path, dtype=HEADER_DTYPE, count=1)[0]
+  * records = numpy.fromfile(path, dtype=RECORD_DTYPE, offset=64)
+  * ```
+  * see `src/python/flight_record.py`, which defines the data types and
+  * sorts the records of the ring. In archive and snapshot files, records are
+  * ordered by time.
+  *
+  * ```c++
+  * pendule_pi::FlightRecorder recorder(params, period_us);
+  * // at each period:
+  * recorder.record(record);
+  * // when something goes wrong:
+  * recorder.trigger();
+  * ```
+  */
+class FlightRecorder {
+public:
+  /// Identifies flight recorder files (first 8 bytes).
+  static auto constexpr MAGIC = "PPFLIGHT";
+  /// Version of the file layout.
+  static constexpr std::uint32_t VERSION = 1;
+
+  /// Flags of a Record.
+  enum Flags : std::uint32_t {
+    COMMAND_VALID = 1, ///< A command was in effect (see CommandTracker::valid()).
+    FEEDBACK_LAW = 2, ///< The PWM was computed by a FeedbackLaw.
+    TRAJECTORY = 4, ///< A Trajectory was in effect.
+    PLUGIN = 8 ///< The PWM was computed by a ControllerPlugin.
+  };
+
+  /// Data recorded at each iteration.
+  struct Record {
+    std::uint64_t time_us; ///< Time at which the iteration started (see pigpio::Clock) [us].
+    std::uint32_t sequence; ///< Sequence number of the state published in this iteration.
+    std::uint32_t command_sequence; ///< Sequence number of the state answered by the last command accepted.
+    std::int32_t position_steps; ///< Raw step counter of the position encoder.
+    std::int32_t angle_steps; ///< Raw step counter of the angle encoder.
+    double position; ///< Position, before filtering [m].
+    double angle; ///< Angle, before filtering [rad].
+    double linvel; ///< Linear velocity, before filtering [m/s].
+    double angvel; ///< Angular velocity, before filtering [rad/s].
+    double filtered_position; ///< Filtered position [m].
+    double filtered_angle; ///< Filtered angle [rad].
+    double filtered_linvel; ///< Filtered linear velocity [m/s].
+    double filtered_angvel; ///< Filtered angular velocity [rad/s].
+    std::int32_t received_pwm; ///< PWM requested by the command in effect.
+    std::int32_t applied_pwm; ///< PWM applied, after the safety limits.
+    std::uint32_t period_us; ///< Time since the previous iteration [us].
+    std::uint32_t busy_us; ///< Time spent by the control thread in this iteration [us].
+    std::uint32_t flags; ///< Combination of Flags.
+    std::uint32_t reserved; ///< Always 0.
+  };
+
+  /// Header of all files.
+  struct FileHeader {
+    char magic[8]; ///< MAGIC, without terminating null character.
+    std::uint32_t version; ///< VERSION.
+    std::uint32_t record_size; ///< Size of a Record, in bytes.
+    std::uint64_t capacity; ///< Number of records of the ring, 0 for archive and snapshot files.
+    std::atomic<std::uint64_t> count; ///< Number of records written (in the ring: since its creation, the latest one being at `(count-1) % capacity`).
+    std::uint64_t period_us; ///< Nominal period of the control loop [us].
+    std::uint64_t start_us; ///< Time of the first record (see pigpio::Clock) [us].
+    std::uint8_t reserved[16]; ///< Always 0.
+  };
+
+  /// Settings of the recorder.
+  struct Parameters {
+    std::string directory; ///< Directory of the archive and snapshot files, created if needed.
+    std::string ring_name; ///< Name of the shared memory object holding the ring, without leading slash.
+    double ring_seconds; ///< Duration covered by the ring [s].
+    double file_mb; ///< Size above which a new archive file is started [MB]. 0 disables archive files.
+    unsigned int max_files; ///< Number of archive files kept. 0 to keep them all.
+    double snapshot_seconds; ///< Duration covered by a snapshot [s].
+    std::vector<int> cpus; ///< CPUs the background thread may run on. Empty to keep the current affinity.
+    /// Initialize the parameters to a default.
+    Parameters();
+  };
+
+  /// Statistics collected since the creation of the recorder.
+  struct Statistics {
+    std::uint64_t records; ///< Number of records written to the ring.
+    std::uint64_t archived; ///< Number of records copied to archive files.
+    std::uint64_t lost; ///< Number of records overwritten in the ring before being archived.
+    std::uint64_t snapshots; ///< Number of snapshot files written.
+    std::uint64_t files; ///< Number of archive files started.
+  };
+
+  /// Create the ring, and start the background thread.
+  /** @param params settings of the recorder.
+    * @param period_us nominal period of the control loop, in microseconds.
+    * @throw std::runtime_error if the ring or the directory cannot be
+    *   created.
+    */
+  FlightRecorder(
+    const Parameters& params,
+    unsigned int period_us
+  );
+
+  /// Archive the last records, write pending snapshots, and stop the background thread.
+  ~FlightRecorder();
+
+  // Prevent the user from making copies of a FlightRecorder.
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  /// Write a record into the ring (control thread). It never blocks.
+  void record(const Record& record) noexcept;
+
+  /// Request a snapshot of the records preceding this call (any thread). It never blocks.
+  /** The snapshot is written by the background thread, at the latest when
+    * the recorder is destroyed.
+    */
+  void trigger() noexcept;
+
+  /// Number of records the ring can hold (the last one can be read while the next one is written).
+  inline std::size_t capacity() const { return capacity_; }
+
+  /// Path of the ring, *e.g.*, to load it with `src/python/flight_record.py`.
+  inline const std::string& ringPath() const { return ring_path_; }
+
+  /// Read the statistics.
+  Statistics statistics() const;
+
+private:
+  const Parameters params_; ///< Settings of the recorder.
+  const unsigned int period_us_; ///< Nominal period of the control loop.
+  const std::size_t capacity_; ///< See capacity().
+  const std::string ring_path_; ///< See ringPath().
+  void* memory_; ///< Mapped ring.
+  std::size_t memory_size_; ///< Size of the mapping.
+  FileHeader* header_; ///< Header of the ring.
+  Record* records_; ///< Records of the ring.
+  std::uint64_t written_; ///< Number of records written by the control thread.
+  std::atomic<std::uint32_t> triggers_; ///< Number of calls to trigger().
+  std::atomic<std::uint64_t> trigger_count_; ///< Number of records written at the last call to trigger().
+  std::atomic<bool> running_; ///< Cleared to stop the background thread.
+  std::atomic<std::uint64_t> archived_; ///< See Statistics::archived.
+  std::atomic<std::uint64_t> lost_; ///< See Statistics::lost.
+  std::atomic<std::uint64_t> snapshots_; ///< See Statistics::snapshots.
+  std::atomic<std::uint64_t> files_; ///< See Statistics::files.
+  // Used by the background thread only
+  int archive_fd_; ///< Archive file being written, or -1.
+  std::uint64_t archive_count_; ///< Number of records in the current archive file.
+  std::uint64_t next_archived_; ///< Index (in the ring) of the next record to be archived.
+  std::deque<std::string> archive_files_; ///< Archive files created, oldest first.
+  std::thread thread_; ///< Background thread.
+
+  /// Body of the background thread.
+  void run();
+  /// Copy the records of the ring that were not archived yet.
+  void archive();
+  /// Write the records of the ring preceding the given one to a new snapshot file.
+  void snapshot(std::uint64_t end);
+  /// Copy records from the ring, in order.
+  /** @param first index of the first record to be copied (see FileHeader::count).
+    * @param[out] out copied records. Records overwritten during the copy are
+    *   not included.
+    * @return the index of the first record copied.
+    */
+  std::uint64_t copy(std::uint64_t first, std::vector<Record>& out) const;
+  /// Create a new file, and write its header.
+  /** @param path path of the file.
+    * @param start_us time of its first record.
+    * @return its file descriptor, or -1 on failure.
+    */
+  int createFile(const std::string& path, std::uint64_t start_us) const;
+  /// Name of a new file, with the given prefix, in the directory of the recorder.
+  std::string newFileName(const std::string& prefix, std::uint64_t index) const;
+};
+
+}
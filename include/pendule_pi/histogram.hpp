@@ -0,0 +1,159 @@
+/** @file histogram.hpp
+  * @brief Header file for the Histogram class.
+  */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Lock-free histogram of non-negative integer samples (*e.g.*, latencies in microseconds).
+/** Two bucketing schemes are available:
+  *   - linear: samples are counted in `n_bins` bins of equal width. Values
+  *     that do not fit in the last bin are counted in an additional overflow
+  *     bin;
+  *   - logarithmic: each power of two is split into `2^precision_bits` bins
+  *     of equal width, so that the relative error on a value is lower than
+  *     `2^-precision_bits`. All `unsigned int` values fit, so there are no
+  *     overflows.
+  *
+  * Adding a sample only requires a few relaxed atomic loads and stores (no
+  * read-modify-write) and never allocates, so it can be done from
+  * time-critical threads while other threads read the statistics.
+  *
+  * ```c++
+  * pendule_pi::Histogram latencies(10, 100); // 10us bins, up to 1ms
+  * pendule_pi::Histogram periods(pendule_pi::Histogram::Logarithmic{3}); // 12.5% precision
+  * latencies.add(42);
+  * std::cout << latencies.count() << " samples, p99: " << latencies.percentile(0.99) << std::endl;
+  * ```
+  * @note Statistics are read field by field: while samples are being added,
+  *   they might be slightly inconsistent with each other.
+  */
+class Histogram {
+public:
+  /// Tag used to create a logarithmic histogram.
+  struct Logarithmic {
+    unsigned int precision_bits; ///< Each power of two is split into `2^precision_bits` bins (at most 8).
+  };
+
+  /// Statistics of a histogram at a given time, see summary().
+  struct Summary {
+    std::uint64_t count; ///< Number of samples.
+    std::uint64_t overflows; ///< Number of samples that did not fit in the bins.
+    unsigned int min; ///< Smallest sample.
+    unsigned int max; ///< Largest sample.
+    double mean; ///< Average of all samples.
+    unsigned int p50; ///< Median, see percentile().
+    unsigned int p99; ///< 99th percentile, see percentile().
+    unsigned int p999; ///< 99.9th percentile, see percentile().
+  };
+
+  /// Create an empty linear histogram.
+  /** @param bin_width width of each bin. Bin `i` counts values in
+    *   `[i*bin_width, (i+1)*bin_width)`.
+    * @param n_bins number of bins, without counting the overflow one.
+    */
+  Histogram(
+    unsigned int bin_width,
+    std::size_t n_bins
+  );
+
+  /// Create an empty logarithmic histogram.
+  /** @param scale precision of the histogram. Values lower than
+    *   `2^precision_bits` are counted exactly.
+    */
+  explicit Histogram(Logarithmic scale);
+
+  // Prevent the user from making copies of a Histogram.
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  /// Add a sample.
+  /** @param value the sample to be counted.
+    * @warning Only one thread at a time is allowed to add samples (or to
+    *   reset the histogram).
+    */
+  inline void add(unsigned int value) {
+    increment(bins_[index(value)]);
+    sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if(value < min_.load(std::memory_order_relaxed))
+      min_.store(value, std::memory_order_relaxed);
+    if(value > max_.load(std::memory_order_relaxed))
+      max_.store(value, std::memory_order_relaxed);
+    increment(count_);
+  }
+
+  /// Forget all samples.
+  void reset();
+
+  /// Width of each bin (0 for a logarithmic histogram).
+  inline unsigned int binWidth() const { return bin_width_; }
+  /// Number of bins, without counting the overflow one.
+  inline std::size_t size() const { return n_bins_; }
+  /// Smallest value counted by the given bin.
+  std::uint64_t lowerBound(std::size_t bin) const;
+  /// Smallest value that is not counted by the given bin.
+  std::uint64_t upperBound(std::size_t bin) const;
+
+  /// Number of samples added since the last reset.
+  inline std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  /// Number of samples that did not fit in the bins.
+  inline std::uint64_t overflows() const { return bins_[n_bins_].load(std::memory_order_relaxed); }
+  /// Smallest sample (0 if there are no samples).
+  unsigned int min() const;
+  /// Largest sample (0 if there are no samples).
+  inline unsigned int max() const { return max_.load(std::memory_order_relaxed); }
+  /// Average of all samples (0 if there are no samples).
+  double mean() const;
+
+  /// Estimate a percentile.
+  /** @param q the requested fraction of samples, between 0 and 1 (*e.g.*,
+    *   0.99 for the 99th percentile).
+    * @return the largest value of the bin containing the percentile, bounded
+    *   by min() and max(). This is conservative: at least a fraction `q` of
+    *   the samples is lower or equal. 0 if there are no samples.
+    */
+  unsigned int percentile(double q) const;
+
+  /// Read all statistics at once.
+  Summary summary() const;
+
+  /// Get a copy of the counters of all bins, the last one being the overflow bin.
+  std::vector<std::uint64_t> bins() const;
+
+private:
+  const unsigned int bin_width_; ///< Width of each bin (0 for a logarithmic histogram).
+  const unsigned int precision_bits_; ///< Precision of a logarithmic histogram.
+  const std::size_t n_bins_; ///< Number of bins, without counting the overflow one.
+  std::unique_ptr<std::atomic<std::uint64_t>[]> bins_; ///< Counters of all bins, including the overflow one.
+  std::atomic<std::uint64_t> count_; ///< Number of samples.
+  std::atomic<std::uint64_t> sum_; ///< Sum of all samples.
+  std::atomic<unsigned int> min_; ///< Smallest sample (UINT_MAX if there are no samples).
+  std::atomic<unsigned int> max_; ///< Largest sample.
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /// Index of the bin counting the given value.
+  inline std::size_t index(unsigned int value) const {
+    if(bin_width_ > 0)
+      return value / bin_width_ < n_bins_ ? value / bin_width_ : n_bins_;
+    if(value < (1u << precision_bits_))
+      return value;
+    // Position of the most significant bit, and number of bits dropped
+    const unsigned int msb = 31 - __builtin_clz(value);
+    const unsigned int shift = msb - precision_bits_;
+    return ((shift+1) << precision_bits_) + ((value >> shift) & ((1u << precision_bits_) - 1));
+  }
+
+  /// Percentile computed from a copy of the bins (see bins()).
+  unsigned int percentile(const std::vector<std::uint64_t>& bins, double q) const;
+};
+
+}
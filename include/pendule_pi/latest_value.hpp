@@ -0,0 +1,71 @@
+/** @file latest_value.hpp
+  * @brief Header file for the LatestValue class.
+  */
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace pendule_pi {
+
+/// Lock-free, single-producer/single-consumer mailbox holding the latest value written.
+/** Unlike SpscRing, which keeps every element until it is consumed, this
+  * mailbox only keeps the most recent value: writing never fails, and the
+  * reader always gets the newest value. It is meant to exchange states and
+  * commands between a control thread and a communication thread, where old
+  * values are useless.
+  *
+  * ```c++
+  * pendule_pi::LatestValue<State> mailbox;
+  * // producer thread
+  * mailbox.write(state);
+  * // consumer thread
+  * State latest;
+  * if(mailbox.read(latest)) { ... } // a new value was written since the last read
+  * ```
+  *
+  * It is implemented as a triple buffer: the producer and the consumer each
+  * own a slot, and exchange it with a third one with a single atomic
+  * operation. Both sides are thus wait-free, and never allocate memory.
+  * @tparam T type of the stored value. It should be cheap to copy.
+  * @warning Only one thread is allowed to call write() and only one (possibly
+  *   different) thread is allowed to call read().
+  */
+template<class T>
+class LatestValue {
+public:
+  /// Publish a new value (producer side), replacing the previous one if it was not read.
+  void write(const T& value) noexcept {
+    slots_[back_] = value;
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  /// Read the latest value (consumer side).
+  /** @param value variable where the latest value is written.
+    * @return false if no value was written since the last read, in which case
+    *   value is not modified.
+    */
+  bool read(T& value) noexcept {
+    if(!(middle_.load(std::memory_order_relaxed) & FRESH))
+      return false;
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+    value = slots_[front_];
+    return true;
+  }
+
+  /// Tells if a value was written since the last read.
+  /** @note The value is only a snapshot, since the producer might be writing
+    *   at the same time.
+    */
+  bool fresh() const noexcept { return middle_.load(std::memory_order_acquire) & FRESH; }
+
+private:
+  static constexpr unsigned int INDEX = 3; ///< Mask extracting the index of a slot.
+  static constexpr unsigned int FRESH = 4; ///< Flag telling that the middle slot holds an unread value.
+  std::array<T,3> slots_{}; ///< Storage for the values.
+  alignas(64) unsigned int back_{0}; ///< Slot being written (owned by the producer).
+  alignas(64) std::atomic<unsigned int> middle_{1}; ///< Slot exchanged between the producer and the consumer, with the FRESH flag.
+  alignas(64) unsigned int front_{2}; ///< Slot being read (owned by the consumer).
+};
+
+}
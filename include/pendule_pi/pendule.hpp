@@ -3,11 +3,16 @@
 #include <pendule_pi/switch.hpp>
 #include <pendule_pi/encoder.hpp>
 #include <pendule_pi/motor.hpp>
+#include <pendule_pi/sample_decoder.hpp>
+#include <pendule_pi/safety_monitor.hpp>
+#include <atomic>
 #include <memory>
 
 
 namespace pendule_pi {
 
+class BurstSampler;
+
 /// Class that allows to control the Pendulum.
 class Pendule {
 public:
@@ -25,6 +30,12 @@ public:
     Pins();
   };
 
+  /// Methods that can be used to estimate velocities inside update().
+  enum class VelocityEstimation {
+    FiniteDifferences, ///< Difference between two consecutive positions, divided by the period.
+    EdgeTiming ///< Timing of the encoder edges, see VelocityEstimator.
+  };
+
   /// Exception class to be thrown when the pendulum has not been calibrated.
   class NotCalibrated : public std::runtime_error {
   public:
@@ -46,7 +57,8 @@ public:
     CalibrationFailed(const std::string& why) : std::runtime_error("Pendulum calibration failed! Reason: " + why) {}
   };
 
-  /// Exception class to be thrown when emergency stop is requested.
+  /// Exception class that can be thrown by the control loop after an emergency stop.
+  /** Pendule itself never throws it: see isStopped(). */
   class EmergencyStop : public std::runtime_error {
   public:
     /// Fills the error message.
@@ -182,6 +194,13 @@ public:
     std::unique_ptr<Encoder> angle_encoder
   );
 
+  /// Remove all safety callbacks, then stop the safety monitor.
+  virtual ~Pendule();
+
+  // Prevent the user from making copies of a Pendule.
+  Pendule(const Pendule&) = delete;
+  Pendule& operator=(const Pendule&) = delete;
+
   /// Initialize the pendulum.
   void calibrate(
     double safety_margin_meters
@@ -192,15 +211,52 @@ public:
 
   /// Perform state estimation.
   /** @param dt time (in seconds) that elapsed since the last call to update().
+    *   It is ignored when velocities are estimated using
+    *   VelocityEstimation::EdgeTiming.
+    * @return false if the pendulum is stopped (see isStopped()), in which
+    *   case the state is not updated.
+    */
+  bool update(double dt);
+
+  /// Choose how velocities are estimated in update().
+  /** @param method the estimation method to be used.
+    * @param params parameters of the edge-based estimators. They are ignored
+    *   if method is VelocityEstimation::FiniteDifferences.
     */
-  void update(double dt);
+  void setVelocityEstimation(
+    VelocityEstimation method,
+    const VelocityEstimator::Parameters& params = VelocityEstimator::Parameters()
+  );
+
+  /// Tell how velocities are estimated in update().
+  inline const VelocityEstimation& velocityEstimation() const { return velocity_estimation_; }
+
+  /// Decode encoders and switches from batches of samples.
+  /** After this call, the encoders and the switches are no longer updated by
+    * per-edge GPIO alerts, but by a SampleDecoder. This cannot be undone.
+    */
+  void enableSampleDecoding();
+
+  /// Access the SampleDecoder, *e.g.*, to read its statistics.
+  /** @return the decoder, or `nullptr` if enableSampleDecoding() was not
+    *   called.
+    */
+  inline const SampleDecoder* sampleDecoder() const { return sample_decoder_.get(); }
+
+  /// Forward the encoder edges drained by update() to a BurstSampler.
+  /** @param sampler the sampler, or `nullptr` to stop forwarding the edges.
+    *   It must remain valid as long as it is attached.
+    */
+  inline void setBurstSampler(BurstSampler* sampler) { burst_sampler_ = sampler; }
 
   /// Forwards the command to the actuator.
   /** Applies the given PWM to the motor.
     * @param pwm the desired command.
     * @return false if the command exceeded the maximum/minimum values and thus
-    *   had to be saturated. Note that the saturation is applied after adding
-    *   the offsets specified via setPwmOffsets().
+    *   had to be saturated, or if the pendulum is stopped (see isStopped()),
+    *   in which case the motor is left off. Note that the command is
+    *   saturated both before and after adding the offsets specified via
+    *   setPwmOffsets(), so that any value is safe.
     */
   bool setCommand(int pwm);
 
@@ -213,6 +269,20 @@ public:
   /// Get the current filtered velocity (in radians per second) of the pendulum.
   inline const double& angularVelocity() const { return angvel_; }
 
+  /// Read-only access to the encoder that measures the position of the base.
+  /** This allows, *e.g.*, to read its signal integrity counters (see
+    * Encoder::diagnostics()).
+    */
+  inline const Encoder& positionEncoder() const { return *position_encoder_; }
+  /// Read-only access to the encoder that measures the angle of the pendulum.
+  inline const Encoder& angleEncoder() const { return *angle_encoder_; }
+
+  /// Set the sampling period of pigpio for both encoders.
+  /** @param us sampling period, in microseconds.
+    * @see Encoder::setSamplingPeriod()
+    */
+  void setSamplingPeriod(unsigned int us);
+
   /// Allow to access min_position_steps_.
   /** If the pendulum has not been calibrated, this method will throw an
     * exception.
@@ -259,16 +329,36 @@ public:
   );
 
   /// Emergency stop.
-  void eStop(const std::string& why);
+  /** The request is posted to the SafetyMonitor, whose thread turns the
+    * motor off and puts the pendulum in the stopped state. This method never
+    * throws and it is cheap enough to be called from GPIO callbacks.
+    * @param why reason to stop. It must have static storage, such as a
+    *   string literal.
+    */
+  void eStop(const char* why);
+
+  /// Tell if the pendulum has been stopped by eStop().
+  /** Once stopped, the motor is off, update() and setCommand() return false,
+    * and calibrate() fails.
+    */
+  inline bool isStopped() const { return emergency_stopped_.load(std::memory_order_acquire); }
+
+  /// Reason given to the first eStop() request (empty if not stopped).
+  std::string stopReason() const;
+
+  /// Delay between each safety event (*e.g.*, the edge that hit a switch) and the moment the motor was turned off, in microseconds.
+  inline const Histogram& safetyLatency() const { return safety_monitor_->latency(); }
 
 private:
   bool calibrated_; ///< Variable that is set to true once the pendulum calibration has been completed.
-  bool emergency_stopped_; ///< Variable that is set to true when the pendulum has to stop.
+  std::atomic<bool> emergency_stopped_; ///< Variable that is set to true when the pendulum has to stop.
+  std::atomic<const char*> stop_reason_; ///< Reason of the first emergency stop (nullptr if not stopped).
   // State variables
   double position_; ///< Current position of the moving base.
   double angle_; ///< Current angle of the pendulum.
   double linvel_; ///< Current velocity of the moving base.
   double angvel_; ///< Current velocity of the pendulum.
+  VelocityEstimation velocity_estimation_; ///< Method used to compute linvel_ and angvel_.
   // Calibration values
   int min_position_steps_; ///< Encoder reading when the base is at the minimum position.
   int max_position_steps_; ///< Encoder reading when the base is at the maximum position.
@@ -286,6 +376,18 @@ private:
   std::unique_ptr<Switch> right_switch_; ///< Right switch (should be near to the encoder).
   std::unique_ptr<Encoder> position_encoder_; ///< Encoder to read the current position of the base.
   std::unique_ptr<Encoder> angle_encoder_; ///< Encoder to read the current angle of the pendulum.
+  std::unique_ptr<SampleDecoder> sample_decoder_; ///< If not null, used instead of GPIO alerts to update encoders and switches.
+  BurstSampler* burst_sampler_; ///< If not null, receives the edges drained by update().
+  std::unique_ptr<SafetyMonitor> safety_monitor_; ///< Thread turning the motor off on eStop(). Declared last, so that it stops first.
+
+  /// Post a safety event that happened at the given time.
+  /** @param tick time of the event, in microseconds.
+    * @param why reason to stop (see eStop()).
+    */
+  void postSafetyEvent(unsigned int tick, const char* why);
+
+  /// Reaction of the SafetyMonitor: stop the pendulum and turn the motor off.
+  void onSafetyEvent(const SafetyMonitor::Event& event);
 
   /// Axuiliary method that converts steps into meters.
   inline double steps2meters(const int& steps) { return meters_per_step_*(steps-mid_position_steps_); }
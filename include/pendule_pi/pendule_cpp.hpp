@@ -1,11 +1,45 @@
 #pragma once
 
+#include <pendule_pi/wire_format.hpp>
+#include <pendule_pi/shm_channel.hpp>
+#include <pendule_pi/latest_value.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <zmqpp/zmqpp.hpp>
 
 namespace pendule_pi {
 
 /// Bridge to the low-level interface.
+/** Both the binary format (see wire_format.hpp) and the legacy text format
+  * of the state messages are understood. Commands are sent in the format of
+  * the last state received.
+  *
+  * When running on the same host as the interface, the shared-memory
+  * transport (see ShmChannel) can be selected instead of TCP, *e.g.*,
+  * `PenduleCpp pendulum("shm://pendule")`.
+  *
+  * By default, states are received by the thread calling readState() or
+  * waitForState(). Once startReceiver() is called, a background thread
+  * receives them instead, and stores the latest one in a lock-free slot
+  * (see LatestValue): readState() then only picks it up, so that the
+  * controller can compute while states arrive.
+  * ```c++
+  * pendule_pi::PenduleCpp pendulum;
+  * pendulum.startReceiver();
+  * while(ok) {
+  *   if(!pendulum.waitForState(0.1)) // ZeroMQ is never called from here
+  *     continue;
+  *   pendulum.sendCommand(computeCommand(pendulum.position(), pendulum.angle()));
+  * }
+  * ```
+  */
 class PenduleCpp {
 public:
   static auto constexpr DEFAULT_HOST = "localhost";
@@ -19,6 +53,20 @@ public:
   /** @see PenduleCpp::readState */
   static auto constexpr NON_BLOCKING = false;
 
+  /// A state of the pendulum, as received from the interface.
+  struct State {
+    double time; ///< Time of the pendulum [s].
+    double position; ///< Position of the pendulum [m].
+    double angle; ///< Angle of the pendulum [rad].
+    double linvel; ///< Linear velocity of the pendulum [m/s].
+    double angvel; ///< Angular velocity of the pendulum [rad/s].
+    std::uint32_t sequence; ///< Sequence number (binary format only).
+    bool binary; ///< Tells if the state was received in the binary format.
+  };
+
+  /// Function called by the receiver thread for each state (see startReceiver()).
+  using StateCallback = std::function<void(const State&)>;
+
   /// Connects to a socket using some default parameters.
   PenduleCpp(int wait=-1);
 
@@ -30,10 +78,9 @@ public:
     * @param command_port port of the socket that is used to send commands to
     *   the low-level interface.
     * @param wait time to wait for the interface, in seconds. If less than or
-    *   equal to zero, wait indefinitely. If positive, the constructor will check
-    *   if a message is available every second, until wait seconds have elapsed.
-    *   If no message is received within the allotted time, an exception will be
-    *   thrown.
+    *   equal to zero, wait indefinitely. If positive, and if no message is
+    *   received within wait seconds, an exception will be thrown. The
+    *   constructor returns as soon as the first state is received.
     */
   PenduleCpp(
     const std::string& host,
@@ -42,9 +89,27 @@ public:
     int wait = -1
   );
 
-  /// Deallocates the memory for the sockets.
+  /// Constructor, connects to the interface through the transport given by an URI.
+  /** @param uri either `shm://[name]`, to use the shared memory channel
+    *   created by the interface (see the 'sockets:shm' configuration of the
+    *   interface), or `tcp://[host]`, `tcp://[host]:[state_port]` or
+    *   `tcp://[host]:[state_port]:[command_port]` to use TCP sockets. Missing
+    *   ports take their default values.
+    * @param wait see PenduleCpp(const std::string&,const std::string&,const std::string&,int).
+    * @throw std::runtime_error if the URI is invalid.
+    */
+  explicit PenduleCpp(
+    const std::string& uri,
+    int wait = -1
+  );
+
+  /// Stops the receiver thread, and deallocates the memory for the sockets.
   ~PenduleCpp();
 
+  // Prevent the user from making copies of a PenduleCpp.
+  PenduleCpp(const PenduleCpp&) = delete;
+  PenduleCpp& operator=(const PenduleCpp&) = delete;
+
   /// Allows to access the current time of the pendulum.
   inline const double& time() const { return time_; }
   /// Allows to access the current position of the pendulum.
@@ -55,6 +120,14 @@ public:
   inline const double& linvel() const { return linvel_; }
   /// Allows to access the current angular velocity of the pendulum.
   inline const double& angvel() const { return angvel_; }
+  /// Allows to access the sequence number of the current state (binary format only).
+  inline std::uint32_t sequence() const { return sequence_; }
+  /// Tells if the interface uses the binary format (see wire_format.hpp).
+  inline bool binary() const { return binary_; }
+  /// Allows to access the current state of the pendulum at once.
+  inline State state() const { return {time_, position_, angle_, linvel_, angvel_, sequence_, binary_}; }
+  /// Tells if the receiver thread is running (see startReceiver()).
+  inline bool receiving() const { return receiver_.joinable(); }
 
   /// Tries to read the state of the pendulum from the interface.
   /** @param blocking if `true`, do not exit until a message has been received
@@ -70,25 +143,147 @@ public:
     *   pendulum.readState(PenduleCpp.BLOCKING);
     *   pendulum.readState(PenduleCpp.NON_BLOCKING);
     *   @endcode
+    * @throw std::runtime_error if a malformed binary message is received.
+    *   When the receiver thread runs, the exception it stopped with (if any)
+    *   is rethrown instead.
     */
   bool readState(bool blocking);
 
+  /// Wait for a new state of the pendulum.
+  /** The calling thread sleeps in `zmq_poll()` (or on the futex of the
+    * shared memory channel) until a state arrives, so that it wakes up as
+    * soon as possible without polling.
+    * @param timeout maximum waiting time in seconds. If negative, wait
+    *   indefinitely. If zero, behave as `readState(NON_BLOCKING)`.
+    * @return `true` if a state has been received and processed, `false` if
+    *   the timeout expired.
+    * @throw std::runtime_error as readState().
+    */
+  bool waitForState(double timeout);
+
+  /// Start receiving the states in a background thread.
+  /** From then on, readState() and waitForState() only pick the latest state
+    * received by the thread, and never call ZeroMQ. States that are not read
+    * in time are replaced by newer ones. Commands are still sent by the
+    * calling thread.
+    * @param callback function called by the receiver thread for each state,
+    *   as soon as it is received, *e.g.*, to notify an event loop. It must
+    *   return quickly, since it delays the next states. If it throws, the
+    *   receiver thread stops and the exception is rethrown by readState().
+    * @throw std::runtime_error if the receiver thread already runs, or if its
+    *   eventfds cannot be created.
+    */
+  void startReceiver(StateCallback callback = {});
+
+  /// Stop the receiver thread, if it runs, and go back to receiving the states synchronously.
+  void stopReceiver();
+
   /// Send a PWM command to the low-level interface.
-  /** @param pwm the PWM signal to be sent. It should be an integer between
+  /** In the binary format, the command carries the sequence number of the
+    * last state read, so that the interface can measure the latency of the
+    * control loop and reject commands computed from states that are too old.
+    * @param pwm the PWM signal to be sent. It should be an integer between
     *   -255 and 255.
     */
   void sendCommand(int pwm);
 
+  /// Upload a state-feedback law, evaluated by the interface at each period.
+  /** The interface applies \f$u = -K(x - x_{ref})\f$, with \f$x\f$ the
+    * state (position, angle, linear velocity, angular velocity), until the
+    * next command or law. The control rate is thus the one of the interface,
+    * whatever the rate at which the client sends laws.
+    * @param gains gains \f$K\f$.
+    * @param setpoint setpoint \f$x_{ref}\f$.
+    * @param limits largest absolute error of each coordinate for which the
+    *   law is used, 0 for no limit.
+    * @param pwm PWM applied when the state is outside of these limits.
+    * @param wrap_angle if `true`, the angle error is wrapped in
+    *   \f$[-\pi,\pi]\f$.
+    * @param lifetime time during which the law remains in effect, in seconds.
+    *   If 0, it expires as a PWM command would (see 'sockets:max_command_age'
+    *   in the configuration of the interface).
+    * @throw std::runtime_error if the interface does not use the binary
+    *   format over TCP.
+    */
+  void sendFeedbackLaw(
+    const std::array<double,4>& gains,
+    const std::array<double,4>& setpoint,
+    const std::array<double,4>& limits = {},
+    int pwm = 0,
+    bool wrap_angle = true,
+    double lifetime = 0
+  );
+
+  /// Send a segment of time-stamped setpoints, interpolated by the interface.
+  /** At each period, the interface interpolates the setpoints smoothly
+    * against its own clock, and fades from the previous segment to this one
+    * (see pendule_pi::Trajectory). Sending segments that extend a little
+    * beyond the time of the next message keeps the actuation smooth even
+    * over jittery links.
+    * @param times times of the setpoints, strictly increasing, in seconds on
+    *   the clock of the interface (*i.e.*, as returned by time()).
+    * @param values setpoints: PWM signals, or position setpoints of the
+    *   feedback law in effect (see sendFeedbackLaw()).
+    * @param kind what the setpoints are.
+    * @throw std::runtime_error if the interface does not use the binary
+    *   format over TCP.
+    * @throw std::invalid_argument if the sizes of times and values differ,
+    *   if there are less than 2 or more than wire::Trajectory::MAX_POINTS
+    *   points, if a time is negative, if the times are not strictly
+    *   increasing (once rounded to the microsecond), or if a value is not
+    *   finite.
+    */
+  void sendTrajectory(
+    const std::vector<double>& times,
+    const std::vector<double>& values,
+    wire::Trajectory::Kind kind = wire::Trajectory::Kind::Pwm
+  );
+
 private:
   double time_{0}; ///< Current time of the pendulum.
   double position_{0}; ///< Current position of the pendulum.
   double angle_{0}; ///< Current angle of the pendulum.
   double linvel_{0}; ///< Current linear velocity of the pendulum.
   double angvel_{0}; ///< Current angular velocity of the pendulum.
+  std::uint32_t sequence_{0}; ///< Sequence number of the current state.
+  bool binary_{false}; ///< Format of the last state received.
+  std::uint32_t command_sequence_{0}; ///< Sequence number of the next binary command.
 
   std::unique_ptr<zmqpp::context> context_; ///< ZeroMQ context used to create TCP connections.
   std::unique_ptr<zmqpp::socket> state_sub_; ///< Socket to read the current state of the pendulum.
   std::unique_ptr<zmqpp::socket> command_pub_; ///< Socket to send commands to the low-level interface.
+  std::string shm_name_; ///< Name of the shared memory channel, empty when using TCP.
+  std::unique_ptr<ShmChannel> shm_; ///< Shared memory channel, once the interface created it.
+
+  std::thread receiver_; ///< Receiver thread, see startReceiver().
+  std::atomic<bool> receiver_running_{false}; ///< Cleared to stop the receiver thread.
+  int wakeup_fd_{-1}; ///< Eventfd signaled by stopReceiver(), to wake the receiver thread up.
+  int state_fd_{-1}; ///< Eventfd signaled by the receiver thread for each state.
+  LatestValue<State> latest_; ///< Latest state, from the receiver thread.
+  std::atomic<bool> receiver_failed_{false}; ///< Set when the receiver thread stopped on an exception.
+  std::exception_ptr receiver_error_; ///< Exception that stopped the receiver thread.
+
+  /// Connect to the TCP sockets of the interface.
+  void connectTcp(const std::string& host, const std::string& state_port, const std::string& command_port);
+  /// Wait for the first state, as described in the constructor.
+  void waitForInterface(int wait);
+  /// Try to open the shared memory channel.
+  /** @return false if the interface did not create it yet. */
+  bool connectShm();
+  /// Receive a state from the transport, without storing it.
+  /** @param blocking see readState().
+    * @param state variable where the state is written.
+    * @return `true` if a state was received.
+    * @throw std::runtime_error if a malformed binary message is received.
+    */
+  bool receiveState(bool blocking, State& state);
+  /// Store the state returned by the accessors.
+  void setState(const State& state);
+  /// Pick the latest state received by the receiver thread, if any.
+  /** @throw any exception that stopped the receiver thread. */
+  bool takeLatestState();
+  /// Body of the receiver thread.
+  void receive(StateCallback callback);
 
 };
 
@@ -7,6 +7,9 @@
 #include <csignal>
 #include <map>
 #include <pigpio.h>
+#include <pendule_pi/backend.hpp>
+#include <pendule_pi/clock.hpp>
+#include <pendule_pi/histogram.hpp>
 
 
 /// Wrapper macro that throws a PiGPIOError if the given pigpio function fails.
@@ -83,7 +86,9 @@ private:
 /// Utility class that activates and deactivates the pigpio library.
 /** This class helps to initialize and terminate the pigpio library.
   * Upon construction, this class calls gpioInitialise(), while upon destruction
-  * it calls gpioTerminate(). This allows to write codes such as the following,
+  * it calls gpioTerminate(). Both calls go through the active Backend: a token
+  * can also be constructed with an explicit backend, which then stays active
+  * for the lifetime of the token. This allows to write codes such as the following,
   * which should ensure that the library is "closed" even if an exception
   * happens:
   * ```
@@ -109,6 +114,15 @@ public:
     *   failure").
     */
   explicit ActivationToken(bool register_sigint=true);
+  /// Activates the given backend, then forwards a call to its initialise().
+  /** Apart from the backend selection, this is equivalent to
+    * ActivationToken(bool). The previously active backend is restored upon
+    * destruction.
+    * @param backend the backend to be used while the token is alive. It must
+    *   outlive the token.
+    * @param register_sigint if true, register pleaseStop() as SIGINT handler.
+    */
+  explicit ActivationToken(Backend& backend, bool register_sigint=true);
   /// Ensures that all GPIO pins are changed to high impedance mode.
   ~ActivationToken();
 
@@ -147,6 +161,13 @@ public:
 
 private:
   static ActivationToken* active_token; ///< Pointer to the currently active token.
+  Backend* previous_backend_; ///< Backend to be restored upon destruction.
+  bool restore_backend_; ///< If true, previous_backend_ is restored upon destruction.
+
+  /// Registers this token and initializes the active backend.
+  /** @param register_sigint if true, register pleaseStop() as SIGINT handler.
+    */
+  void activate(bool register_sigint);
 
   /// Puts all GPIO pins in high impedance mode.
   /** This method allows to "disconnect" all GPIO pins, by putting them into
@@ -174,7 +195,7 @@ private:
   * const unsigned int micros = 100000; // 100ms
   * pigpio::Rate rate(micros);
   * while(true) {
-  *   unsigned int now = rate.sleep();
+  *   std::uint64_t now = rate.sleep();
   *   std::cout << "Current time: " << now << "us" << std::endl;
   *   // other instructions here
   * }
@@ -201,29 +222,113 @@ private:
   * Current time: 493106565
   * ```
   *
+  * Wake-up times are absolute deadlines, spaced by exactly one period, so
+  * that errors do not accumulate over time. The schedule starts with the
+  * first call to sleep(), which always lasts a full period.
+  *
+  * Most of the waiting is done by putting the thread to sleep (see
+  * Backend::sleepUntil()), so that the CPU is available to other threads.
+  * Since the OS might wake the thread up a bit late, the last `spin_us`
+  * microseconds before each deadline are spent busy-waiting on the clock.
+  * A larger margin gives a more accurate period, at the price of CPU time.
+  *
   * Of course, for this to work properly, the total time required to execute
   * the instructions after Rate::sleep() must be lower than a Rate's period!
+  * When this is not the case, the behavior is chosen by the Overrun policy.
+  *
+  * In order to check this, sleep() keeps logarithmic histograms (see
+  * pendule_pi::Histogram) of the actual periods, of how late the thread woke
+  * up, and of how late sleep() was called when a deadline was missed. They
+  * can be read at any time, from any thread, via statistics().
   */
 class Rate {
 public:
+  /// What sleep() does when it is called after the deadline.
+  enum class Overrun {
+    Skip, ///< Wait for the next deadline of the original schedule: late periods are dropped.
+    CatchUp, ///< Return immediately, keeping the original schedule: the following periods are shortened until it is met again.
+    Rephase ///< Return immediately and start a new schedule from now on.
+  };
+
+  /// Default busy-waiting margin, in microseconds.
+  static constexpr unsigned int DEFAULT_SPIN_US = 200;
+  /// Precision of the timing histograms (each power of two is split into `2^STATISTICS_PRECISION_BITS` bins).
+  static constexpr unsigned int STATISTICS_PRECISION_BITS = 4;
+
+  /// Timing statistics, all in microseconds.
+  struct Statistics {
+    pendule_pi::Histogram::Summary period; ///< Time between consecutive values returned by sleep().
+    pendule_pi::Histogram::Summary lateness; ///< Delay between the deadline and the actual wake-up, when sleep() was called on time.
+    pendule_pi::Histogram::Summary overrun; ///< Delay between the deadline and the call to sleep(), when it was called too late.
+  };
+
   /// Create a rate of given period.
   /** @param period_us desired period in microseconds.
+    * @param spin_us the last `spin_us` microseconds before each deadline are
+    *   spent busy-waiting. If this is not lower than the period, sleep()
+    *   never puts the thread to sleep.
+    * @param overrun policy to be applied when a deadline is missed.
     */
-  explicit Rate(unsigned int period_us);
+  explicit Rate(
+    unsigned int period_us,
+    unsigned int spin_us = DEFAULT_SPIN_US,
+    Overrun overrun = Overrun::Rephase
+  );
 
   /// Sleep for the required time.
-  /** @return Clock time in microseconds when the thread "wakes up".
+  /** @return Clock time in microseconds when the thread "wakes up", on 64
+    *   bits (see Clock::ticks()).
     */
-  unsigned int sleep();
+  std::uint64_t sleep();
+
+  /// Restart the schedule: the next call to sleep() lasts a full period.
+  void reset();
 
   /// Get the last "wake up" time.
   /** @return The last value returned by a call to sleep().
     */
-  inline const unsigned int& lastTick() const { return tpast_; }
+  inline const std::uint64_t& lastTick() const { return tpast_; }
+
+  /// Get the index of the period that started with the last "wake up".
+  /** Periods are counted from the first call to sleep() of the schedule
+    * (index 0), against the clock: when deadlines are missed, the index
+    * grows by the number of periods that elapsed, not by one. With
+    * Overrun::CatchUp, it lags behind the clock until the schedule is met
+    * again.
+    * @return the index of the period of the last call to sleep().
+    */
+  inline std::uint64_t lastIndex() const { return last_index_; }
+
+  /// Number of calls to sleep() that happened after the deadline.
+  inline unsigned int overruns() const { return static_cast<unsigned int>(overrun_stats_.count()); }
+
+  /// Read the timing statistics collected since the last reset.
+  Statistics statistics() const;
+
+  /// Forget the timing statistics.
+  /** @warning This must be called by the thread that calls sleep(). */
+  void resetStatistics();
+
+  /// Histogram of the time between consecutive values returned by sleep().
+  inline const pendule_pi::Histogram& periods() const { return period_stats_; }
+
 private:
   const unsigned int period_; ///< Target period of this Rate.
-  unsigned int tnow_; ///< Used inside sleep() to store the current clock time.
-  unsigned int tpast_; ///< Clock time corresponding to the last time sleep() exited.
+  const unsigned int spin_us_; ///< Busy-waiting margin before each deadline.
+  const Overrun overrun_; ///< Policy applied when a deadline is missed.
+  bool started_; ///< False until the first call to sleep() (or after reset()).
+  std::uint64_t deadline_; ///< Clock time at which the current call to sleep() should return.
+  std::uint64_t tnow_; ///< Used inside sleep() to store the current clock time.
+  std::uint64_t tpast_; ///< Clock time corresponding to the last time sleep() exited.
+  std::uint64_t index_; ///< Index of the period that starts at deadline_.
+  std::uint64_t last_index_; ///< See lastIndex().
+  pendule_pi::Histogram period_stats_; ///< See Statistics::period.
+  pendule_pi::Histogram lateness_stats_; ///< See Statistics::lateness.
+  pendule_pi::Histogram overrun_stats_; ///< See Statistics::overrun.
+
+  /// Record the period that ends now, then return the wake-up time.
+  /** @param first true if this is the first call to sleep() of the schedule. */
+  std::uint64_t wakeUp(bool first);
 };
 
 
@@ -256,10 +361,18 @@ public:
 
   /// Reset the timer so that it will expire again in the future.
   void reset();
+
+  /// Histogram of the delay (in microseconds) between each expiration and the call to expired() that detected it.
+  inline const pendule_pi::Histogram& lateness() const { return lateness_; }
 private:
   const unsigned int period_; ///< Target period of this Rate.
   const bool auto_reset_; ///< If true, this timer automatically resets upon expiration.
-  unsigned int tpast_; ///< Clock time corresponding to the last time reset() was called.
+  std::uint64_t tpast_; ///< Clock time corresponding to the last time reset() was called.
+  bool reported_; ///< True if the current expiration has already been recorded in lateness_.
+  pendule_pi::Histogram lateness_; ///< See lateness().
+
+  /// Reset the timer, given the current clock time.
+  void reset(std::uint64_t tnow);
 };
 
 } // end of namespace pigpio
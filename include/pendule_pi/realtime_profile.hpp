@@ -0,0 +1,83 @@
+/** @file realtime_profile.hpp
+  * @brief Header file for the RealtimeProfile class.
+  */
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Settings reducing the jitter of the control loop.
+/** With the default Linux scheduler, the control thread can be preempted by
+  * any other process, and page faults can stall it at random times. This
+  * class gathers the usual countermeasures:
+  *   - SCHED_FIFO priority for the control thread;
+  *   - CPU affinity for the control thread and for the other threads of the
+  *     process (*i.e.*, pigpio's callback threads);
+  *   - `mlockall()`, so that memory is never paged out;
+  *   - prefaulting of the stack of the control thread.
+  *
+  * Each setting is optional. Settings that cannot be applied (typically
+  * because the process is not privileged, or because the stack to prefault
+  * exceeds the stack size limit) are reported, not treated as
+  * errors, so that the same code runs on the Pi and in a simulation.
+  *
+  * ```c++
+  * pigpio::ActivationToken token;
+  * pendule_pi::RealtimeProfile::Parameters params;
+  * params.priority = 70;
+  * params.cpus = {3};
+  * params.callback_cpus = {2};
+  * std::cout << pendule_pi::RealtimeProfile(params).apply();
+  * // create the Pendule and run the control loop here
+  * ```
+  *
+  * @note apply() must be called by the control thread, after pigpio has been
+  *   initialized (so that its threads exist) but before creating other
+  *   threads, which then inherit the settings of the control thread.
+  */
+class RealtimeProfile {
+public:
+  /// Settings to be applied. Default values leave everything untouched.
+  struct Parameters {
+    int priority; ///< SCHED_FIFO priority (1-99) of the control thread. Negative to keep the current policy.
+    std::vector<int> cpus; ///< CPUs the control thread may run on. Empty to keep the current affinity.
+    std::vector<int> callback_cpus; ///< CPUs the other threads of the process may run on. Empty to keep their affinity.
+    bool lock_memory; ///< If true, lock all current and future memory with `mlockall()`.
+    std::size_t prefault_stack_kb; ///< Amount of stack (in KiB) of the control thread to be touched in advance. Requests that do not fit below the stack size limit (`ulimit -s`) are reported as failed.
+    /// Initialize the parameters to a default.
+    Parameters();
+  };
+
+  /// Outcome of apply().
+  struct Report {
+    std::vector<std::string> applied; ///< Description of the settings that were applied.
+    std::vector<std::string> failed; ///< Description of the settings that could not be applied, with the reason.
+    /// Tells if all requested settings were applied.
+    inline bool ok() const { return failed.empty(); }
+  };
+
+  /// Constructor, using the given parameters.
+  explicit RealtimeProfile(const Parameters& params = Parameters());
+
+  /// Access the parameters.
+  inline const Parameters& parameters() const { return params_; }
+
+  /// Apply the settings to the calling thread and to the process.
+  /** This method never throws because of missing privileges or invalid
+    * CPUs: the problems are listed in the returned report.
+    * @return what could and could not be applied.
+    */
+  Report apply() const;
+
+private:
+  Parameters params_; ///< Settings to be applied.
+};
+
+/// Print a report, one line per setting.
+std::ostream& operator<<(std::ostream& os, const RealtimeProfile::Report& report);
+
+}
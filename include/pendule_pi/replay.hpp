@@ -0,0 +1,165 @@
+/** @file replay.hpp
+  * @brief Header file for the Replay class.
+  */
+#pragma once
+
+#include <pendule_pi/pendule.hpp>
+#include <pendule_pi/state_filter.hpp>
+#include <pendule_pi/velocity_estimator.hpp>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Runs recorded sessions through the state estimation chain, offline.
+/** A recording (a CSV file, such as those in `src/bin/identification`, or a
+  * FlightRecorder file) provides the measured position and angle at each
+  * period. Replaying it with a Configuration reproduces what the low-level
+  * interface would have published:
+  *   - the velocities are estimated as in Pendule::update(), either by finite
+  *     differences over the nominal period, or from the timing of the encoder
+  *     edges. Since recordings only hold one sample per period, the edges are
+  *     assumed to be spread evenly between two samples in the second case;
+  *   - the state then goes through a StateFilter.
+  *
+  * There is no clock involved: a recording is replayed as fast as the CPU
+  * allows, and several configurations can be evaluated in parallel:
+  * ```c++
+  * pendule_pi::Replay replay(pendule_pi::Replay::load("logged_motion.csv"));
+  * auto results = replay.run(configurations); // one thread per core
+  * std::cout << results[0].metrics[pendule_pi::Replay::LINVEL].lag_us << std::endl;
+  * ```
+  *
+  * For each coordinate, the filtered signal is compared with the unfiltered
+  * one to compute Metrics:
+  *   - the *lag* is the delay that maximizes the cross-correlation of the two
+  *     signals (refined below one period by parabolic interpolation);
+  *   - the *residual* is the RMS difference between the filtered signal and
+  *     the unfiltered one delayed by the lag, *i.e.*, what the filter removed
+  *     or distorted;
+  *   - the *noise* is the RMS of the second differences of the filtered
+  *     signal, relative to the one of the unfiltered signal: 1 means that the
+  *     high-frequency content is left untouched, 0 that it is removed.
+  */
+class Replay {
+public:
+  /// Indices of the coordinates in States and Metrics.
+  enum Coordinate {
+    POSITION = 0, ///< Position [m].
+    ANGLE = 1, ///< Angle [rad].
+    LINVEL = 2, ///< Linear velocity [m/s].
+    ANGVEL = 3 ///< Angular velocity [rad/s].
+  };
+
+  /// Position, angle, linear and angular velocity (see Coordinate).
+  using State = std::array<double,4>;
+
+  /// A measurement of the recording.
+  struct Sample {
+    std::uint64_t time_us; ///< Time of the measurement [us].
+    double position; ///< Measured position [m].
+    double angle; ///< Measured angle [rad].
+    int pwm; ///< PWM applied at that time (0 if not recorded).
+  };
+
+  /// A recorded session.
+  struct Recording {
+    std::string name; ///< Name of the recording, *e.g.*, its file name.
+    std::uint64_t period_us; ///< Nominal period of the measurements [us].
+    std::vector<Sample> samples; ///< Measurements, ordered by time.
+  };
+
+  /// Settings of the estimation chain.
+  struct Configuration {
+    std::string name; ///< Name of the configuration, used in reports.
+    double meters_per_step; ///< Conversion coefficient of the position encoder, as given to Pendule.
+    double radians_per_step; ///< Conversion coefficient of the angle encoder, as given to Pendule.
+    Pendule::VelocityEstimation velocity_estimation; ///< How velocities are estimated.
+    VelocityEstimator::Parameters velocity_parameters; ///< Used with Pendule::VelocityEstimation::EdgeTiming.
+    StateFilter::Parameters filter; ///< Settings of the filters.
+    /// Initialize the configuration to a default.
+    Configuration();
+  };
+
+  /// Comparison of a filtered coordinate with the unfiltered one.
+  struct Metrics {
+    double lag_us; ///< Delay introduced by the filter [us].
+    double residual; ///< RMS difference with the unfiltered signal, once delayed by the lag.
+    double noise; ///< Relative RMS of the second differences.
+  };
+
+  /// Output of a replay.
+  struct Result {
+    std::vector<State> raw; ///< Unfiltered state, at each sample.
+    std::vector<State> filtered; ///< Filtered state, at each sample.
+    std::array<Metrics,4> metrics; ///< Metrics of each coordinate (see Coordinate).
+    double elapsed_s; ///< Wall-clock time spent in the replay [s].
+  };
+
+  /// Load a recording.
+  /** Flight recorder files are recognized by their header, and their
+    * unfiltered position and angle are used. Other files are read as CSV
+    * files, whose first line names the columns: `time_us` is required, as
+    * well as `position` and/or `angle`, while `pwm` is optional. Other
+    * columns are ignored.
+    * @param path path of the file.
+    * @param position_scale factor applied to the positions of CSV files,
+    *   *e.g.*, to convert steps to meters.
+    * @param angle_scale factor applied to the angles of CSV files.
+    * @return the recording, with a nominal period equal to the median of
+    *   the intervals between samples (or to the one stored in flight recorder
+    *   files).
+    * @throw std::runtime_error if the file cannot be read, or if it holds
+    *   less than two samples.
+    */
+  static Recording load(
+    const std::string& path,
+    double position_scale = 1.0,
+    double angle_scale = 1.0
+  );
+
+  /// Prepare the replay of a recording.
+  explicit Replay(
+    Recording recording
+  );
+
+  /// Access the recording.
+  inline const Recording& recording() const { return recording_; }
+
+  /// Replay the recording with the given configuration.
+  /** It can be called from several threads at once.
+    */
+  Result run(const Configuration& configuration) const;
+
+  /// Replay the recording with several configurations, in parallel.
+  /** @param configurations the configurations to be evaluated.
+    * @param threads number of threads used. 0 means one per core.
+    * @return the results, in the same order as the configurations.
+    * @throw std::runtime_error (or any other exception thrown by a replay)
+    *   after all threads completed, if a replay failed.
+    */
+  std::vector<Result> run(
+    const std::vector<Configuration>& configurations,
+    unsigned int threads = 0
+  ) const;
+
+  /// Compare a filtered signal with the unfiltered one.
+  /** @param raw unfiltered signal.
+    * @param filtered filtered signal, with the same length.
+    * @param period_us sampling period [us].
+    * @param max_lag largest lag searched, in samples.
+    */
+  static Metrics compare(
+    const std::vector<double>& raw,
+    const std::vector<double>& filtered,
+    std::uint64_t period_us,
+    std::size_t max_lag
+  );
+
+private:
+  const Recording recording_; ///< See recording().
+};
+
+}
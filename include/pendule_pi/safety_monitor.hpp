@@ -0,0 +1,133 @@
+/** @file safety_monitor.hpp
+  * @brief Header file for the SafetyMonitor class.
+  */
+#pragma once
+
+#include <pendule_pi/histogram.hpp>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <semaphore.h>
+
+namespace pendule_pi {
+
+/// Dedicated thread that reacts to safety events.
+/** GPIO callbacks (*e.g.*, a Switch being hit or an Encoder entering a
+  * forbidden zone) should not perform slow operations, nor throw exceptions:
+  * they run on pigpio's thread, and there is nobody there to catch them. With
+  * this class, they simply post() an event, which costs a couple of atomic
+  * operations. A dedicated thread, running with real-time priority if
+  * possible, wakes up and executes the reaction (*e.g.*, zeroing the motor).
+  *
+  * ```c++
+  * pendule_pi::SafetyMonitor monitor([&](const auto& e) { motor.setPWM(0); });
+  * // inside a GPIO callback
+  * monitor.post(tick, "limit reached");
+  * // later, in the control loop
+  * if(monitor.triggered())
+  *   std::cout << monitor.firstEvent().reason << std::endl;
+  * ```
+  *
+  * The delay between the tick of each event and the end of its reaction is
+  * measured and stored in a Histogram (see latency()).
+  */
+class SafetyMonitor {
+public:
+  /// A safety event.
+  struct Event {
+    unsigned int tick; ///< Time at which the event happened, in microseconds (as given by `gpioTick()`).
+    const char* reason; ///< Description of the event. It must be a string with static storage, such as a literal.
+  };
+
+  /// Function executed by the monitor thread for each event.
+  using Reaction = std::function<void(const Event&)>;
+
+  /// Maximum number of events waiting to be processed.
+  static constexpr std::size_t QUEUE_SIZE = 64;
+  /// Default real-time priority (SCHED_FIFO) of the monitor thread.
+  static constexpr int DEFAULT_PRIORITY = 80;
+  /// Width of the bins of the latency histogram, in microseconds.
+  static constexpr unsigned int LATENCY_BIN_US = 10;
+  /// Number of bins of the latency histogram.
+  static constexpr std::size_t LATENCY_BINS = 200;
+
+  /// Start the monitor thread.
+  /** @param reaction function executed for each event. It runs on the monitor
+    *   thread. Exceptions it throws are caught and reported as warnings.
+    * @param priority SCHED_FIFO priority of the monitor thread. If it cannot
+    *   be set (*e.g.*, because of missing privileges), a warning is printed
+    *   and the thread keeps the default scheduling policy. Use a negative
+    *   value to skip this step.
+    */
+  explicit SafetyMonitor(
+    Reaction reaction,
+    int priority = DEFAULT_PRIORITY
+  );
+
+  // Prevent the user from making copies of a SafetyMonitor.
+  SafetyMonitor(const SafetyMonitor&) = delete;
+  SafetyMonitor& operator=(const SafetyMonitor&) = delete;
+
+  /// Stop and join the monitor thread. Pending events are processed first.
+  virtual ~SafetyMonitor();
+
+  /// Post an event.
+  /** This method is lock-free, it never allocates and it never throws. It
+    * can be called from any thread, including GPIO callbacks.
+    * @param tick time at which the event happened, in microseconds.
+    * @param reason description of the event. It must have static storage.
+    * @return false if the queue was full, in which case the event is lost
+    *   (see droppedEvents()).
+    */
+  bool post(unsigned int tick, const char* reason) noexcept;
+
+  /// Tell if at least one event has been processed.
+  inline bool triggered() const { return first_reason_.load(std::memory_order_acquire) != nullptr; }
+
+  /// First processed event.
+  /** @return the first event, or an event with `reason == nullptr` if
+    *   triggered() is false.
+    */
+  Event firstEvent() const;
+
+  /// Number of processed events.
+  inline unsigned int processedEvents() const { return processed_events_.load(std::memory_order_relaxed); }
+
+  /// Number of events that could not be posted because the queue was full.
+  inline unsigned int droppedEvents() const { return dropped_events_.load(std::memory_order_relaxed); }
+
+  /// Delay between the tick of each event and the end of its reaction, in microseconds.
+  inline const Histogram& latency() const { return latency_; }
+
+private:
+  /// Element of the queue.
+  struct Slot {
+    std::atomic<std::size_t> sequence{0}; ///< Set to `position+1` when the slot at `position` is ready to be read.
+    Event event; ///< Stored event.
+  };
+
+  static constexpr std::size_t MASK = QUEUE_SIZE - 1; ///< Used to compute indices in slots_.
+  static_assert((QUEUE_SIZE & MASK) == 0, "SafetyMonitor: QUEUE_SIZE must be a power of two");
+
+  Reaction reaction_; ///< Function executed for each event.
+  std::array<Slot,QUEUE_SIZE> slots_; ///< Multi-producer, single-consumer queue of events.
+  std::atomic<std::size_t> head_; ///< Next position to be written by producers.
+  std::atomic<std::size_t> tail_; ///< Next position to be read by the monitor thread.
+  std::atomic<unsigned int> processed_events_; ///< See processedEvents().
+  std::atomic<unsigned int> dropped_events_; ///< See droppedEvents().
+  std::atomic<unsigned int> first_tick_; ///< Tick of the first processed event.
+  std::atomic<const char*> first_reason_; ///< Reason of the first processed event (nullptr if none).
+  Histogram latency_; ///< See latency().
+  std::atomic<bool> quit_; ///< Tells the monitor thread to exit.
+  sem_t semaphore_; ///< Posted once per event, to wake up the monitor thread.
+  std::thread thread_; ///< The monitor thread.
+
+  /// Body of the monitor thread.
+  void run();
+
+  /// Process all events in the queue.
+  void processEvents();
+};
+
+}
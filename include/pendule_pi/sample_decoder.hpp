@@ -0,0 +1,136 @@
+/** @file sample_decoder.hpp
+  * @brief Header file for the SampleDecoder class.
+  */
+#pragma once
+
+#include <pendule_pi/encoder.hpp>
+#include <pendule_pi/encoder_bank.hpp>
+#include <pendule_pi/switch.hpp>
+#include <pendule_pi/backend.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Decodes encoders and switches from batches of GPIO samples.
+/** By default, each Encoder registers one GPIO alert per phase and each
+  * Switch one alert for its pin: pigpio then performs one callback dispatch
+  * per edge. This class offers an alternative, based on
+  * `gpioSetGetSamplesFuncEx()`: pigpio calls a single function about once per
+  * millisecond, passing a batch of snapshots of the levels of all pins. The
+  * function then updates all registered encoders and switches at once.
+  *
+  * ```c++
+  * pendule_pi::Encoder encoder(20, 21);
+  * pendule_pi::SampleDecoder decoder;
+  * decoder.addEncoder(encoder); // disables the alerts of the encoder
+  * decoder.start();
+  * // ...
+  * auto stats = decoder.statistics();
+  * ```
+  *
+  * The decoder keeps some statistics (see Statistics) that allow to compare
+  * the cost of this approach against the per-edge alerts.
+  * @warning Registered objects must outlive the decoder, or at least be
+  *   registered only while the decoder is stopped.
+  */
+class SampleDecoder {
+public:
+  /// Statistics about the processed batches.
+  struct Statistics {
+    std::uint64_t batches; ///< Number of processed batches.
+    std::uint64_t samples; ///< Total number of processed samples.
+    std::uint64_t steps; ///< Total number of decoded encoder steps (in absolute value).
+    std::uint64_t cpu_ns; ///< Total CPU time spent decoding batches, in nanoseconds.
+    std::uint32_t last_batch_samples; ///< Number of samples in the last batch.
+    std::uint32_t last_batch_steps; ///< Number of steps decoded in the last batch.
+    std::uint32_t last_batch_ns; ///< CPU time spent decoding the last batch, in nanoseconds.
+    std::uint32_t max_batch_ns; ///< Maximum CPU time spent decoding a single batch, in nanoseconds.
+  };
+
+  /// Create a decoder with no registered object.
+  SampleDecoder();
+
+  // Prevent the user from making copies of a SampleDecoder.
+  SampleDecoder(const SampleDecoder&) = delete;
+  SampleDecoder& operator=(const SampleDecoder&) = delete;
+
+  /// Stops the decoder and restores the alerts of registered objects.
+  virtual ~SampleDecoder();
+
+  /// Register an encoder.
+  /** The alerts of the encoder are disabled (see Encoder::useAlerts()).
+    * @param encoder the encoder to be updated by this decoder.
+    */
+  void addEncoder(Encoder& encoder);
+
+  /// Register a bank of encoders.
+  /** The alerts of the bank are disabled (see EncoderBank::useAlerts()). Each
+    * sample that affects its pins is passed as-is to EncoderBank::process().
+    * @param bank the bank to be updated by this decoder.
+    */
+  void addEncoderBank(EncoderBank& bank);
+
+  /// Register a switch.
+  /** The switch will no longer register alerts when its interrupts are
+    * enabled (see Switch::useAlerts()).
+    * @param sw the switch to be updated by this decoder.
+    */
+  void addSwitch(Switch& sw);
+
+  /// Start receiving samples.
+  void start();
+
+  /// Stop receiving samples.
+  void stop();
+
+  /// Tells if the decoder is receiving samples.
+  inline bool running() const { return running_; }
+
+  /// Get a snapshot of the statistics.
+  /** @note The fields are read one by one, meaning that they might not be
+    *   mutually consistent if a batch is being processed at the same time.
+    */
+  Statistics statistics() const;
+
+  /// Reset all statistics to zero.
+  void resetStatistics();
+
+private:
+  std::vector<Encoder*> encoders_; ///< Registered encoders.
+  std::vector<std::uint32_t> encoder_masks_; ///< For each encoder, the bits of its two phases.
+  std::vector<EncoderBank*> banks_; ///< Registered encoder banks.
+  std::vector<Switch*> switches_; ///< Registered switches.
+  std::uint32_t bits_; ///< Bits of all monitored pins.
+  std::uint32_t last_level_; ///< Levels of all pins in the last processed sample.
+  bool running_; ///< If true, the sampling function is registered.
+  std::atomic<std::uint64_t> batches_; ///< See Statistics::batches.
+  std::atomic<std::uint64_t> samples_; ///< See Statistics::samples.
+  std::atomic<std::uint64_t> steps_; ///< See Statistics::steps.
+  std::atomic<std::uint64_t> cpu_ns_; ///< See Statistics::cpu_ns.
+  std::atomic<std::uint32_t> last_batch_samples_; ///< See Statistics::last_batch_samples.
+  std::atomic<std::uint32_t> last_batch_steps_; ///< See Statistics::last_batch_steps.
+  std::atomic<std::uint32_t> last_batch_ns_; ///< See Statistics::last_batch_ns.
+  std::atomic<std::uint32_t> max_batch_ns_; ///< See Statistics::max_batch_ns.
+
+  /// Process a batch of samples.
+  /** @param samples pointer to the first sample of the batch.
+    * @param n_samples number of samples in the batch.
+    */
+  void process(const gpioSample_t* samples, int n_samples);
+
+  /// Static wrapper to call process.
+  /** @param samples pointer to the first sample of the batch.
+    * @param n_samples number of samples in the batch.
+    * @param THIS a pointer to a SampleDecoder. Named `THIS` simply because it
+    *   tries to mimic the `this` pointer.
+    */
+  static void processStatic(
+    const gpioSample_t* samples,
+    int n_samples,
+    void* THIS
+  );
+};
+
+}
@@ -0,0 +1,165 @@
+/** @file scheduler.hpp
+  * @brief Header file for the Scheduler class.
+  */
+#pragma once
+
+#include <pendule_pi/pigpio.hpp>
+#include <pendule_pi/histogram.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Cooperative scheduler running periodic tasks at multiples of a base period.
+/** Instead of polling several Timer objects inside a loop driven by a Rate,
+  * each activity is registered as a task:
+  * ```c++
+  * pendule_pi::Scheduler scheduler(1000); // 1kHz base tick
+  * scheduler.addTask("estimation", [&](){ pendule.update(0.001); }, 1, 0, 10);
+  * scheduler.addTask("publish", [&](){ publish(); }, 20, 0, 5, 300);
+  * scheduler.addTask("console", [&](){ print(); }, 100, 50);
+  * scheduler.run(); // until stop() is called
+  * ```
+  *
+  * At each base tick (enforced by a pigpio::Rate), the tasks that are due
+  * are executed one after the other, by the calling thread, from the highest
+  * to the lowest priority (tasks with equal priorities run in the order in
+  * which they were added). A task with period `n` and offset `k` runs at
+  * ticks `k`, `k+n`, `k+2n`, *etc*. Offsets allow to spread slow tasks over
+  * different ticks.
+  *
+  * Ticks are counted against the clock (see pigpio::Rate::lastIndex()), not
+  * by the number of calls to step(): when base periods are skipped after an
+  * overrun, tasks keep running at their intended instants. A task whose
+  * tick was skipped runs once, at the next step.
+  *
+  * Since scheduling is cooperative, a task is never interrupted. The
+  * execution time of each task is measured and compared with its budget:
+  * statistics() reports per-task execution times and budget overruns, and
+  * the underlying Rate reports overruns of the base period.
+  *
+  * Exceptions thrown by tasks (*e.g.*, pigpio::ActivationToken::PleaseStop)
+  * propagate to the caller of step() or run().
+  */
+class Scheduler {
+public:
+  /// Function executed by a task.
+  using Function = std::function<void(void)>;
+
+  /// Statistics of a single task.
+  struct TaskStatistics {
+    std::string name; ///< Name given to addTask().
+    unsigned int period; ///< Period of the task, in base ticks.
+    int priority; ///< Priority of the task.
+    unsigned int budget_us; ///< Execution time budget, in microseconds (0 if none).
+    std::uint64_t runs; ///< Number of executions.
+    std::uint64_t budget_overruns; ///< Number of executions that exceeded the budget.
+    std::uint64_t total_ns; ///< Total execution time, in nanoseconds.
+    Histogram::Summary execution_us; ///< Execution times, in microseconds.
+  };
+
+  /// Create a scheduler with no task.
+  /** @param base_period_us base tick, in microseconds. The periods of all
+    *   tasks are multiples of it.
+    * @param spin_us see pigpio::Rate::Rate().
+    * @param overrun see pigpio::Rate::Rate().
+    */
+  explicit Scheduler(
+    unsigned int base_period_us,
+    unsigned int spin_us = pigpio::Rate::DEFAULT_SPIN_US,
+    pigpio::Rate::Overrun overrun = pigpio::Rate::Overrun::Rephase
+  );
+
+  // Prevent the user from making copies of a Scheduler.
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  /// Register a periodic task.
+  /** @param name name of the task, used in statistics().
+    * @param function function to be executed.
+    * @param period period of the task, in base ticks (at least 1).
+    * @param offset index of the first tick at which the task runs (modulo
+    *   the period).
+    * @param priority tasks with higher priorities run first.
+    * @param budget_us execution time above which a budget overrun is
+    *   counted, in microseconds. Use 0 for no budget.
+    * @return the index of the task, as used in statistics().
+    * @throw std::runtime_error if the period is 0.
+    * @warning Tasks must not be added while step() or run() are executing
+    *   (*e.g.*, from inside a task).
+    */
+  std::size_t addTask(
+    const std::string& name,
+    Function function,
+    unsigned int period,
+    unsigned int offset = 0,
+    int priority = 0,
+    unsigned int budget_us = 0
+  );
+
+  /// Wait for the next base tick, then run all tasks that are due.
+  /** @return the wake-up time, in microseconds (see pigpio::Rate::sleep()).
+    */
+  std::uint64_t step();
+
+  /// Call step() until stop() is called.
+  void run();
+
+  /// Make run() return after the current tick. It can be called from any thread, including tasks.
+  inline void stop() { stop_.store(true, std::memory_order_relaxed); }
+
+  /// Number of base ticks executed so far, *i.e.*, of calls to step().
+  inline std::uint64_t ticks() const { return ticks_; }
+
+  /// Base period, in microseconds.
+  inline unsigned int basePeriod() const { return base_period_us_; }
+
+  /// Access the Rate enforcing the base period, *e.g.*, to read its timing statistics.
+  inline const pigpio::Rate& rate() const { return rate_; }
+
+  /// Read the statistics of all tasks, in the order in which they were added.
+  std::vector<TaskStatistics> statistics() const;
+
+  /// Forget the statistics of all tasks, and the timing statistics of rate().
+  /** @warning This must be called by the thread running the scheduler. */
+  void resetStatistics();
+
+private:
+  /// A registered task and its counters.
+  struct Task {
+    std::string name; ///< See TaskStatistics::name.
+    Function function; ///< Function to be executed.
+    unsigned int period; ///< See TaskStatistics::period.
+    unsigned int offset; ///< Offset, already reduced modulo the period.
+    int priority; ///< See TaskStatistics::priority.
+    unsigned int budget_us; ///< See TaskStatistics::budget_us.
+    std::atomic<std::uint64_t> runs; ///< See TaskStatistics::runs.
+    std::atomic<std::uint64_t> budget_overruns; ///< See TaskStatistics::budget_overruns.
+    std::atomic<std::uint64_t> total_ns; ///< See TaskStatistics::total_ns.
+    Histogram execution_us; ///< See TaskStatistics::execution_us.
+    /// Create a task with null counters.
+    Task(const std::string& name, Function function, unsigned int period, unsigned int offset, int priority, unsigned int budget_us);
+  };
+
+  const unsigned int base_period_us_; ///< Base tick, in microseconds.
+  pigpio::Rate rate_; ///< Enforces the base period.
+  std::vector<std::unique_ptr<Task>> tasks_; ///< Tasks, in the order in which they were added.
+  std::vector<Task*> order_; ///< Tasks, in execution order.
+  std::uint64_t ticks_; ///< See ticks().
+  std::uint64_t next_index_; ///< Index of the first base tick (see pigpio::Rate::lastIndex()) that was not scheduled yet.
+  std::atomic<bool> stop_; ///< Set by stop().
+
+  /// Execute a task and update its counters.
+  void execute(Task& task);
+
+  /// Number of runs of a task scheduled before a given base tick.
+  static inline std::uint64_t runsBefore(const Task& task, std::uint64_t index) {
+    return index > task.offset ? (index - task.offset - 1) / task.period + 1 : 0;
+  }
+};
+
+}
@@ -0,0 +1,135 @@
+/** @file shm_channel.hpp
+  * @brief Header file for the ShmChannel class.
+  */
+#pragma once
+
+#include <pendule_pi/wire_format.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace pendule_pi {
+
+/// Shared-memory transport between the low-level interface and a client running on the same host.
+/** The interface creates a POSIX shared memory object (`/dev/shm/<name>`)
+  * holding two slots: the latest state, written by the interface, and the
+  * latest command, written by the client. Both contain a message in the
+  * binary wire format (see wire_format.hpp), protected by a seqlock:
+  *   - writing never blocks, and never waits for the reader;
+  *   - reading never blocks the writer: a read that overlaps a write is
+  *     simply retried. It gives up after a bounded number of attempts (as if
+  *     no message was available), so that a writer dying in the middle of a
+  *     write cannot make the reader spin forever.
+  *
+  * A reader can sleep until a new message is written with waitState() or
+  * waitCommand(), which rely on a futex in the shared memory. Writers only
+  * issue the wake-up system call when somebody is waiting, so that exchanging
+  * a message usually costs no system call at all.
+  *
+  * ```c++
+  * // interface
+  * pendule_pi::ShmChannel channel("pendule", pendule_pi::ShmChannel::CREATE);
+  * channel.writeState(state_buffer);
+  * if(channel.readCommand(command_buffer)) { ... }
+  * // client
+  * pendule_pi::ShmChannel channel("pendule", pendule_pi::ShmChannel::OPEN);
+  * channel.waitState(-1);
+  * channel.readState(state_buffer);
+  * channel.writeCommand(command_buffer);
+  * ```
+  *
+  * The shared memory object is only accessible to the user and group of the
+  * interface (mode 0660, whatever the umask): as for the
+  * command socket, whoever can open it drives the motor.
+  *
+  * @warning Each slot supports a single writer: only one client at a time
+  *   may send commands through a given channel.
+  */
+class ShmChannel {
+public:
+  /// Prefix of the URIs selecting this transport (*e.g.*, `shm://pendule`).
+  static auto constexpr URI_PREFIX = "shm://";
+
+  /// Named option to be passed to the constructor: create the shared memory (interface side).
+  static auto constexpr CREATE = true;
+  /// Named option to be passed to the constructor: open an existing shared memory (client side).
+  static auto constexpr OPEN = false;
+
+  /// Exception thrown when opening a channel that was not created (yet).
+  class NotFound : public std::runtime_error {
+  public:
+    /// Constructor.
+    NotFound(const std::string& name) : std::runtime_error("ShmChannel: no shared memory named '" + name + "'") { }
+  };
+
+  /// Create or open a channel.
+  /** @param name name of the channel, without leading slash.
+    * @param create if CREATE, a new shared memory object is created (any
+    *   previous one with the same name is removed first), and it is removed
+    *   by the destructor. If OPEN, an existing one is mapped.
+    * @throw NotFound if opening a channel that does not exist.
+    * @throw std::runtime_error if the shared memory cannot be created or
+    *   mapped, or if it was created by an incompatible version.
+    */
+  ShmChannel(
+    const std::string& name,
+    bool create
+  );
+
+  /// Unmap the shared memory, and remove it if it was created by this object.
+  ~ShmChannel();
+
+  // Prevent the user from making copies of a ShmChannel.
+  ShmChannel(const ShmChannel&) = delete;
+  ShmChannel& operator=(const ShmChannel&) = delete;
+
+  /// Name of the channel.
+  inline const std::string& name() const { return name_; }
+
+  /// Publish a state (interface side). It never blocks.
+  void writeState(const wire::StateBuffer& buffer) noexcept;
+
+  /// Read the latest state (client side).
+  /** @param[out] buffer the latest state.
+    * @return false if no state was written since the last successful read,
+    *   or if it could not be read because a write seems stuck, in which
+    *   case buffer is not modified.
+    */
+  bool readState(wire::StateBuffer& buffer) noexcept;
+
+  /// Wait until a state that was not read yet is available (client side).
+  /** @param timeout_us maximum waiting time in microseconds, negative to wait
+    *   indefinitely.
+    * @return true if a new state is available.
+    */
+  bool waitState(long timeout_us) noexcept;
+
+  /// Send a command (client side). It never blocks.
+  void writeCommand(const wire::CommandBuffer& buffer) noexcept;
+
+  /// Read the latest command (interface side).
+  /** @param[out] buffer the latest command.
+    * @return false if no command was written since the last successful read,
+    *   or if it could not be read because a write seems stuck, in which
+    *   case buffer is not modified.
+    */
+  bool readCommand(wire::CommandBuffer& buffer) noexcept;
+
+  /// Wait until a command that was not read yet is available (interface side).
+  /** @param timeout_us maximum waiting time in microseconds, negative to wait
+    *   indefinitely.
+    * @return true if a new command is available.
+    */
+  bool waitCommand(long timeout_us) noexcept;
+
+private:
+  struct Layout;
+
+  const std::string name_; ///< See name().
+  const bool owner_; ///< Tells if the shared memory must be removed by the destructor.
+  Layout* layout_; ///< Mapped shared memory.
+  std::uint32_t last_state_; ///< Seqlock value of the last state read.
+  std::uint32_t last_command_; ///< Seqlock value of the last command read.
+};
+
+}
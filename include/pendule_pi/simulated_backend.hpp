@@ -0,0 +1,163 @@
+/** @file simulated_backend.hpp
+  * @brief Header file for the SimulatedBackend class.
+  */
+#pragma once
+
+#include <pendule_pi/backend.hpp>
+#include <array>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace pigpio {
+
+/// In-process, deterministic implementation of a Backend.
+/** This backend does not touch any hardware. It stores the configuration and
+  * the level of each pin, and it keeps time using a virtual clock that only
+  * moves when asked to. It allows to run (and profile) the library on any
+  * machine:
+  * ```c++
+  * pigpio::SimulatedBackend sim;
+  * pigpio::ActivationToken token(sim);
+  * pendule_pi::Encoder encoder(20, 21);
+  * // Generate a forward step, 100us from now.
+  * sim.scheduleLevel(sim.now() + 100, 21, PI_LOW);
+  * sim.advance(1000); // the encoder callback is executed here
+  * ```
+  *
+  * Alert callbacks registered via setAlertFuncEx() are executed
+  * synchronously, by the thread that moves the virtual clock (via advance(),
+  * advanceTo(), setLevel() or tick() if setTickIncrement() was used). They
+  * receive the virtual time of the level change as tick. Similarly to pigpio,
+  * the function registered via setGetSamplesFuncEx() receives a batch of
+  * samples every (virtual) millisecond, one per tick at which the monitored
+  * pins changed. All PWM writes are recorded along with their virtual time, see
+  * pwmWrites().
+  *
+  * All methods are thread-safe. The virtual clock can thus be moved by a
+  * "plant" thread while the code under test runs in another one.
+  */
+class SimulatedBackend : public Backend {
+public:
+  /// Number of GPIO pins handled by the simulation.
+  static constexpr unsigned N_GPIO = 54;
+
+  /// Record of a call to pwm().
+  struct PwmWrite {
+    std::uint32_t tick; ///< Virtual time of the call.
+    unsigned gpio; ///< Pin that was written.
+    unsigned dutycycle; ///< Written dutycycle.
+  };
+
+  /// Create the backend, with the virtual clock set to the given time.
+  explicit SimulatedBackend(std::uint32_t start_tick = 0);
+
+  int initialise() override;
+  void terminate() override;
+  int setMode(unsigned gpio, unsigned mode) override;
+  int setPullUpDown(unsigned gpio, unsigned pud) override;
+  int read(unsigned gpio) override;
+  std::uint32_t readBits0to31() override;
+  int write(unsigned gpio, unsigned level) override;
+  int pwm(unsigned gpio, unsigned dutycycle) override;
+  int setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata) override;
+  int setGetSamplesFuncEx(gpioGetSamplesFuncEx_t f, std::uint32_t bits, void* userdata) override;
+  /// Read the virtual clock.
+  /** If setTickIncrement() was called with a positive value, the clock is
+    * also moved forward by that amount. This allows busy-waiting loops (such
+    * as the one in Rate::sleep()) to terminate.
+    */
+  std::uint32_t tick() override;
+  /// Move the virtual clock to the given tick (see advanceTo()), without actually sleeping.
+  void sleepUntil(std::uint32_t tick) override;
+
+  /// Current value of the virtual clock, without moving it.
+  std::uint32_t now() const;
+
+  /// Amount of microseconds the clock should advance at each call to tick().
+  void setTickIncrement(std::uint32_t us);
+
+  /// Drive a pin to the given level, at the current virtual time.
+  /** The pin is considered as driven by external hardware from now on,
+    * meaning that pull-up and pull-down resistors no longer affect it. If
+    * the level changes, registered alerts are triggered.
+    */
+  void setLevel(unsigned gpio, int level);
+
+  /// Schedule a level change on a pin.
+  /** The change is applied (as in setLevel()) when the virtual clock reaches
+    * the given tick. Changes scheduled for the same tick are applied in the
+    * order in which they were scheduled.
+    * @param tick virtual time at which the change happens. It is interpreted
+    *   as being in the future if `tick-now() < 2^31`.
+    * @param gpio pin to be changed.
+    * @param level new level of the pin.
+    */
+  void scheduleLevel(std::uint32_t tick, unsigned gpio, int level);
+
+  /// Move the virtual clock forward, applying scheduled level changes.
+  void advance(std::uint32_t us);
+
+  /// Move the virtual clock to the given time, applying scheduled level changes.
+  void advanceTo(std::uint32_t tick);
+
+  /// Current mode of a pin (`PI_INPUT`, `PI_OUTPUT`...).
+  unsigned mode(unsigned gpio) const;
+  /// Current pull-up/pull-down configuration of a pin.
+  unsigned pullUpDown(unsigned gpio) const;
+  /// Current level of a pin.
+  int level(unsigned gpio) const;
+  /// Last dutycycle written to a pin via pwm().
+  unsigned dutycycle(unsigned gpio) const;
+  /// Tells if an alert callback is registered on the given pin.
+  bool hasAlert(unsigned gpio) const;
+
+  /// Get a copy of all recorded PWM writes.
+  std::vector<PwmWrite> pwmWrites() const;
+  /// Forget recorded PWM writes.
+  void clearPwmWrites();
+
+private:
+  /// Internal representation of a pin.
+  struct Pin {
+    unsigned mode{PI_INPUT}; ///< Pin mode.
+    unsigned pud{PI_PUD_OFF}; ///< Pull-up/pull-down configuration.
+    int level{PI_LOW}; ///< Current level.
+    unsigned dutycycle{0}; ///< Last dutycycle written to the pin.
+    bool driven{false}; ///< If true, the level is imposed externally and pull resistors are ignored.
+    gpioAlertFuncEx_t alert{nullptr}; ///< Registered alert callback.
+    void* userdata{nullptr}; ///< Userdata for the alert callback.
+  };
+
+  /// A level change scheduled via scheduleLevel().
+  struct Event {
+    unsigned gpio; ///< Pin to be changed.
+    int level; ///< New level.
+  };
+
+  /// Period, in microseconds, at which batches of samples are delivered.
+  static constexpr std::uint64_t SAMPLES_PERIOD_US = 1000;
+
+  /// Change the level of a pin and fire the associated alert if needed.
+  void changeLevel(unsigned gpio, int level);
+  /// Deliver pending samples if a batch boundary has been crossed before the given time.
+  void flushSamples(std::uint64_t target);
+  /// Convert a 32 bits tick into a 64 bits time, assuming it is at most 2^31 microseconds in the future.
+  std::uint64_t unwrap(std::uint32_t tick) const;
+  /// Move the clock to the given time, applying events on the way.
+  void advanceToLocked(std::uint64_t target);
+
+  mutable std::recursive_mutex mutex_; ///< Protects all members. Recursive since callbacks may call the backend.
+  std::uint64_t time_; ///< Virtual clock (it does not wrap, unlike the values returned by tick()).
+  std::uint32_t tick_increment_; ///< Amount by which tick() moves the clock.
+  std::array<Pin,N_GPIO> pins_; ///< State of all pins.
+  std::multimap<std::uint64_t,Event> events_; ///< Scheduled level changes, sorted by time.
+  std::vector<PwmWrite> pwm_writes_; ///< History of all PWM writes.
+  gpioGetSamplesFuncEx_t samples_func_; ///< Function registered via setGetSamplesFuncEx().
+  std::uint32_t samples_bits_; ///< Pins monitored by samples_func_.
+  void* samples_userdata_; ///< Userdata for samples_func_.
+  std::vector<gpioSample_t> pending_samples_; ///< Samples not yet delivered to samples_func_.
+  std::uint64_t next_batch_; ///< Time at which pending_samples_ should be delivered.
+};
+
+} // end of namespace pigpio
@@ -0,0 +1,99 @@
+/** @file spsc_ring.hpp
+  * @brief Header file for the SpscRing class.
+  */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace pendule_pi {
+
+/// Fixed-capacity, lock-free, single-producer/single-consumer ring buffer.
+/** This container allows one thread (the producer) to push elements while a
+  * second thread (the consumer) pops them, without using any lock. It is meant
+  * to move data out of pigpio's callback thread: pushing an element only
+  * requires a couple of atomic loads and one atomic store, and it never
+  * allocates memory.
+  *
+  * ```c++
+  * pendule_pi::SpscRing<int, 16> ring;
+  * // producer thread
+  * if(!ring.push(42)) { ... } // the ring is full, the element is discarded
+  * // consumer thread
+  * ring.consume([](const int& i) { std::cout << i << std::endl; });
+  * ```
+  * @tparam T type of the stored elements. It should be cheap to copy.
+  * @tparam N capacity of the ring. It must be a power of two.
+  * @warning Only one thread is allowed to call push() and only one (possibly
+  *   different) thread is allowed to call pop() or consume().
+  */
+template<class T, std::size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N-1)) == 0, "SpscRing: the capacity must be a power of two");
+public:
+  /// Number of elements that the ring can store.
+  static constexpr std::size_t capacity() { return N; }
+
+  /// Insert a new element (producer side).
+  /** @param value the element to be stored.
+    * @return false if the ring is full, in which case value is discarded.
+    */
+  bool push(const T& value) noexcept {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if(head - tail_.load(std::memory_order_acquire) >= N)
+      return false;
+    buffer_[head & MASK] = value;
+    head_.store(head+1, std::memory_order_release);
+    return true;
+  }
+
+  /// Extract the oldest element (consumer side).
+  /** @param value variable where the extracted element is written.
+    * @return false if the ring is empty, in which case value is not modified.
+    */
+  bool pop(T& value) noexcept {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail == head_.load(std::memory_order_acquire))
+      return false;
+    value = buffer_[tail & MASK];
+    tail_.store(tail+1, std::memory_order_release);
+    return true;
+  }
+
+  /// Extract all elements currently stored (consumer side).
+  /** Elements pushed while this method is running might or might not be
+    * processed: they are guaranteed to be available at the next call.
+    * @param f callable with signature `void(const T&)`, invoked once for each
+    *   element, from the oldest to the newest.
+    * @return the number of processed elements.
+    */
+  template<class F>
+  std::size_t consume(F&& f) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    const std::size_t head = head_.load(std::memory_order_acquire);
+    for(std::size_t i=tail; i!=head; i++)
+      f(buffer_[i & MASK]);
+    tail_.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  /// Number of elements currently stored.
+  /** @note The value is only a snapshot, since the other thread might be
+    *   modifying the ring at the same time.
+    */
+  std::size_t size() const noexcept {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  /// Tells if the ring is currently empty.
+  bool empty() const noexcept { return size() == 0; }
+
+private:
+  static constexpr std::size_t MASK = N-1; ///< Mask used to wrap indices.
+  alignas(64) std::atomic<std::size_t> head_{0}; ///< Index of the next slot to be written (owned by the producer).
+  alignas(64) std::atomic<std::size_t> tail_{0}; ///< Index of the next slot to be read (owned by the consumer).
+  std::array<T,N> buffer_{}; ///< Storage for the elements.
+};
+
+}
@@ -0,0 +1,78 @@
+/** @file state_filter.hpp
+  * @brief Header file for the StateFilter class.
+  */
+#pragma once
+
+#include <memory>
+
+namespace pendule_pi {
+
+/// Low-pass filters applied to the state of the pendulum.
+/** Each coordinate of the state (position, angle and their velocities) goes
+  * through its own Butterworth filter. This is the chain used by the
+  * low-level interface before publishing the state, and by Replay to evaluate
+  * other settings offline.
+  *
+  * ```c++
+  * pendule_pi::StateFilter filter(params, 0.02);
+  * filter.reset(pendule.position(), pendule.angle());
+  * // at each period:
+  * filter.filter(pendule.position(), pendule.angle(), pendule.linearVelocity(), pendule.angularVelocity());
+  * ```
+  */
+class StateFilter {
+public:
+  /// Settings of the filters.
+  struct Parameters {
+    unsigned int order; ///< Order of the Butterworth filters.
+    double cutoff_frequency; ///< Cutoff frequency of the filters [Hz]. It should be less than half the sampling frequency.
+    bool filter_velocities; ///< If `false`, velocities are passed through unchanged.
+    /// Initialize the parameters to a default.
+    Parameters();
+  };
+
+  /// Create the filters.
+  /** @param params settings of the filters.
+    * @param period sampling period, in seconds.
+    */
+  StateFilter(
+    const Parameters& params,
+    double period
+  );
+
+  /// Release the filters.
+  ~StateFilter();
+
+  // Prevent the user from making copies of a StateFilter.
+  StateFilter(const StateFilter&) = delete;
+  StateFilter& operator=(const StateFilter&) = delete;
+
+  /// Initialize the filters with a state at rest.
+  void reset(double position, double angle);
+
+  /// Filter a new measurement of the state.
+  void filter(double position, double angle, double linvel, double angvel);
+
+  /// Settings of the filters.
+  inline const Parameters& parameters() const { return params_; }
+
+  /// Filtered position [m].
+  inline double position() const { return position_; }
+  /// Filtered angle [rad].
+  inline double angle() const { return angle_; }
+  /// Filtered linear velocity [m/s].
+  inline double linearVelocity() const { return linvel_; }
+  /// Filtered angular velocity [rad/s].
+  inline double angularVelocity() const { return angvel_; }
+
+private:
+  struct Filters;
+  const Parameters params_; ///< See parameters().
+  std::unique_ptr<Filters> filters_; ///< One filter per coordinate.
+  double position_; ///< See position().
+  double angle_; ///< See angle().
+  double linvel_; ///< See linearVelocity().
+  double angvel_; ///< See angularVelocity().
+};
+
+}
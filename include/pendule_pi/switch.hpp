@@ -61,6 +61,31 @@ public:
     */
   void disableInterrupts();
 
+  /// Pin the switch is connected to.
+  inline int pin() const { return pin_; }
+
+  /// Time of the last level change that was served, in microseconds.
+  /** Inside the callback passed to enableInterrupts(), this is the tick of
+    * the edge that triggered it.
+    */
+  inline unsigned int lastTick() const { return last_tick_; }
+
+  /// Choose whether enableInterrupts() should rely on GPIO alerts.
+  /** By default, enableInterrupts() registers a GPIO alert on the pin. If
+    * alerts are disabled, the level of the pin must be provided by other
+    * means, *e.g.*, by a SampleDecoder calling processLevel().
+    * @param enable if true, GPIO alerts are used.
+    */
+  void useAlerts(bool enable);
+
+  /// Update the switch given the current level of its pin.
+  /** This is what the GPIO alert does internally. It has no effect if
+    * interrupts are disabled (see enableInterrupts()).
+    * @param level current level of the pin.
+    * @param tick time at which the level was sampled, in microseconds.
+    */
+  void processLevel(int level, unsigned int tick);
+
   /// Get the current state of the switch.
   /** This method performs a "direct" GPIO read, *i.e.*, it does not use the
     * "cached" state (obtained using interrupts).
@@ -93,6 +118,7 @@ private:
   bool at_rest_now_; ///< Tells if the switch is now at rest.
   bool has_triggered_; ///< Tells if the switch has been activated.
   bool with_interrupts_; ///< If true, interrupts are being used.
+  bool use_alerts_; ///< If true, enableInterrupts() registers a GPIO alert.
   std::function<void(void)> callback_; ///< A custom callback that can be executed when the switch is activated.
 
   /// Internal callback to be executed everytime the switch changes state.
@@ -0,0 +1,149 @@
+/** @file threshold_engine.hpp
+  * @brief Header file for the ThresholdEngine class.
+  */
+#pragma once
+
+#include <pendule_pi/spsc_ring.hpp>
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace pendule_pi {
+
+/// Splits the range of an encoder into zones and reports when it moves across them.
+/** The zones are contiguous intervals of step counts, defined by their lower
+  * bounds. As an example, the zones `{INT_MIN, 100, 200}` correspond to
+  * `(-inf,99]`, `[100,199]` and `[200,+inf)`, and they are numbered 0, 1 and
+  * 2. The owner of the engine (usually an Encoder) calls update() after each
+  * edge. Since only the bounds of the current zone are checked, the cost of
+  * an update does not depend on the number of zones: it boils down to an
+  * atomic load and two comparisons, even when no zone is defined.
+  *
+  * When the current zone changes, an Event is pushed into a lock-free buffer
+  * (see drainEvents()) and the callback associated to the new zone, if any,
+  * is executed.
+  *
+  * ```c++
+  * encoder.thresholds().setZones({
+  *   {INT_MIN, [](const auto&){ std::cout << "too low!" << std::endl; }},
+  *   {-1000, nullptr},
+  *   {1000, [](const auto&){ std::cout << "too high!" << std::endl; }},
+  * });
+  * ```
+  *
+  * Zones can be changed at any time from any thread. Each configuration is
+  * published atomically, and it is adopted by update() at the following
+  * edge. At that moment, the zone containing the step count is entered: an
+  * event with `from == to` is posted and the callback of the zone is
+  * executed. This ensures that a limit that is already exceeded when the
+  * zones are defined is not silently ignored.
+  */
+class ThresholdEngine {
+public:
+  /// Information about a change of zone.
+  struct Event {
+    unsigned int tick; ///< Time of the edge that caused the change, in microseconds.
+    int steps; ///< Step counter right after the edge.
+    unsigned int from; ///< Index of the zone that was left (equal to `to` when a new configuration is adopted).
+    unsigned int to; ///< Index of the zone that was entered.
+  };
+
+  /// Function executed when entering a zone.
+  using Callback = std::function<void(const Event&)>;
+
+  /// Definition of a single zone.
+  struct Zone {
+    int lower; ///< First step count that belongs to the zone (ignored for the first zone, which is unbounded).
+    Callback on_enter; ///< Optional callback, executed by the thread calling update() when entering the zone.
+  };
+
+  /// Maximum number of events that can be buffered between two calls to drainEvents().
+  static constexpr std::size_t EVENT_BUFFER_SIZE = 64;
+
+  /// Create an engine with no zone.
+  ThresholdEngine();
+
+  // Prevent the user from making copies of a ThresholdEngine.
+  ThresholdEngine(const ThresholdEngine&) = delete;
+  ThresholdEngine& operator=(const ThresholdEngine&) = delete;
+
+  /// Define the zones.
+  /** @param zones list of zones, sorted by increasing lower bound (the lower
+    *   bound of the first zone is ignored). It must not be empty.
+    * @throw std::runtime_error if the zones are not sorted or if the list is
+    *   empty.
+    * @note Previous configurations are kept in memory until the engine is
+    *   destroyed, since update() might still be using them. Zones are meant
+    *   to be changed a handful of times (*e.g.*, during a calibration), not
+    *   at every control cycle.
+    */
+  void setZones(std::vector<Zone> zones);
+
+  /// Remove all zones.
+  void clear();
+
+  /// Index of the current zone.
+  /** @note After setZones(), this value is updated at the following edge. */
+  inline unsigned int zone() const { return zone_.load(std::memory_order_relaxed); }
+
+  /// Tell if the given step count belongs to the current zone.
+  /** This is the fast path of update(), and it is meant to be used by the
+    * thread that calls update() only.
+    */
+  inline bool inCurrentZone(int steps) const { return steps >= lower_ && steps < upper_; }
+
+  /// Update the engine after an edge.
+  /** @param steps current step count.
+    * @param tick time of the edge, in microseconds.
+    * @warning Only one thread is allowed to call this method.
+    */
+  inline void update(int steps, unsigned int tick) {
+    const Config* config = config_.load(std::memory_order_acquire);
+    if(config == active_ && inCurrentZone(steps))
+      return;
+    changeZone(config, steps, tick);
+  }
+
+  /// Process all events generated since the last call.
+  /** @param f callable with signature `void(const Event&)`.
+    * @return the number of processed events.
+    * @warning Only one thread is allowed to consume events.
+    */
+  template<class F>
+  inline std::size_t drainEvents(F&& f) { return events_.consume(std::forward<F>(f)); }
+
+  /// Number of events that were discarded because the buffer was full.
+  inline unsigned int droppedEvents() const { return dropped_events_.load(std::memory_order_relaxed); }
+
+private:
+  /// Immutable set of zones.
+  struct Config {
+    std::vector<int> lower; ///< Lower bound of each zone (the first one being INT_MIN).
+    std::vector<Callback> on_enter; ///< Callback of each zone.
+  };
+
+  std::mutex mutex_; ///< Serializes calls to setZones() and clear().
+  std::vector<std::unique_ptr<const Config>> configs_; ///< All configurations ever published.
+  std::atomic<const Config*> config_; ///< Latest published configuration (nullptr if there is no zone).
+  const Config* active_; ///< Configuration used by update().
+  int lower_; ///< Lower bound of the current zone (inclusive).
+  int upper_; ///< Upper bound of the current zone (exclusive).
+  std::atomic<unsigned int> zone_; ///< Index of the current zone.
+  SpscRing<Event,EVENT_BUFFER_SIZE> events_; ///< Events waiting to be processed by drainEvents().
+  std::atomic<unsigned int> dropped_events_; ///< Number of events that did not fit inside events_.
+
+  /// Slow path of update(), executed when leaving the current zone or when the configuration changed.
+  void changeZone(const Config* config, int steps, unsigned int tick);
+
+  /// Set lower_ and upper_ according to the given zone of active_.
+  void setBounds(unsigned int zone);
+
+  /// Post the event and execute the callback of the zone it enters.
+  void enter(const Event& event);
+};
+
+}
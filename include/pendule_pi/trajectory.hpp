@@ -0,0 +1,129 @@
+/** @file trajectory.hpp
+  * @brief Header file for the Trajectory class.
+  */
+#pragma once
+
+#include <pendule_pi/wire_format.hpp>
+#include <atomic>
+#include <cstdint>
+
+namespace pendule_pi {
+
+/// Time-stamped setpoints streamed by a client, and interpolated by the low-level interface.
+/** A client running at a low rate, or over a jittery link, can send short
+  * segments of setpoints (see wire::Trajectory) instead of one PWM per
+  * state. The interface evaluates the segment at each period, against its
+  * own clock, so that the actuation remains smooth whatever the timing of
+  * the messages:
+  *   - between two points, the setpoints are interpolated by a monotone
+  *     cubic Hermite spline, which never overshoots the points (a single
+  *     point gives a constant, two points a straight line);
+  *   - before the first point and after the last one, the nearest setpoint
+  *     is held;
+  *   - when a new segment is loaded, the output fades from the previous
+  *     segment to the new one during a blending time, so that late or
+  *     inconsistent segments do not cause steps.
+  *
+  * ```c++
+  * pendule_pi::Trajectory trajectory(50000); // 50ms blending
+  * trajectory.load(received_trajectory, pigpio::Clock::ticks());
+  * // at each period:
+  * pwm = std::lround(trajectory.evaluate(pigpio::Clock::ticks()));
+  * ```
+  *
+  * All methods but statistics() must be called by the same thread.
+  */
+class Trajectory {
+public:
+  /// Statistics collected since the last reset.
+  struct Statistics {
+    std::uint64_t uploads; ///< Number of segments loaded.
+    std::uint64_t rejected; ///< Number of segments that could not be used (see reject()).
+    std::uint64_t late; ///< Number of segments whose last point was already in the past when they were loaded.
+    std::uint64_t evaluations; ///< Number of calls to evaluate().
+    std::uint64_t held; ///< Number of evaluations after the last point, *i.e.*, while waiting for the next segment.
+  };
+
+  /// Create an object with no segment loaded.
+  /** @param blend_us time during which the output fades from a segment to
+    *   the next one, in microseconds. Use 0 to switch immediately.
+    */
+  explicit Trajectory(
+    std::uint64_t blend_us
+  );
+
+  // Prevent the user from making copies of a Trajectory.
+  Trajectory(const Trajectory&) = delete;
+  Trajectory& operator=(const Trajectory&) = delete;
+
+  /// Tells if a segment received from a client can be loaded.
+  /** @return `false` if its kind is unknown, if it has no point or too many
+    *   points, if its times are not strictly increasing, or if a value is
+    *   not finite.
+    */
+  static bool isValid(const wire::Trajectory& trajectory);
+
+  /// Load a segment, which takes over from the current one.
+  /** If a segment of the same kind is loaded, the output fades from it to
+    * the new one. If the output was still fading into that segment, the new
+    * fade starts from the output itself, so that it remains continuous.
+    * @param trajectory the segment, which should pass isValid().
+    * @param now_us current time, in microseconds (see pigpio::Clock).
+    */
+  void load(const wire::Trajectory& trajectory, std::uint64_t now_us);
+
+  /// Count a segment that was received, but could not be used.
+  inline void reject() { increment(rejected_); }
+
+  /// Forget the segment, *e.g.*, when a PWM command is received.
+  inline void unload() { loaded_ = false; }
+
+  /// Tells if a segment is loaded.
+  inline bool loaded() const { return loaded_; }
+
+  /// Kind of the segment loaded.
+  inline wire::Trajectory::Kind kind() const { return current_.kind; }
+
+  /// Blending time, in microseconds.
+  inline std::uint64_t blendTime() const { return blend_us_; }
+
+  /// Evaluate the setpoint.
+  /** @param now_us current time, in microseconds (see pigpio::Clock).
+    * @param[out] derivative if not null, derivative of the setpoint, per
+    *   second.
+    * @return the setpoint. It must not be called if no segment is loaded.
+    */
+  double evaluate(std::uint64_t now_us, double* derivative = nullptr);
+
+  /// Read the statistics collected since the last reset.
+  Statistics statistics() const;
+
+  /// Forget the statistics.
+  void resetStatistics();
+
+private:
+  const std::uint64_t blend_us_; ///< See blendTime().
+  wire::Trajectory current_; ///< Segment in effect.
+  wire::Trajectory previous_; ///< Segment the output fades from (see load()).
+  bool loaded_; ///< See loaded().
+  bool blending_; ///< Tells if the output is fading from previous_ to current_.
+  std::uint64_t blend_start_us_; ///< Time at which current_ was loaded.
+  std::atomic<std::uint64_t> uploads_; ///< See Statistics::uploads.
+  std::atomic<std::uint64_t> rejected_; ///< See Statistics::rejected.
+  std::atomic<std::uint64_t> late_; ///< See Statistics::late.
+  std::atomic<std::uint64_t> evaluations_; ///< See Statistics::evaluations.
+  std::atomic<std::uint64_t> held_; ///< See Statistics::held.
+
+  /// Evaluate the output, including the fade, without updating any state.
+  double output(std::uint64_t now_us, double& derivative) const;
+
+  /// Evaluate the spline through the points of a segment.
+  static double interpolate(const wire::Trajectory& trajectory, std::uint64_t now_us, double& derivative);
+
+  /// Increment a counter that has a single writer.
+  static inline void increment(std::atomic<std::uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+}
@@ -0,0 +1,79 @@
+/** @file velocity_estimator.hpp
+  * @brief Header file for the VelocityEstimator class.
+  */
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+namespace pendule_pi {
+
+/// Estimates the velocity of an encoder from the timing of its edges.
+/** Differentiating the step count over a fixed period gives very quantized
+  * velocities at low speed: with a 20ms period, a single step corresponds to
+  * a velocity of 50 steps/s. This class uses instead the timestamps of the
+  * most recent edges, switching automatically between two classic methods:
+  * - at high speed (at least Parameters::min_edges edges within the last
+  *   Parameters::window_us microseconds) it uses the *M/T method*: the number
+  *   of steps registered within the window is divided by the exact time
+  *   elapsed between the first and the last edge of the window;
+  * - at low speed it uses the *1/T method*: the velocity is obtained from the
+  *   time elapsed between the last two edges.
+  *
+  * In both cases, if the time elapsed since the last edge exceeds the
+  * average edge period, the latter is replaced by the former: the velocity
+  * thus decays smoothly towards zero when the encoder stops, instead of being
+  * held at its last value. After Parameters::timeout_us microseconds without
+  * edges, the velocity is exactly zero.
+  *
+  * Edges are fed with addEdge(), while estimate() computes the velocity at a
+  * given time. Both methods are meant to be called from the same thread.
+  */
+class VelocityEstimator {
+public:
+  /// Parameters of the estimator.
+  struct Parameters {
+    unsigned int window_us; ///< Width of the window used by the M/T method.
+    unsigned int min_edges; ///< Minimum number of edges in the window to use the M/T method.
+    unsigned int timeout_us; ///< Time without edges after which the velocity is considered null.
+    /// Initialize the parameters to a default.
+    Parameters();
+  };
+
+  /// Number of edges stored to compute the estimate.
+  static constexpr std::size_t HISTORY_SIZE = 64;
+
+  /// Constructor, using the given parameters.
+  explicit VelocityEstimator(const Parameters& params = Parameters());
+
+  /// Change the parameters of the estimator.
+  void setParameters(const Parameters& params);
+
+  /// Access the current parameters of the estimator.
+  inline const Parameters& parameters() const { return params_; }
+
+  /// Register a new edge.
+  /** @param tick time of the edge, in microseconds.
+    * @param steps step counter after the edge.
+    */
+  void addEdge(unsigned int tick, int steps);
+
+  /// Forget all registered edges.
+  void reset();
+
+  /// Compute the velocity at the given time.
+  /** @param now current time, in microseconds. If it is older than the last
+    *   edge passed to addEdge(), the time of that edge is used instead.
+    * @return the estimated velocity, in steps per second.
+    */
+  double estimate(unsigned int now) const;
+
+private:
+  Parameters params_; ///< Parameters of the estimator.
+  std::array<unsigned int,HISTORY_SIZE> ticks_; ///< Timestamps of the last edges (circular buffer).
+  std::array<int,HISTORY_SIZE> steps_; ///< Step counters of the last edges (circular buffer).
+  std::size_t count_; ///< Number of valid entries in ticks_ and steps_.
+  std::size_t newest_; ///< Index of the newest entry in ticks_ and steps_.
+};
+
+}
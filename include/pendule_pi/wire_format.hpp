@@ -0,0 +1,440 @@
+/** @file wire_format.hpp
+  * @brief Binary messages exchanged between the low-level interface and its clients.
+  */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace pendule_pi {
+
+/// Binary, fixed-layout wire format of the state and command messages.
+/** Each message is a packed, little-endian record starting with a common
+  * header:
+  *
+  * | offset | type     | field                                            |
+  * |--------|----------|--------------------------------------------------|
+  * | 0      | uint16   | magic number, `0x5050` (the characters `"PP"`)   |
+  * | 2      | uint8    | version of the format, wire::VERSION             |
+  * | 3      | uint8    | message type, see wire::MessageType              |
+  * | 4      | uint32   | sequence number, incremented by the sender       |
+  * | 8      | uint64   | timestamp of the sender, in microseconds         |
+  *
+  * A state message (wire::STATE_SIZE bytes) continues with the position,
+  * angle, linear velocity and angular velocity, as four IEEE-754 doubles.
+  * Its timestamp is the hardware time of the interface (see pigpio::Clock).
+  *
+  * A command message (wire::COMMAND_SIZE bytes) continues with the PWM as an
+  * int32, followed by the sequence number of the state from which the
+  * command was computed, as an uint32. The interface uses it to measure the
+  * state-to-command latency, and to reject commands computed from old states.
+  *
+  * A feedback law message (wire::FEEDBACK_LAW_SIZE bytes) replaces the PWM by
+  * a state-feedback law evaluated by the interface at each period, until the
+  * next command (see pendule_pi::FeedbackLaw). It continues with the gains,
+  * the setpoint and the limits of the validity region, each as four doubles
+  * (position, angle, linear velocity, angular velocity), followed by the PWM
+  * applied outside the region (int32), the sequence number of the state the
+  * law answers (uint32), its lifetime in microseconds (uint32) and flags
+  * (uint32, see wire::FeedbackLaw::WRAP_ANGLE).
+  *
+  * A trajectory message (wire::TRAJECTORY_SIZE bytes) carries a short
+  * sequence of time-stamped setpoints, interpolated by the interface at each
+  * period (see pendule_pi::Trajectory). It continues with the sequence number
+  * of the state it answers (uint32), the kind of setpoints (uint8, see
+  * wire::Trajectory::Kind), the number of points (uint8) and two unused
+  * bytes, followed by wire::Trajectory::MAX_POINTS points made of a time
+  * (uint64, in microseconds, on the clock of the interface: see the
+  * timestamps of the states) and a value (double). Unused points are zero.
+  *
+  * A burst message carries the raw encoder readings sampled at a high rate
+  * during the last period (see pendule_pi::BurstSampler), for identification
+  * clients. Its size depends on the number of samples: it continues with the
+  * number of samples (uint32), the sampling period in microseconds (uint32),
+  * the number of samples lost so far by the interface (uint32) and four
+  * unused bytes, then with the conversion coefficients of the steps (four
+  * doubles: position scale and offset, angle scale and offset, such that
+  * `position = scale * steps + offset`), followed by the samples (see
+  * wire::Burst::Sample): a time (uint64, on the clock of the interface), the
+  * steps of the position and angle encoders (int32) and the PWM applied at
+  * that time (int32).
+  *
+  * Encoding and decoding never allocate, and do not depend on the byte order
+  * or on the struct layout of the host. Text messages (space-separated
+  * values) start with a digit or a sign, so they are never mistaken for
+  * binary ones: see wire::isBinary().
+  *
+  * The layout is mirrored by `src/python/pendule_pi.py`: both must be
+  * updated together, and VERSION incremented, when it changes. New message
+  * types can be added without changing VERSION: older peers reject them as
+  * malformed.
+  */
+namespace wire {
+
+static constexpr std::uint16_t MAGIC = 0x5050; ///< First two bytes of every binary message.
+static constexpr std::uint8_t VERSION = 2; ///< Version of the format.
+static constexpr std::size_t HEADER_SIZE = 16; ///< Size of Header on the wire, in bytes.
+static constexpr std::size_t STATE_SIZE = HEADER_SIZE + 4*8; ///< Size of a state message, in bytes.
+static constexpr std::size_t COMMAND_SIZE = HEADER_SIZE + 8; ///< Size of a command message, in bytes.
+static constexpr std::size_t FEEDBACK_LAW_SIZE = HEADER_SIZE + 12*8 + 16; ///< Size of a feedback law message, in bytes.
+static constexpr std::size_t TRAJECTORY_POINTS = 8; ///< Largest number of points of a trajectory message.
+static constexpr std::size_t TRAJECTORY_SIZE = HEADER_SIZE + 8 + TRAJECTORY_POINTS*16; ///< Size of a trajectory message, in bytes.
+static constexpr std::size_t BURST_HEADER_SIZE = HEADER_SIZE + 16 + 4*8; ///< Size of a burst message without samples, in bytes.
+static constexpr std::size_t BURST_SAMPLE_SIZE = 20; ///< Size of a sample of a burst message, in bytes.
+static constexpr std::size_t BURST_SAMPLES = 256; ///< Largest number of samples of a burst message.
+static constexpr std::size_t BURST_MAX_SIZE = BURST_HEADER_SIZE + BURST_SAMPLES*BURST_SAMPLE_SIZE; ///< Largest size of a burst message, in bytes.
+
+/// Type of a message, stored in its header.
+enum class MessageType : std::uint8_t {
+  State = 1, ///< State of the pendulum, sent by the interface.
+  Command = 2, ///< PWM command, sent by a client.
+  FeedbackLaw = 3, ///< State-feedback law, sent by a client.
+  Trajectory = 4, ///< Time-stamped setpoints, sent by a client.
+  Burst = 5 ///< Encoder readings sampled at a high rate, sent by the interface.
+};
+
+/// Common header of all messages.
+struct Header {
+  MessageType type; ///< Type of the message.
+  std::uint32_t sequence; ///< Sequence number, incremented by the sender.
+  std::uint64_t timestamp_us; ///< Time at which the message was created, in microseconds.
+};
+
+/// State of the pendulum.
+struct State {
+  Header header; ///< Header, with type MessageType::State.
+  double position; ///< Position of the cart [m].
+  double angle; ///< Angle of the pendulum [rad].
+  double linvel; ///< Linear velocity of the cart [m/s].
+  double angvel; ///< Angular velocity of the pendulum [rad/s].
+};
+
+/// Command sent to the motor.
+struct Command {
+  Header header; ///< Header, with type MessageType::Command.
+  std::int32_t pwm; ///< PWM signal, between -255 and 255.
+  std::uint32_t state_sequence; ///< Sequence number of the state the command answers.
+};
+
+/// State-feedback law to be evaluated by the interface.
+/** Arrays are indexed as the state: position, angle, linear velocity and
+  * angular velocity.
+  */
+struct FeedbackLaw {
+  /// Flag: the angle error is wrapped in \f$[-\pi,\pi]\f$ before being used.
+  static constexpr std::uint32_t WRAP_ANGLE = 1;
+
+  Header header; ///< Header, with type MessageType::FeedbackLaw.
+  std::array<double,4> gains; ///< Gains \f$K\f$ of the law \f$u = -K(x - x_{ref})\f$.
+  std::array<double,4> setpoint; ///< Setpoint \f$x_{ref}\f$.
+  std::array<double,4> limits; ///< Largest absolute error of each coordinate for which the law is used, 0 for no limit.
+  std::int32_t pwm; ///< PWM signal applied outside the validity region.
+  std::uint32_t state_sequence; ///< Sequence number of the state the law answers.
+  std::uint32_t lifetime_us; ///< Time during which the law remains in effect after its reception, 0 to expire as a PWM command.
+  std::uint32_t flags; ///< Combination of flags, such as WRAP_ANGLE.
+};
+
+/// Time-stamped setpoints to be interpolated by the interface.
+struct Trajectory {
+  static constexpr std::size_t MAX_POINTS = TRAJECTORY_POINTS; ///< Largest number of points.
+
+  /// What the setpoints are.
+  enum class Kind : std::uint8_t {
+    Pwm = 1, ///< PWM signal.
+    Position = 2 ///< Position setpoint of the feedback law in effect [m].
+  };
+
+  /// A setpoint.
+  struct Point {
+    std::uint64_t time_us; ///< Time at which the setpoint is reached, on the clock of the interface [us].
+    double value; ///< Setpoint.
+  };
+
+  Header header; ///< Header, with type MessageType::Trajectory.
+  std::uint32_t state_sequence; ///< Sequence number of the state the trajectory answers.
+  Kind kind; ///< What the setpoints are.
+  std::uint8_t count; ///< Number of points in use.
+  std::array<Point,MAX_POINTS> points; ///< Points, by increasing time.
+};
+
+/// Encoder readings sampled at a high rate.
+struct Burst {
+  static constexpr std::size_t MAX_SAMPLES = BURST_SAMPLES; ///< Largest number of samples.
+
+  /// Reading of the encoders at a given time.
+  struct Sample {
+    std::uint64_t time_us; ///< Time of the reading, on the clock of the interface [us].
+    std::int32_t position_steps; ///< Step counter of the position encoder.
+    std::int32_t angle_steps; ///< Step counter of the angle encoder.
+    std::int32_t pwm; ///< PWM applied at that time.
+  };
+
+  Header header; ///< Header, with type MessageType::Burst.
+  std::uint32_t count; ///< Number of samples in use.
+  std::uint32_t period_us; ///< Time between two samples [us].
+  std::uint32_t lost; ///< Number of samples that could not be sent since the interface started.
+  double position_scale; ///< Meters per step of the position encoder.
+  double position_offset; ///< Position when the step counter is 0 [m].
+  double angle_scale; ///< Radians per step of the angle encoder.
+  double angle_offset; ///< Angle when the step counter is 0 [rad].
+  std::array<Sample,MAX_SAMPLES> samples; ///< Samples, by increasing time.
+};
+
+/// Size of an encoded burst message with the given number of samples, in bytes.
+inline constexpr std::size_t burstSize(std::size_t count) { return BURST_HEADER_SIZE + count*BURST_SAMPLE_SIZE; }
+
+using StateBuffer = std::array<std::uint8_t,STATE_SIZE>; ///< Encoded state message.
+using CommandBuffer = std::array<std::uint8_t,COMMAND_SIZE>; ///< Encoded command message.
+using FeedbackLawBuffer = std::array<std::uint8_t,FEEDBACK_LAW_SIZE>; ///< Encoded feedback law message.
+using TrajectoryBuffer = std::array<std::uint8_t,TRAJECTORY_SIZE>; ///< Encoded trajectory message.
+using BurstBuffer = std::array<std::uint8_t,BURST_MAX_SIZE>; ///< Encoded burst message (only the first burstSize() bytes are used).
+
+/// Write an unsigned integer in little-endian order.
+template <typename T>
+inline void storeLE(std::uint8_t* p, T value) {
+  for(std::size_t i = 0; i < sizeof(T); i++)
+    p[i] = static_cast<std::uint8_t>(value >> (8*i));
+}
+
+/// Read an unsigned integer stored in little-endian order.
+template <typename T>
+inline T loadLE(const std::uint8_t* p) {
+  T value = 0;
+  for(std::size_t i = 0; i < sizeof(T); i++)
+    value |= static_cast<T>(p[i]) << (8*i);
+  return value;
+}
+
+/// Write a double in little-endian order.
+inline void storeDouble(std::uint8_t* p, double value) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  storeLE<std::uint64_t>(p, bits);
+}
+
+/// Read a double stored in little-endian order.
+inline double loadDouble(const std::uint8_t* p) {
+  const auto bits = loadLE<std::uint64_t>(p);
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/// Write a header at the beginning of a message.
+inline void encodeHeader(std::uint8_t* p, const Header& header) {
+  storeLE<std::uint16_t>(p, MAGIC);
+  p[2] = VERSION;
+  p[3] = static_cast<std::uint8_t>(header.type);
+  storeLE<std::uint32_t>(p + 4, header.sequence);
+  storeLE<std::uint64_t>(p + 8, header.timestamp_us);
+}
+
+/// Read the header at the beginning of a message.
+/** @param data beginning of the message.
+  * @param size size of the message, in bytes.
+  * @param[out] header decoded header.
+  * @return `false` if the message is too short, or if its magic number or
+  *   version do not match.
+  */
+inline bool decodeHeader(const void* data, std::size_t size, Header& header) {
+  const auto p = static_cast<const std::uint8_t*>(data);
+  if(size < HEADER_SIZE || loadLE<std::uint16_t>(p) != MAGIC || p[2] != VERSION)
+    return false;
+  header.type = static_cast<MessageType>(p[3]);
+  header.sequence = loadLE<std::uint32_t>(p + 4);
+  header.timestamp_us = loadLE<std::uint64_t>(p + 8);
+  return true;
+}
+
+/// Tells if a message uses the binary format (as opposed to the text one).
+/** Only the magic number is checked: the message may still be malformed. */
+inline bool isBinary(const void* data, std::size_t size) {
+  return size >= 2 && loadLE<std::uint16_t>(static_cast<const std::uint8_t*>(data)) == MAGIC;
+}
+
+/// Encode a state message.
+inline void encode(const State& state, StateBuffer& buffer) {
+  Header header = state.header;
+  header.type = MessageType::State;
+  encodeHeader(buffer.data(), header);
+  storeDouble(buffer.data() + HEADER_SIZE, state.position);
+  storeDouble(buffer.data() + HEADER_SIZE + 8, state.angle);
+  storeDouble(buffer.data() + HEADER_SIZE + 16, state.linvel);
+  storeDouble(buffer.data() + HEADER_SIZE + 24, state.angvel);
+}
+
+/// Encode a command message.
+inline void encode(const Command& command, CommandBuffer& buffer) {
+  Header header = command.header;
+  header.type = MessageType::Command;
+  encodeHeader(buffer.data(), header);
+  storeLE<std::uint32_t>(buffer.data() + HEADER_SIZE, static_cast<std::uint32_t>(command.pwm));
+  storeLE<std::uint32_t>(buffer.data() + HEADER_SIZE + 4, command.state_sequence);
+}
+
+/// Encode a feedback law message.
+inline void encode(const FeedbackLaw& law, FeedbackLawBuffer& buffer) {
+  Header header = law.header;
+  header.type = MessageType::FeedbackLaw;
+  encodeHeader(buffer.data(), header);
+  std::uint8_t* p = buffer.data() + HEADER_SIZE;
+  for(std::size_t i = 0; i < 4; i++) {
+    storeDouble(p + 8*i, law.gains[i]);
+    storeDouble(p + 32 + 8*i, law.setpoint[i]);
+    storeDouble(p + 64 + 8*i, law.limits[i]);
+  }
+  storeLE<std::uint32_t>(p + 96, static_cast<std::uint32_t>(law.pwm));
+  storeLE<std::uint32_t>(p + 100, law.state_sequence);
+  storeLE<std::uint32_t>(p + 104, law.lifetime_us);
+  storeLE<std::uint32_t>(p + 108, law.flags);
+}
+
+/// Encode a trajectory message.
+/** Points beyond `trajectory.count` are encoded as zeros. */
+inline void encode(const Trajectory& trajectory, TrajectoryBuffer& buffer) {
+  Header header = trajectory.header;
+  header.type = MessageType::Trajectory;
+  encodeHeader(buffer.data(), header);
+  std::uint8_t* p = buffer.data() + HEADER_SIZE;
+  storeLE<std::uint32_t>(p, trajectory.state_sequence);
+  p[4] = static_cast<std::uint8_t>(trajectory.kind);
+  p[5] = trajectory.count;
+  p[6] = 0;
+  p[7] = 0;
+  for(std::size_t i = 0; i < Trajectory::MAX_POINTS; i++) {
+    const bool used = i < trajectory.count;
+    storeLE<std::uint64_t>(p + 8 + 16*i, used ? trajectory.points[i].time_us : 0);
+    storeDouble(p + 16 + 16*i, used ? trajectory.points[i].value : 0.0);
+  }
+}
+
+/// Encode a burst message.
+/** @return the size of the message, see burstSize(). Samples beyond
+  *   Burst::MAX_SAMPLES are ignored.
+  */
+inline std::size_t encode(const Burst& burst, BurstBuffer& buffer) {
+  Header header = burst.header;
+  header.type = MessageType::Burst;
+  encodeHeader(buffer.data(), header);
+  const std::size_t count = burst.count < Burst::MAX_SAMPLES ? burst.count : Burst::MAX_SAMPLES;
+  std::uint8_t* p = buffer.data() + HEADER_SIZE;
+  storeLE<std::uint32_t>(p, static_cast<std::uint32_t>(count));
+  storeLE<std::uint32_t>(p + 4, burst.period_us);
+  storeLE<std::uint32_t>(p + 8, burst.lost);
+  storeLE<std::uint32_t>(p + 12, 0);
+  storeDouble(p + 16, burst.position_scale);
+  storeDouble(p + 24, burst.position_offset);
+  storeDouble(p + 32, burst.angle_scale);
+  storeDouble(p + 40, burst.angle_offset);
+  p = buffer.data() + BURST_HEADER_SIZE;
+  for(std::size_t i = 0; i < count; i++, p += BURST_SAMPLE_SIZE) {
+    storeLE<std::uint64_t>(p, burst.samples[i].time_us);
+    storeLE<std::uint32_t>(p + 8, static_cast<std::uint32_t>(burst.samples[i].position_steps));
+    storeLE<std::uint32_t>(p + 12, static_cast<std::uint32_t>(burst.samples[i].angle_steps));
+    storeLE<std::uint32_t>(p + 16, static_cast<std::uint32_t>(burst.samples[i].pwm));
+  }
+  return burstSize(count);
+}
+
+/// Decode a state message.
+/** @return `false` if the message is not a valid state message of the
+  *   current version, in which case `state` is left in an unspecified state.
+  */
+inline bool decode(const void* data, std::size_t size, State& state) {
+  if(size != STATE_SIZE || !decodeHeader(data, size, state.header) || state.header.type != MessageType::State)
+    return false;
+  const auto p = static_cast<const std::uint8_t*>(data) + HEADER_SIZE;
+  state.position = loadDouble(p);
+  state.angle = loadDouble(p + 8);
+  state.linvel = loadDouble(p + 16);
+  state.angvel = loadDouble(p + 24);
+  return true;
+}
+
+/// Decode a command message.
+/** @return `false` if the message is not a valid command message of the
+  *   current version, in which case `command` is left in an unspecified state.
+  */
+inline bool decode(const void* data, std::size_t size, Command& command) {
+  if(size != COMMAND_SIZE || !decodeHeader(data, size, command.header) || command.header.type != MessageType::Command)
+    return false;
+  const auto p = static_cast<const std::uint8_t*>(data) + HEADER_SIZE;
+  command.pwm = static_cast<std::int32_t>(loadLE<std::uint32_t>(p));
+  command.state_sequence = loadLE<std::uint32_t>(p + 4);
+  return true;
+}
+
+/// Decode a feedback law message.
+/** @return `false` if the message is not a valid feedback law message of the
+  *   current version, in which case `law` is left in an unspecified state.
+  */
+inline bool decode(const void* data, std::size_t size, FeedbackLaw& law) {
+  if(size != FEEDBACK_LAW_SIZE || !decodeHeader(data, size, law.header) || law.header.type != MessageType::FeedbackLaw)
+    return false;
+  const auto p = static_cast<const std::uint8_t*>(data) + HEADER_SIZE;
+  for(std::size_t i = 0; i < 4; i++) {
+    law.gains[i] = loadDouble(p + 8*i);
+    law.setpoint[i] = loadDouble(p + 32 + 8*i);
+    law.limits[i] = loadDouble(p + 64 + 8*i);
+  }
+  law.pwm = static_cast<std::int32_t>(loadLE<std::uint32_t>(p + 96));
+  law.state_sequence = loadLE<std::uint32_t>(p + 100);
+  law.lifetime_us = loadLE<std::uint32_t>(p + 104);
+  law.flags = loadLE<std::uint32_t>(p + 108);
+  return true;
+}
+
+/// Decode a trajectory message.
+/** The content is not checked: see pendule_pi::Trajectory::isValid().
+  * @return `false` if the message is not a valid trajectory message of the
+  *   current version, in which case `trajectory` is left in an unspecified
+  *   state.
+  */
+inline bool decode(const void* data, std::size_t size, Trajectory& trajectory) {
+  if(size != TRAJECTORY_SIZE || !decodeHeader(data, size, trajectory.header) || trajectory.header.type != MessageType::Trajectory)
+    return false;
+  const auto p = static_cast<const std::uint8_t*>(data) + HEADER_SIZE;
+  trajectory.state_sequence = loadLE<std::uint32_t>(p);
+  trajectory.kind = static_cast<Trajectory::Kind>(p[4]);
+  trajectory.count = p[5];
+  for(std::size_t i = 0; i < Trajectory::MAX_POINTS; i++) {
+    trajectory.points[i].time_us = loadLE<std::uint64_t>(p + 8 + 16*i);
+    trajectory.points[i].value = loadDouble(p + 16 + 16*i);
+  }
+  return true;
+}
+
+/// Decode a burst message.
+/** @return `false` if the message is not a valid burst message of the
+  *   current version, or if its size does not match its number of samples,
+  *   in which case `burst` is left in an unspecified state.
+  */
+inline bool decode(const void* data, std::size_t size, Burst& burst) {
+  if(size < BURST_HEADER_SIZE || !decodeHeader(data, size, burst.header) || burst.header.type != MessageType::Burst)
+    return false;
+  const auto p = static_cast<const std::uint8_t*>(data) + HEADER_SIZE;
+  burst.count = loadLE<std::uint32_t>(p);
+  if(burst.count > Burst::MAX_SAMPLES || size != burstSize(burst.count))
+    return false;
+  burst.period_us = loadLE<std::uint32_t>(p + 4);
+  burst.lost = loadLE<std::uint32_t>(p + 8);
+  burst.position_scale = loadDouble(p + 16);
+  burst.position_offset = loadDouble(p + 24);
+  burst.angle_scale = loadDouble(p + 32);
+  burst.angle_offset = loadDouble(p + 40);
+  const auto q = static_cast<const std::uint8_t*>(data) + BURST_HEADER_SIZE;
+  for(std::size_t i = 0; i < burst.count; i++) {
+    const auto r = q + i*BURST_SAMPLE_SIZE;
+    burst.samples[i].time_us = loadLE<std::uint64_t>(r);
+    burst.samples[i].position_steps = static_cast<std::int32_t>(loadLE<std::uint32_t>(r + 8));
+    burst.samples[i].angle_steps = static_cast<std::int32_t>(loadLE<std::uint32_t>(r + 12));
+    burst.samples[i].pwm = static_cast<std::int32_t>(loadLE<std::uint32_t>(r + 16));
+  }
+  return true;
+}
+
+} // end of namespace wire
+
+} // end of namespace pendule_pi
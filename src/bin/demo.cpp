@@ -1,6 +1,8 @@
 #include <pendule_pi/pigpio.hpp>
 #include <pendule_pi/pendule.hpp>
 #include <pendule_pi/joystick.hpp>
+#include <pendule_pi/realtime_profile.hpp>
+#include <pendule_pi/scheduler.hpp>
 #include <digital_filters/filters.hpp>
 #include <iostream>
 #include <iomanip>
@@ -68,6 +70,13 @@ int main(int argc, char** argv) {
   try {
     // Let the token manage the pigpio library!
     pigpio::ActivationToken token;
+    // Reduce the jitter of the control loop as much as the privileges allow.
+    pp::RealtimeProfile::Parameters realtime_params;
+    realtime_params.priority = 70;
+    realtime_params.lock_memory = true;
+    realtime_params.prefault_stack_kb = 256;
+    std::cout << "Real-time profile:" << std::endl
+              << pp::RealtimeProfile(realtime_params).apply();
     // Create the joystick device to be used for controlling the demo.
     pp::Joystick joy;
     // Create the pendulum instance and perform the calibration.
@@ -78,16 +87,14 @@ int main(int argc, char** argv) {
     std::cout << "Calibration completed!" << std::endl;
     // Define soft limits for the pendulum.
     const double MAX_POSITION = pendule.softMinMaxPosition() - 0.1;
-    // Create the timer used for enforcing a stable control rate.
+    // Create the scheduler used for enforcing a stable control rate. The
+    // joystick is updated, and information is printed on the screen, at a
+    // lower rate (on different ticks).
     const int SLEEP_MS = 20;
     const double SLEEP_SEC = SLEEP_MS/1000.0;
-    pigpio::Rate rate(SLEEP_MS*1000);
-    // Create the timer used to print some information on the screen
+    pp::Scheduler scheduler(SLEEP_MS*1000);
     const int COUT_MS = 100;
-    pigpio::Timer cout_timer(COUT_MS*1000, true);
-    // Timer used to update the joystick at a slightly lower rate
     const int JOY_MS = 100;
-    pigpio::Timer joy_timer(JOY_MS*1000, true);
     // Used to allow the user to detect when buttons are released or pressed
     CachedButton btn_switch;
     // Variables used to perform control and filtering
@@ -134,32 +141,32 @@ int main(int argc, char** argv) {
     std::cout << std::setfill('0') << std::internal << std::showpos << std::fixed << std::setprecision(4);
     // sleep a little bit before starting with the main loop
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    // Main loop!
-    while(true) {
-      // Sleep and update the state of the pendulum
-      rate.sleep();
-      pendule.update(SLEEP_SEC);
+    // Tasks, by decreasing priority: state estimation, joystick, control
+    // and printing.
+    scheduler.addTask("estimation", [&]() {
+      // Update the state of the pendulum
+      if(!pendule.update(SLEEP_SEC))
+        throw pp::Pendule::EmergencyStop(pendule.stopReason());
       // perform state filtering
       filtered_position = filter_position.filter(pendule.position());
       filtered_angle = filter_angle.filter(pendule.angle());
       filtered_linvel = filter_linvel.filter(pendule.linearVelocity());
       filtered_angvel = filter_angvel.filter(pendule.angularVelocity());
-
-      // update the joystick when needed
-      if(joy_timer.expired()) {
-        joy.update();
-        // should we exit?
-        if(joy.button(BTN_EXIT)) {
-          std::cout << std::endl << "Qutting!" << std::endl;
-          throw pigpio::ActivationToken::PleaseStop();
-        }
-        // should we switch control mode?
-        btn_switch.update(joy.button(BTN_SWITCH));
-        if(btn_switch.pressed()) {
-          control_mode = next(control_mode);
-        }
+    }, 1, 0, 3);
+    scheduler.addTask("joystick", [&]() {
+      joy.update();
+      // should we exit?
+      if(joy.button(BTN_EXIT)) {
+        std::cout << std::endl << "Qutting!" << std::endl;
+        throw pigpio::ActivationToken::PleaseStop();
       }
-
+      // should we switch control mode?
+      btn_switch.update(joy.button(BTN_SWITCH));
+      if(btn_switch.pressed()) {
+        control_mode = next(control_mode);
+      }
+    }, JOY_MS/SLEEP_MS, 0, 2);
+    scheduler.addTask("control", [&]() {
       if(control_mode == ControlMode::Manual) {
         int ref = joy.axis(AXIS_PWM);
         ref = robustZero(ref, 2500);
@@ -212,19 +219,19 @@ int main(int argc, char** argv) {
       else if(pendule.position() < -MAX_POSITION && pwm < 0)
         pwm = 0;
       pendule.setCommand(pwm);
-
-      // print on screen once in a while
-      if(cout_timer.expired()) {
-        std::cout << "\r";
-        std::cout << to_string(control_mode);
-        std::cout << "  " << std::setw(12) << pendule.position();
-        std::cout << "  " << std::setw(12) << pendule.angle();
-        std::cout << "  " << std::setw(12) << pendule.linearVelocity();
-        std::cout << "  " << std::setw(12) << pendule.angularVelocity();
-        std::cout << "  " << std::setw(4) << pwm;
-        std::cout << "   " << std::flush;
-      }
-    }
+    }, 1, 0, 1);
+    scheduler.addTask("console", [&]() {
+      std::cout << "\r";
+      std::cout << to_string(control_mode);
+      std::cout << "  " << std::setw(12) << pendule.position();
+      std::cout << "  " << std::setw(12) << pendule.angle();
+      std::cout << "  " << std::setw(12) << pendule.linearVelocity();
+      std::cout << "  " << std::setw(12) << pendule.angularVelocity();
+      std::cout << "  " << std::setw(4) << pwm;
+      std::cout << "   " << std::flush;
+    }, COUT_MS/SLEEP_MS, COUT_MS/SLEEP_MS/2, 0);
+    // Main loop!
+    scheduler.run();
   }
   catch(const pigpio::ActivationToken::PleaseStop&) { }
   catch(...) { throw; }
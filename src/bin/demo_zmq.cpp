@@ -62,7 +62,8 @@ int main(int argc, char** argv) {
     while(true) {
       // Sleep and update the state of the pendulum
       double hw_time = 1e-6 * rate.sleep();
-      pendule.update(SLEEP_SEC);
+      if(!pendule.update(SLEEP_SEC))
+        throw pp::Pendule::EmergencyStop(pendule.stopReason());
       // perform state filtering
       filtered_position = filter_position.filter(pendule.position());
       filtered_angle = filter_angle.filter(pendule.angle());
@@ -0,0 +1,303 @@
+#include "pendule_pi/pigpio.hpp"
+#include "pendule_pi/simulated_backend.hpp"
+#include "pendule_pi/encoder.hpp"
+#include "pendule_pi/spsc_ring.hpp"
+#include <array>
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+
+/// Pins used to replay the edges (they only exist in the simulation).
+const int PIN_A = 20;
+const int PIN_B = 21;
+
+/// Number of times the whole edge stream is replayed.
+const unsigned int REPETITIONS = 20;
+
+/// Number of edges processed between two drains of the edge buffers.
+const std::size_t CHUNK_SIZE = 512;
+
+
+/// A single level change, as received by a GPIO alert.
+struct Alert {
+  int gpio;
+  int level;
+  unsigned int tick;
+};
+
+
+/// Copy of the per-edge decoder that Encoder used before the lookup table became constexpr.
+/** The step counter, the edge buffer and the safety thresholds are kept, so
+  * that the comparison only measures the differences in the decoding logic.
+  */
+class LegacyEncoder {
+public:
+  LegacyEncoder(int gpioA, int gpioB, bool a, bool b)
+  : pin_a_(gpioA)
+  , pin_b_(gpioB)
+  , a_current_(a)
+  , b_current_(b)
+  , a_past_(a)
+  , b_past_(b)
+  , steps_(0)
+  , direction_(0)
+  , dropped_edges_(0)
+  , lower_threshold_(std::numeric_limits<int>::min())
+  , upper_threshold_(std::numeric_limits<int>::max())
+  , lower_cb_(nullptr)
+  , upper_cb_(nullptr)
+  { }
+
+  int steps() const { return steps_.load(std::memory_order_relaxed); }
+
+  std::size_t drain() { return edges_.consume([](const pendule_pi::Encoder::Edge&){}); }
+
+  static void pulseStatic(int gpio, int level, unsigned int tick, void* THIS) {
+    static_cast<LegacyEncoder*>(THIS)->pulse(gpio, level, tick);
+  }
+
+private:
+  static const std::vector<int> ENCODER_TABLE;
+
+  static int encode(bool past_a, bool past_b, bool a, bool b) {
+    return (past_a<<3) | (past_b<<2) | (a<<1) | (b);
+  }
+
+  void pulse(int gpio, int level, unsigned int tick) {
+    if(gpio != pin_a_ && gpio != pin_b_) {
+      throw std::runtime_error(
+        "Expected Encoder interrupt on pins " + std::to_string(pin_a_) + " or "
+        + std::to_string(pin_b_) + ", however an interrupt was fired for pin "
+        + std::to_string(gpio)
+      );
+    }
+    a_past_ = a_current_;
+    b_past_ = b_current_;
+    (gpio == pin_a_ ? a_current_ : b_current_) = level;
+    const int direction = ENCODER_TABLE.at(encode(a_past_, b_past_, a_current_, b_current_));
+    const int steps = steps_.load(std::memory_order_relaxed) + direction;
+    direction_.store(direction, std::memory_order_relaxed);
+    steps_.store(steps, std::memory_order_relaxed);
+    if(!edges_.push({tick, steps, direction}))
+      dropped_edges_.fetch_add(1, std::memory_order_relaxed);
+    if(steps <= lower_threshold_ && lower_cb_ != nullptr)
+      lower_cb_();
+    if(steps >= upper_threshold_ && upper_cb_ != nullptr)
+      upper_cb_();
+  }
+
+  int pin_a_;
+  int pin_b_;
+  bool a_current_;
+  bool b_current_;
+  bool a_past_;
+  bool b_past_;
+  std::atomic<int> steps_;
+  std::atomic<int> direction_;
+  pendule_pi::SpscRing<pendule_pi::Encoder::Edge,pendule_pi::Encoder::EDGE_BUFFER_SIZE> edges_;
+  std::atomic<unsigned int> dropped_edges_;
+  int lower_threshold_;
+  int upper_threshold_;
+  std::function<void(void)> lower_cb_;
+  std::function<void(void)> upper_cb_;
+};
+
+const std::vector<int> LegacyEncoder::ENCODER_TABLE = {0,1,-1,0,-1,0,0,1,1,0,0,-1,0,-1,1,0};
+
+
+/// Simulated backend that exposes the alert callbacks registered on it.
+/** This allows to call the Encoder callbacks directly, without the overhead
+  * of the simulation itself.
+  */
+class CapturingBackend : public pigpio::SimulatedBackend {
+public:
+  int setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata) override {
+    if(gpio < N_GPIO) {
+      alerts_[gpio] = f;
+      userdata_[gpio] = userdata;
+    }
+    return SimulatedBackend::setAlertFuncEx(gpio, f, userdata);
+  }
+
+  gpioAlertFuncEx_t alert(unsigned gpio) const { return alerts_[gpio]; }
+  void* userdata(unsigned gpio) const { return userdata_[gpio]; }
+
+private:
+  std::array<gpioAlertFuncEx_t,N_GPIO> alerts_{};
+  std::array<void*,N_GPIO> userdata_{};
+};
+
+
+/// Load one column of a CSV file, together with the `time_us` column.
+bool loadColumn(
+  const std::string& file_name,
+  const std::string& column,
+  std::vector<unsigned int>& times,
+  std::vector<double>& values
+)
+{
+  std::ifstream file(file_name);
+  if(!file.is_open()) {
+    std::cout << "ERROR! Could not open file '" << file_name << "'" << std::endl;
+    return false;
+  }
+
+  // Locate the columns in the header
+  auto trim = [](std::string s) {
+    s.erase(0, s.find_first_not_of(" \t\r"));
+    s.erase(s.find_last_not_of(" \t\r") + 1);
+    return s;
+  };
+  std::string line, cell;
+  std::getline(file, line);
+  std::stringstream header(line);
+  int time_col = -1, value_col = -1;
+  for(int i=0; std::getline(header, cell, ','); i++) {
+    if(trim(cell) == "time_us")
+      time_col = i;
+    else if(trim(cell) == column)
+      value_col = i;
+  }
+  if(time_col < 0 || value_col < 0) {
+    std::cout << "ERROR! File '" << file_name << "' has no 'time_us' or '"
+              << column << "' column" << std::endl;
+    return false;
+  }
+
+  // Read the data
+  while(std::getline(file, line)) {
+    std::stringstream row(line);
+    for(int i=0; std::getline(row, cell, ','); i++) {
+      if(i == time_col)
+        times.push_back(std::stoul(cell));
+      else if(i == value_col)
+        values.push_back(std::stod(cell));
+    }
+  }
+  return times.size() == values.size() && times.size() > 1;
+}
+
+
+/// Convert sampled positions into the sequence of alerts an encoder would generate.
+/** The steps between two consecutive samples are spread evenly in time. */
+std::vector<Alert> makeAlerts(
+  const std::vector<unsigned int>& times,
+  const std::vector<double>& values,
+  double step_size
+)
+{
+  // Levels (a,b) visited when moving forward, see Encoder::ENCODER_TABLE.
+  const int SEQUENCE[4][2] = {{0,0}, {0,1}, {1,1}, {1,0}};
+  std::vector<Alert> alerts;
+  long phase = 0;
+  long previous = std::lround(values[0] / step_size);
+  for(std::size_t i=1; i<values.size(); i++) {
+    const long current = std::lround(values[i] / step_size);
+    const long n_steps = std::labs(current - previous);
+    const long dir = current > previous ? 1 : -1;
+    const unsigned int dt = times[i] - times[i-1];
+    for(long s=0; s<n_steps; s++) {
+      const int* from = SEQUENCE[((phase % 4) + 4) % 4];
+      phase += dir;
+      const int* to = SEQUENCE[((phase % 4) + 4) % 4];
+      const unsigned int tick = times[i-1] + static_cast<unsigned int>(dt * (s + 1) / (n_steps + 1));
+      if(from[0] != to[0])
+        alerts.push_back({PIN_A, to[0], tick});
+      else
+        alerts.push_back({PIN_B, to[1], tick});
+    }
+    previous = current;
+  }
+  return alerts;
+}
+
+
+/// Replay all alerts through a callback, returning the total time in nanoseconds.
+template<class Drain>
+double replay(
+  const std::vector<Alert>& alerts,
+  gpioAlertFuncEx_t f,
+  void* userdata,
+  Drain&& drain
+)
+{
+  double total_ns = 0;
+  for(unsigned int r=0; r<REPETITIONS; r++) {
+    for(std::size_t start=0; start<alerts.size(); start+=CHUNK_SIZE) {
+      const std::size_t end = std::min(start + CHUNK_SIZE, alerts.size());
+      const auto t0 = std::chrono::steady_clock::now();
+      for(std::size_t i=start; i<end; i++)
+        f(alerts[i].gpio, alerts[i].level, alerts[i].tick, userdata);
+      const auto t1 = std::chrono::steady_clock::now();
+      total_ns += std::chrono::duration<double,std::nano>(t1 - t0).count();
+      drain();
+    }
+  }
+  return total_ns;
+}
+
+
+int main(int argc, char** argv) {
+  namespace pp = pendule_pi;
+
+  if(argc < 3) {
+    std::cout << "Usage: " << argv[0] << " FILE COLUMN [STEP_SIZE]" << std::endl
+              << "Replays the edges recorded in a CSV file (such as those in"
+              << " src/bin/identification) through the legacy and the current"
+              << " Encoder decoders, and reports the time spent per edge."
+              << std::endl
+              << "STEP_SIZE converts the values of COLUMN into encoder steps"
+              << " (default: 1, meaning that values are already in steps)."
+              << std::endl;
+    return 1;
+  }
+  const std::string file_name = argv[1];
+  const std::string column = argv[2];
+  const double step_size = argc > 3 ? std::stod(argv[3]) : 1.0;
+
+  std::vector<unsigned int> times;
+  std::vector<double> values;
+  if(!loadColumn(file_name, column, times, values))
+    return 1;
+  const auto alerts = makeAlerts(times, values, step_size);
+  if(alerts.empty()) {
+    std::cout << "ERROR! No edges to replay" << std::endl;
+    return 1;
+  }
+  std::cout << "Replaying " << alerts.size() << " edges (" << values.size()
+            << " samples) " << REPETITIONS << " times" << std::endl;
+
+  CapturingBackend sim;
+  pigpio::ActivationToken token(sim, false);
+  sim.setLevel(PIN_A, PI_LOW);
+  sim.setLevel(PIN_B, PI_LOW);
+
+  // Current implementation
+  pp::Encoder encoder(PIN_A, PIN_B);
+  const double new_ns = replay(alerts, sim.alert(PIN_A), sim.userdata(PIN_A), [&]() {
+    encoder.drainEdges([](const pp::Encoder::Edge&){});
+  });
+
+  // Legacy implementation
+  LegacyEncoder legacy(PIN_A, PIN_B, false, false);
+  const double legacy_ns = replay(alerts, LegacyEncoder::pulseStatic, &legacy, [&]() {
+    legacy.drain();
+  });
+
+  const double n_edges = static_cast<double>(alerts.size()) * REPETITIONS;
+  std::cout << std::fixed << std::setprecision(2)
+            << "legacy:  " << legacy_ns / n_edges << " ns/edge (steps: " << legacy.steps() << ")" << std::endl
+            << "current: " << new_ns / n_edges << " ns/edge (steps: " << encoder.steps() << ")" << std::endl;
+  if(legacy.steps() != encoder.steps()) {
+    std::cout << "ERROR! The two decoders disagree" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,394 @@
+#pragma once
+#include <pendule_pi/pigpio.hpp>
+#include <pendule_pi/feedback_law.hpp>
+#include <pendule_pi/histogram.hpp>
+#include <pendule_pi/latest_value.hpp>
+#include <pendule_pi/spsc_ring.hpp>
+#include <pendule_pi/trajectory.hpp>
+#include <pendule_pi/wire_format.hpp>
+#include <pendule_pi/debug.hpp>
+#include <zmqpp/zmqpp.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// Socket I/O of the low-level interface, run by a dedicated thread.
+/** The control thread never touches ZeroMQ (nor the heap): it exchanges
+  * states and commands with the communication thread through lock-free
+  * mailboxes.
+  *   - publishState() stores the latest state and wakes the communication
+  *     thread up (through an eventfd), which encodes and sends it;
+  *   - commands (PWM, feedback laws or trajectory segments) are received
+  *     and decoded as soon as they arrive, and queued: readCommand() returns
+  *     them in order. They are not conflated, since a client may send
+  *     several commands of different kinds within one period (*e.g.*, a
+  *     feedback law and the trajectory of its setpoint);
+  *   - publishBurst() queues a burst message (see pendule_pi::BurstSampler)
+  *     to be sent on its own socket. Unlike states, bursts are not replaced
+  *     by newer ones: identification clients need all of them.
+  *
+  * The communication thread also publishes the diagnostics message, built by
+  * a user-provided function, so that formatting strings does not happen in
+  * the control thread either. The p50, p99 and max of publishLatency() are
+  * appended to it.
+  *
+  * The communication thread leaves the real-time scheduler inherited from
+  * the control thread, and moves to the given CPUs, before creating the
+  * sockets: ZeroMQ's I/O threads thus never compete with the control thread.
+  * The diagnostics function is called by the communication thread, so the
+  * object must be destroyed before anything the function reads.
+  */
+class InterfaceComms {
+public:
+  /// Latest command received from a client.
+  struct Command {
+    /// What the client sent.
+    enum class Kind {
+      Pwm, ///< A PWM signal, see pwm.
+      FeedbackLaw, ///< A feedback law, see law.
+      Trajectory ///< A trajectory segment, see trajectory.
+    };
+
+    Kind kind; ///< What the client sent.
+    int pwm; ///< PWM signal.
+    bool tracked; ///< False for text commands, which do not carry state_sequence.
+    std::uint32_t state_sequence; ///< Sequence number of the state the command answers.
+    pendule_pi::wire::FeedbackLaw law; ///< Feedback law.
+    pendule_pi::wire::Trajectory trajectory; ///< Trajectory segment.
+  };
+
+  /// Number of commands that can wait for the control thread.
+  static constexpr std::size_t COMMAND_QUEUE_SIZE = 32;
+
+  /// Number of burst messages that can wait for the communication thread.
+  static constexpr std::size_t BURST_QUEUE_SIZE = 8;
+
+  /// Function building the diagnostics message. It is called by the communication thread.
+  using DiagnosticsFunction = std::function<std::string(void)>;
+
+  /// Start the communication thread, and wait for it to bind the sockets.
+  /** @param host host of the sockets.
+    * @param state_port port on which states are published.
+    * @param command_port port on which commands are received.
+    * @param diagnostics_port port on which the diagnostics are published.
+    * @param burst_port port on which burst messages are published. Empty to
+    *   disable them.
+    * @param binary if true, states are published in the binary format,
+    *   otherwise as text. Commands are accepted in both formats.
+    * @param diagnostics_period_ms period of the diagnostics messages.
+    * @param diagnostics function building the diagnostics message.
+    * @param cpus CPUs on which the communication thread runs. Empty to keep
+    *   the affinity of the calling thread.
+    * @throw zmqpp::exception if the sockets cannot be bound, and
+    *   std::runtime_error if the eventfd cannot be created.
+    */
+  InterfaceComms(
+    const std::string& host,
+    const std::string& state_port,
+    const std::string& command_port,
+    const std::string& diagnostics_port,
+    const std::string& burst_port,
+    bool binary,
+    unsigned int diagnostics_period_ms,
+    DiagnosticsFunction diagnostics,
+    const std::vector<int>& cpus
+  )
+  : binary_(binary)
+  , diagnostics_period_ms_(diagnostics_period_ms)
+  , diagnostics_(std::move(diagnostics))
+  , wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  , running_(true)
+  , publish_latency_us_(pendule_pi::Histogram::Logarithmic{pigpio::Rate::STATISTICS_PRECISION_BITS})
+  {
+    if(!burst_port.empty())
+      bursts_ = std::make_unique<BurstQueue>();
+    if(wakeup_fd_ < 0)
+      throw std::runtime_error(std::string("InterfaceComms: cannot create the eventfd: ") + std::strerror(errno));
+    std::promise<void> ready;
+    auto bound = ready.get_future();
+    thread_ = std::thread(&InterfaceComms::run, this, host, state_port, command_port, diagnostics_port, burst_port, cpus, std::move(ready));
+    try {
+      bound.get();
+    }
+    catch(...) {
+      thread_.join();
+      close(wakeup_fd_);
+      throw;
+    }
+  }
+
+  // Prevent the user from making copies of an InterfaceComms.
+  InterfaceComms(const InterfaceComms&) = delete;
+  InterfaceComms& operator=(const InterfaceComms&) = delete;
+
+  /// Stop the communication thread.
+  ~InterfaceComms() {
+    running_.store(false, std::memory_order_relaxed);
+    wakeUp();
+    thread_.join();
+    close(wakeup_fd_);
+  }
+
+  /// Publish a state (control thread). It never blocks nor allocates.
+  inline void publishState(const pendule_pi::wire::State& state) {
+    states_.write(Outgoing{state, pigpio::Clock::ticks()});
+    wakeUp();
+  }
+
+  /// Queue a burst message (control thread). It never blocks nor allocates.
+  /** @return false if the message was dropped, because the communication
+    *   thread is late, or because bursts are disabled.
+    */
+  inline bool publishBurst(const pendule_pi::wire::Burst& burst) {
+    if(!bursts_ || !bursts_->push(burst))
+      return false;
+    wakeUp();
+    return true;
+  }
+
+  /// Tells if burst messages are published.
+  inline bool burstsEnabled() const { return bursts_ != nullptr; }
+
+  /// Get the oldest command not read yet (control thread). It never blocks nor allocates.
+  /** Call it until it returns false to apply all the commands received
+    * since the last period, in the order in which they arrived.
+    * @return false if no command is waiting.
+    */
+  inline bool readCommand(Command& command) { return commands_.pop(command); }
+
+  /// Tells if the control thread should reset its statistics.
+  /** The communication thread requests a reset after each diagnostics
+    * message, since statistics must be reset by the threads writing them.
+    */
+  inline bool resetRequested() { return reset_requested_.exchange(false, std::memory_order_relaxed); }
+
+  /// Histogram of the time between publishState() and the end of the transmission, in microseconds.
+  inline const pendule_pi::Histogram& publishLatency() const { return publish_latency_us_; }
+
+private:
+  /// State waiting to be sent.
+  struct Outgoing {
+    pendule_pi::wire::State state; ///< State to be sent.
+    std::uint64_t posted_us; ///< Time at which publishState() was called.
+  };
+
+  /// Commands waiting to be read.
+  using CommandQueue = pendule_pi::SpscRing<Command,COMMAND_QUEUE_SIZE>;
+
+  /// Burst messages waiting to be sent.
+  using BurstQueue = pendule_pi::SpscRing<pendule_pi::wire::Burst,BURST_QUEUE_SIZE>;
+
+  const bool binary_; ///< Format of the published states.
+  const unsigned int diagnostics_period_ms_; ///< Period of the diagnostics messages.
+  DiagnosticsFunction diagnostics_; ///< Builds the diagnostics messages.
+  std::unique_ptr<zmqpp::context> context_; ///< ZeroMQ context, created by the thread.
+  std::unique_ptr<zmqpp::socket> state_pub_; ///< Socket publishing the states.
+  std::unique_ptr<zmqpp::socket> command_sub_; ///< Socket receiving the commands.
+  std::unique_ptr<zmqpp::socket> diagnostics_pub_; ///< Socket publishing the diagnostics.
+  std::unique_ptr<zmqpp::socket> burst_pub_; ///< Socket publishing the burst messages, if enabled.
+  const int wakeup_fd_; ///< Signaled by publishState() and by the destructor.
+  std::atomic<bool> running_; ///< Cleared to stop the thread.
+  std::atomic<bool> reset_requested_{false}; ///< See resetRequested().
+  pendule_pi::LatestValue<Outgoing> states_; ///< States, from the control thread.
+  CommandQueue commands_; ///< Commands, to the control thread.
+  std::unique_ptr<BurstQueue> bursts_; ///< Burst messages, from the control thread (null if disabled).
+  pendule_pi::Histogram publish_latency_us_; ///< See publishLatency().
+  std::thread thread_; ///< Communication thread.
+
+  /// Wake the communication thread up.
+  inline void wakeUp() {
+    const std::uint64_t one = 1;
+    // It can only fail if the counter overflows, i.e., if the thread is awake anyway
+    [[maybe_unused]] const auto written = write(wakeup_fd_, &one, sizeof(one));
+  }
+
+  /// Body of the communication thread.
+  void run(
+    const std::string host,
+    const std::string state_port,
+    const std::string command_port,
+    const std::string diagnostics_port,
+    const std::string burst_port,
+    const std::vector<int> cpus,
+    std::promise<void> ready
+  )
+  {
+    // Leave the real-time scheduler and CPUs of the control thread.
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    if(!cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for(const auto& cpu : cpus)
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &set);
+      const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if(err != 0)
+        PENDULE_PI_WRN("InterfaceComms: cannot set the CPU affinity of the communication thread: " << std::strerror(err));
+    }
+    // Create the sockets: ZeroMQ's I/O threads inherit the settings above.
+    try {
+      context_ = std::make_unique<zmqpp::context>();
+      state_pub_ = std::make_unique<zmqpp::socket>(*context_, zmqpp::socket_type::publish);
+      state_pub_->bind("tcp://" + host + ":" + state_port);
+      command_sub_ = std::make_unique<zmqpp::socket>(*context_, zmqpp::socket_type::subscribe);
+      command_sub_->bind("tcp://" + host + ":" + command_port);
+      command_sub_->subscribe("");
+      diagnostics_pub_ = std::make_unique<zmqpp::socket>(*context_, zmqpp::socket_type::publish);
+      diagnostics_pub_->bind("tcp://" + host + ":" + diagnostics_port);
+      if(bursts_) {
+        burst_pub_ = std::make_unique<zmqpp::socket>(*context_, zmqpp::socket_type::publish);
+        burst_pub_->bind("tcp://" + host + ":" + burst_port);
+      }
+    }
+    catch(...) {
+      ready.set_exception(std::current_exception());
+      return;
+    }
+    ready.set_value();
+    zmqpp::poller poller;
+    poller.add(*command_sub_);
+    poller.add(wakeup_fd_);
+    auto next_diagnostics = std::chrono::steady_clock::now() + std::chrono::milliseconds(diagnostics_period_ms_);
+    while(running_.load(std::memory_order_relaxed)) {
+      const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next_diagnostics - std::chrono::steady_clock::now()).count();
+      poller.poll(std::max<long>(timeout, 0));
+      if(poller.has_input(wakeup_fd_)) {
+        std::uint64_t count;
+        [[maybe_unused]] const auto n_read = read(wakeup_fd_, &count, sizeof(count));
+      }
+      sendState();
+      sendBursts();
+      if(poller.has_input(*command_sub_))
+        receiveCommands();
+      if(std::chrono::steady_clock::now() >= next_diagnostics) {
+        const auto publish = publish_latency_us_.summary();
+        zmqpp::message msg;
+        msg << diagnostics_()
+             + " " + std::to_string(publish.p50)
+             + " " + std::to_string(publish.p99)
+             + " " + std::to_string(publish.max);
+        diagnostics_pub_->send(msg, true);
+        publish_latency_us_.reset();
+        reset_requested_.store(true, std::memory_order_relaxed);
+        next_diagnostics += std::chrono::milliseconds(diagnostics_period_ms_);
+      }
+    }
+    // Close the sockets before the context.
+    state_pub_.reset();
+    command_sub_.reset();
+    diagnostics_pub_.reset();
+    burst_pub_.reset();
+    context_.reset();
+  }
+
+  /// Send the latest state, if any.
+  void sendState() {
+    Outgoing outgoing;
+    if(!states_.read(outgoing))
+      return;
+    const auto& state = outgoing.state;
+    zmqpp::message msg;
+    if(binary_) {
+      pendule_pi::wire::StateBuffer buffer;
+      pendule_pi::wire::encode(state, buffer);
+      msg.add_raw(buffer.data(), buffer.size());
+    }
+    else {
+      msg << std::to_string(1e-6 * state.header.timestamp_us) + " "
+           + std::to_string(state.position) + " "
+           + std::to_string(state.angle) + " "
+           + std::to_string(state.linvel) + " "
+           + std::to_string(state.angvel);
+    }
+    state_pub_->send(msg, true);
+    const std::uint64_t latency = pigpio::Clock::ticks() - outgoing.posted_us;
+    publish_latency_us_.add(static_cast<unsigned int>(std::min<std::uint64_t>(latency, UINT_MAX)));
+  }
+
+  /// Send the queued burst messages, if any.
+  void sendBursts() {
+    if(!bursts_)
+      return;
+    bursts_->consume([this](const pendule_pi::wire::Burst& burst) {
+      pendule_pi::wire::BurstBuffer buffer;
+      const std::size_t size = pendule_pi::wire::encode(burst, buffer);
+      zmqpp::message msg;
+      msg.add_raw(buffer.data(), size);
+      burst_pub_->send(msg, true);
+    });
+  }
+
+  /// Decode all available commands, and queue the valid ones.
+  void receiveCommands() {
+    zmqpp::message msg;
+    while(command_sub_->receive(msg, true)) {
+      Command command;
+      command.kind = Command::Kind::Pwm;
+      command.pwm = 0;
+      if(msg.parts() > 0 && msg.size(0) == pendule_pi::wire::FEEDBACK_LAW_SIZE
+         && pendule_pi::wire::isBinary(msg.raw_data(0), msg.size(0))) {
+        if(!pendule_pi::wire::decode(msg.raw_data(0), msg.size(0), command.law)
+           || !pendule_pi::FeedbackLaw::isValid(command.law)) {
+          PENDULE_PI_WRN("Malformed feedback law ignored");
+          continue;
+        }
+        command.kind = Command::Kind::FeedbackLaw;
+        command.tracked = true;
+        command.state_sequence = command.law.state_sequence;
+      }
+      else if(msg.parts() > 0 && msg.size(0) == pendule_pi::wire::TRAJECTORY_SIZE
+              && pendule_pi::wire::isBinary(msg.raw_data(0), msg.size(0))) {
+        if(!pendule_pi::wire::decode(msg.raw_data(0), msg.size(0), command.trajectory)
+           || !pendule_pi::Trajectory::isValid(command.trajectory)) {
+          PENDULE_PI_WRN("Malformed trajectory ignored");
+          continue;
+        }
+        command.kind = Command::Kind::Trajectory;
+        command.tracked = true;
+        command.state_sequence = command.trajectory.state_sequence;
+      }
+      else if(msg.parts() > 0 && pendule_pi::wire::isBinary(msg.raw_data(0), msg.size(0))) {
+        pendule_pi::wire::Command decoded;
+        if(!pendule_pi::wire::decode(msg.raw_data(0), msg.size(0), decoded)) {
+          PENDULE_PI_WRN("Malformed binary command ignored (" << msg.size(0) << " bytes)");
+          continue;
+        }
+        command.pwm = decoded.pwm;
+        command.tracked = true;
+        command.state_sequence = decoded.state_sequence;
+      }
+      else {
+        std::string msg_str;
+        msg >> msg_str;
+        try {
+          command.pwm = std::stoi(msg_str);
+        }
+        catch(const std::exception&) {
+          PENDULE_PI_WRN("Malformed text command ignored ('" << msg_str << "')");
+          continue;
+        }
+        command.tracked = false;
+        command.state_sequence = 0;
+      }
+      if(!commands_.push(command))
+        PENDULE_PI_WRN("Command dropped: more than " << COMMAND_QUEUE_SIZE << " commands received within one period");
+    }
+  }
+};
@@ -46,18 +46,19 @@ int main(int argc, char** argv) {
     pendule.setCommand(-50);
     do {
       rate.sleep();
-      pendule.update(PERIOD_SEC);
+      if(!pendule.update(PERIOD_SEC))
+        throw pp::Pendule::EmergencyStop(pendule.stopReason());
     }
     while(pendule.position() > -MAX_POSITION);
     pendule.setCommand(0);
 
     const int ESTIM_DATA = static_cast<int>(20 * 1000000 / PERIOD_US);
     std::vector<int> commands = range(50, 250, 10);
-    unsigned int t;
+    std::uint64_t t;
 
     for(const auto& pwm : commands) {
       // Prepare the data
-      std::vector<unsigned int> times;
+      std::vector<std::uint64_t> times;
       std::vector<double> positions;
       times.reserve(ESTIM_DATA);
       positions.reserve(ESTIM_DATA);
@@ -69,7 +70,8 @@ int main(int argc, char** argv) {
       pendule.setCommand(pwm);
       do {
         t = rate.sleep();
-        pendule.update(PERIOD_SEC);
+        if(!pendule.update(PERIOD_SEC))
+          throw pp::Pendule::EmergencyStop(pendule.stopReason());
         times.push_back(t);
         positions.push_back(pendule.position());
       }
@@ -102,7 +104,8 @@ int main(int argc, char** argv) {
       pendule.setCommand(-pwm);
       do {
         t = rate.sleep();
-        pendule.update(PERIOD_SEC);
+        if(!pendule.update(PERIOD_SEC))
+          throw pp::Pendule::EmergencyStop(pendule.stopReason());
         times.push_back(t);
         positions.push_back(pendule.position());
       }
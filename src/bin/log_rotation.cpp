@@ -12,9 +12,9 @@ bool moving(
   unsigned int wait_seconds
 )
 {
-  unsigned int wait_us = wait_seconds * 1000000;
-  unsigned int t0 = gpioTick();
-  while(gpioTick() - t0 < wait_us) {
+  const std::uint64_t wait_us = wait_seconds * 1000000ull;
+  const std::uint64_t t0 = pigpio::Clock::ticks();
+  while(pigpio::Clock::ticks() - t0 < wait_us) {
     if(encoder.steps() != 0)
       return true;
   }
@@ -59,7 +59,7 @@ int main(int argc, char** argv) {
     unsigned int packet_id = 0;
     while(true) {
       // Prepare the data
-      std::vector<unsigned int> times;
+      std::vector<std::uint64_t> times;
       std::vector<int> angles;
       times.reserve(DATA_PACKET_SIZE);
       angles.reserve(DATA_PACKET_SIZE);
@@ -73,7 +73,7 @@ int main(int argc, char** argv) {
       std::cout << "Logging, please wait... " << std::flush;
 
       // Record data
-      unsigned int tnow = 0;
+      std::uint64_t tnow = 0;
       while(times.size() < DATA_PACKET_SIZE) {
         // Wait for the clock to advance
         tnow = rate.sleep();
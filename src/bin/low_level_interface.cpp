@@ -1,11 +1,23 @@
 #include <pendule_pi/pigpio.hpp>
 #include <pendule_pi/pendule.hpp>
+#include <pendule_pi/realtime_profile.hpp>
+#include <pendule_pi/command_tracker.hpp>
+#include <pendule_pi/feedback_law.hpp>
+#include <pendule_pi/trajectory.hpp>
+#include <pendule_pi/wire_format.hpp>
+#include <pendule_pi/shm_channel.hpp>
+#include <pendule_pi/controller_plugin.hpp>
+#include <pendule_pi/flight_recorder.hpp>
+#include <pendule_pi/state_filter.hpp>
+#include <pendule_pi/burst_sampler.hpp>
 #include <pendule_pi/debug.hpp>
-#include <digital_filters/filters.hpp>
 #include <yaml-cpp/yaml.h>
-#include <zmqpp/zmqpp.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <memory>
 #include <thread>
+#include "interface_comms.hpp"
 #include "utils.hpp"
 
 
@@ -45,7 +57,12 @@ int main(int argc, char** argv) {
   std::string HOST("*");
   std::string STATE_PORT("10001");
   std::string COMMAND_PORT("10002");
-  double MAX_IDLE_TIME = 1.0;
+  std::string DIAGNOSTICS_PORT("10003");
+  std::string BURST_PORT("10004");
+  double MAX_COMMAND_AGE = 1.0;
+  auto STALE_COMMANDS = pp::CommandTracker::StalePolicy::Drop;
+  bool BINARY_FORMAT = true;
+  std::string SHM_NAME;
   if(config["sockets"]) {
     if(config["sockets"]["host"])
       HOST = config["sockets"]["host"].as<std::string>();
@@ -53,8 +70,37 @@ int main(int argc, char** argv) {
       STATE_PORT = config["sockets"]["state_port"].as<std::string>();
     if(config["sockets"]["command_port"])
       COMMAND_PORT = config["sockets"]["command_port"].as<std::string>();
+    if(config["sockets"]["diagnostics_port"])
+      DIAGNOSTICS_PORT = config["sockets"]["diagnostics_port"].as<std::string>();
+    if(config["sockets"]["burst_port"])
+      BURST_PORT = config["sockets"]["burst_port"].as<std::string>();
+    // 'max_idle_time' is the former name of 'max_command_age'
     if(config["sockets"]["max_idle_time"])
-      MAX_IDLE_TIME = config["sockets"]["max_idle_time"].as<double>();
+      MAX_COMMAND_AGE = config["sockets"]["max_idle_time"].as<double>();
+    if(config["sockets"]["shm"])
+      SHM_NAME = config["sockets"]["shm"].as<std::string>();
+    if(config["sockets"]["max_command_age"])
+      MAX_COMMAND_AGE = config["sockets"]["max_command_age"].as<double>();
+    if(config["sockets"]["stale_commands"]) {
+      const auto stale_commands = config["sockets"]["stale_commands"].as<std::string>();
+      if(stale_commands == "flag")
+        STALE_COMMANDS = pp::CommandTracker::StalePolicy::Flag;
+      else if(stale_commands != "drop")
+        throw std::runtime_error("Unknown stale command policy '" + stale_commands + "'");
+    }
+    if(config["sockets"]["format"]) {
+      const auto format = config["sockets"]["format"].as<std::string>();
+      if(format == "text")
+        BINARY_FORMAT = false;
+      else if(format != "binary")
+        throw std::runtime_error("Unknown message format '" + format + "'");
+    }
+  }
+  // Trajectories streamed by the clients
+  unsigned int TRAJECTORY_BLEND_MS = 50;
+  if(config["trajectories"]) {
+    if(config["trajectories"]["blend_ms"])
+      TRAJECTORY_BLEND_MS = config["trajectories"]["blend_ms"].as<unsigned int>();
   }
   // Get other configuration parameters.
   const auto METERS_PER_STEP = config["meters_per_step"].as<double>();
@@ -66,6 +112,121 @@ int main(int argc, char** argv) {
   const auto PWM_OFFSET_HIGH = config["pwm_offsets"]["high"].as<int>();
   const auto PERIOD_MS = config["period_ms"] ? config["period_ms"].as<int>() : 20;
   const auto CUTOFF_FREQUENCY = config["cutoff_frequency"].as<double>();
+  // Control loop timing
+  unsigned int SPIN_US = pigpio::Rate::DEFAULT_SPIN_US;
+  auto OVERRUN = pigpio::Rate::Overrun::Rephase;
+  if(config["timing"]) {
+    if(config["timing"]["spin_us"])
+      SPIN_US = config["timing"]["spin_us"].as<unsigned int>();
+    if(config["timing"]["overrun"]) {
+      const auto overrun = config["timing"]["overrun"].as<std::string>();
+      if(overrun == "skip")
+        OVERRUN = pigpio::Rate::Overrun::Skip;
+      else if(overrun == "catch_up")
+        OVERRUN = pigpio::Rate::Overrun::CatchUp;
+      else if(overrun != "rephase")
+        throw std::runtime_error("Unknown overrun policy '" + overrun + "'");
+    }
+  }
+  // Real-time execution profile
+  pp::RealtimeProfile::Parameters realtime_params;
+  if(config["realtime"]) {
+    if(config["realtime"]["priority"])
+      realtime_params.priority = config["realtime"]["priority"].as<int>();
+    if(config["realtime"]["cpus"])
+      realtime_params.cpus = config["realtime"]["cpus"].as<std::vector<int>>();
+    if(config["realtime"]["callback_cpus"])
+      realtime_params.callback_cpus = config["realtime"]["callback_cpus"].as<std::vector<int>>();
+    if(config["realtime"]["lock_memory"])
+      realtime_params.lock_memory = config["realtime"]["lock_memory"].as<bool>();
+    if(config["realtime"]["prefault_stack_kb"])
+      realtime_params.prefault_stack_kb = config["realtime"]["prefault_stack_kb"].as<std::size_t>();
+  }
+  // Decoding of encoders and switches
+  bool SAMPLE_DECODING = false;
+  if(config["decoding"]) {
+    const auto decoding = config["decoding"].as<std::string>();
+    if(decoding == "samples")
+      SAMPLE_DECODING = true;
+    else if(decoding != "alerts")
+      throw std::runtime_error("Unknown decoding mode '" + decoding + "'");
+  }
+  // Signal integrity diagnostics
+  unsigned int DIAGNOSTICS_PERIOD_MS = 1000;
+  unsigned int SAMPLING_PERIOD_US = pp::Encoder::DEFAULT_SAMPLING_PERIOD_US;
+  if(config["diagnostics"]) {
+    if(config["diagnostics"]["period_ms"])
+      DIAGNOSTICS_PERIOD_MS = config["diagnostics"]["period_ms"].as<unsigned int>();
+    if(config["diagnostics"]["sampling_period_us"])
+      SAMPLING_PERIOD_US = config["diagnostics"]["sampling_period_us"].as<unsigned int>();
+  }
+  // Velocity estimation
+  auto VELOCITY_ESTIMATION = pp::Pendule::VelocityEstimation::FiniteDifferences;
+  pp::VelocityEstimator::Parameters velocity_params;
+  bool FILTER_VELOCITIES = true;
+  if(config["velocity_estimation"]) {
+    if(config["velocity_estimation"]["method"]) {
+      const auto method = config["velocity_estimation"]["method"].as<std::string>();
+      if(method == "edge_timing")
+        VELOCITY_ESTIMATION = pp::Pendule::VelocityEstimation::EdgeTiming;
+      else if(method != "finite_differences")
+        throw std::runtime_error("Unknown velocity estimation method '" + method + "'");
+    }
+    if(config["velocity_estimation"]["window_us"])
+      velocity_params.window_us = config["velocity_estimation"]["window_us"].as<unsigned int>();
+    if(config["velocity_estimation"]["min_edges"])
+      velocity_params.min_edges = config["velocity_estimation"]["min_edges"].as<unsigned int>();
+    if(config["velocity_estimation"]["timeout_us"])
+      velocity_params.timeout_us = config["velocity_estimation"]["timeout_us"].as<unsigned int>();
+    if(config["velocity_estimation"]["filter"])
+      FILTER_VELOCITIES = config["velocity_estimation"]["filter"].as<bool>();
+  }
+  // In-process controller, used instead of the commands of the clients
+  std::string CONTROLLER_PATH;
+  std::string CONTROLLER_PARAMETERS;
+  unsigned int CONTROLLER_BUDGET_US = 0;
+  if(config["controller"]) {
+    if(config["controller"]["path"])
+      CONTROLLER_PATH = config["controller"]["path"].as<std::string>();
+    if(config["controller"]["parameters"])
+      CONTROLLER_PARAMETERS = config["controller"]["parameters"].as<std::string>();
+    if(config["controller"]["budget_us"])
+      CONTROLLER_BUDGET_US = config["controller"]["budget_us"].as<unsigned int>();
+  }
+  // Flight recorder
+  bool FLIGHT_RECORDER = true;
+  pp::FlightRecorder::Parameters recorder_params;
+  recorder_params.cpus = realtime_params.callback_cpus;
+  if(config["flight_recorder"]) {
+    if(config["flight_recorder"]["enabled"])
+      FLIGHT_RECORDER = config["flight_recorder"]["enabled"].as<bool>();
+    if(config["flight_recorder"]["directory"])
+      recorder_params.directory = config["flight_recorder"]["directory"].as<std::string>();
+    if(config["flight_recorder"]["ring_name"])
+      recorder_params.ring_name = config["flight_recorder"]["ring_name"].as<std::string>();
+    if(config["flight_recorder"]["ring_s"])
+      recorder_params.ring_seconds = config["flight_recorder"]["ring_s"].as<double>();
+    if(config["flight_recorder"]["file_mb"])
+      recorder_params.file_mb = config["flight_recorder"]["file_mb"].as<double>();
+    if(config["flight_recorder"]["max_files"])
+      recorder_params.max_files = config["flight_recorder"]["max_files"].as<unsigned int>();
+    if(config["flight_recorder"]["snapshot_s"])
+      recorder_params.snapshot_seconds = config["flight_recorder"]["snapshot_s"].as<double>();
+  }
+  // High-rate sampling of the encoders
+  bool BURST = false;
+  unsigned int BURST_RATE_HZ = 2000;
+  unsigned int BURST_DELAY_MS = 5;
+  if(config["burst"]) {
+    if(config["burst"]["enabled"])
+      BURST = config["burst"]["enabled"].as<bool>();
+    if(config["burst"]["rate_hz"])
+      BURST_RATE_HZ = config["burst"]["rate_hz"].as<unsigned int>();
+    if(config["burst"]["delay_ms"])
+      BURST_DELAY_MS = config["burst"]["delay_ms"].as<unsigned int>();
+  }
+  if(BURST && (BURST_RATE_HZ == 0 || BURST_RATE_HZ > 1000000))
+    throw std::runtime_error("Invalid burst sampling rate: " + std::to_string(BURST_RATE_HZ) + "Hz");
   // In debug mode
   PENDULE_PI_DBG("LOW-LEVEL INTERFACE CONFIGURATION:");
   PENDULE_PI_DBG("----------------------------------");
@@ -93,100 +254,417 @@ int main(int argc, char** argv) {
   PENDULE_PI_DBG("  low: " << PWM_OFFSET_LOW);
   PENDULE_PI_DBG("  high: " << PWM_OFFSET_HIGH);
   PENDULE_PI_DBG("period [ms]: " << PERIOD_MS);
+  PENDULE_PI_DBG("timing:");
+  PENDULE_PI_DBG("  spin [us]: " << SPIN_US);
+  PENDULE_PI_DBG("  overrun: " << (OVERRUN == pigpio::Rate::Overrun::Skip ? "skip" : OVERRUN == pigpio::Rate::Overrun::CatchUp ? "catch_up" : "rephase"));
   PENDULE_PI_DBG("cutoff frequency [Hz]: " << CUTOFF_FREQUENCY);
+  PENDULE_PI_DBG("realtime:");
+  PENDULE_PI_DBG("  priority: " << realtime_params.priority);
+  PENDULE_PI_DBG("  cpus: " << realtime_params.cpus.size() << " cpu(s)");
+  PENDULE_PI_DBG("  callback cpus: " << realtime_params.callback_cpus.size() << " cpu(s)");
+  PENDULE_PI_DBG("  lock memory: " << (realtime_params.lock_memory ? "yes" : "no"));
+  PENDULE_PI_DBG("  prefault stack [KiB]: " << realtime_params.prefault_stack_kb);
+  PENDULE_PI_DBG("decoding: " << (SAMPLE_DECODING ? "samples" : "alerts"));
+  PENDULE_PI_DBG("diagnostics:");
+  PENDULE_PI_DBG("  period [ms]: " << DIAGNOSTICS_PERIOD_MS);
+  PENDULE_PI_DBG("  sampling period [us]: " << SAMPLING_PERIOD_US);
+  PENDULE_PI_DBG("velocity estimation:");
+  PENDULE_PI_DBG("  method: " << (VELOCITY_ESTIMATION == pp::Pendule::VelocityEstimation::EdgeTiming ? "edge_timing" : "finite_differences"));
+  PENDULE_PI_DBG("  window [us]: " << velocity_params.window_us);
+  PENDULE_PI_DBG("  min edges: " << velocity_params.min_edges);
+  PENDULE_PI_DBG("  timeout [us]: " << velocity_params.timeout_us);
+  PENDULE_PI_DBG("  filter: " << (FILTER_VELOCITIES ? "yes" : "no"));
+  PENDULE_PI_DBG("controller:");
+  PENDULE_PI_DBG("  path: " << (CONTROLLER_PATH.empty() ? "none (commands from the clients)" : CONTROLLER_PATH));
+  PENDULE_PI_DBG("  parameters: " << CONTROLLER_PARAMETERS);
+  PENDULE_PI_DBG("  budget [us]: " << CONTROLLER_BUDGET_US);
+  PENDULE_PI_DBG("flight recorder: " << (FLIGHT_RECORDER ? "enabled" : "disabled"));
+  PENDULE_PI_DBG("  directory: " << recorder_params.directory);
+  PENDULE_PI_DBG("  ring name: " << recorder_params.ring_name);
+  PENDULE_PI_DBG("  ring [s]: " << recorder_params.ring_seconds);
+  PENDULE_PI_DBG("  file size [MB]: " << recorder_params.file_mb);
+  PENDULE_PI_DBG("  max files: " << recorder_params.max_files);
+  PENDULE_PI_DBG("  snapshot [s]: " << recorder_params.snapshot_seconds);
+  PENDULE_PI_DBG("burst: " << (BURST ? "enabled" : "disabled"));
+  PENDULE_PI_DBG("  rate [Hz]: " << BURST_RATE_HZ);
+  PENDULE_PI_DBG("  delay [ms]: " << BURST_DELAY_MS);
   PENDULE_PI_DBG("----------------------------------");
   PENDULE_PI_DBG("SOCKETS");
   PENDULE_PI_DBG("host: " << HOST);
   PENDULE_PI_DBG("state port: " << STATE_PORT);
   PENDULE_PI_DBG("command port: " << COMMAND_PORT);
+  PENDULE_PI_DBG("diagnostics port: " << DIAGNOSTICS_PORT);
+  PENDULE_PI_DBG("burst port: " << BURST_PORT);
+  PENDULE_PI_DBG("format: " << (BINARY_FORMAT ? "binary" : "text"));
+  PENDULE_PI_DBG("shared memory: " << (SHM_NAME.empty() ? "disabled" : SHM_NAME));
+  PENDULE_PI_DBG("max command age [s]: " << MAX_COMMAND_AGE);
+  PENDULE_PI_DBG("stale commands: " << (STALE_COMMANDS == pp::CommandTracker::StalePolicy::Flag ? "flag" : "drop"));
+  PENDULE_PI_DBG("trajectory blending [ms]: " << TRAJECTORY_BLEND_MS);
   PENDULE_PI_DBG("----------------------------------");
 
   try {
     // Let the token manage the pigpio library!
     pigpio::ActivationToken token;
+    // Apply the real-time profile now: pigpio's threads exist, and the ones
+    // created from now on inherit the settings of this thread.
+    std::cout << "Real-time profile:" << std::endl
+              << pp::RealtimeProfile(realtime_params).apply();
     // Create the pendulum instance and perform the calibration.
     pp::Pendule pendule(METERS_PER_STEP, RADIANS_PER_STEP, ANGLE_OFFSET, pins);
+    if(SAMPLE_DECODING)
+      pendule.enableSampleDecoding();
+    pendule.setSamplingPeriod(SAMPLING_PERIOD_US);
     std::cout << "Calibrating pendulum" << std::endl;
     pendule.calibrate(SAFETY_THRESHOLD_HARD);
     pendule.setPwmOffsets(PWM_OFFSET_LOW, PWM_OFFSET_HIGH);
+    pendule.setVelocityEstimation(VELOCITY_ESTIMATION, velocity_params);
     std::cout << "Calibration completed!" << std::endl;
     // Define soft limits for the pendulum.
     const double MAX_POSITION = pendule.softMinMaxPosition() - SAFETY_THRESHOLD_SOFT;
     // Create the timer used for enforcing a stable control rate.
     const double PERIOD_SEC = PERIOD_MS/1000.0;
-    pigpio::Rate rate(PERIOD_MS*1000);
+    pigpio::Rate rate(PERIOD_MS*1000, SPIN_US, OVERRUN);
     // Variables used to perform control and filtering
     int pwm = 0;
     // Filters
-    const double Fs = 1.0/PERIOD_SEC; // sampling frequency
-    auto filter_position = digital_filters::butterworth<double,double>(4, CUTOFF_FREQUENCY, Fs);
-    auto filter_angle = digital_filters::butterworth<double,double>(4, CUTOFF_FREQUENCY, Fs);
-    auto filter_linvel = digital_filters::butterworth<double,double>(4, CUTOFF_FREQUENCY, Fs);
-    auto filter_angvel = digital_filters::butterworth<double,double>(4, CUTOFF_FREQUENCY, Fs);
-    filter_position.initInput(pendule.position());
-    filter_position.initOutput(pendule.position());
-    filter_angle.initInput(pendule.angle());
-    filter_angle.initOutput(pendule.angle());
-    filter_linvel.initInput(0.0);
-    filter_linvel.initOutput(0.0);
-    filter_angvel.initInput(0.0);
-    filter_angvel.initOutput(0.0);
-    // process variables
-    double filtered_position;
-    double filtered_angle;
-    double filtered_linvel;
-    double filtered_angvel;
-    // Create the socket connections
-    zmqpp::context context;
-    zmqpp::socket state_pub(context, zmqpp::socket_type::publish);
-    state_pub.bind("tcp://" + HOST + ":" + STATE_PORT);
-    zmqpp::socket command_sub(context, zmqpp::socket_type::subscribe);
-    command_sub.set(zmqpp::socket_option::conflate, 1);
-    command_sub.bind("tcp://" + HOST + ":" + COMMAND_PORT);
-    command_sub.subscribe("");
-    const unsigned int MAX_MISSED_MESSAGES = 1 + static_cast<int>(MAX_IDLE_TIME/PERIOD_SEC);
-    unsigned int missed_messages = 0;
+    pp::StateFilter::Parameters filter_params;
+    filter_params.cutoff_frequency = CUTOFF_FREQUENCY;
+    filter_params.filter_velocities = FILTER_VELOCITIES;
+    pp::StateFilter state_filter(filter_params, PERIOD_SEC);
+    state_filter.reset(pendule.position(), pendule.angle());
+    // Tracks the age of the commands, and stops the motor when the command
+    // in effect answers a state that is too old.
+    pp::CommandTracker command_tracker(static_cast<std::uint64_t>(1e6 * MAX_COMMAND_AGE), STALE_COMMANDS);
+    // Feedback law uploaded by a client, evaluated at each period until the
+    // next command.
+    pp::FeedbackLaw feedback_law;
+    // Trajectory segment streamed by a client: either PWM setpoints, or
+    // position setpoints of the feedback law.
+    pp::Trajectory trajectory(1000 * TRAJECTORY_BLEND_MS);
+    // Time spent by the control thread in each iteration, in microseconds
+    pp::Histogram busy_us(pp::Histogram::Logarithmic{pigpio::Rate::STATISTICS_PRECISION_BITS});
+    // The in-process controller, if any, replaces the commands of the clients
+    std::unique_ptr<pp::ControllerPlugin> controller;
+    if(!CONTROLLER_PATH.empty()) {
+      controller = std::make_unique<pp::ControllerPlugin>(CONTROLLER_PATH, CONTROLLER_PARAMETERS, CONTROLLER_BUDGET_US);
+      std::cout << "Controller '" << controller->name() << "' loaded from " << CONTROLLER_PATH << std::endl;
+    }
+    // Every iteration is recorded, and the last seconds are saved on an
+    // emergency stop.
+    std::unique_ptr<pp::FlightRecorder> recorder;
+    if(FLIGHT_RECORDER) {
+      recorder = std::make_unique<pp::FlightRecorder>(recorder_params, PERIOD_MS*1000);
+      std::cout << "Flight recorder: " << recorder->ringPath() << std::endl;
+    }
+    // Append the signal integrity counters of an encoder to a message.
+    auto append_diagnostics = [](std::string& str, const pp::Encoder& encoder) {
+      const auto diag = encoder.diagnostics();
+      str += " " + std::to_string(diag.edges)
+           + " " + std::to_string(diag.illegal_transitions)
+           + " " + std::to_string(diag.lost_edges)
+           + " " + std::to_string(diag.min_interval_us)
+           + " " + std::to_string(diag.peak_edge_rate)
+           + " " + std::to_string(diag.near_sampling_limit ? 1 : 0)
+           + " " + std::to_string(encoder.droppedEdges());
+    };
+    // The socket connections are handled by a dedicated thread, which also
+    // publishes the diagnostics once in a while. The message contains the
+    // time followed by, for the position and then the angle encoder: edges,
+    // illegal transitions, lost edges, minimum interval between edges [us],
+    // peak edge rate [edges/s], near sampling limit (0 or 1), and edges
+    // dropped by the edge buffer. Then come the loop timing statistics since
+    // the previous message, in microseconds: period p50, p99, p99.9 and max,
+    // wake-up lateness p99 and max, number of overruns and largest overrun.
+    // Then come the command statistics since the previous message: number of
+    // commands, stale commands and expirations, state-to-command latency
+    // p50, p99 and max [us], and largest staleness [states]. Then come the
+    // statistics of the feedback laws uploaded by the clients: number of
+    // uploads, evaluations, evaluations outside the validity region, and
+    // expirations. Then come the statistics of the trajectory segments:
+    // number of uploads, rejected segments (position setpoints without
+    // feedback law), late segments, evaluations, and evaluations after the
+    // last point. Then come the statistics of the in-process controller
+    // (all 0 if there is none): steps, overruns, failures, saturations, and
+    // execution time p99 and max [us]. Finally come the per-thread timing statistics,
+    // in microseconds: time spent by the control thread in each iteration
+    // (p50, p99 and max), and time taken by the communication thread to send
+    // each state (p50, p99 and max, added by InterfaceComms).
+    auto diagnostics = [&]() {
+      std::string diag_str = std::to_string(1e-6 * pigpio::Clock::ticks());
+      append_diagnostics(diag_str, pendule.positionEncoder());
+      append_diagnostics(diag_str, pendule.angleEncoder());
+      const auto timing = rate.statistics();
+      diag_str += " " + std::to_string(timing.period.p50)
+                + " " + std::to_string(timing.period.p99)
+                + " " + std::to_string(timing.period.p999)
+                + " " + std::to_string(timing.period.max)
+                + " " + std::to_string(timing.lateness.p99)
+                + " " + std::to_string(timing.lateness.max)
+                + " " + std::to_string(timing.overrun.count)
+                + " " + std::to_string(timing.overrun.max);
+      const auto commands = command_tracker.statistics();
+      diag_str += " " + std::to_string(commands.commands)
+                + " " + std::to_string(commands.stale)
+                + " " + std::to_string(commands.expired)
+                + " " + std::to_string(commands.latency_us.p50)
+                + " " + std::to_string(commands.latency_us.p99)
+                + " " + std::to_string(commands.latency_us.max)
+                + " " + std::to_string(commands.staleness.max);
+      const auto laws = feedback_law.statistics();
+      diag_str += " " + std::to_string(laws.uploads)
+                + " " + std::to_string(laws.evaluations)
+                + " " + std::to_string(laws.fallbacks)
+                + " " + std::to_string(laws.expired);
+      const auto segments = trajectory.statistics();
+      diag_str += " " + std::to_string(segments.uploads)
+                + " " + std::to_string(segments.rejected)
+                + " " + std::to_string(segments.late)
+                + " " + std::to_string(segments.evaluations)
+                + " " + std::to_string(segments.held);
+      pp::ControllerPlugin::Statistics plugin{};
+      if(controller)
+        plugin = controller->statistics();
+      diag_str += " " + std::to_string(plugin.steps)
+                + " " + std::to_string(plugin.overruns)
+                + " " + std::to_string(plugin.failures)
+                + " " + std::to_string(plugin.saturations)
+                + " " + std::to_string(plugin.execution_us.p99)
+                + " " + std::to_string(plugin.execution_us.max);
+      const auto busy = busy_us.summary();
+      diag_str += " " + std::to_string(busy.p50)
+                + " " + std::to_string(busy.p99)
+                + " " + std::to_string(busy.max);
+      return diag_str;
+    };
+#ifdef PENDULE_PI_DEBUG_ENABLED
+    // Used to report decoding statistics once in a while
+    pigpio::Timer stats_timer(5000000, true);
+#endif
     // sleep a little bit before starting with the main loop
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    // Main loop!
+    InterfaceComms comms(HOST, STATE_PORT, COMMAND_PORT, DIAGNOSTICS_PORT, BURST ? BURST_PORT : "",
+      BINARY_FORMAT, DIAGNOSTICS_PERIOD_MS, diagnostics, realtime_params.callback_cpus);
+    // Clients running on the same host can also use shared memory, which
+    // the control thread accesses directly.
+    std::unique_ptr<pp::ShmChannel> shm;
+    if(!SHM_NAME.empty())
+      shm = std::make_unique<pp::ShmChannel>(SHM_NAME, pp::ShmChannel::CREATE);
+    // State and command exchanged with the communication thread
+    pp::wire::State state;
+    InterfaceComms::Command command;
+    pp::wire::StateBuffer shm_state;
+    pp::wire::CommandBuffer shm_command;
+    pp::wire::Command decoded_command;
+    pendule_pi_controller_state controller_state{};
+    controller_state.period = PERIOD_SEC;
+    pp::FlightRecorder::Record record{};
+    std::uint32_t command_sequence = 0;
+    std::uint64_t previous_time_us = 0;
+    // Encoder readings sampled at a high rate from the edges drained by
+    // Pendule::update(), and published once per period.
+    std::unique_ptr<pp::BurstSampler> burst_sampler;
+    pp::wire::Burst burst{};
+    std::uint32_t burst_sequence = 0;
+    if(BURST) {
+      burst_sampler = std::make_unique<pp::BurstSampler>(1000000 / BURST_RATE_HZ, 1000 * BURST_DELAY_MS);
+      burst.period_us = burst_sampler->period();
+      burst.position_scale = METERS_PER_STEP / 4;
+      burst.position_offset = -burst.position_scale * pendule.midPositionSteps();
+      burst.angle_scale = RADIANS_PER_STEP / 4;
+      burst.angle_offset = -ANGLE_OFFSET;
+      burst_sampler->reset(pigpio::Clock::ticks(), pendule.positionEncoder().steps(), pendule.angleEncoder().steps(), 0);
+      pendule.setBurstSampler(burst_sampler.get());
+      std::cout << "Burst sampling at " << BURST_RATE_HZ << "Hz on port " << BURST_PORT << std::endl;
+    }
+    // Main loop! The control thread never touches the sockets nor the heap.
     while(true) {
       // Sleep and update the state of the pendulum
-      double hw_time = 1e-6 * rate.sleep();
-      pendule.update(PERIOD_SEC);
+      const std::uint64_t hw_time_us = rate.sleep();
+      if(comms.resetRequested()) {
+        rate.resetStatistics();
+        command_tracker.resetStatistics();
+        feedback_law.resetStatistics();
+        trajectory.resetStatistics();
+        busy_us.reset();
+        if(controller)
+          controller->resetStatistics();
+      }
+      if(!pendule.update(PERIOD_SEC)) {
+        const auto& latency = pendule.safetyLatency();
+        std::cerr << "Emergency stop: motor turned off " << latency.max()
+                  << "us after the event (" << latency.count() << " event(s))" << std::endl;
+        if(recorder)
+          recorder->trigger();
+        throw pp::Pendule::EmergencyStop(pendule.stopReason());
+      }
       // perform state filtering
-      filtered_position = filter_position.filter(pendule.position());
-      filtered_angle = filter_angle.filter(pendule.angle());
-      filtered_linvel = filter_linvel.filter(pendule.linearVelocity());
-      filtered_angvel = filter_angvel.filter(pendule.angularVelocity());
+      state_filter.filter(pendule.position(), pendule.angle(), pendule.linearVelocity(), pendule.angularVelocity());
       // send the current state
-      zmqpp::message msg;
-      msg << std::to_string(hw_time) + " "
-           + std::to_string(filtered_position) + " "
-           + std::to_string(filtered_angle) + " "
-           + std::to_string(filtered_linvel) + " "
-           + std::to_string(filtered_angvel);
-      state_pub.send(msg, true);
-      // read the current command
-      if(command_sub.receive(msg, true)) {
-        std::string msg_str;
-        msg >> msg_str;
-        pwm = std::stoi(msg_str);
-        missed_messages = 0;
+      state.header.sequence = command_tracker.published(hw_time_us);
+      state.header.timestamp_us = hw_time_us;
+      state.position = state_filter.position();
+      state.angle = state_filter.angle();
+      state.linvel = state_filter.linearVelocity();
+      state.angvel = state_filter.angularVelocity();
+      comms.publishState(state);
+      if(shm) {
+        pp::wire::encode(state, shm_state);
+        shm->writeState(shm_state);
       }
-      else if(missed_messages < MAX_MISSED_MESSAGES) {
-        // no command was available, but we did not "loose" too many messages
-        missed_messages++;
+      if(controller) {
+        // the in-process controller computes the command
+        controller_state.time_us = hw_time_us;
+        controller_state.sequence = state.header.sequence;
+        controller_state.position = state_filter.position();
+        controller_state.angle = state_filter.angle();
+        controller_state.linvel = state_filter.linearVelocity();
+        controller_state.angvel = state_filter.angularVelocity();
+        pwm = controller->step(controller_state);
+        record.flags = pp::FlightRecorder::PLUGIN;
+        // clients cannot override the controller: discard their commands
+        while(comms.readCommand(command)) { }
       }
       else {
-        // we lost too many messages: override the command!
-        pwm = 0;
+        // read the latest command, if any, from the shared memory, and then
+        // apply the commands received from the sockets since the last period,
+        // in order (the last one wins). A PWM command replaces the feedback
+        // law and the trajectory, if any. A feedback law replaces a PWM
+        // trajectory, and a PWM trajectory replaces the feedback law. A
+        // position trajectory moves the setpoint of the feedback law.
+        if(shm && shm->readCommand(shm_command)
+           && pp::wire::decode(shm_command.data(), shm_command.size(), decoded_command)) {
+          if(command_tracker.received(decoded_command.state_sequence, pigpio::Clock::ticks())) {
+            command_sequence = decoded_command.state_sequence;
+            pwm = decoded_command.pwm;
+            feedback_law.unload();
+            trajectory.unload();
+          }
+        }
+        while(comms.readCommand(command)) {
+          if(!command.tracked) {
+            pwm = command.pwm;
+            feedback_law.unload();
+            trajectory.unload();
+            command_tracker.receivedUntracked(pigpio::Clock::ticks());
+          }
+          else if(command.kind == InterfaceComms::Command::Kind::Trajectory
+                  && command.trajectory.kind == pp::wire::Trajectory::Kind::Position
+                  && !feedback_law.loaded()) {
+            // position setpoints are meaningless without a feedback law
+            trajectory.reject();
+          }
+          else if(command_tracker.received(command.state_sequence, pigpio::Clock::ticks())) {
+            command_sequence = command.state_sequence;
+            switch(command.kind) {
+              case InterfaceComms::Command::Kind::Pwm:
+                pwm = command.pwm;
+                feedback_law.unload();
+                trajectory.unload();
+                break;
+              case InterfaceComms::Command::Kind::FeedbackLaw:
+                feedback_law.load(command.law, pigpio::Clock::ticks());
+                if(trajectory.loaded() && trajectory.kind() == pp::wire::Trajectory::Kind::Pwm)
+                  trajectory.unload();
+                break;
+              case InterfaceComms::Command::Kind::Trajectory:
+                trajectory.load(command.trajectory, hw_time_us);
+                if(command.trajectory.kind == pp::wire::Trajectory::Kind::Pwm)
+                  feedback_law.unload();
+                break;
+            }
+          }
+        }
+        const bool command_valid = command_tracker.valid(pigpio::Clock::ticks());
+        if(feedback_law.loaded()) {
+          // evaluate the feedback law, unless it expired
+          if(feedback_law.active(pigpio::Clock::ticks(), command_valid)) {
+            if(trajectory.loaded()) {
+              double linvel_setpoint;
+              const double position_setpoint = trajectory.evaluate(hw_time_us, &linvel_setpoint);
+              feedback_law.moveSetpoint(position_setpoint, linvel_setpoint);
+            }
+            pwm = feedback_law.evaluate(state_filter.position(), state_filter.angle(), state_filter.linearVelocity(), state_filter.angularVelocity());
+          }
+          else {
+            pwm = 0;
+            trajectory.unload();
+          }
+        }
+        else if(trajectory.loaded()) {
+          // interpolate the PWM setpoints, unless they expired
+          if(command_valid) {
+            pwm = static_cast<int>(std::lround(std::clamp<double>(trajectory.evaluate(hw_time_us), -255, 255)));
+          }
+          else {
+            pwm = 0;
+            trajectory.unload();
+          }
+        }
+        else if(!command_valid) {
+          // the command in effect is too old: override it!
+          pwm = 0;
+        }
+        record.flags = 0;
+        if(command_valid)
+          record.flags |= pp::FlightRecorder::COMMAND_VALID;
+        if(feedback_law.loaded())
+          record.flags |= pp::FlightRecorder::FEEDBACK_LAW;
+        if(trajectory.loaded())
+          record.flags |= pp::FlightRecorder::TRAJECTORY;
       }
+      record.received_pwm = pwm;
       // Enforce soft safety limits, then send the command.
       if(pendule.position() > MAX_POSITION && pwm > 0)
         pwm = 0;
       else if(pendule.position() < -MAX_POSITION && pwm < 0)
         pwm = 0;
       pendule.setCommand(pwm);
+      if(burst_sampler) {
+        burst_sampler->setPwm(pigpio::Clock::ticks(), pwm);
+        bool full;
+        do {
+          full = burst_sampler->sample(hw_time_us, burst);
+          if(burst.count > 0) {
+            burst.header.sequence = burst_sequence++;
+            burst.header.timestamp_us = hw_time_us;
+            if(!comms.publishBurst(burst))
+              burst.lost += burst.count;
+            burst.count = 0;
+          }
+        } while(full);
+      }
+      const std::uint64_t busy = pigpio::Clock::ticks() - hw_time_us;
+      busy_us.add(static_cast<unsigned int>(busy));
+      if(recorder) {
+        record.time_us = hw_time_us;
+        record.sequence = state.header.sequence;
+        record.command_sequence = command_sequence;
+        record.position_steps = pendule.positionEncoder().steps();
+        record.angle_steps = pendule.angleEncoder().steps();
+        record.position = pendule.position();
+        record.angle = pendule.angle();
+        record.linvel = pendule.linearVelocity();
+        record.angvel = pendule.angularVelocity();
+        record.filtered_position = state_filter.position();
+        record.filtered_angle = state_filter.angle();
+        record.filtered_linvel = state_filter.linearVelocity();
+        record.filtered_angvel = state_filter.angularVelocity();
+        record.applied_pwm = pwm;
+        record.period_us = previous_time_us > 0 ? static_cast<std::uint32_t>(hw_time_us - previous_time_us) : 0;
+        record.busy_us = static_cast<std::uint32_t>(busy);
+        recorder->record(record);
+      }
+      previous_time_us = hw_time_us;
+#ifdef PENDULE_PI_DEBUG_ENABLED
+      // Debug information
+      if(pendule.sampleDecoder() != nullptr && stats_timer.expired()) {
+        auto stats = pendule.sampleDecoder()->statistics();
+        PENDULE_PI_DBG("sample decoder: " << stats.batches << " batches, "
+          << stats.samples << " samples, " << stats.steps << " steps, "
+          << (stats.batches > 0 ? stats.cpu_ns / stats.batches : 0) << "ns/batch (max "
+          << stats.max_batch_ns << "ns)");
+      }
+#endif
     }
   }
   catch(const pigpio::ActivationToken::PleaseStop&) { }
@@ -0,0 +1,206 @@
+#include <pendule_pi/replay.hpp>
+#include <yaml-cpp/yaml.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+/// Split a comma-separated list of values.
+template<class T>
+std::vector<T> parseList(
+  const std::string& list,
+  T (*parse)(const std::string&)
+)
+{
+  std::vector<T> values;
+  std::stringstream stream(list);
+  std::string item;
+  while(std::getline(stream, item, ','))
+    values.push_back(parse(item));
+  if(values.empty())
+    throw std::runtime_error("empty list '" + list + "'");
+  return values;
+}
+
+
+double parseDouble(const std::string& s) { return std::stod(s); }
+unsigned int parseUnsigned(const std::string& s) { return static_cast<unsigned int>(std::stoul(s)); }
+bool parseBool(const std::string& s) {
+  if(s == "yes" || s == "true" || s == "1")
+    return true;
+  if(s == "no" || s == "false" || s == "0")
+    return false;
+  throw std::runtime_error("invalid boolean '" + s + "'");
+}
+pendule_pi::Pendule::VelocityEstimation parseMethod(const std::string& s) {
+  if(s == "finite_differences")
+    return pendule_pi::Pendule::VelocityEstimation::FiniteDifferences;
+  if(s == "edge_timing")
+    return pendule_pi::Pendule::VelocityEstimation::EdgeTiming;
+  throw std::runtime_error("unknown velocity estimation method '" + s + "'");
+}
+
+
+/// Write the unfiltered and filtered state at each sample.
+void writeCsv(
+  const std::string& file_name,
+  const pendule_pi::Replay::Recording& recording,
+  const pendule_pi::Replay::Result& result
+)
+{
+  std::ofstream file(file_name);
+  if(!file.is_open())
+    throw std::runtime_error("could not open file '" + file_name + "'");
+  file << "time_us, pwm, position, angle, linvel, angvel, filtered_position, filtered_angle, filtered_linvel, filtered_angvel" << std::endl;
+  file << std::setprecision(9);
+  for(std::size_t i=0; i<recording.samples.size(); i++) {
+    file << recording.samples[i].time_us << ", " << recording.samples[i].pwm;
+    for(double v : result.raw[i])
+      file << ", " << v;
+    for(double v : result.filtered[i])
+      file << ", " << v;
+    file << "\n";
+  }
+}
+
+
+int main(int argc, char** argv) {
+  namespace pp = pendule_pi;
+
+  if(argc < 2) {
+    std::cout << "Usage: " << argv[0] << " RECORDING [OPTIONS]" << std::endl
+              << "Replays a recording (a CSV file, such as those in src/bin/identification,"
+              << " or a flight recorder file) through the state estimation and filtering"
+              << " chain of low_level_interface, as fast as possible, and reports the lag"
+              << " and noise of each coordinate." << std::endl
+              << "Options (LIST is a comma-separated list: all combinations are replayed in parallel):" << std::endl
+              << "  --config FILE              defaults (default: ./pendule_pi_config.yaml)" << std::endl
+              << "  --cutoff LIST              cutoff frequencies [Hz]" << std::endl
+              << "  --order LIST               orders of the Butterworth filters" << std::endl
+              << "  --method LIST              velocity estimation: finite_differences, edge_timing" << std::endl
+              << "  --filter-velocities LIST   yes, no" << std::endl
+              << "  --steps                    CSV values are encoder steps, as written by log_rotation" << std::endl
+              << "  --threads N                number of threads (default: one per core)" << std::endl
+              << "  --output DIR               write the filtered state of each configuration to DIR/replay_<index>.csv" << std::endl;
+    return 1;
+  }
+
+  try {
+    const std::string recording_file = argv[1];
+    std::string config_file = "./pendule_pi_config.yaml";
+    std::string cutoffs, orders, methods, filter_velocities, output_directory;
+    bool steps = false;
+    unsigned int threads = 0;
+    for(int i=2; i<argc; i++) {
+      const std::string option = argv[i];
+      if(option == "--steps") {
+        steps = true;
+        continue;
+      }
+      if(i + 1 >= argc)
+        throw std::runtime_error("missing value after '" + option + "'");
+      const std::string value = argv[++i];
+      if(option == "--config")
+        config_file = value;
+      else if(option == "--cutoff")
+        cutoffs = value;
+      else if(option == "--order")
+        orders = value;
+      else if(option == "--method")
+        methods = value;
+      else if(option == "--filter-velocities")
+        filter_velocities = value;
+      else if(option == "--threads")
+        threads = parseUnsigned(value);
+      else if(option == "--output")
+        output_directory = value;
+      else
+        throw std::runtime_error("unknown option '" + option + "'");
+    }
+
+    // Defaults: the settings of the low-level interface.
+    pp::Replay::Configuration base;
+    YAML::Node config = YAML::LoadFile(config_file);
+    base.meters_per_step = config["meters_per_step"].as<double>();
+    base.radians_per_step = config["radians_per_step"].as<double>();
+    base.filter.cutoff_frequency = config["cutoff_frequency"].as<double>();
+    if(config["velocity_estimation"]) {
+      if(config["velocity_estimation"]["method"])
+        base.velocity_estimation = parseMethod(config["velocity_estimation"]["method"].as<std::string>());
+      if(config["velocity_estimation"]["window_us"])
+        base.velocity_parameters.window_us = config["velocity_estimation"]["window_us"].as<unsigned int>();
+      if(config["velocity_estimation"]["min_edges"])
+        base.velocity_parameters.min_edges = config["velocity_estimation"]["min_edges"].as<unsigned int>();
+      if(config["velocity_estimation"]["timeout_us"])
+        base.velocity_parameters.timeout_us = config["velocity_estimation"]["timeout_us"].as<unsigned int>();
+      if(config["velocity_estimation"]["filter"])
+        base.filter.filter_velocities = config["velocity_estimation"]["filter"].as<bool>();
+    }
+
+    // All combinations of the values given on the command line.
+    const auto cutoff_list = cutoffs.empty() ? std::vector<double>{base.filter.cutoff_frequency} : parseList(cutoffs, parseDouble);
+    const auto order_list = orders.empty() ? std::vector<unsigned int>{base.filter.order} : parseList(orders, parseUnsigned);
+    const auto method_list = methods.empty() ? std::vector<pp::Pendule::VelocityEstimation>{base.velocity_estimation} : parseList(methods, parseMethod);
+    const auto filter_list = filter_velocities.empty() ? std::vector<bool>{base.filter.filter_velocities} : parseList(filter_velocities, parseBool);
+    std::vector<pp::Replay::Configuration> configurations;
+    for(auto method : method_list) {
+      for(bool filter : filter_list) {
+        for(unsigned int order : order_list) {
+          for(double cutoff : cutoff_list) {
+            pp::Replay::Configuration c = base;
+            c.velocity_estimation = method;
+            c.filter.filter_velocities = filter;
+            c.filter.order = order;
+            c.filter.cutoff_frequency = cutoff;
+            std::stringstream name;
+            name << (method == pp::Pendule::VelocityEstimation::EdgeTiming ? "edge_timing" : "finite_differences")
+                 << (filter ? "" : "-unfiltered_velocities")
+                 << "-order_" << order << "-cutoff_" << cutoff;
+            c.name = name.str();
+            configurations.push_back(c);
+          }
+        }
+      }
+    }
+
+    // Replay
+    const double position_scale = steps ? base.meters_per_step / 4 : 1.0;
+    const double angle_scale = steps ? base.radians_per_step / 4 : 1.0;
+    pp::Replay replay(pp::Replay::load(recording_file, position_scale, angle_scale));
+    const auto& recording = replay.recording();
+    const double duration_s = 1e-6 * (recording.samples.back().time_us - recording.samples.front().time_us);
+    std::cout << "Replaying " << recording.samples.size() << " samples (" << duration_s << "s, period "
+              << recording.period_us << "us) with " << configurations.size() << " configuration(s)" << std::endl;
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = replay.run(configurations, threads);
+    const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Report
+    const char* NAMES[4] = {"position", "angle", "linvel", "angvel"};
+    std::cout << std::fixed;
+    for(std::size_t i=0; i<results.size(); i++) {
+      std::cout << "[" << i << "] " << configurations[i].name << " ("
+                << std::setprecision(0) << duration_s / results[i].elapsed_s << "x real time)" << std::endl;
+      for(std::size_t c=0; c<4; c++) {
+        const auto& m = results[i].metrics[c];
+        std::cout << "    " << std::setw(8) << NAMES[c]
+                  << "  lag: " << std::setprecision(1) << std::setw(7) << 1e-3 * m.lag_us << "ms"
+                  << "  residual: " << std::scientific << std::setprecision(3) << m.residual << std::fixed
+                  << "  noise: " << std::setprecision(3) << m.noise << std::endl;
+      }
+      if(!output_directory.empty())
+        writeCsv(output_directory + "/replay_" + std::to_string(i) + ".csv", recording, results[i]);
+    }
+    std::cout << "Total: " << std::setprecision(3) << elapsed_s << "s ("
+              << std::setprecision(0) << configurations.size() * duration_s / elapsed_s << "x real time)" << std::endl;
+  }
+  catch(const std::exception& e) {
+    std::cout << "ERROR! " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
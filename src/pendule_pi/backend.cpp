@@ -0,0 +1,159 @@
+#include "pendule_pi/backend.hpp"
+#include <cerrno>
+#include <time.h>
+
+
+namespace pigpio {
+
+Backend* Backend::active_backend = nullptr;
+
+
+Backend::Backend()
+: tick_reference_(0)
+{
+  // nothing else to do here
+}
+
+
+std::uint64_t Backend::extendTick(
+  std::uint32_t tick
+) noexcept
+{
+  std::uint64_t reference = tick_reference_.load(std::memory_order_relaxed);
+  // First call: the epoch is the beginning of the current 32 bits period. If
+  // another thread was faster, its reference is loaded by the exchange.
+  if(reference == 0 && tick_reference_.compare_exchange_strong(reference, tick, std::memory_order_relaxed))
+    return tick;
+  const std::int32_t delta = static_cast<std::int32_t>(tick - static_cast<std::uint32_t>(reference));
+  if(delta < 0 && static_cast<std::uint64_t>(-static_cast<std::int64_t>(delta)) > reference)
+    return 0;
+  const std::uint64_t extended = reference + static_cast<std::int64_t>(delta);
+  // Move the reference forward from time to time. If another thread did it
+  // in the meantime, its value is as good as ours.
+  if(delta > (1 << 30))
+    tick_reference_.compare_exchange_strong(reference, extended, std::memory_order_relaxed);
+  return extended;
+}
+
+
+Backend& Backend::active() {
+  static PigpioBackend default_backend;
+  return active_backend == nullptr ? default_backend : *active_backend;
+}
+
+
+Backend* Backend::select(
+  Backend* backend
+)
+{
+  Backend* previous = active_backend;
+  active_backend = backend;
+  return previous;
+}
+
+
+int PigpioBackend::initialise() {
+  return gpioInitialise();
+}
+
+
+void PigpioBackend::terminate() {
+  gpioTerminate();
+}
+
+
+int PigpioBackend::setMode(
+  unsigned gpio,
+  unsigned mode
+)
+{
+  return gpioSetMode(gpio, mode);
+}
+
+
+int PigpioBackend::setPullUpDown(
+  unsigned gpio,
+  unsigned pud
+)
+{
+  return gpioSetPullUpDown(gpio, pud);
+}
+
+
+int PigpioBackend::read(
+  unsigned gpio
+)
+{
+  return gpioRead(gpio);
+}
+
+
+std::uint32_t PigpioBackend::readBits0to31() {
+  return gpioRead_Bits_0_31();
+}
+
+
+int PigpioBackend::write(
+  unsigned gpio,
+  unsigned level
+)
+{
+  return gpioWrite(gpio, level);
+}
+
+
+int PigpioBackend::pwm(
+  unsigned gpio,
+  unsigned dutycycle
+)
+{
+  return gpioPWM(gpio, dutycycle);
+}
+
+
+int PigpioBackend::setAlertFuncEx(
+  unsigned gpio,
+  gpioAlertFuncEx_t f,
+  void* userdata
+)
+{
+  return gpioSetAlertFuncEx(gpio, f, userdata);
+}
+
+
+int PigpioBackend::setGetSamplesFuncEx(
+  gpioGetSamplesFuncEx_t f,
+  std::uint32_t bits,
+  void* userdata
+)
+{
+  return gpioSetGetSamplesFuncEx(f, bits, userdata);
+}
+
+
+std::uint32_t PigpioBackend::tick() {
+  return gpioTick();
+}
+
+
+void PigpioBackend::sleepUntil(
+  std::uint32_t tick
+)
+{
+  const std::int32_t remaining = static_cast<std::int32_t>(tick - gpioTick());
+  if(remaining <= 0)
+    return;
+  // Convert the deadline to CLOCK_MONOTONIC once: since it is absolute,
+  // being interrupted by a signal does not shift it.
+  timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += remaining / 1000000;
+  deadline.tv_nsec += (remaining % 1000000) * 1000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR);
+}
+
+} // end of namespace pigpio
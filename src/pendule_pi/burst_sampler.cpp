@@ -0,0 +1,122 @@
+#include "pendule_pi/burst_sampler.hpp"
+
+
+namespace pendule_pi {
+
+
+BurstSampler::BurstSampler(
+  unsigned int period_us,
+  unsigned int delay_us
+)
+: period_us_(period_us > 0 ? period_us : 1)
+, delay_us_(delay_us)
+, started_(false)
+, next_us_(0)
+, position_steps_(0)
+, angle_steps_(0)
+, pwm_(0)
+, samples_(0)
+, late_(0)
+, dropped_(0)
+{
+  // Allocate once and for all: the buffers are used by the control thread.
+  position_edges_.reserve(EDGE_CAPACITY);
+  angle_edges_.reserve(EDGE_CAPACITY);
+  pwm_changes_.reserve(PWM_CAPACITY);
+}
+
+
+void BurstSampler::reset(
+  std::uint64_t now_us,
+  int position_steps,
+  int angle_steps,
+  int pwm
+)
+{
+  started_ = true;
+  next_us_ = now_us;
+  position_steps_ = position_steps;
+  angle_steps_ = angle_steps;
+  pwm_ = pwm;
+  position_edges_.clear();
+  angle_edges_.clear();
+  pwm_changes_.clear();
+}
+
+
+void BurstSampler::setPwm(
+  std::uint64_t time_us,
+  int pwm
+)
+{
+  if(!started_)
+    return;
+  if(pwm == (pwm_changes_.empty() ? pwm_ : pwm_changes_.back().pwm))
+    return;
+  if(pwm_changes_.size() == PWM_CAPACITY)
+    pwm_changes_.erase(pwm_changes_.begin());
+  pwm_changes_.push_back({time_us, pwm});
+}
+
+
+bool BurstSampler::sample(
+  std::uint64_t now_us,
+  wire::Burst& burst
+)
+{
+  if(!started_ || now_us < delay_us_)
+    return false;
+  const std::uint64_t end_us = now_us - delay_us_;
+  std::size_t p = 0, a = 0, c = 0;
+  bool full = false;
+  while(next_us_ <= end_us) {
+    if(burst.count >= wire::Burst::MAX_SAMPLES) {
+      full = true;
+      break;
+    }
+    // Reading at next_us_: counters of the last edges that preceded it.
+    for(; p < position_edges_.size() && position_edges_[p].tick <= next_us_; p++)
+      position_steps_ = position_edges_[p].steps;
+    for(; a < angle_edges_.size() && angle_edges_[a].tick <= next_us_; a++)
+      angle_steps_ = angle_edges_[a].steps;
+    for(; c < pwm_changes_.size() && pwm_changes_[c].time_us <= next_us_; c++)
+      pwm_ = pwm_changes_[c].pwm;
+    burst.samples[burst.count++] = {next_us_, position_steps_, angle_steps_, pwm_};
+    increment(samples_);
+    next_us_ += period_us_;
+  }
+  // Forget what was sampled. Vectors do not reallocate when shrinking.
+  position_edges_.erase(position_edges_.begin(), position_edges_.begin() + p);
+  angle_edges_.erase(angle_edges_.begin(), angle_edges_.begin() + a);
+  pwm_changes_.erase(pwm_changes_.begin(), pwm_changes_.begin() + c);
+  return full;
+}
+
+
+BurstSampler::Statistics BurstSampler::statistics() const {
+  Statistics stats;
+  stats.samples = samples_.load(std::memory_order_relaxed);
+  stats.late = late_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
+void BurstSampler::addEdge(
+  std::vector<Encoder::Edge>& edges,
+  const Encoder::Edge& edge
+)
+{
+  if(!started_)
+    return;
+  if(edges.size() == EDGE_CAPACITY) {
+    increment(dropped_);
+    return;
+  }
+  // An edge that precedes the last sample can only affect the next one.
+  if(edge.tick + period_us_ <= next_us_)
+    increment(late_);
+  edges.push_back(edge);
+}
+
+}
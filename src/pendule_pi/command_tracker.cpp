@@ -0,0 +1,115 @@
+#include "pendule_pi/command_tracker.hpp"
+#include <algorithm>
+#include <climits>
+
+
+namespace pendule_pi {
+
+static_assert((CommandTracker::HISTORY_SIZE & (CommandTracker::HISTORY_SIZE - 1)) == 0,
+  "CommandTracker::HISTORY_SIZE must be a power of two, so that sequence numbers wrap consistently");
+
+
+CommandTracker::CommandTracker(
+  std::uint64_t max_age_us,
+  StalePolicy policy
+)
+: max_age_us_(max_age_us)
+, policy_(policy)
+, times_{}
+, next_sequence_(0)
+, has_command_(false)
+, deadline_us_(0)
+, commands_(0)
+, stale_(0)
+, expired_(0)
+, latency_us_(Histogram::Logarithmic{4})
+, staleness_(1, HISTORY_SIZE)
+{
+  // nothing else to do here
+}
+
+
+std::uint32_t CommandTracker::published(
+  std::uint64_t time_us
+)
+{
+  const std::uint32_t sequence = next_sequence_++;
+  times_[sequence % HISTORY_SIZE] = time_us;
+  return sequence;
+}
+
+
+bool CommandTracker::received(
+  std::uint32_t state_sequence,
+  std::uint64_t now_us
+)
+{
+  increment(commands_);
+  // Number of states published after the one answered by the command. With
+  // unsigned arithmetic, it is correct across wraps of the sequence numbers,
+  // and huge for sequence numbers that were never published.
+  const std::uint32_t staleness = next_sequence_ - 1 - state_sequence;
+  bool stale = next_sequence_ == 0 || staleness >= HISTORY_SIZE;
+  if(!stale) {
+    const std::uint64_t published_us = times_[state_sequence % HISTORY_SIZE];
+    const std::uint64_t latency = now_us > published_us ? now_us - published_us : 0;
+    latency_us_.add(static_cast<unsigned int>(std::min<std::uint64_t>(latency, UINT_MAX)));
+    staleness_.add(staleness);
+    stale = latency > max_age_us_;
+    if(!stale) {
+      has_command_ = true;
+      deadline_us_ = published_us + max_age_us_;
+      return true;
+    }
+  }
+  increment(stale_);
+  if(policy_ == StalePolicy::Drop)
+    return false;
+  has_command_ = true;
+  deadline_us_ = now_us + max_age_us_;
+  return true;
+}
+
+
+void CommandTracker::receivedUntracked(
+  std::uint64_t now_us
+)
+{
+  increment(commands_);
+  has_command_ = true;
+  deadline_us_ = now_us + max_age_us_;
+}
+
+
+bool CommandTracker::valid(
+  std::uint64_t now_us
+)
+{
+  if(has_command_ && now_us > deadline_us_) {
+    has_command_ = false;
+    increment(expired_);
+  }
+  return has_command_;
+}
+
+
+CommandTracker::Statistics CommandTracker::statistics() const {
+  Statistics stats;
+  stats.commands = commands_.load(std::memory_order_relaxed);
+  stats.stale = stale_.load(std::memory_order_relaxed);
+  stats.expired = expired_.load(std::memory_order_relaxed);
+  stats.latency_us = latency_us_.summary();
+  stats.staleness = staleness_.summary();
+  return stats;
+}
+
+
+void CommandTracker::resetStatistics() {
+  commands_.store(0, std::memory_order_relaxed);
+  stale_.store(0, std::memory_order_relaxed);
+  expired_.store(0, std::memory_order_relaxed);
+  latency_us_.reset();
+  staleness_.reset();
+}
+
+}
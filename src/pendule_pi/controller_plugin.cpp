@@ -0,0 +1,102 @@
+#include "pendule_pi/controller_plugin.hpp"
+#include "pendule_pi/debug.hpp"
+#include <dlfcn.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <stdexcept>
+
+
+namespace pendule_pi {
+
+
+ControllerPlugin::ControllerPlugin(
+  const std::string& path,
+  const std::string& parameters,
+  unsigned int budget_us
+)
+: library_(nullptr)
+, api_(nullptr)
+, instance_(nullptr)
+, budget_us_(budget_us)
+, steps_(0)
+, overruns_(0)
+, failures_(0)
+, saturations_(0)
+, execution_us_(Histogram::Logarithmic{4})
+{
+  // Resolve all symbols now, so that nothing is loaded by the control thread
+  library_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if(library_ == nullptr)
+    throw std::runtime_error("ControllerPlugin: cannot load '" + path + "': " + dlerror());
+  auto entry = reinterpret_cast<pendule_pi_controller_entry>(dlsym(library_, "pendule_pi_controller"));
+  if(entry != nullptr)
+    api_ = entry();
+  if(api_ == nullptr || api_->abi_version != PENDULE_PI_CONTROLLER_ABI_VERSION
+     || api_->init == nullptr || api_->step == nullptr || api_->shutdown == nullptr) {
+    dlclose(library_);
+    throw std::runtime_error("ControllerPlugin: '" + path + "' does not export a compatible controller (ABI version "
+      + std::to_string(PENDULE_PI_CONTROLLER_ABI_VERSION) + " expected)");
+  }
+  name_ = api_->name != nullptr ? api_->name : path;
+  instance_ = api_->init(parameters.c_str());
+  if(instance_ == nullptr) {
+    dlclose(library_);
+    throw std::runtime_error("ControllerPlugin: initialization of '" + name_ + "' failed");
+  }
+  PENDULE_PI_DBG("ControllerPlugin: loaded '" << name_ << "' from " << path << " (budget: " << budget_us << "us)");
+}
+
+
+ControllerPlugin::~ControllerPlugin() {
+  api_->shutdown(instance_);
+  dlclose(library_);
+}
+
+
+int ControllerPlugin::step(
+  const pendule_pi_controller_state& state
+) noexcept
+{
+  int pwm = 0;
+  const auto start = std::chrono::steady_clock::now();
+  const int status = api_->step(instance_, &state, &pwm);
+  const std::uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  increment(steps_);
+  execution_us_.add(static_cast<unsigned int>(std::min<std::uint64_t>(us, UINT_MAX)));
+  if(status != 0) {
+    increment(failures_);
+    return 0;
+  }
+  if(budget_us_ > 0 && us > budget_us_) {
+    increment(overruns_);
+    return 0;
+  }
+  if(pwm < -MAX_PWM || pwm > MAX_PWM) {
+    increment(saturations_);
+    pwm = std::clamp(pwm, -MAX_PWM, MAX_PWM);
+  }
+  return pwm;
+}
+
+
+ControllerPlugin::Statistics ControllerPlugin::statistics() const {
+  Statistics stats;
+  stats.steps = steps_.load(std::memory_order_relaxed);
+  stats.overruns = overruns_.load(std::memory_order_relaxed);
+  stats.failures = failures_.load(std::memory_order_relaxed);
+  stats.saturations = saturations_.load(std::memory_order_relaxed);
+  stats.execution_us = execution_us_.summary();
+  return stats;
+}
+
+
+void ControllerPlugin::resetStatistics() {
+  steps_.store(0, std::memory_order_relaxed);
+  overruns_.store(0, std::memory_order_relaxed);
+  failures_.store(0, std::memory_order_relaxed);
+  saturations_.store(0, std::memory_order_relaxed);
+  execution_us_.reset();
+}
+
+}
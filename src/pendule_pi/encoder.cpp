@@ -9,17 +9,27 @@
 namespace pendule_pi {
 
 
-const std::vector<int> Encoder::ENCODER_TABLE = {0,1,-1,0,-1,0,0,1,1,0,0,-1,0,-1,1,0};
-
-
-int Encoder::encode(
-  bool past_a,
-  bool past_b,
-  bool a,
-  bool b
+namespace {
+
+/// Check ENCODER_TABLE against the rule used by EncoderBank::decode().
+/** A single phase change from `(a',b')` to `(a,b)` is a forward step if
+  * `a' != b`, and a backward one otherwise. Any other transition is null.
+  */
+constexpr bool encoderTableIsConsistent(
+  const std::array<std::int8_t,16>& table
 )
 {
-  return (past_a<<3) | (past_b<<2) | (a<<1) | (b);
+  for(unsigned int idx=0; idx<16; idx++) {
+    const unsigned int past_a = (idx >> 3) & 1, past_b = (idx >> 2) & 1;
+    const unsigned int a = (idx >> 1) & 1, b = idx & 1;
+    const bool single_change = (past_a != a) != (past_b != b);
+    const int expected = single_change ? (past_a != b ? 1 : -1) : 0;
+    if(table[idx] != expected)
+      return false;
+  }
+  return true;
+}
+
 }
 
 
@@ -29,35 +39,39 @@ Encoder::Encoder(
 )
 : pin_a_(gpioA)
 , pin_b_(gpioB)
-, a_current_(0)
-, b_current_(0)
-, a_past_(0)
-, b_past_(0)
+, state_(0)
 , steps_(0)
-, lower_threshold_(0)
-, upper_threshold_(0)
-, lower_cb_(nullptr)
-, upper_cb_(nullptr)
+, direction_(0)
+, dropped_edges_(0)
+, n_edges_(0)
+, illegal_transitions_(0)
+, lost_edges_(0)
+, min_interval_us_(std::numeric_limits<unsigned int>::max())
+, peak_edge_rate_(0)
+, near_sampling_limit_(false)
+, sampling_period_us_(DEFAULT_SAMPLING_PERIOD_US)
+, last_tick_(0)
+, window_start_(0)
+, window_edges_(0)
 {
   PENDULE_PI_DBG("Creating Encoder on pins " << pin_a_ << " and " << pin_b_);
   // Configure the pins using pigpio
-  PiGPIO_RUN_VOID(gpioSetMode, pin_a_, PI_INPUT);
-  PiGPIO_RUN_VOID(gpioSetMode, pin_b_, PI_INPUT);
+  PiGPIO_RUN_VOID(pigpio::backend().setMode, pin_a_, PI_INPUT);
+  PiGPIO_RUN_VOID(pigpio::backend().setMode, pin_b_, PI_INPUT);
 
   // This assumes that the phases are common grounded.
-  PiGPIO_RUN_VOID(gpioSetPullUpDown, pin_a_, PI_PUD_UP);
-  PiGPIO_RUN_VOID(gpioSetPullUpDown, pin_b_, PI_PUD_UP);
+  PiGPIO_RUN_VOID(pigpio::backend().setPullUpDown, pin_a_, PI_PUD_UP);
+  PiGPIO_RUN_VOID(pigpio::backend().setPullUpDown, pin_b_, PI_PUD_UP);
 
   // Setup interrupts so that we handle the rotation without polling.
-  PiGPIO_RUN_VOID(gpioSetAlertFuncEx, pin_a_, Encoder::pulseStatic, this);
-  PiGPIO_RUN_VOID(gpioSetAlertFuncEx, pin_b_, Encoder::pulseStatic, this);
+  useAlerts(true);
 
   // initialize properly the pin reading
   int level; // NOTE: use an int otherwise the comparison 'if(retval<0)' inside PiGPIO_RUN does not make sense!
-  PiGPIO_RUN(level, gpioRead, pin_a_);
-  a_current_ = a_past_ = level;
-  PiGPIO_RUN(level, gpioRead, pin_b_);
-  b_current_ = b_past_ = level;
+  PiGPIO_RUN(level, pigpio::backend().read, pin_a_);
+  state_ = (level != PI_LOW) << 1;
+  PiGPIO_RUN(level, pigpio::backend().read, pin_b_);
+  state_ |= (level != PI_LOW);
   PENDULE_PI_DBG("Encoder created successfully");
 }
 
@@ -65,65 +79,145 @@ Encoder::Encoder(
 Encoder::~Encoder() {
   PENDULE_PI_DBG("Destroying Encoder on pins " << pin_a_ << " and " << pin_b_);
   // Disable interrupts
-  gpioSetAlertFuncEx(pin_a_, nullptr, nullptr);
-  gpioSetAlertFuncEx(pin_b_, nullptr, nullptr);
+  pigpio::backend().setAlertFuncEx(pin_a_, nullptr, nullptr);
+  pigpio::backend().setAlertFuncEx(pin_b_, nullptr, nullptr);
   // Set all pins in high impedance, just in case
-  gpioSetPullUpDown(pin_a_, PI_PUD_OFF);
-  gpioSetPullUpDown(pin_b_, PI_PUD_OFF);
-  gpioSetMode(pin_a_, PI_INPUT);
-  gpioSetMode(pin_b_, PI_INPUT);
+  pigpio::backend().setPullUpDown(pin_a_, PI_PUD_OFF);
+  pigpio::backend().setPullUpDown(pin_b_, PI_PUD_OFF);
+  pigpio::backend().setMode(pin_a_, PI_INPUT);
+  pigpio::backend().setMode(pin_b_, PI_INPUT);
   PENDULE_PI_DBG("Encoder destroyed successfully");
 }
 
 
-void Encoder::setSafetyCallbacks(
-  int lower_threshold,
-  int upper_threshold,
-  std::function<void(void)> lower_cb,
-  std::function<void(void)> upper_cb
+void Encoder::useAlerts(
+  bool enable
+)
+{
+  if(enable) {
+    PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, pin_a_, Encoder::pulseStatic, this);
+    PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, pin_b_, Encoder::pulseStatic, this);
+  }
+  else {
+    PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, pin_a_, nullptr, nullptr);
+    PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, pin_b_, nullptr, nullptr);
+  }
+}
+
+
+std::size_t Encoder::drainEdges(
+  std::vector<Edge>& edges
+)
+{
+  return drainEdges([&](const Edge& edge){ edges.push_back(edge); });
+}
+
+
+Encoder::Diagnostics Encoder::diagnostics() const {
+  Diagnostics diag;
+  diag.edges = n_edges_.load(std::memory_order_relaxed);
+  diag.illegal_transitions = illegal_transitions_.load(std::memory_order_relaxed);
+  diag.lost_edges = lost_edges_.load(std::memory_order_relaxed);
+  diag.min_interval_us = min_interval_us_.load(std::memory_order_relaxed);
+  diag.peak_edge_rate = peak_edge_rate_.load(std::memory_order_relaxed);
+  diag.near_sampling_limit = near_sampling_limit_.load(std::memory_order_relaxed);
+  return diag;
+}
+
+
+void Encoder::resetDiagnostics() {
+  n_edges_ = 0;
+  illegal_transitions_ = 0;
+  lost_edges_ = 0;
+  min_interval_us_ = std::numeric_limits<unsigned int>::max();
+  peak_edge_rate_ = 0;
+  near_sampling_limit_ = false;
+}
+
+
+double Encoder::velocity(
+  unsigned int now
 )
 {
-  lower_threshold_ = lower_threshold;
-  upper_threshold_ = upper_threshold;
-  lower_cb_ = lower_cb;
-  upper_cb_ = upper_cb;
+  drainEdges([](const Edge&){});
+  return velocity_estimator_.estimate(now);
 }
 
 
-void Encoder::removeSafetyCallbacks() {
-  lower_cb_ = nullptr;
-  upper_cb_ = nullptr;
-  lower_threshold_ = std::numeric_limits<int>::min();
-  upper_threshold_ = std::numeric_limits<int>::max();
+void Encoder::pulse(int gpio, int level, unsigned int tick)
+{
+  // Replace the bit of the phase that caused the interrupt: (a<<1) for
+  // pin_a_, b otherwise.
+  const unsigned int shift = (gpio == pin_a_);
+  const unsigned int bit = 1u << shift;
+  decode((state_ & ~bit) | (static_cast<unsigned int>(level != PI_LOW) << shift), tick);
 }
 
 
-void Encoder::pulse(int gpio, int level, unsigned int/*tick*/)
+void Encoder::processLevels(
+  bool a,
+  bool b,
+  unsigned int tick
+)
+{
+  const unsigned int state = (a << 1) | b;
+  if(state == state_)
+    return;
+  decode(state, tick);
+}
+
+
+void Encoder::decode(
+  unsigned int state,
+  unsigned int tick
+)
 {
-  // This is more for debug purposes. I guess this condition should never pass.
-  if(gpio != pin_a_ && gpio != pin_b_) {
-    throw std::runtime_error(
-      "Expected Encoder interrupt on pins " + std::to_string(pin_a_) + " or "
-      + std::to_string(pin_b_) + ", however an interrupt was fired for pin "
-      + std::to_string(gpio)
-    );
+  static_assert(encoderTableIsConsistent(ENCODER_TABLE), "Encoder::ENCODER_TABLE does not match the quadrature rule");
+  // Update the current step count. This is the only thread writing into
+  // steps_, so there is no need for an atomic read-modify-write.
+  const int direction = ENCODER_TABLE[encode(state_, state)];
+  const unsigned int changed = state ^ state_;
+  state_ = state;
+  const int steps = steps_.load(std::memory_order_relaxed) + direction;
+  direction_.store(direction, std::memory_order_relaxed);
+  steps_.store(steps, std::memory_order_relaxed);
+
+  // Update the signal integrity counters. Again, this is the only writer.
+  const unsigned int n_edges = n_edges_.load(std::memory_order_relaxed);
+  if(changed == 0)
+    lost_edges_.store(lost_edges_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  else if(changed == 3)
+    illegal_transitions_.store(illegal_transitions_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  if(n_edges > 0) {
+    const unsigned int interval = tick - last_tick_;
+    if(interval < min_interval_us_.load(std::memory_order_relaxed)) {
+      min_interval_us_.store(interval, std::memory_order_relaxed);
+      if(interval < SAMPLING_MARGIN * sampling_period_us_.load(std::memory_order_relaxed))
+        near_sampling_limit_.store(true, std::memory_order_relaxed);
+    }
+    const unsigned int window = tick - window_start_;
+    if(window >= RATE_WINDOW_US) {
+      const unsigned int rate = static_cast<unsigned int>(1000000ull * window_edges_ / window);
+      if(rate > peak_edge_rate_.load(std::memory_order_relaxed))
+        peak_edge_rate_.store(rate, std::memory_order_relaxed);
+      window_start_ = tick;
+      window_edges_ = 0;
+    }
   }
+  else {
+    window_start_ = tick;
+    window_edges_ = 0;
+  }
+  last_tick_ = tick;
+  window_edges_++;
+  n_edges_.store(n_edges + 1, std::memory_order_relaxed);
+
+  // Make the edge available to consumers
+  if(!edges_.push({pigpio::Clock::extend(tick), steps, direction}))
+    dropped_edges_.fetch_add(1, std::memory_order_relaxed);
 
-  // "Shift in time" the pin states
-  a_past_ = a_current_;
-  b_past_ = b_current_;
-  // update the pint state that caused the interrupt
-  (gpio == pin_a_ ? a_current_ : b_current_) = level;
-
-  // Update the current step count
-  direction_ = ENCODER_TABLE.at(encode(a_past_, b_past_, a_current_, b_current_));
-  steps_ += direction_;
-
-  // execute safety callbacks if needed
-  if(steps_ <= lower_threshold_ && lower_cb_ != nullptr)
-    lower_cb_();
-  if(steps_ >= upper_threshold_ && upper_cb_ != nullptr)
-    upper_cb_();
+  // Check if we moved to another zone
+  thresholds_.update(steps, tick);
 }
 
 
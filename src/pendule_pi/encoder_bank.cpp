@@ -0,0 +1,222 @@
+#include "pendule_pi/encoder_bank.hpp"
+#include "pendule_pi/pigpio.hpp"
+#include "pendule_pi/debug.hpp"
+#include <pigpio.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+namespace pendule_pi {
+
+
+EncoderBank::EncoderBank(
+  const std::vector<PinPair>& channels,
+  bool use_alerts
+)
+: channels_(channels)
+, mask_a_(0)
+, mask_b_(0)
+, levels_(0)
+, past_a_(0)
+, past_b_(0)
+, steps_(channels.size())
+, directions_(channels.size())
+, illegal_(channels.size())
+, tick_(0)
+, sequence_(0)
+{
+  PENDULE_PI_DBG("Creating EncoderBank with " << channels_.size() << " channels");
+  std::fill(std::begin(lane_channel_), std::end(lane_channel_), -1);
+
+  // Validate the pins and build the masks
+  for(std::size_t i=0; i<channels_.size(); i++) {
+    const int pin_a = channels_[i].first;
+    const int pin_b = channels_[i].second;
+    if(pin_a < 0 || pin_a > 31 || pin_b < 0 || pin_b > 31 || pin_a == pin_b) {
+      throw std::runtime_error(
+        "EncoderBank: invalid pins (" + std::to_string(pin_a) + ","
+        + std::to_string(pin_b) + ") for channel " + std::to_string(i)
+        + "; pins must be distinct and between 0 and 31"
+      );
+    }
+    const std::uint32_t bits = (1u << pin_a) | (1u << pin_b);
+    if((mask_a_ | mask_b_) & bits) {
+      throw std::runtime_error(
+        "EncoderBank: the pins of channel " + std::to_string(i)
+        + " are already used by another channel"
+      );
+    }
+    mask_a_ |= 1u << pin_a;
+    mask_b_ |= 1u << pin_b;
+    lane_channel_[pin_a] = static_cast<std::int8_t>(i);
+
+    // Add the channel to the group that shares the same offset between pins
+    const int offset = pin_b - pin_a;
+    const unsigned int right = offset > 0 ? offset : 0;
+    const unsigned int left = offset < 0 ? -offset : 0;
+    auto group = std::find_if(groups_.begin(), groups_.end(), [&](const ShiftGroup& g) {
+      return g.right == right && g.left == left;
+    });
+    if(group == groups_.end())
+      groups_.push_back({right, left, 1u << pin_a});
+    else
+      group->mask |= 1u << pin_a;
+
+    steps_[i] = 0;
+    directions_[i] = 0;
+    illegal_[i] = 0;
+  }
+  PENDULE_PI_DBG("EncoderBank uses " << groups_.size() << " shift group(s)");
+
+  // Configure the pins using pigpio. This assumes that the phases are common
+  // grounded, as in Encoder.
+  for(const auto& ch : channels_) {
+    PiGPIO_RUN_VOID(pigpio::backend().setMode, ch.first, PI_INPUT);
+    PiGPIO_RUN_VOID(pigpio::backend().setMode, ch.second, PI_INPUT);
+    PiGPIO_RUN_VOID(pigpio::backend().setPullUpDown, ch.first, PI_PUD_UP);
+    PiGPIO_RUN_VOID(pigpio::backend().setPullUpDown, ch.second, PI_PUD_UP);
+  }
+
+  // Initialize the reference levels
+  levels_ = pigpio::backend().readBits0to31();
+  lanes(levels_, past_a_, past_b_);
+  tick_ = pigpio::backend().tick();
+
+  if(use_alerts)
+    useAlerts(true);
+  PENDULE_PI_DBG("EncoderBank created successfully");
+}
+
+
+EncoderBank::~EncoderBank() {
+  PENDULE_PI_DBG("Destroying EncoderBank");
+  for(const auto& ch : channels_) {
+    pigpio::backend().setAlertFuncEx(ch.first, nullptr, nullptr);
+    pigpio::backend().setAlertFuncEx(ch.second, nullptr, nullptr);
+    pigpio::backend().setPullUpDown(ch.first, PI_PUD_OFF);
+    pigpio::backend().setPullUpDown(ch.second, PI_PUD_OFF);
+    pigpio::backend().setMode(ch.first, PI_INPUT);
+    pigpio::backend().setMode(ch.second, PI_INPUT);
+  }
+  PENDULE_PI_DBG("EncoderBank destroyed successfully");
+}
+
+
+void EncoderBank::useAlerts(
+  bool enable
+)
+{
+  for(const auto& ch : channels_) {
+    if(enable) {
+      PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, ch.first, EncoderBank::pulseStatic, this);
+      PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, ch.second, EncoderBank::pulseStatic, this);
+    }
+    else {
+      PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, ch.first, nullptr, nullptr);
+      PiGPIO_RUN_VOID(pigpio::backend().setAlertFuncEx, ch.second, nullptr, nullptr);
+    }
+  }
+}
+
+
+void EncoderBank::lanes(
+  std::uint32_t levels,
+  std::uint32_t& a,
+  std::uint32_t& b
+) const
+{
+  a = levels & mask_a_;
+  b = 0;
+  for(const auto& g : groups_)
+    b |= ((levels >> g.right) << g.left) & g.mask;
+}
+
+
+unsigned int EncoderBank::process(
+  std::uint32_t levels,
+  unsigned int tick
+)
+{
+  levels_ = levels;
+  std::uint32_t a, b;
+  lanes(levels, a, b);
+  std::uint32_t forward, backward, illegal;
+  decode(past_a_, past_b_, a, b, forward, backward, illegal);
+  past_a_ = a;
+  past_b_ = b;
+  const unsigned int n_steps = __builtin_popcount(forward | backward);
+
+  // Publish the new counters. This is the only thread writing them, so there
+  // is no need for atomic read-modify-write operations.
+  const unsigned int seq = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for(; forward != 0; forward &= forward - 1) {
+    const int idx = lane_channel_[__builtin_ctz(forward)];
+    steps_[idx].store(steps_[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    directions_[idx].store(1, std::memory_order_relaxed);
+  }
+  for(; backward != 0; backward &= backward - 1) {
+    const int idx = lane_channel_[__builtin_ctz(backward)];
+    steps_[idx].store(steps_[idx].load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    directions_[idx].store(-1, std::memory_order_relaxed);
+  }
+  for(; illegal != 0; illegal &= illegal - 1) {
+    const int idx = lane_channel_[__builtin_ctz(illegal)];
+    illegal_[idx].store(illegal_[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+  tick_.store(tick, std::memory_order_relaxed);
+  sequence_.store(seq + 2, std::memory_order_release);
+  return n_steps;
+}
+
+
+void EncoderBank::update() {
+  const std::uint32_t levels = pigpio::backend().readBits0to31();
+  process(levels, pigpio::backend().tick());
+}
+
+
+void EncoderBank::snapshot(
+  Snapshot& snapshot
+) const
+{
+  snapshot.steps.resize(channels_.size());
+  snapshot.illegal_transitions.resize(channels_.size());
+  unsigned int before, after;
+  do {
+    before = sequence_.load(std::memory_order_acquire);
+    for(std::size_t i=0; i<channels_.size(); i++) {
+      snapshot.steps[i] = steps_[i].load(std::memory_order_relaxed);
+      snapshot.illegal_transitions[i] = illegal_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.tick = tick_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = sequence_.load(std::memory_order_relaxed);
+  } while((before & 1u) || before != after);
+}
+
+
+void EncoderBank::pulse(
+  int gpio,
+  int level,
+  unsigned int tick
+)
+{
+  const std::uint32_t bit = 1u << gpio;
+  process(level ? (levels_ | bit) : (levels_ & ~bit), tick);
+}
+
+
+void EncoderBank::pulseStatic(
+  int gpio,
+  int level,
+  unsigned int tick,
+  void* THIS
+)
+{
+  static_cast<EncoderBank*>(THIS)->pulse(gpio, level, tick);
+}
+
+}
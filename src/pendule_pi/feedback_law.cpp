@@ -0,0 +1,104 @@
+#include "pendule_pi/feedback_law.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+namespace pendule_pi {
+
+
+FeedbackLaw::FeedbackLaw()
+: law_{}
+, loaded_(false)
+, deadline_us_(0)
+, uploads_(0)
+, evaluations_(0)
+, fallbacks_(0)
+, expired_(0)
+{
+  // nothing else to do here
+}
+
+
+bool FeedbackLaw::isValid(
+  const wire::FeedbackLaw& law
+)
+{
+  for(std::size_t i=0; i<4; i++) {
+    if(!std::isfinite(law.gains[i]) || !std::isfinite(law.setpoint[i])
+       || !std::isfinite(law.limits[i]) || law.limits[i] < 0)
+      return false;
+  }
+  return true;
+}
+
+
+void FeedbackLaw::load(
+  const wire::FeedbackLaw& law,
+  std::uint64_t now_us
+)
+{
+  law_ = law;
+  loaded_ = true;
+  deadline_us_ = now_us + law.lifetime_us;
+  increment(uploads_);
+}
+
+
+bool FeedbackLaw::active(
+  std::uint64_t now_us,
+  bool command_valid
+)
+{
+  if(!loaded_)
+    return false;
+  const bool expired = law_.lifetime_us > 0 ? now_us > deadline_us_ : !command_valid;
+  if(expired) {
+    loaded_ = false;
+    increment(expired_);
+  }
+  return loaded_;
+}
+
+
+int FeedbackLaw::evaluate(
+  double position,
+  double angle,
+  double linvel,
+  double angvel
+)
+{
+  increment(evaluations_);
+  const double x[4] = {position, angle, linvel, angvel};
+  double u = 0;
+  for(std::size_t i=0; i<4; i++) {
+    double error = x[i] - law_.setpoint[i];
+    if(i == 1 && (law_.flags & wire::FeedbackLaw::WRAP_ANGLE))
+      error = std::remainder(error, 2*M_PI);
+    if(law_.limits[i] > 0 && std::fabs(error) > law_.limits[i]) {
+      increment(fallbacks_);
+      return law_.pwm;
+    }
+    u -= law_.gains[i] * error;
+  }
+  return static_cast<int>(std::lround(std::clamp<double>(u, -MAX_PWM, MAX_PWM)));
+}
+
+
+FeedbackLaw::Statistics FeedbackLaw::statistics() const {
+  Statistics stats;
+  stats.uploads = uploads_.load(std::memory_order_relaxed);
+  stats.evaluations = evaluations_.load(std::memory_order_relaxed);
+  stats.fallbacks = fallbacks_.load(std::memory_order_relaxed);
+  stats.expired = expired_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
+void FeedbackLaw::resetStatistics() {
+  uploads_.store(0, std::memory_order_relaxed);
+  evaluations_.store(0, std::memory_order_relaxed);
+  fallbacks_.store(0, std::memory_order_relaxed);
+  expired_.store(0, std::memory_order_relaxed);
+}
+
+}
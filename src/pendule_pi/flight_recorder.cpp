@@ -0,0 +1,359 @@
+#include "pendule_pi/flight_recorder.hpp"
+#include "pendule_pi/debug.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+
+
+namespace pendule_pi {
+
+// The layout is mirrored by src/python/flight_record.py.
+static_assert(sizeof(FlightRecorder::Record) == 112 && offsetof(FlightRecorder::Record, flags) == 104,
+  "FlightRecorder: the layout of the records must not contain padding");
+static_assert(sizeof(FlightRecorder::FileHeader) == 64 && offsetof(FlightRecorder::FileHeader, count) == 24,
+  "FlightRecorder: the layout of the header must not contain padding");
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free && sizeof(std::atomic<std::uint64_t>) == 8,
+  "FlightRecorder: the record counter must be a plain 64 bits word");
+
+namespace {
+
+/// Period of the background thread.
+static constexpr auto BACKGROUND_PERIOD = std::chrono::milliseconds(100);
+
+
+/// Write a whole buffer to a file.
+bool writeAll(
+  int fd,
+  const void* data,
+  std::size_t size
+)
+{
+  auto p = static_cast<const char*>(data);
+  while(size > 0) {
+    const ssize_t n = write(fd, p, size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+
+/// Store the number of records in the header of a file.
+void writeCount(
+  int fd,
+  std::uint64_t count
+)
+{
+  if(pwrite(fd, &count, sizeof(count), offsetof(FlightRecorder::FileHeader, count)) != sizeof(count))
+    PENDULE_PI_WRN("FlightRecorder: cannot update the header of a file: " << std::strerror(errno));
+}
+
+} // end of anonymous namespace
+
+
+FlightRecorder::Parameters::Parameters()
+: directory("./flight_recorder")
+, ring_name("pendule_pi_flight_recorder")
+, ring_seconds(60)
+, file_mb(64)
+, max_files(16)
+, snapshot_seconds(10)
+{
+  // nothing else to do here
+}
+
+
+FlightRecorder::FlightRecorder(
+  const Parameters& params,
+  unsigned int period_us
+)
+: params_(params)
+, period_us_(period_us)
+, capacity_(std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(1e6 * params.ring_seconds / period_us))))
+, ring_path_("/dev/shm/" + params.ring_name)
+, memory_(nullptr)
+, memory_size_(sizeof(FileHeader) + capacity_ * sizeof(Record))
+, header_(nullptr)
+, records_(nullptr)
+, written_(0)
+, triggers_(0)
+, trigger_count_(0)
+, running_(true)
+, archived_(0)
+, lost_(0)
+, snapshots_(0)
+, files_(0)
+, archive_fd_(-1)
+, archive_count_(0)
+, next_archived_(0)
+{
+  if(mkdir(params_.directory.c_str(), 0755) != 0 && errno != EEXIST)
+    throw std::runtime_error("FlightRecorder: cannot create the directory '" + params_.directory + "': " + std::strerror(errno));
+  // The ring lives in tmpfs: a file on a storage device would be written
+  // back by the kernel, and the next store of the control thread to a page
+  // written back would wait for the device.
+  const std::string name = "/" + params_.ring_name;
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+  if(fd < 0)
+    throw std::runtime_error("FlightRecorder: cannot create '" + ring_path_ + "': " + std::strerror(errno));
+  // Allocate the pages now: writing to a sparse mapping could fail later.
+  const int err = posix_fallocate(fd, 0, memory_size_);
+  if(err != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("FlightRecorder: cannot allocate '" + ring_path_ + "': " + std::strerror(err));
+  }
+  // Populate the mapping, so that the control thread does not page-fault.
+  memory_ = mmap(nullptr, memory_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  const int map_err = errno;
+  close(fd);
+  if(memory_ == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    throw std::runtime_error("FlightRecorder: cannot map '" + ring_path_ + "': " + std::strerror(map_err));
+  }
+  // Nor should it be swapped out (this is already the case if the process
+  // locked all its memory).
+  if(mlock(memory_, memory_size_) != 0)
+    PENDULE_PI_WRN("FlightRecorder: cannot lock the ring in memory: " << std::strerror(errno));
+  header_ = new(memory_) FileHeader;
+  std::memcpy(header_->magic, MAGIC, sizeof(header_->magic));
+  header_->version = VERSION;
+  header_->record_size = sizeof(Record);
+  header_->capacity = capacity_;
+  header_->count.store(0, std::memory_order_relaxed);
+  header_->period_us = period_us_;
+  header_->start_us = 0;
+  std::memset(header_->reserved, 0, sizeof(header_->reserved));
+  records_ = reinterpret_cast<Record*>(static_cast<char*>(memory_) + sizeof(FileHeader));
+  thread_ = std::thread(&FlightRecorder::run, this);
+}
+
+
+FlightRecorder::~FlightRecorder() {
+  running_.store(false, std::memory_order_relaxed);
+  thread_.join();
+  // The ring is left in /dev/shm, to be inspected after the interface exited.
+  munmap(memory_, memory_size_);
+}
+
+
+void FlightRecorder::record(
+  const Record& record
+) noexcept
+{
+  if(written_ == 0)
+    header_->start_us = record.time_us;
+  std::memcpy(&records_[written_ % capacity_], &record, sizeof(Record));
+  written_++;
+  // Readers check the counter before and after copying a record.
+  header_->count.store(written_, std::memory_order_release);
+}
+
+
+void FlightRecorder::trigger() noexcept {
+  trigger_count_.store(header_->count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  triggers_.fetch_add(1, std::memory_order_release);
+}
+
+
+FlightRecorder::Statistics FlightRecorder::statistics() const {
+  Statistics stats;
+  stats.records = header_->count.load(std::memory_order_relaxed);
+  stats.archived = archived_.load(std::memory_order_relaxed);
+  stats.lost = lost_.load(std::memory_order_relaxed);
+  stats.snapshots = snapshots_.load(std::memory_order_relaxed);
+  stats.files = files_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
+void FlightRecorder::run() {
+  // Leave the real-time scheduler and CPUs of the control thread.
+  sched_param param;
+  param.sched_priority = 0;
+  pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  if(!params_.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(const auto& cpu : params_.cpus)
+      if(cpu >= 0 && cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &set);
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(err != 0)
+      PENDULE_PI_WRN("FlightRecorder: cannot set the CPU affinity of the background thread: " << std::strerror(err));
+  }
+  std::uint32_t snapshots_done = 0;
+  while(true) {
+    const bool last = !running_.load(std::memory_order_relaxed);
+    if(params_.file_mb > 0)
+      archive();
+    // Several triggers in a row give a single snapshot.
+    const std::uint32_t triggers = triggers_.load(std::memory_order_acquire);
+    if(triggers != snapshots_done) {
+      snapshots_done = triggers;
+      snapshot(trigger_count_.load(std::memory_order_relaxed));
+    }
+    if(last)
+      break;
+    std::this_thread::sleep_for(BACKGROUND_PERIOD);
+  }
+  if(archive_fd_ >= 0) {
+    writeCount(archive_fd_, archive_count_);
+    close(archive_fd_);
+  }
+}
+
+
+void FlightRecorder::archive() {
+  std::vector<Record> records;
+  const std::uint64_t first = copy(next_archived_, records);
+  if(first > next_archived_)
+    lost_.fetch_add(first - next_archived_, std::memory_order_relaxed);
+  next_archived_ = first + records.size();
+  const std::uint64_t max_records = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(1e6 * params_.file_mb / sizeof(Record)));
+  std::size_t i = 0;
+  while(i < records.size()) {
+    // Start a new file when needed, and remove the oldest ones.
+    if(archive_fd_ < 0 || archive_count_ >= max_records) {
+      if(archive_fd_ >= 0) {
+        writeCount(archive_fd_, archive_count_);
+        close(archive_fd_);
+      }
+      const std::string path = newFileName("flight", files_.load(std::memory_order_relaxed));
+      archive_fd_ = createFile(path, records[i].time_us);
+      archive_count_ = 0;
+      if(archive_fd_ < 0)
+        return;
+      files_.fetch_add(1, std::memory_order_relaxed);
+      archive_files_.push_back(path);
+      while(params_.max_files > 0 && archive_files_.size() > params_.max_files) {
+        unlink(archive_files_.front().c_str());
+        archive_files_.pop_front();
+      }
+    }
+    const std::size_t n = std::min<std::uint64_t>(records.size() - i, max_records - archive_count_);
+    if(!writeAll(archive_fd_, records.data() + i, n * sizeof(Record))) {
+      PENDULE_PI_WRN("FlightRecorder: cannot write to an archive file: " << std::strerror(errno));
+      close(archive_fd_);
+      archive_fd_ = -1;
+      return;
+    }
+    archive_count_ += n;
+    archived_.fetch_add(n, std::memory_order_relaxed);
+    i += n;
+  }
+  if(archive_fd_ >= 0 && !records.empty())
+    writeCount(archive_fd_, archive_count_);
+}
+
+
+void FlightRecorder::snapshot(
+  std::uint64_t end
+)
+{
+  const std::uint64_t length = static_cast<std::uint64_t>(std::ceil(1e6 * params_.snapshot_seconds / period_us_));
+  std::vector<Record> records;
+  const std::uint64_t first = copy(end > length ? end - length : 0, records);
+  // Drop the records written after the trigger.
+  records.resize(end > first ? std::min<std::uint64_t>(end - first, records.size()) : 0);
+  const std::string path = newFileName("snapshot", snapshots_.load(std::memory_order_relaxed));
+  const int fd = createFile(path, records.empty() ? 0 : records.front().time_us);
+  if(fd < 0)
+    return;
+  if(!writeAll(fd, records.data(), records.size() * sizeof(Record)))
+    PENDULE_PI_WRN("FlightRecorder: cannot write the snapshot '" << path << "': " << std::strerror(errno));
+  writeCount(fd, records.size());
+  close(fd);
+  snapshots_.fetch_add(1, std::memory_order_relaxed);
+  PENDULE_PI_DBG("FlightRecorder: snapshot of " << records.size() << " records written to " << path);
+}
+
+
+std::uint64_t FlightRecorder::copy(
+  std::uint64_t first,
+  std::vector<Record>& out
+) const
+{
+  const std::uint64_t count = header_->count.load(std::memory_order_acquire);
+  // Records older than the capacity were overwritten, and the oldest one
+  // may be being overwritten by the record that follows the last one.
+  if(count + 1 > capacity_ && first < count + 1 - capacity_)
+    first = count + 1 - capacity_;
+  out.clear();
+  if(first >= count)
+    return first;
+  out.resize(count - first);
+  for(std::uint64_t i=first; i<count; i++)
+    std::memcpy(&out[i - first], &records_[i % capacity_], sizeof(Record));
+  // The control thread may have overwritten the oldest records meanwhile.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t now = header_->count.load(std::memory_order_relaxed);
+  if(now + 1 > capacity_ && now + 1 - capacity_ > first) {
+    const std::uint64_t overwritten = std::min(now + 1 - capacity_ - first, count - first);
+    out.erase(out.begin(), out.begin() + overwritten);
+    first += overwritten;
+  }
+  return first;
+}
+
+
+int FlightRecorder::createFile(
+  const std::string& path,
+  std::uint64_t start_us
+) const
+{
+  const int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if(fd < 0) {
+    PENDULE_PI_WRN("FlightRecorder: cannot create '" << path << "': " << std::strerror(errno));
+    return -1;
+  }
+  FileHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.record_size = sizeof(Record);
+  header.capacity = 0;
+  header.count.store(0, std::memory_order_relaxed);
+  header.period_us = period_us_;
+  header.start_us = start_us;
+  std::memset(header.reserved, 0, sizeof(header.reserved));
+  if(!writeAll(fd, &header, sizeof(header))) {
+    PENDULE_PI_WRN("FlightRecorder: cannot write to '" << path << "': " << std::strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+std::string FlightRecorder::newFileName(
+  const std::string& prefix,
+  std::uint64_t index
+) const
+{
+  const std::time_t now = std::time(nullptr);
+  std::tm local;
+  localtime_r(&now, &local);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &local);
+  return params_.directory + "/" + prefix + "_" + date + "_" + std::to_string(index) + ".rec";
+}
+
+}
@@ -0,0 +1,140 @@
+#include "pendule_pi/histogram.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+namespace pendule_pi {
+
+
+Histogram::Histogram(
+  unsigned int bin_width,
+  std::size_t n_bins
+)
+: bin_width_(bin_width)
+, precision_bits_(0)
+, n_bins_(n_bins)
+, bins_(new std::atomic<std::uint64_t>[n_bins+1])
+{
+  if(bin_width_ == 0 || n_bins_ == 0)
+    throw std::runtime_error("Histogram: the bin width and the number of bins must be positive");
+  reset();
+}
+
+
+Histogram::Histogram(
+  Logarithmic scale
+)
+: bin_width_(0)
+, precision_bits_(scale.precision_bits)
+, n_bins_(static_cast<std::size_t>(33 - std::min(scale.precision_bits, 8u)) << std::min(scale.precision_bits, 8u))
+, bins_(new std::atomic<std::uint64_t>[n_bins_+1])
+{
+  if(precision_bits_ > 8)
+    throw std::runtime_error("Histogram: the precision of a logarithmic histogram must be at most 8 bits");
+  reset();
+}
+
+
+void Histogram::reset() {
+  for(std::size_t i=0; i<=n_bins_; i++)
+    bins_[i] = 0;
+  count_ = 0;
+  sum_ = 0;
+  min_ = std::numeric_limits<unsigned int>::max();
+  max_ = 0;
+}
+
+
+std::uint64_t Histogram::lowerBound(
+  std::size_t bin
+) const
+{
+  if(bin_width_ > 0)
+    return static_cast<std::uint64_t>(std::min(bin, n_bins_)) * bin_width_;
+  if(bin < (1u << precision_bits_))
+    return bin;
+  const std::size_t shift = (bin >> precision_bits_) - 1;
+  const std::uint64_t mantissa = (1u << precision_bits_) + (bin & ((1u << precision_bits_) - 1));
+  return mantissa << shift;
+}
+
+
+std::uint64_t Histogram::upperBound(
+  std::size_t bin
+) const
+{
+  if(bin >= n_bins_)
+    return static_cast<std::uint64_t>(std::numeric_limits<unsigned int>::max()) + 1;
+  return lowerBound(bin+1);
+}
+
+
+unsigned int Histogram::min() const {
+  return count() == 0 ? 0 : min_.load(std::memory_order_relaxed);
+}
+
+
+double Histogram::mean() const {
+  const auto n = count();
+  return n == 0 ? 0.0 : static_cast<double>(sum_.load(std::memory_order_relaxed)) / n;
+}
+
+
+unsigned int Histogram::percentile(
+  double q
+) const
+{
+  return percentile(bins(), q);
+}
+
+
+Histogram::Summary Histogram::summary() const {
+  const auto copy = bins();
+  Summary s;
+  s.count = count();
+  s.overflows = copy[n_bins_];
+  s.min = min();
+  s.max = max();
+  s.mean = mean();
+  s.p50 = percentile(copy, 0.5);
+  s.p99 = percentile(copy, 0.99);
+  s.p999 = percentile(copy, 0.999);
+  return s;
+}
+
+
+std::vector<std::uint64_t> Histogram::bins() const {
+  std::vector<std::uint64_t> copy(n_bins_+1);
+  for(std::size_t i=0; i<=n_bins_; i++)
+    copy[i] = bins_[i].load(std::memory_order_relaxed);
+  return copy;
+}
+
+
+unsigned int Histogram::percentile(
+  const std::vector<std::uint64_t>& bins,
+  double q
+) const
+{
+  std::uint64_t total = 0;
+  for(const auto& n : bins)
+    total += n;
+  if(total == 0)
+    return 0;
+  // Rank of the requested sample, starting from 1
+  const double clamped = std::min(std::max(q, 0.0), 1.0);
+  const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(clamped * total)));
+  std::uint64_t cumulated = 0;
+  std::size_t bin = 0;
+  for(; bin<bins.size(); bin++) {
+    cumulated += bins[bin];
+    if(cumulated >= rank)
+      break;
+  }
+  const std::uint64_t largest = std::min<std::uint64_t>(upperBound(bin) - 1, max());
+  return static_cast<unsigned int>(std::max<std::uint64_t>(largest, min()));
+}
+
+}
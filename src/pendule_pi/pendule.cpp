@@ -1,7 +1,11 @@
 #include "pendule_pi/pendule.hpp"
+#include "pendule_pi/burst_sampler.hpp"
 #include "pendule_pi/pigpio.hpp"
 #include "pendule_pi/debug.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <thread>
 #include <cmath>
 
@@ -70,6 +74,8 @@ Pendule::Pendule(
 )
 : calibrated_(false)
 , emergency_stopped_(false)
+, stop_reason_(nullptr)
+, velocity_estimation_(VelocityEstimation::FiniteDifferences)
 , meters_per_step_(meters_per_step/4)
 , radians_per_step_(radians_per_step/4)
 , rest_angle_(rest_angle)
@@ -81,6 +87,8 @@ Pendule::Pendule(
 , right_switch_(std::move(right_switch))
 , position_encoder_(std::move(position_encoder))
 , angle_encoder_(std::move(angle_encoder))
+, burst_sampler_(nullptr)
+, safety_monitor_(std::make_unique<SafetyMonitor>([this](const SafetyMonitor::Event& e){ onSafetyEvent(e); }))
 {
   PENDULE_PI_DBG("Creating Pendule object");
   // Default pin connections, in case we need to create any instance here
@@ -99,6 +107,19 @@ Pendule::Pendule(
 }
 
 
+Pendule::~Pendule() {
+  PENDULE_PI_DBG("Destroying Pendule object");
+  // Safety callbacks post to safety_monitor_, which is destroyed first: make
+  // sure that nobody calls them anymore.
+  sample_decoder_.reset();
+  position_encoder_->thresholds().clear();
+  angle_encoder_->thresholds().clear();
+  left_switch_->disableInterrupts();
+  right_switch_->disableInterrupts();
+  PENDULE_PI_DBG("Pendule object destroyed");
+}
+
+
 void Pendule::calibrate(
   double safety_margin_meters
 )
@@ -115,26 +136,30 @@ void Pendule::calibrate(
   if(!right_switch_->atRest())
     throw CalibrationFailed("right switch is not at rest");
   // Reset all callbacks
-  position_encoder_->removeSafetyCallbacks();
-  angle_encoder_->removeSafetyCallbacks();
+  position_encoder_->thresholds().clear();
+  angle_encoder_->thresholds().clear();
   left_switch_->disableInterrupts();
   right_switch_->disableInterrupts();
   // Calibrate the angle encoder. It simpli means that we want to ensure that
   // it is static and that its initial position is zero!
   const int angle_steps = angle_encoder_->steps();
-  bool moving = false;
-  angle_encoder_->setSafetyCallbacks(
-    angle_steps-1,
-    angle_steps+1,
-    [&](){ moving=true; }
-  );
+  // The callback runs on the pigpio thread and may still be executing after
+  // clear() returns (or outlive this call if we throw), hence the flag is
+  // shared with it instead of living on this stack frame.
+  auto moving = std::make_shared<std::atomic<bool>>(false);
+  auto moving_cb = [moving](const ThresholdEngine::Event&){ *moving = true; };
+  angle_encoder_->thresholds().setZones({
+    {INT_MIN, moving_cb},
+    {angle_steps, nullptr},
+    {angle_steps+1, moving_cb}
+  });
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-  if(moving)
+  if(*moving)
     throw CalibrationFailed("the pendulum is moving");
   if(angle_encoder_->steps() != 0)
     throw CalibrationFailed("the angle encoder is at a non-zero position");
   // Remove callbacks on the angle encoder
-  angle_encoder_->removeSafetyCallbacks();
+  angle_encoder_->thresholds().clear();
   // prepare some auxiliary callbacks used to reach the switches
   const int calibration_pwm = 40;
   bool wrong_switch = false;
@@ -199,17 +224,16 @@ void Pendule::calibrate(
   }
   motor_->setPWM(0);
   // Ok, we are in the central position!
-  left_switch_->enableInterrupts([&](){ eStop("left switch hit"); });
-  right_switch_->enableInterrupts([&](){ eStop("right switch hit"); });
+  left_switch_->enableInterrupts([this](){ postSafetyEvent(left_switch_->lastTick(), "left switch hit"); });
+  right_switch_->enableInterrupts([this](){ postSafetyEvent(right_switch_->lastTick(), "right switch hit"); });
   int safety_margin_steps = static_cast<int>(std::ceil(std::fabs(safety_margin_meters/meters_per_step_)));
   int soft_min = min_position_steps_ + safety_margin_steps;
   int soft_max = max_position_steps_ - safety_margin_steps;
-  position_encoder_->setSafetyCallbacks(
-    soft_min,
-    soft_max,
-    [&](){ eStop("soft minimum position limit reached"); },
-    [&](){ eStop("soft maximum position limit reached"); }
-  );
+  position_encoder_->thresholds().setZones({
+    {INT_MIN, [this](const ThresholdEngine::Event& e){ postSafetyEvent(e.tick, "soft minimum position limit reached"); }},
+    {soft_min+1, nullptr},
+    {soft_max, [this](const ThresholdEngine::Event& e){ postSafetyEvent(e.tick, "soft maximum position limit reached"); }}
+  });
   soft_minmax_position_meters_ = std::fabs(steps2meters(soft_max));
   calibrated_ = true;
   PENDULE_PI_DBG("Calibration completed!");
@@ -222,22 +246,86 @@ void Pendule::calibrate(
 }
 
 
-void Pendule::update(
+bool Pendule::update(
   double dt
 )
 {
-  if(emergency_stopped_)
-    throw std::runtime_error("Pendule::update(): eStop() has been called");
+  if(isStopped())
+    return false;
   if(!calibrated_)
     throw NotCalibrated("Pendule::update()");
   // Get raw encoder reading
   double new_position = steps2meters(position_encoder_->steps());
   double new_angle = steps2radians(angle_encoder_->steps());
-  // State estimation: TODO!
-  linvel_ = (new_position-position_) / dt;
-  angvel_ = (new_angle-angle_) / dt;
+  // Edge-based velocities. They are always evaluated, so that the encoder
+  // buffers are drained regularly even when they are not used.
+  if(burst_sampler_ != nullptr) {
+    // Every drained edge also reaches the sampler.
+    position_encoder_->drainEdges([this](const Encoder::Edge& e) { burst_sampler_->addPositionEdge(e); });
+    angle_encoder_->drainEdges([this](const Encoder::Edge& e) { burst_sampler_->addAngleEdge(e); });
+  }
+  else {
+    position_encoder_->drainEdges([](const Encoder::Edge&){});
+    angle_encoder_->drainEdges([](const Encoder::Edge&){});
+  }
+  // Read the time after draining, so that no edge is newer.
+  const unsigned int now = pigpio::backend().tick();
+  const double edge_linvel = meters_per_step_ * position_encoder_->velocityEstimator().estimate(now);
+  const double edge_angvel = radians_per_step_ * angle_encoder_->velocityEstimator().estimate(now);
+  if(velocity_estimation_ == VelocityEstimation::EdgeTiming) {
+    linvel_ = edge_linvel;
+    angvel_ = edge_angvel;
+  }
+  else {
+    linvel_ = (new_position-position_) / dt;
+    angvel_ = (new_angle-angle_) / dt;
+  }
   position_ = new_position;
   angle_ = new_angle;
+  // Zone changes are handled by the callbacks set in calibrate(): here, the
+  // events are simply consumed (and logged in debug mode). Logging is done
+  // here rather than by the engine, whose update() runs in the edge callback.
+  position_encoder_->thresholds().drainEvents([](const ThresholdEngine::Event& e) {
+    if(e.from == e.to) {
+      PENDULE_PI_DBG("Position encoder: new zone configuration adopted, current zone: " << e.to << " (steps: " << e.steps << ")");
+    }
+    else {
+      PENDULE_PI_DBG("Position encoder: zone " << e.from << " -> " << e.to << " at tick " << e.tick << " (steps: " << e.steps << ")");
+    }
+  });
+  angle_encoder_->thresholds().drainEvents([](const ThresholdEngine::Event& e) {
+    if(e.from == e.to) {
+      PENDULE_PI_DBG("Angle encoder: new zone configuration adopted, current zone: " << e.to << " (steps: " << e.steps << ")");
+    }
+    else {
+      PENDULE_PI_DBG("Angle encoder: zone " << e.from << " -> " << e.to << " at tick " << e.tick << " (steps: " << e.steps << ")");
+    }
+  });
+  return true;
+}
+
+
+void Pendule::setVelocityEstimation(
+  VelocityEstimation method,
+  const VelocityEstimator::Parameters& params
+)
+{
+  velocity_estimation_ = method;
+  position_encoder_->velocityEstimator().setParameters(params);
+  angle_encoder_->velocityEstimator().setParameters(params);
+}
+
+
+void Pendule::enableSampleDecoding() {
+  if(sample_decoder_ != nullptr)
+    return;
+  PENDULE_PI_DBG("Switching Pendule to batched sample decoding");
+  sample_decoder_ = std::make_unique<SampleDecoder>();
+  sample_decoder_->addEncoder(*position_encoder_);
+  sample_decoder_->addEncoder(*angle_encoder_);
+  sample_decoder_->addSwitch(*left_switch_);
+  sample_decoder_->addSwitch(*right_switch_);
+  sample_decoder_->start();
 }
 
 
@@ -245,11 +333,17 @@ bool Pendule::setCommand(
   int pwm
 )
 {
-  if(emergency_stopped_)
-    throw std::runtime_error("Pendule::setCommand(): eStop() has been called");
+  if(isStopped())
+    return false;
   if(!calibrated_)
     throw NotCalibrated("Pendule::setCommand()");
   bool retval = true;
+  // Saturate before adding the offsets: commands may come from the network
+  // or from plugins, and take any value.
+  if(pwm > 255 || pwm < -255) {
+    pwm = std::clamp(pwm, -255, 255);
+    retval = false;
+  }
   if(pwm != 0) {
     if(pwm > 0)
       pwm += offset_up_;
@@ -265,6 +359,12 @@ bool Pendule::setCommand(
     }
   }
   motor_->setPWM(pwm);
+  // The safety monitor might have turned the motor off between the first
+  // check and the write above: never let our command win.
+  if(emergency_stopped_.load()) {
+    motor_->setPWM(0);
+    return false;
+  }
   return retval;
 }
 
@@ -307,13 +407,50 @@ void Pendule::setPwmOffsets(
 }
 
 
+void Pendule::setSamplingPeriod(
+  unsigned int us
+)
+{
+  position_encoder_->setSamplingPeriod(us);
+  angle_encoder_->setSamplingPeriod(us);
+}
+
+
 void Pendule::eStop(
-  const std::string& why
+  const char* why
+)
+{
+  postSafetyEvent(pigpio::backend().tick(), why);
+}
+
+
+std::string Pendule::stopReason() const {
+  const char* reason = stop_reason_.load(std::memory_order_acquire);
+  return reason == nullptr ? std::string() : std::string(reason);
+}
+
+
+void Pendule::postSafetyEvent(
+  unsigned int tick,
+  const char* why
+)
+{
+  // If the queue is full, the monitor is already busy turning the motor off:
+  // at least make sure that no further command goes through.
+  if(!safety_monitor_->post(tick, why))
+    emergency_stopped_.store(true);
+}
+
+
+void Pendule::onSafetyEvent(
+  const SafetyMonitor::Event& event
 )
 {
+  // Flag first, so that setCommand() cannot turn the motor back on
+  if(stop_reason_.load(std::memory_order_relaxed) == nullptr)
+    stop_reason_.store(event.reason, std::memory_order_release);
+  emergency_stopped_.store(true);
   motor_->setPWM(0);
-  emergency_stopped_ = true;
-  throw EmergencyStop(why);
 }
 
 
@@ -1,6 +1,13 @@
 #include <pendule_pi/pendule_cpp.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <sstream>
-#include <thread>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 namespace pendule_pi {
 
@@ -22,6 +29,45 @@ PenduleCpp::PenduleCpp(
   const std::string& command_port,
   int wait
 )
+{
+  connectTcp(host, state_port, command_port);
+  waitForInterface(wait);
+}
+
+
+PenduleCpp::PenduleCpp(
+  const std::string& uri,
+  int wait
+)
+{
+  const std::string shm_prefix = ShmChannel::URI_PREFIX;
+  const std::string tcp_prefix = "tcp://";
+  if(uri.compare(0, shm_prefix.size(), shm_prefix) == 0) {
+    shm_name_ = uri.substr(shm_prefix.size());
+    if(shm_name_.empty())
+      throw std::runtime_error("PenduleCpp: missing shared memory name in '" + uri + "'");
+  }
+  else if(uri.compare(0, tcp_prefix.size(), tcp_prefix) == 0) {
+    // Split "host[:state_port[:command_port]]"
+    std::string parts[3] = {"", DEFAULT_STATE_PORT, DEFAULT_COMMAND_PORT};
+    std::istringstream iss(uri.substr(tcp_prefix.size()));
+    for(int i=0; i<3 && std::getline(iss, parts[i], ':'); i++) { }
+    if(parts[0].empty() || parts[1].empty() || parts[2].empty() || !iss.eof())
+      throw std::runtime_error("PenduleCpp: invalid URI '" + uri + "'");
+    connectTcp(parts[0], parts[1], parts[2]);
+  }
+  else {
+    throw std::runtime_error("PenduleCpp: unknown transport in '" + uri + "' (expected shm:// or tcp://)");
+  }
+  waitForInterface(wait);
+}
+
+
+void PenduleCpp::connectTcp(
+  const std::string& host,
+  const std::string& state_port,
+  const std::string& command_port
+)
 {
   // Connect to the sockets to exchange data with the low-level interface.
   context_ = std::make_unique<zmqpp::context>();
@@ -31,37 +77,39 @@ PenduleCpp::PenduleCpp(
   state_sub_->subscribe("");
   command_pub_ = std::make_unique<zmqpp::socket>(*context_, zmqpp::socket_type::publish);
   command_pub_->connect("tcp://" + host + ":" + command_port);
+}
+
 
-  // TODO: wait for connection to be established.
-  // Wait for the low-level interface to be up and running.
-  if(wait <= 0) {
-    // Wait indefinitely for the first message.
-    readState(BLOCKING);
+void PenduleCpp::waitForInterface(
+  int wait
+)
+{
+  // Wait for the low-level interface to be up and running. The first state
+  // wakes us up, so that this only takes about one period of the interface.
+  if(!waitForState(wait > 0 ? wait : -1)) {
+    throw std::runtime_error("PenduleCpp: failed to establish a connection "
+      "with the low-level interface within the allotted time.");
   }
-  else {
-    // Wait for the given amount of time.
-    int elapsed = 0;
-    while(elapsed < wait) {
-      // Wait one second.
-      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-      // Check if it is possible to read a message.
-      if(readState(NON_BLOCKING)) {
-        // A message was received: exit!
-        break;
-      }
-      elapsed += 1;
-      // Did we exit due to a received message? If not, throw!
-      if(elapsed >= wait) {
-        throw std::runtime_error("PenduleCpp: failed to establish a connection "
-          "with the low-level interface within the allotted time.");
-      }
-    }
+}
+
+
+bool PenduleCpp::connectShm() {
+  if(shm_)
+    return true;
+  try {
+    shm_ = std::make_unique<ShmChannel>(shm_name_, ShmChannel::OPEN);
+  }
+  catch(const ShmChannel::NotFound&) {
+    return false;
   }
+  return true;
 }
 
 
 PenduleCpp::~PenduleCpp()
 {
+  stopReceiver();
+  shm_.reset();
   state_sub_.reset();
   command_pub_.reset();
   context_.reset();
@@ -72,28 +120,346 @@ bool PenduleCpp::readState(
   bool blocking
 )
 {
+  // The receiver thread already did the work.
+  if(receiving())
+    return blocking ? waitForState(-1) : takeLatestState();
+  State state;
+  if(!receiveState(blocking, state))
+    return false;
+  setState(state);
+  return true;
+}
+
+
+bool PenduleCpp::waitForState(
+  double timeout
+)
+{
+  using Clock = std::chrono::steady_clock;
+  const auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(std::max(timeout, 0.0)));
+  // Time left before the deadline in microseconds, negative to wait indefinitely.
+  auto remaining_us = [&]() -> long {
+    if(timeout < 0)
+      return -1;
+    return std::max<long>(std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now()).count(), 0);
+  };
+  // zmq_poll() timeouts are in milliseconds: round up, so as not to spin.
+  auto poll_timeout_ms = [](long timeout_us) -> long {
+    return timeout_us < 0 ? zmqpp::poller::wait_forever : (timeout_us + 999) / 1000;
+  };
+
+  // Receiver thread: sleep until it signals a state (or an error).
+  if(receiving()) {
+    zmqpp::poller poller;
+    poller.add(state_fd_);
+    while(!takeLatestState()) {
+      const long timeout_us = remaining_us();
+      if(timeout_us == 0)
+        return false;
+      poller.poll(poll_timeout_ms(timeout_us));
+      if(poller.has_input(state_fd_)) {
+        std::uint64_t count;
+        [[maybe_unused]] const auto n_read = read(state_fd_, &count, sizeof(count));
+      }
+    }
+    return true;
+  }
+  // Shared memory: sleep on the futex of the channel, once the interface created it.
+  if(!shm_name_.empty()) {
+    while(!readState(NON_BLOCKING)) {
+      const long timeout_us = remaining_us();
+      if(timeout_us == 0)
+        return false;
+      if(shm_)
+        shm_->waitState(timeout_us);
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(timeout_us < 0 ? 10000 : std::min(timeout_us, 10000L)));
+    }
+    return true;
+  }
+  // TCP: sleep in zmq_poll() until a message arrives.
+  zmqpp::poller poller;
+  poller.add(*state_sub_);
+  while(!readState(NON_BLOCKING)) {
+    const long timeout_us = remaining_us();
+    if(timeout_us == 0)
+      return false;
+    poller.poll(poll_timeout_ms(timeout_us));
+  }
+  return true;
+}
+
+
+void PenduleCpp::startReceiver(
+  StateCallback callback
+)
+{
+  if(receiving())
+    throw std::runtime_error("PenduleCpp: the receiver thread already runs");
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  state_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(wakeup_fd_ < 0 || state_fd_ < 0) {
+    const std::string error = std::strerror(errno);
+    if(wakeup_fd_ >= 0)
+      close(wakeup_fd_);
+    if(state_fd_ >= 0)
+      close(state_fd_);
+    wakeup_fd_ = state_fd_ = -1;
+    throw std::runtime_error("PenduleCpp: cannot create the eventfds of the receiver thread: " + error);
+  }
+  // Forget what a previous receiver thread left.
+  State stale;
+  latest_.read(stale);
+  receiver_error_ = nullptr;
+  receiver_failed_.store(false, std::memory_order_relaxed);
+  receiver_running_.store(true, std::memory_order_relaxed);
+  receiver_ = std::thread(&PenduleCpp::receive, this, std::move(callback));
+}
+
+
+void PenduleCpp::stopReceiver()
+{
+  if(!receiving())
+    return;
+  receiver_running_.store(false, std::memory_order_relaxed);
+  const std::uint64_t one = 1;
+  // It can only fail if the counter overflows, i.e., if the thread is awake anyway
+  [[maybe_unused]] const auto written = write(wakeup_fd_, &one, sizeof(one));
+  receiver_.join();
+  close(wakeup_fd_);
+  close(state_fd_);
+  wakeup_fd_ = state_fd_ = -1;
+  // Keep the last state received by the thread.
+  State state;
+  if(latest_.read(state))
+    setState(state);
+}
+
+
+bool PenduleCpp::receiveState(
+  bool blocking,
+  State& state
+)
+{
+  auto from_wire = [&state](const wire::State& message) {
+    state.time = 1e-6 * message.header.timestamp_us;
+    state.position = message.position;
+    state.angle = message.angle;
+    state.linvel = message.linvel;
+    state.angvel = message.angvel;
+    state.sequence = message.header.sequence;
+    state.binary = true;
+  };
+  // Shared memory: the latest state is read without any system call, unless
+  // we have to wait for it.
+  if(!shm_name_.empty()) {
+    while(!connectShm()) {
+      if(!blocking)
+        return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    wire::StateBuffer buffer;
+    while(!shm_->readState(buffer)) {
+      if(!blocking)
+        return false;
+      shm_->waitState(-1);
+    }
+    wire::State message;
+    if(!wire::decode(buffer.data(), buffer.size(), message))
+      throw std::runtime_error("PenduleCpp: malformed state in shared memory '" + shm_name_ + "'");
+    from_wire(message);
+    return true;
+  }
   // Message to be received.
   zmqpp::message msg;
   // Try receiving a message.
   if(!state_sub_->receive(msg, !blocking)) {
     return false;
   }
+  // Binary messages are decoded in place.
+  if(msg.parts() > 0 && wire::isBinary(msg.raw_data(0), msg.size(0))) {
+    wire::State message;
+    if(!wire::decode(msg.raw_data(0), msg.size(0), message))
+      throw std::runtime_error("PenduleCpp: malformed binary state message received (" + std::to_string(msg.size(0)) + " bytes)");
+    from_wire(message);
+    return true;
+  }
   // Split the string message into parts. Each part should be a double.
+  state = State{};
   std::string msg_str;
   msg >> msg_str;
   std::istringstream iss(msg_str);
-  iss >> time_ >> position_ >> angle_ >> linvel_ >> angvel_;
+  iss >> state.time >> state.position >> state.angle >> state.linvel >> state.angvel;
   // State read successfully.
   return true;
 }
 
 
+bool PenduleCpp::takeLatestState()
+{
+  if(receiver_failed_.load(std::memory_order_acquire))
+    std::rethrow_exception(receiver_error_);
+  State state;
+  if(!latest_.read(state))
+    return false;
+  setState(state);
+  return true;
+}
+
+
+void PenduleCpp::receive(
+  StateCallback callback
+)
+{
+  // How often the thread checks if it must stop, while waiting on the shared
+  // memory channel (its futex cannot be polled together with an eventfd).
+  constexpr long SHM_STOP_PERIOD_US = 100000;
+  try {
+    zmqpp::poller poller;
+    if(shm_name_.empty()) {
+      poller.add(*state_sub_);
+      poller.add(wakeup_fd_);
+    }
+    State state;
+    while(receiver_running_.load(std::memory_order_relaxed)) {
+      // Sleep until a state arrives.
+      if(!shm_name_.empty()) {
+        if(!connectShm()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          continue;
+        }
+        if(!shm_->waitState(SHM_STOP_PERIOD_US))
+          continue;
+      }
+      else {
+        poller.poll(zmqpp::poller::wait_forever);
+        if(!poller.has_input(*state_sub_))
+          continue;
+      }
+      // Hand all the states received over to the reader.
+      while(receiveState(NON_BLOCKING, state)) {
+        latest_.write(state);
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const auto written = write(state_fd_, &one, sizeof(one));
+        if(callback)
+          callback(state);
+      }
+    }
+  }
+  catch(...) {
+    receiver_error_ = std::current_exception();
+    receiver_failed_.store(true, std::memory_order_release);
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(state_fd_, &one, sizeof(one));
+  }
+}
+
+
 void PenduleCpp::sendCommand(int pwm) {
   // Create the message to be sent.
   zmqpp::message msg;
-  msg << std::to_string(pwm);
+  if(binary_) {
+    wire::Command command;
+    command.header.sequence = command_sequence_++;
+    command.header.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    command.pwm = pwm;
+    command.state_sequence = sequence_;
+    wire::CommandBuffer buffer;
+    wire::encode(command, buffer);
+    if(shm_) {
+      shm_->writeCommand(buffer);
+      return;
+    }
+    msg.add_raw(buffer.data(), buffer.size());
+  }
+  else {
+    msg << std::to_string(pwm);
+  }
   // Send the PWM to the low-level interface.
   command_pub_->send(msg);
 }
 
+
+void PenduleCpp::sendFeedbackLaw(
+  const std::array<double,4>& gains,
+  const std::array<double,4>& setpoint,
+  const std::array<double,4>& limits,
+  int pwm,
+  bool wrap_angle,
+  double lifetime
+)
+{
+  if(!binary_ || shm_)
+    throw std::runtime_error("PenduleCpp: feedback laws require the binary format over TCP");
+  wire::FeedbackLaw law;
+  law.header.sequence = command_sequence_++;
+  law.header.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  law.gains = gains;
+  law.setpoint = setpoint;
+  law.limits = limits;
+  law.pwm = pwm;
+  law.state_sequence = sequence_;
+  law.lifetime_us = static_cast<std::uint32_t>(std::clamp(1e6 * lifetime, 0.0, double(UINT32_MAX)));
+  law.flags = wrap_angle ? wire::FeedbackLaw::WRAP_ANGLE : 0;
+  wire::FeedbackLawBuffer buffer;
+  wire::encode(law, buffer);
+  zmqpp::message msg;
+  msg.add_raw(buffer.data(), buffer.size());
+  command_pub_->send(msg);
+}
+
+
+void PenduleCpp::sendTrajectory(
+  const std::vector<double>& times,
+  const std::vector<double>& values,
+  wire::Trajectory::Kind kind
+)
+{
+  if(!binary_ || shm_)
+    throw std::runtime_error("PenduleCpp: trajectories require the binary format over TCP");
+  if(times.size() != values.size() || times.size() < 2 || times.size() > wire::Trajectory::MAX_POINTS)
+    throw std::invalid_argument("PenduleCpp: a trajectory needs between 2 and "
+      + std::to_string(wire::Trajectory::MAX_POINTS) + " points, with as many times as values");
+  // The interface would silently reject what does not survive the conversion to microseconds.
+  for(std::size_t i=0; i<times.size(); i++) {
+    if(!std::isfinite(times[i]) || times[i] < 0 || !std::isfinite(values[i]))
+      throw std::invalid_argument("PenduleCpp: the times of a trajectory must be non-negative, and its points finite");
+    if(i > 0 && std::llround(1e6 * times[i]) <= std::llround(1e6 * times[i-1]))
+      throw std::invalid_argument("PenduleCpp: the times of a trajectory must be strictly increasing (at the microsecond)");
+  }
+  wire::Trajectory trajectory;
+  trajectory.header.sequence = command_sequence_++;
+  trajectory.header.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  trajectory.state_sequence = sequence_;
+  trajectory.kind = kind;
+  trajectory.count = static_cast<std::uint8_t>(times.size());
+  for(std::size_t i=0; i<times.size(); i++) {
+    trajectory.points[i].time_us = static_cast<std::uint64_t>(std::llround(1e6 * times[i]));
+    trajectory.points[i].value = values[i];
+  }
+  wire::TrajectoryBuffer buffer;
+  wire::encode(trajectory, buffer);
+  zmqpp::message msg;
+  msg.add_raw(buffer.data(), buffer.size());
+  command_pub_->send(msg);
+}
+
+void PenduleCpp::setState(
+  const State& state
+)
+{
+  time_ = state.time;
+  position_ = state.position;
+  angle_ = state.angle;
+  linvel_ = state.linvel;
+  angvel_ = state.angvel;
+  if(state.binary)
+    sequence_ = state.sequence;
+  binary_ = state.binary;
+}
+
 } // namespace pendule_pi
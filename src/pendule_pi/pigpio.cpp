@@ -1,5 +1,7 @@
 #include "pendule_pi/pigpio.hpp"
 #include "pendule_pi/debug.hpp"
+#include <algorithm>
+#include <climits>
 #include <csignal>
 
 
@@ -40,28 +42,41 @@ std::string Exception::error2msg(
 ActivationToken* ActivationToken::active_token = nullptr;
 
 
-ActivationToken::ActivationToken(bool register_sigint) {
-  PENDULE_PI_DBG("ActivationToken: checking that no other token exists");
-  // Make sure that no other active token exists
+ActivationToken::ActivationToken(bool register_sigint)
+: previous_backend_(nullptr)
+, restore_backend_(false)
+{
+  activate(register_sigint);
+}
+
+
+ActivationToken::ActivationToken(
+  Backend& backend,
+  bool register_sigint
+)
+: previous_backend_(nullptr)
+, restore_backend_(true)
+{
+  // Do not touch the active backend if another token is using it
   if(active_token != nullptr) {
     throw MultpleTokensCreated(true);
   }
-  // "register" this object as the active token
-  active_token = this;
-  // Initialize the pigpio library
-  PENDULE_PI_DBG("ActivationToken: initializing");
-  PiGPIO_RUN_VOID(gpioInitialise);
-  // NOTE: it is VERY important that the signal handlers are assigned after
-  // attempting to call gpioInitialise()!
-  if(register_sigint)
-    std::signal(SIGINT, ActivationToken::pleaseStop);
-  std::signal(SIGABRT, ActivationToken::abort);
+  previous_backend_ = Backend::select(&backend);
+  try {
+    activate(register_sigint);
+  }
+  catch(...) {
+    Backend::select(previous_backend_);
+    throw;
+  }
 }
 
 
 ActivationToken::~ActivationToken() {
   PENDULE_PI_DBG("ActivationToken: calling resetPins() upon token destruction");
   resetPins();
+  if(restore_backend_)
+    Backend::select(previous_backend_);
   // If there is no registered token, or another one is registered, bad things might happen!
   if(active_token != this) {
     PENDULE_PI_WRN("ActivationToken: during destruction another active token was found");
@@ -73,15 +88,34 @@ ActivationToken::~ActivationToken() {
 }
 
 
+void ActivationToken::activate(bool register_sigint) {
+  PENDULE_PI_DBG("ActivationToken: checking that no other token exists");
+  // Make sure that no other active token exists
+  if(active_token != nullptr) {
+    throw MultpleTokensCreated(true);
+  }
+  // "register" this object as the active token
+  active_token = this;
+  // Initialize the pigpio library
+  PENDULE_PI_DBG("ActivationToken: initializing");
+  PiGPIO_RUN_VOID(backend().initialise);
+  // NOTE: it is VERY important that the signal handlers are assigned after
+  // attempting to call gpioInitialise()!
+  if(register_sigint)
+    std::signal(SIGINT, ActivationToken::pleaseStop);
+  std::signal(SIGABRT, ActivationToken::abort);
+}
+
+
 void ActivationToken::resetPins() {
   PENDULE_PI_DBG("ActivationToken: putting all pins into high impedance mode");
   for(int pin=0; pin<=26; pin++) {
-    auto retval = gpioSetPullUpDown(pin, PI_PUD_OFF);
+    auto retval = backend().setPullUpDown(pin, PI_PUD_OFF);
     if(retval < 0) {
       PENDULE_PI_WRN("ActivationToken: while disabling resistors on pin " << \
         pin << ", gpioSetPullUpDown() returned " << Exception::error2msg(retval));
     }
-    retval = gpioSetMode(pin, PI_INPUT);
+    retval = backend().setMode(pin, PI_INPUT);
     if(retval < 0) {
       PENDULE_PI_WRN("ActivationToken: while setting pin " << pin << " as " \
         "input, gpioSetMode() returned " << Exception::error2msg(retval));
@@ -89,7 +123,7 @@ void ActivationToken::resetPins() {
   }
   #warning "Calling gpioTerminate() while handling a signal seems to kill the process, which is NOT a good thing. Check if there is a fix for this."
   // PENDULE_PI_DBG("ActivationToken: calling gpioTerminate()");
-  // gpioTerminate();
+  // backend().terminate();
   PENDULE_PI_DBG("ActivationToken: GPIO reset completed");
 }
 
@@ -109,21 +143,97 @@ void ActivationToken::abort(int s) {
 
 
 Rate::Rate(
-  unsigned int period_us
+  unsigned int period_us,
+  unsigned int spin_us,
+  Overrun overrun
 )
 : period_(period_us)
+, spin_us_(spin_us)
+, overrun_(overrun)
+, started_(false)
+, deadline_(0)
 , tnow_(0)
 , tpast_(0)
+, index_(0)
+, last_index_(0)
+, period_stats_(pendule_pi::Histogram::Logarithmic{STATISTICS_PRECISION_BITS})
+, lateness_stats_(pendule_pi::Histogram::Logarithmic{STATISTICS_PRECISION_BITS})
+, overrun_stats_(pendule_pi::Histogram::Logarithmic{STATISTICS_PRECISION_BITS})
 {
   // nothing else to do here!
 }
 
 
-unsigned int Rate::sleep() {
+std::uint64_t Rate::sleep() {
+  tnow_ = Clock::ticks();
+  const bool first = !started_;
+  if(first) {
+    deadline_ = tnow_ + period_;
+    index_ = 0;
+    started_ = true;
+  }
+  if(tnow_ > deadline_) {
+    const std::uint64_t lateness = tnow_ - deadline_;
+    overrun_stats_.add(static_cast<unsigned int>(std::min<std::uint64_t>(lateness, UINT_MAX)));
+    switch(overrun_) {
+      case Overrun::Skip:
+        deadline_ += period_ * (lateness / period_ + 1);
+        index_ += lateness / period_ + 1;
+        break;
+      case Overrun::CatchUp:
+        deadline_ += period_;
+        last_index_ = index_++;
+        return wakeUp(first);
+      case Overrun::Rephase:
+        // The new schedule starts within the period that is elapsing now.
+        deadline_ = tnow_ + period_;
+        last_index_ = index_ + lateness / period_;
+        index_ = last_index_ + 1;
+        return wakeUp(first);
+    }
+  }
+  // Sleep until the spinning margin, then busy-wait for the deadline. The
+  // backend works with 32 bits ticks, which is fine for less than 2^31us.
+  if(deadline_ - tnow_ > spin_us_)
+    backend().sleepUntil(static_cast<std::uint32_t>(deadline_ - spin_us_));
   do {
-    tnow_ = gpioTick();
+    tnow_ = Clock::ticks();
   }
-  while(tnow_-tpast_ < period_);
+  while(tnow_ < deadline_);
+  lateness_stats_.add(static_cast<unsigned int>(std::min<std::uint64_t>(tnow_ - deadline_, UINT_MAX)));
+  deadline_ += period_;
+  last_index_ = index_++;
+  return wakeUp(first);
+}
+
+
+void Rate::reset() {
+  started_ = false;
+}
+
+
+Rate::Statistics Rate::statistics() const {
+  Statistics stats;
+  stats.period = period_stats_.summary();
+  stats.lateness = lateness_stats_.summary();
+  stats.overrun = overrun_stats_.summary();
+  return stats;
+}
+
+
+void Rate::resetStatistics() {
+  period_stats_.reset();
+  lateness_stats_.reset();
+  overrun_stats_.reset();
+}
+
+
+std::uint64_t Rate::wakeUp(
+  bool first
+)
+{
+  if(!first)
+    period_stats_.add(static_cast<unsigned int>(std::min<std::uint64_t>(tnow_ - tpast_, UINT_MAX)));
   return tpast_ = tnow_;
 }
 
@@ -135,19 +245,26 @@ Timer::Timer(
 : period_(period_us)
 , auto_reset_(auto_reset)
 , tpast_(0)
+, reported_(true)
+, lateness_(pendule_pi::Histogram::Logarithmic{Rate::STATISTICS_PRECISION_BITS})
 {
-  // nothing else to do here!
+  // reported_ starts as true since tpast_ is not an actual reset time: the
+  // first expiration must not be recorded.
 }
 
 
 bool Timer::expired() {
   // get current time
-  auto tnow = gpioTick();
+  const std::uint64_t tnow = Clock::ticks();
   // check if the elapsed time since "tpast_" exceeds the target period
   if(tnow - tpast_ > period_) {
-    // the timer expired
+    // the timer expired: record how late we noticed it (only once)
+    if(!reported_) {
+      lateness_.add(static_cast<unsigned int>(std::min<std::uint64_t>(tnow - tpast_ - period_, UINT_MAX)));
+      reported_ = true;
+    }
     if(auto_reset_)
-      tpast_ = tnow;
+      reset(tnow);
     return true;
   }
   else {
@@ -158,7 +275,16 @@ bool Timer::expired() {
 
 
 void Timer::reset() {
-  tpast_ = gpioTick();
+  reset(Clock::ticks());
+}
+
+
+void Timer::reset(
+  std::uint64_t tnow
+)
+{
+  tpast_ = tnow;
+  reported_ = false;
 }
 
 
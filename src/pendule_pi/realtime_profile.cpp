@@ -0,0 +1,216 @@
+#include "pendule_pi/realtime_profile.hpp"
+#include <alloca.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace pendule_pi {
+
+namespace {
+
+/// Build a CPU set from a list of CPUs.
+/** @return an empty string on success, or a description of the problem. */
+std::string makeCpuSet(
+  const std::vector<int>& cpus,
+  cpu_set_t& set
+)
+{
+  const long n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  CPU_ZERO(&set);
+  for(const auto& cpu : cpus) {
+    if(cpu < 0 || cpu >= n_cpus || cpu >= CPU_SETSIZE)
+      return "CPU " + std::to_string(cpu) + " does not exist (" + std::to_string(n_cpus) + " CPUs)";
+    CPU_SET(cpu, &set);
+  }
+  return std::string();
+}
+
+
+/// Format a list of CPUs.
+std::string cpuList(
+  const std::vector<int>& cpus
+)
+{
+  std::string str;
+  for(const auto& cpu : cpus)
+    str += (str.empty() ? "" : ",") + std::to_string(cpu);
+  return str;
+}
+
+
+/// Stack (in bytes) kept untouched by prefaultStack(), for the frames of the callers.
+constexpr std::size_t STACK_MARGIN = 64*1024;
+
+
+/// Estimate by how much the stack of the calling thread can still grow.
+/** The size of the stack is bounded by `RLIMIT_STACK` and, for threads other
+  * than the main one, by the size they were created with. With an unlimited
+  * `RLIMIT_STACK`, the physical memory is used as the bound instead. The part
+  * already in use is measured from the top of the stack to the current frame.
+  * @return the number of bytes available.
+  */
+__attribute__((noinline)) std::size_t availableStack() {
+  std::size_t size = static_cast<std::size_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  rlimit limit;
+  if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    size = std::min(size, static_cast<std::size_t>(limit.rlim_cur));
+  std::size_t used = 0;
+  pthread_attr_t attr;
+  if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+    void* addr = nullptr;
+    std::size_t attr_size = 0;
+    if(pthread_attr_getstack(&attr, &addr, &attr_size) == 0) {
+      const char marker = 0;
+      const char* top = static_cast<const char*>(addr) + attr_size;
+      size = std::min(size, attr_size);
+      used = static_cast<std::size_t>(top - &marker);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  return size > used ? size - used : 0;
+}
+
+
+/// Touch the given amount of stack, so that the pages are mapped now.
+__attribute__((noinline)) void prefaultStack(
+  std::size_t bytes
+)
+{
+  const long page = sysconf(_SC_PAGESIZE);
+  volatile unsigned char* stack = static_cast<volatile unsigned char*>(alloca(bytes));
+  for(std::size_t i=0; i<bytes; i+=page)
+    stack[i] = 0;
+}
+
+} // end of anonymous namespace
+
+
+RealtimeProfile::Parameters::Parameters()
+: priority(-1)
+, lock_memory(false)
+, prefault_stack_kb(0)
+{
+  // nothing else to do here
+}
+
+
+RealtimeProfile::RealtimeProfile(
+  const Parameters& params
+)
+: params_(params)
+{
+  // nothing else to do here
+}
+
+
+RealtimeProfile::Report RealtimeProfile::apply() const {
+  Report report;
+  // Scheduling policy of the control thread
+  if(params_.priority >= 0) {
+    const std::string what = "SCHED_FIFO priority " + std::to_string(params_.priority);
+    sched_param param;
+    param.sched_priority = params_.priority;
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(err == 0)
+      report.applied.push_back(what);
+    else
+      report.failed.push_back(what + ": " + std::strerror(err));
+  }
+  // Affinity of the control thread
+  if(!params_.cpus.empty()) {
+    const std::string what = "control thread on CPU(s) " + cpuList(params_.cpus);
+    cpu_set_t set;
+    std::string problem = makeCpuSet(params_.cpus, set);
+    if(problem.empty()) {
+      const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if(err != 0)
+        problem = std::strerror(err);
+    }
+    if(problem.empty())
+      report.applied.push_back(what);
+    else
+      report.failed.push_back(what + ": " + problem);
+  }
+  // Affinity of all other threads (pigpio's ones, at this point)
+  if(!params_.callback_cpus.empty()) {
+    const std::string what = "other threads on CPU(s) " + cpuList(params_.callback_cpus);
+    cpu_set_t set;
+    std::string problem = makeCpuSet(params_.callback_cpus, set);
+    unsigned int n_threads = 0;
+    if(problem.empty()) {
+      DIR* tasks = opendir("/proc/self/task");
+      if(tasks == nullptr)
+        problem = std::string("cannot list threads: ") + std::strerror(errno);
+      else {
+        const pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        while(const dirent* entry = readdir(tasks)) {
+          const pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+          if(tid <= 0 || tid == self)
+            continue;
+          if(sched_setaffinity(tid, sizeof(set), &set) != 0) {
+            problem = "thread " + std::to_string(tid) + ": " + std::strerror(errno);
+            break;
+          }
+          n_threads++;
+        }
+        closedir(tasks);
+      }
+    }
+    if(problem.empty())
+      report.applied.push_back(what + " (" + std::to_string(n_threads) + " thread(s))");
+    else
+      report.failed.push_back(what + ": " + problem);
+  }
+  // Memory locking
+  if(params_.lock_memory) {
+    const std::string what = "memory locked (mlockall)";
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+      report.applied.push_back(what);
+    else
+      report.failed.push_back(what + ": " + std::strerror(errno));
+  }
+  // Stack prefaulting. It is only useful if memory is locked: otherwise, the
+  // pages might be reclaimed later on. Going past the stack size limit would
+  // crash the process, so requests that do not fit are rejected.
+  if(params_.prefault_stack_kb > 0) {
+    const std::string what = "prefaulted " + std::to_string(params_.prefault_stack_kb) + "KiB of stack";
+    const std::size_t available = availableStack();
+    const std::size_t usable = available > STACK_MARGIN ? available - STACK_MARGIN : 0;
+    if(params_.prefault_stack_kb <= usable / 1024) {
+      prefaultStack(params_.prefault_stack_kb * 1024);
+      report.applied.push_back(what);
+    }
+    else {
+      report.failed.push_back(
+        what + ": only " + std::to_string(usable / 1024) + "KiB can be "
+        "prefaulted without exceeding the stack size limit (see ulimit -s) "
+        "or the physical memory"
+      );
+    }
+  }
+  return report;
+}
+
+
+std::ostream& operator<<(
+  std::ostream& os,
+  const RealtimeProfile::Report& report
+)
+{
+  for(const auto& line : report.applied)
+    os << "[ OK ] " << line << std::endl;
+  for(const auto& line : report.failed)
+    os << "[FAIL] " << line << std::endl;
+  return os;
+}
+
+}
@@ -0,0 +1,365 @@
+#include "pendule_pi/replay.hpp"
+#include "pendule_pi/flight_recorder.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+
+namespace pendule_pi {
+
+namespace {
+
+/// Largest lag searched by run(), in seconds.
+constexpr double MAX_LAG_SECONDS = 1.0;
+
+
+/// Remove leading and trailing blanks.
+std::string trim(std::string s) {
+  s.erase(0, s.find_first_not_of(" \t\r"));
+  s.erase(s.find_last_not_of(" \t\r") + 1);
+  return s;
+}
+
+
+/// Read a flight recorder file, whose magic number was already checked.
+void loadFlightRecord(
+  std::ifstream& file,
+  const std::string& path,
+  Replay::Recording& recording
+)
+{
+  using Record = FlightRecorder::Record;
+  // The header holds an atomic counter: read its fields from the bytes.
+  unsigned char header[sizeof(FlightRecorder::FileHeader)];
+  file.seekg(0);
+  if(!file.read(reinterpret_cast<char*>(header), sizeof(header)))
+    throw std::runtime_error("Replay: truncated flight recorder file '" + path + "'");
+  std::uint32_t version, record_size;
+  std::uint64_t capacity, count, period_us;
+  std::memcpy(&version, header + offsetof(FlightRecorder::FileHeader, version), sizeof(version));
+  std::memcpy(&record_size, header + offsetof(FlightRecorder::FileHeader, record_size), sizeof(record_size));
+  std::memcpy(&capacity, header + offsetof(FlightRecorder::FileHeader, capacity), sizeof(capacity));
+  std::memcpy(&count, header + offsetof(FlightRecorder::FileHeader, count), sizeof(count));
+  std::memcpy(&period_us, header + offsetof(FlightRecorder::FileHeader, period_us), sizeof(period_us));
+  if(version != FlightRecorder::VERSION || record_size != sizeof(Record))
+    throw std::runtime_error("Replay: unsupported flight recorder file '" + path + "' (version " + std::to_string(version) + ")");
+  std::vector<Record> records;
+  Record record;
+  while(file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    records.push_back(record);
+  if(capacity > 0) {
+    // Ring: the latest record is at (count-1) % capacity.
+    if(count <= capacity)
+      records.resize(std::min<std::size_t>(count, records.size()));
+    else if(records.size() == capacity)
+      std::rotate(records.begin(), records.begin() + count % capacity, records.end());
+  }
+  else {
+    records.resize(std::min<std::size_t>(count, records.size()));
+  }
+  recording.period_us = period_us;
+  recording.samples.reserve(records.size());
+  for(const auto& r : records)
+    recording.samples.push_back({r.time_us, r.position, r.angle, r.applied_pwm});
+}
+
+
+/// Read a CSV file, with named columns.
+void loadCsv(
+  std::ifstream& file,
+  const std::string& path,
+  double position_scale,
+  double angle_scale,
+  Replay::Recording& recording
+)
+{
+  // Locate the columns in the header
+  std::string line, cell;
+  file.seekg(0);
+  std::getline(file, line);
+  std::stringstream header(line);
+  int time_col = -1, position_col = -1, angle_col = -1, pwm_col = -1;
+  for(int i=0; std::getline(header, cell, ','); i++) {
+    cell = trim(cell);
+    if(cell == "time_us")
+      time_col = i;
+    else if(cell == "position")
+      position_col = i;
+    else if(cell == "angle")
+      angle_col = i;
+    else if(cell == "pwm")
+      pwm_col = i;
+  }
+  if(time_col < 0 || (position_col < 0 && angle_col < 0))
+    throw std::runtime_error("Replay: file '" + path + "' has no 'time_us' column, or neither 'position' nor 'angle' column");
+
+  // Read the data
+  while(std::getline(file, line)) {
+    if(trim(line).empty())
+      continue;
+    Replay::Sample sample{0, 0.0, 0.0, 0};
+    std::stringstream row(line);
+    try {
+      for(int i=0; std::getline(row, cell, ','); i++) {
+        if(i == time_col)
+          sample.time_us = std::stoull(cell);
+        else if(i == position_col)
+          sample.position = position_scale * std::stod(cell);
+        else if(i == angle_col)
+          sample.angle = angle_scale * std::stod(cell);
+        else if(i == pwm_col)
+          sample.pwm = std::stoi(cell);
+      }
+    }
+    catch(const std::logic_error&) {
+      throw std::runtime_error("Replay: invalid line in '" + path + "': " + line);
+    }
+    recording.samples.push_back(sample);
+  }
+
+  // Nominal period: median of the intervals, robust to the gaps between
+  // successive acquisitions.
+  std::vector<std::uint64_t> intervals;
+  for(std::size_t i=1; i<recording.samples.size(); i++)
+    if(recording.samples[i].time_us > recording.samples[i-1].time_us)
+      intervals.push_back(recording.samples[i].time_us - recording.samples[i-1].time_us);
+  if(!intervals.empty()) {
+    std::nth_element(intervals.begin(), intervals.begin() + intervals.size()/2, intervals.end());
+    recording.period_us = intervals[intervals.size()/2];
+  }
+}
+
+
+/// Velocity estimated from the timing of edges, spread evenly between two samples.
+class EdgeReplay {
+public:
+  EdgeReplay(const VelocityEstimator::Parameters& params, double step, double first)
+  : estimator_(params)
+  , step_(step)
+  , steps_(std::lround(first / step))
+  {
+    // nothing else to do here
+  }
+
+  /// Register the edges from the previous sample to this one, and estimate the velocity.
+  double update(double value, std::uint64_t previous_us, std::uint64_t now_us) {
+    const long current = std::lround(value / step_);
+    const long n_steps = std::labs(current - steps_);
+    const long dir = current > steps_ ? 1 : -1;
+    const std::uint64_t dt = now_us - previous_us;
+    for(long s=0; s<n_steps; s++) {
+      steps_ += dir;
+      estimator_.addEdge(static_cast<unsigned int>(previous_us + dt * (s + 1) / (n_steps + 1)), static_cast<int>(steps_));
+    }
+    return step_ * estimator_.estimate(static_cast<unsigned int>(now_us));
+  }
+
+private:
+  VelocityEstimator estimator_;
+  const double step_;
+  long steps_;
+};
+
+} // end of anonymous namespace
+
+
+// Same coefficients as pendule_pi_config.yaml
+Replay::Configuration::Configuration()
+: name("default")
+, meters_per_step(3.990566037735849e-05)
+, radians_per_step(0.006283185307179587)
+, velocity_estimation(Pendule::VelocityEstimation::FiniteDifferences)
+, velocity_parameters()
+, filter()
+{
+  // nothing else to do here
+}
+
+
+Replay::Recording Replay::load(
+  const std::string& path,
+  double position_scale,
+  double angle_scale
+)
+{
+  std::ifstream file(path, std::ios::binary);
+  if(!file.is_open())
+    throw std::runtime_error("Replay: could not open file '" + path + "'");
+  Recording recording;
+  recording.name = path;
+  recording.period_us = 0;
+  char magic[8] = {0};
+  file.read(magic, sizeof(magic));
+  file.clear();
+  if(std::memcmp(magic, FlightRecorder::MAGIC, sizeof(magic)) == 0)
+    loadFlightRecord(file, path, recording);
+  else
+    loadCsv(file, path, position_scale, angle_scale, recording);
+  if(recording.samples.size() < 2 || recording.period_us == 0)
+    throw std::runtime_error("Replay: file '" + path + "' holds less than two samples");
+  return recording;
+}
+
+
+Replay::Replay(
+  Recording recording
+)
+: recording_(std::move(recording))
+{
+  if(recording_.samples.empty() || recording_.period_us == 0)
+    throw std::runtime_error("Replay: empty recording '" + recording_.name + "'");
+}
+
+
+Replay::Result Replay::run(
+  const Configuration& configuration
+) const
+{
+  const auto start = std::chrono::steady_clock::now();
+  const auto& samples = recording_.samples;
+  const std::size_t n = samples.size();
+  const double dt = 1e-6 * recording_.period_us;
+  Result result;
+  result.raw.resize(n);
+  result.filtered.resize(n);
+
+  // Same chain as the low-level interface: estimation as in Pendule::update(),
+  // then filtering, with the filters starting at rest.
+  const bool edge_timing = configuration.velocity_estimation == Pendule::VelocityEstimation::EdgeTiming;
+  EdgeReplay position_edges(configuration.velocity_parameters, configuration.meters_per_step/4, samples[0].position);
+  EdgeReplay angle_edges(configuration.velocity_parameters, configuration.radians_per_step/4, samples[0].angle);
+  StateFilter filter(configuration.filter, dt);
+  filter.reset(samples[0].position, samples[0].angle);
+  result.raw[0] = {samples[0].position, samples[0].angle, 0.0, 0.0};
+  result.filtered[0] = result.raw[0];
+  for(std::size_t i=1; i<n; i++) {
+    State& raw = result.raw[i];
+    raw[POSITION] = samples[i].position;
+    raw[ANGLE] = samples[i].angle;
+    if(edge_timing) {
+      raw[LINVEL] = position_edges.update(samples[i].position, samples[i-1].time_us, samples[i].time_us);
+      raw[ANGVEL] = angle_edges.update(samples[i].angle, samples[i-1].time_us, samples[i].time_us);
+    }
+    else {
+      raw[LINVEL] = (samples[i].position - samples[i-1].position) / dt;
+      raw[ANGVEL] = (samples[i].angle - samples[i-1].angle) / dt;
+    }
+    filter.filter(raw[POSITION], raw[ANGLE], raw[LINVEL], raw[ANGVEL]);
+    result.filtered[i] = {filter.position(), filter.angle(), filter.linearVelocity(), filter.angularVelocity()};
+  }
+
+  // Compare each coordinate with its unfiltered version
+  const std::size_t max_lag = std::min<std::size_t>(n/4, static_cast<std::size_t>(MAX_LAG_SECONDS / dt));
+  std::vector<double> raw(n), filtered(n);
+  for(std::size_t c=0; c<4; c++) {
+    for(std::size_t i=0; i<n; i++) {
+      raw[i] = result.raw[i][c];
+      filtered[i] = result.filtered[i][c];
+    }
+    result.metrics[c] = compare(raw, filtered, recording_.period_us, max_lag);
+  }
+  result.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+
+std::vector<Replay::Result> Replay::run(
+  const std::vector<Configuration>& configurations,
+  unsigned int threads
+) const
+{
+  if(threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<std::size_t>(threads, std::max<std::size_t>(1, configurations.size()));
+  std::vector<Result> results(configurations.size());
+  std::vector<std::exception_ptr> errors(threads);
+  std::atomic<std::size_t> next(0);
+  // Each worker takes the next configuration that was not replayed yet.
+  auto worker = [&](unsigned int id) {
+    try {
+      for(std::size_t i=next++; i<configurations.size(); i=next++)
+        results[i] = run(configurations[i]);
+    }
+    catch(...) {
+      errors[id] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> workers;
+  for(unsigned int t=1; t<threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for(auto& w : workers)
+    w.join();
+  for(const auto& e : errors)
+    if(e)
+      std::rethrow_exception(e);
+  return results;
+}
+
+
+Replay::Metrics Replay::compare(
+  const std::vector<double>& raw,
+  const std::vector<double>& filtered,
+  std::uint64_t period_us,
+  std::size_t max_lag
+)
+{
+  Metrics metrics{0.0, 0.0, 0.0};
+  const std::size_t n = std::min(raw.size(), filtered.size());
+  if(n < 3)
+    return metrics;
+  max_lag = std::min(max_lag, n - 2);
+
+  // Lag: maximum of the cross-correlation of the centered signals.
+  double mean_raw = 0, mean_filtered = 0;
+  for(std::size_t i=0; i<n; i++) {
+    mean_raw += raw[i];
+    mean_filtered += filtered[i];
+  }
+  mean_raw /= n;
+  mean_filtered /= n;
+  std::vector<double> correlation(max_lag + 1);
+  std::size_t lag = 0;
+  for(std::size_t k=0; k<=max_lag; k++) {
+    double sum = 0;
+    for(std::size_t i=k; i<n; i++)
+      sum += (raw[i-k] - mean_raw) * (filtered[i] - mean_filtered);
+    correlation[k] = sum / (n - k);
+    if(correlation[k] > correlation[lag])
+      lag = k;
+  }
+  double fraction = 0;
+  if(lag > 0 && lag < max_lag) {
+    const double curvature = correlation[lag-1] - 2 * correlation[lag] + correlation[lag+1];
+    if(curvature < 0)
+      fraction = 0.5 * (correlation[lag-1] - correlation[lag+1]) / curvature;
+  }
+  metrics.lag_us = (lag + fraction) * period_us;
+
+  // Residual, once the lag is compensated.
+  double residual = 0;
+  for(std::size_t i=lag; i<n; i++)
+    residual += (filtered[i] - raw[i-lag]) * (filtered[i] - raw[i-lag]);
+  metrics.residual = std::sqrt(residual / (n - lag));
+
+  // Noise: high-frequency content left by the filter.
+  double rough_raw = 0, rough_filtered = 0;
+  for(std::size_t i=2; i<n; i++) {
+    const double d_raw = raw[i] - 2 * raw[i-1] + raw[i-2];
+    const double d_filtered = filtered[i] - 2 * filtered[i-1] + filtered[i-2];
+    rough_raw += d_raw * d_raw;
+    rough_filtered += d_filtered * d_filtered;
+  }
+  metrics.noise = rough_raw > 0 ? std::sqrt(rough_filtered / rough_raw) : 0.0;
+  return metrics;
+}
+
+}
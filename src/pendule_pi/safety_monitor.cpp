@@ -0,0 +1,115 @@
+#include "pendule_pi/safety_monitor.hpp"
+#include "pendule_pi/backend.hpp"
+#include "pendule_pi/debug.hpp"
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+
+namespace pendule_pi {
+
+
+SafetyMonitor::SafetyMonitor(
+  Reaction reaction,
+  int priority
+)
+: reaction_(std::move(reaction))
+, head_(0)
+, tail_(0)
+, processed_events_(0)
+, dropped_events_(0)
+, first_tick_(0)
+, first_reason_(nullptr)
+, latency_(LATENCY_BIN_US, LATENCY_BINS)
+, quit_(false)
+{
+  PENDULE_PI_DBG("Creating SafetyMonitor");
+  if(sem_init(&semaphore_, 0, 0) != 0)
+    throw std::runtime_error("SafetyMonitor: sem_init() failed: " + std::string(std::strerror(errno)));
+  thread_ = std::thread(&SafetyMonitor::run, this);
+  if(priority >= 0) {
+    sched_param param;
+    param.sched_priority = priority;
+    const int err = pthread_setschedparam(thread_.native_handle(), SCHED_FIFO, &param);
+    if(err != 0) {
+      PENDULE_PI_WRN("SafetyMonitor: could not set real-time priority " << priority
+        << " (" << std::strerror(err) << "); using the default scheduling policy");
+    }
+  }
+  PENDULE_PI_DBG("SafetyMonitor created");
+}
+
+
+SafetyMonitor::~SafetyMonitor() {
+  PENDULE_PI_DBG("Destroying SafetyMonitor");
+  quit_.store(true, std::memory_order_release);
+  sem_post(&semaphore_);
+  thread_.join();
+  sem_destroy(&semaphore_);
+  PENDULE_PI_DBG("SafetyMonitor destroyed");
+}
+
+
+bool SafetyMonitor::post(
+  unsigned int tick,
+  const char* reason
+) noexcept
+{
+  // Reserve a slot
+  std::size_t position = head_.load(std::memory_order_relaxed);
+  do {
+    if(position - tail_.load(std::memory_order_acquire) >= QUEUE_SIZE) {
+      dropped_events_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while(!head_.compare_exchange_weak(position, position+1, std::memory_order_relaxed));
+  // Fill it and wake up the monitor thread
+  Slot& slot = slots_[position & MASK];
+  slot.event = Event{tick, reason};
+  slot.sequence.store(position+1, std::memory_order_release);
+  sem_post(&semaphore_);
+  return true;
+}
+
+
+SafetyMonitor::Event SafetyMonitor::firstEvent() const {
+  const char* reason = first_reason_.load(std::memory_order_acquire);
+  return Event{reason == nullptr ? 0 : first_tick_.load(std::memory_order_relaxed), reason};
+}
+
+
+void SafetyMonitor::run() {
+  while(true) {
+    if(sem_wait(&semaphore_) != 0)
+      continue; // EINTR
+    processEvents();
+    if(quit_.load(std::memory_order_acquire))
+      break;
+  }
+}
+
+
+void SafetyMonitor::processEvents() {
+  std::size_t position = tail_.load(std::memory_order_relaxed);
+  Slot* slot = &slots_[position & MASK];
+  while(slot->sequence.load(std::memory_order_acquire) == position+1) {
+    const Event event = slot->event;
+    tail_.store(++position, std::memory_order_release);
+    try {
+      reaction_(event);
+    }
+    catch(const std::exception& e) {
+      PENDULE_PI_WRN("SafetyMonitor: the reaction to '" << event.reason << "' threw an exception: " << e.what());
+    }
+    latency_.add(pigpio::backend().tick() - event.tick);
+    if(first_reason_.load(std::memory_order_relaxed) == nullptr) {
+      first_tick_.store(event.tick, std::memory_order_relaxed);
+      first_reason_.store(event.reason, std::memory_order_release);
+    }
+    processed_events_.fetch_add(1, std::memory_order_relaxed);
+    slot = &slots_[position & MASK];
+  }
+}
+
+}
@@ -0,0 +1,191 @@
+#include "pendule_pi/sample_decoder.hpp"
+#include "pendule_pi/pigpio.hpp"
+#include "pendule_pi/debug.hpp"
+#include <time.h>
+
+
+namespace pendule_pi {
+
+namespace {
+
+/// CPU time consumed by the calling thread, in nanoseconds.
+std::uint64_t threadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+
+SampleDecoder::SampleDecoder()
+: bits_(0)
+, last_level_(0)
+, running_(false)
+{
+  resetStatistics();
+}
+
+
+SampleDecoder::~SampleDecoder() {
+  PENDULE_PI_DBG("Destroying SampleDecoder");
+  stop();
+  for(auto encoder : encoders_)
+    encoder->useAlerts(true);
+  for(auto bank : banks_)
+    bank->useAlerts(true);
+  for(auto sw : switches_)
+    sw->useAlerts(true);
+}
+
+
+void SampleDecoder::addEncoder(
+  Encoder& encoder
+)
+{
+  if(running_)
+    throw std::runtime_error("SampleDecoder::addEncoder(): cannot register objects while running");
+  encoder.useAlerts(false);
+  encoders_.push_back(&encoder);
+  encoder_masks_.push_back((1u << encoder.pinA()) | (1u << encoder.pinB()));
+  bits_ |= encoder_masks_.back();
+}
+
+
+void SampleDecoder::addEncoderBank(
+  EncoderBank& bank
+)
+{
+  if(running_)
+    throw std::runtime_error("SampleDecoder::addEncoderBank(): cannot register objects while running");
+  bank.useAlerts(false);
+  banks_.push_back(&bank);
+  bits_ |= bank.pinMask();
+}
+
+
+void SampleDecoder::addSwitch(
+  Switch& sw
+)
+{
+  if(running_)
+    throw std::runtime_error("SampleDecoder::addSwitch(): cannot register objects while running");
+  sw.useAlerts(false);
+  switches_.push_back(&sw);
+  bits_ |= 1u << sw.pin();
+}
+
+
+void SampleDecoder::start() {
+  if(running_)
+    return;
+  PENDULE_PI_DBG("Starting SampleDecoder on pins mask " << std::hex << bits_ << std::dec);
+  // Initialize the reference levels, so that the first sample is decoded
+  // against the current state of the pins.
+  last_level_ = 0;
+  for(unsigned int pin=0; pin<32; pin++) {
+    if(bits_ & (1u << pin)) {
+      int level;
+      PiGPIO_RUN(level, pigpio::backend().read, pin);
+      last_level_ |= static_cast<std::uint32_t>(level) << pin;
+    }
+  }
+  PiGPIO_RUN_VOID(pigpio::backend().setGetSamplesFuncEx, SampleDecoder::processStatic, bits_, this);
+  running_ = true;
+}
+
+
+void SampleDecoder::stop() {
+  if(!running_)
+    return;
+  pigpio::backend().setGetSamplesFuncEx(nullptr, 0, nullptr);
+  running_ = false;
+}
+
+
+SampleDecoder::Statistics SampleDecoder::statistics() const {
+  Statistics stats;
+  stats.batches = batches_.load(std::memory_order_relaxed);
+  stats.samples = samples_.load(std::memory_order_relaxed);
+  stats.steps = steps_.load(std::memory_order_relaxed);
+  stats.cpu_ns = cpu_ns_.load(std::memory_order_relaxed);
+  stats.last_batch_samples = last_batch_samples_.load(std::memory_order_relaxed);
+  stats.last_batch_steps = last_batch_steps_.load(std::memory_order_relaxed);
+  stats.last_batch_ns = last_batch_ns_.load(std::memory_order_relaxed);
+  stats.max_batch_ns = max_batch_ns_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
+void SampleDecoder::resetStatistics() {
+  batches_ = 0;
+  samples_ = 0;
+  steps_ = 0;
+  cpu_ns_ = 0;
+  last_batch_samples_ = 0;
+  last_batch_steps_ = 0;
+  last_batch_ns_ = 0;
+  max_batch_ns_ = 0;
+}
+
+
+void SampleDecoder::process(
+  const gpioSample_t* samples,
+  int n_samples
+)
+{
+  const auto start_ns = threadCpuNs();
+  std::uint32_t steps = 0;
+  for(int i=0; i<n_samples; i++) {
+    const std::uint32_t level = samples[i].level;
+    const std::uint32_t changed = (level ^ last_level_) & bits_;
+    if(changed == 0)
+      continue;
+    const unsigned int tick = samples[i].tick;
+    for(std::size_t e=0; e<encoders_.size(); e++) {
+      if(changed & encoder_masks_[e]) {
+        auto encoder = encoders_[e];
+        const int before = encoder->steps();
+        encoder->processLevels(
+          level & (1u << encoder->pinA()),
+          level & (1u << encoder->pinB()),
+          tick
+        );
+        steps += before != encoder->steps();
+      }
+    }
+    for(auto bank : banks_) {
+      if(changed & bank->pinMask())
+        steps += bank->process(level, tick);
+    }
+    for(auto sw : switches_) {
+      const std::uint32_t bit = 1u << sw->pin();
+      if(changed & bit)
+        sw->processLevel((level & bit) ? PI_HIGH : PI_LOW, tick);
+    }
+    last_level_ = level;
+  }
+  // Update the statistics
+  const auto elapsed_ns = static_cast<std::uint32_t>(threadCpuNs() - start_ns);
+  batches_.fetch_add(1, std::memory_order_relaxed);
+  samples_.fetch_add(n_samples, std::memory_order_relaxed);
+  steps_.fetch_add(steps, std::memory_order_relaxed);
+  cpu_ns_.fetch_add(elapsed_ns, std::memory_order_relaxed);
+  last_batch_samples_.store(n_samples, std::memory_order_relaxed);
+  last_batch_steps_.store(steps, std::memory_order_relaxed);
+  last_batch_ns_.store(elapsed_ns, std::memory_order_relaxed);
+  if(elapsed_ns > max_batch_ns_.load(std::memory_order_relaxed))
+    max_batch_ns_.store(elapsed_ns, std::memory_order_relaxed);
+}
+
+
+void SampleDecoder::processStatic(
+  const gpioSample_t* samples,
+  int n_samples,
+  void* THIS
+)
+{
+  static_cast<SampleDecoder*>(THIS)->process(samples, n_samples);
+}
+
+}
@@ -0,0 +1,143 @@
+#include "pendule_pi/scheduler.hpp"
+#include "pendule_pi/debug.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <stdexcept>
+
+
+namespace pendule_pi {
+
+
+Scheduler::Task::Task(
+  const std::string& name,
+  Function function,
+  unsigned int period,
+  unsigned int offset,
+  int priority,
+  unsigned int budget_us
+)
+: name(name)
+, function(std::move(function))
+, period(period)
+, offset(offset % period)
+, priority(priority)
+, budget_us(budget_us)
+, runs(0)
+, budget_overruns(0)
+, total_ns(0)
+, execution_us(Histogram::Logarithmic{pigpio::Rate::STATISTICS_PRECISION_BITS})
+{
+  // nothing else to do here
+}
+
+
+Scheduler::Scheduler(
+  unsigned int base_period_us,
+  unsigned int spin_us,
+  pigpio::Rate::Overrun overrun
+)
+: base_period_us_(base_period_us)
+, rate_(base_period_us, spin_us, overrun)
+, ticks_(0)
+, next_index_(0)
+, stop_(false)
+{
+  // nothing else to do here
+}
+
+
+std::size_t Scheduler::addTask(
+  const std::string& name,
+  Function function,
+  unsigned int period,
+  unsigned int offset,
+  int priority,
+  unsigned int budget_us
+)
+{
+  if(period == 0)
+    throw std::runtime_error("Scheduler::addTask(): the period of task '" + name + "' must be positive");
+  PENDULE_PI_DBG("Scheduler: adding task '" << name << "' (period: " << period << "x" << base_period_us_
+    << "us, offset: " << offset << ", priority: " << priority << ", budget: " << budget_us << "us)");
+  tasks_.push_back(std::make_unique<Task>(name, std::move(function), period, offset, priority, budget_us));
+  // Keep the execution order sorted by decreasing priority. Since the sort
+  // is stable, tasks with equal priorities run in the order they were added.
+  order_.push_back(tasks_.back().get());
+  std::stable_sort(order_.begin(), order_.end(), [](const Task* a, const Task* b) {
+    return a->priority > b->priority;
+  });
+  return tasks_.size() - 1;
+}
+
+
+std::uint64_t Scheduler::step() {
+  const std::uint64_t now = rate_.sleep();
+  // Base ticks elapsed since the previous step, skipped ones included.
+  const std::uint64_t index = rate_.lastIndex();
+  if(index < next_index_)
+    next_index_ = index; // the schedule of the rate restarted
+  for(Task* task : order_) {
+    if(runsBefore(*task, index + 1) > runsBefore(*task, next_index_))
+      execute(*task);
+  }
+  next_index_ = index + 1;
+  ticks_++;
+  return now;
+}
+
+
+void Scheduler::run() {
+  stop_.store(false, std::memory_order_relaxed);
+  while(!stop_.load(std::memory_order_relaxed))
+    step();
+}
+
+
+std::vector<Scheduler::TaskStatistics> Scheduler::statistics() const {
+  std::vector<TaskStatistics> stats;
+  stats.reserve(tasks_.size());
+  for(const auto& task : tasks_) {
+    TaskStatistics s;
+    s.name = task->name;
+    s.period = task->period;
+    s.priority = task->priority;
+    s.budget_us = task->budget_us;
+    s.runs = task->runs.load(std::memory_order_relaxed);
+    s.budget_overruns = task->budget_overruns.load(std::memory_order_relaxed);
+    s.total_ns = task->total_ns.load(std::memory_order_relaxed);
+    s.execution_us = task->execution_us.summary();
+    stats.push_back(s);
+  }
+  return stats;
+}
+
+
+void Scheduler::resetStatistics() {
+  for(auto& task : tasks_) {
+    task->runs.store(0, std::memory_order_relaxed);
+    task->budget_overruns.store(0, std::memory_order_relaxed);
+    task->total_ns.store(0, std::memory_order_relaxed);
+    task->execution_us.reset();
+  }
+  rate_.resetStatistics();
+}
+
+
+void Scheduler::execute(
+  Task& task
+)
+{
+  const auto start = std::chrono::steady_clock::now();
+  task.function();
+  const std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  const std::uint64_t us = ns / 1000;
+  // Counters have a single writer: no need for read-modify-write operations
+  task.runs.store(task.runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  task.total_ns.store(task.total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+  task.execution_us.add(static_cast<unsigned int>(std::min<std::uint64_t>(us, UINT_MAX)));
+  if(task.budget_us > 0 && ns > 1000ull * task.budget_us)
+    task.budget_overruns.store(task.budget_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,278 @@
+#include "pendule_pi/shm_channel.hpp"
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+
+
+namespace pendule_pi {
+
+namespace {
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::uint64_t>::is_always_lock_free,
+  "ShmChannel: atomics shared between processes must be lock-free");
+
+/// Identifies a channel created by a compatible version.
+static constexpr std::uint32_t MAGIC = 0x50504d53; // "SMPP"
+/// Version of the layout of the shared memory.
+static constexpr std::uint32_t LAYOUT_VERSION = 1;
+/// Number of attempts of a read before giving up, when it keeps overlapping writes.
+/** A write takes well below a microsecond: this is only reached if the
+  * writer died in the middle of one, or if it is descheduled while writing.
+  */
+static constexpr unsigned int MAX_READ_ATTEMPTS = 1000;
+/// Permissions of the shared memory: only the user and group of the interface may send commands.
+static constexpr mode_t PERMISSIONS = 0660;
+
+
+/// Wait on a futex shared between processes.
+void futexWait(
+  std::atomic<std::uint32_t>& word,
+  std::uint32_t expected,
+  const timespec* timeout
+)
+{
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+
+/// Wake all processes waiting on a futex.
+void futexWakeAll(
+  std::atomic<std::uint32_t>& word
+)
+{
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+
+/// Message protected by a seqlock.
+/** The sequence is odd while the message is being written, and each write
+  * moves it to the next even value. It doubles as the futex word readers
+  * wait on.
+  */
+template<std::size_t SIZE>
+struct Slot {
+  static_assert(SIZE % 8 == 0, "ShmChannel: messages must be made of 64 bits words");
+  static constexpr std::size_t WORDS = SIZE / 8; ///< Number of words of the message.
+
+  alignas(64) std::atomic<std::uint32_t> sequence; ///< Seqlock.
+  std::atomic<std::uint32_t> waiters; ///< Number of readers sleeping on the futex.
+  std::atomic<std::uint64_t> words[WORDS]; ///< Message, copied word by word.
+
+  /// Write a message (single writer).
+  void write(const std::array<std::uint8_t,SIZE>& buffer) noexcept {
+    // Rounded up to even: a writer killed between the two stores below
+    // would otherwise leave the sequence odd, and readers locked out, forever.
+    const std::uint32_t s = (sequence.load(std::memory_order_relaxed) + 1) & ~1u;
+    sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(std::size_t i=0; i<WORDS; i++) {
+      std::uint64_t word;
+      std::memcpy(&word, buffer.data() + 8*i, 8);
+      words[i].store(word, std::memory_order_relaxed);
+    }
+    sequence.store(s + 2, std::memory_order_release);
+    // Pairs with the increment of waiters in wait(): either the reader sees
+    // the new sequence, or the writer sees the reader.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiters.load(std::memory_order_relaxed) > 0)
+      futexWakeAll(sequence);
+  }
+
+  /// Read the message if it changed since the last read.
+  /** It gives up after MAX_READ_ATTEMPTS attempts overlapping a write, as
+    * if no message was available.
+    */
+  bool read(std::array<std::uint8_t,SIZE>& buffer, std::uint32_t& last) noexcept {
+    std::array<std::uint8_t,SIZE> copy;
+    for(unsigned int attempt=0; attempt<MAX_READ_ATTEMPTS; attempt++) {
+      const std::uint32_t s1 = sequence.load(std::memory_order_acquire);
+      if(s1 == last)
+        return false;
+      if(s1 & 1)
+        continue;
+      for(std::size_t i=0; i<WORDS; i++) {
+        const std::uint64_t word = words[i].load(std::memory_order_relaxed);
+        std::memcpy(copy.data() + 8*i, &word, 8);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(sequence.load(std::memory_order_relaxed) == s1) {
+        buffer = copy;
+        last = s1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Wait until the message changes.
+  bool wait(std::uint32_t last, long timeout_us) noexcept {
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if(timeout_us >= 0) {
+      deadline.tv_sec += timeout_us / 1000000;
+      deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+      if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+    }
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool available = false;
+    while(true) {
+      const std::uint32_t s = sequence.load(std::memory_order_seq_cst);
+      if(s != last && !(s & 1)) {
+        available = true;
+        break;
+      }
+      if(timeout_us < 0) {
+        futexWait(sequence, s, nullptr);
+        continue;
+      }
+      // FUTEX_WAIT takes a relative timeout
+      timespec now, remaining;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+      remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if(remaining.tv_nsec < 0) {
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000;
+      }
+      if(remaining.tv_sec < 0)
+        break;
+      futexWait(sequence, s, &remaining);
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return available;
+  }
+};
+
+} // end of anonymous namespace
+
+
+/// Content of the shared memory.
+struct ShmChannel::Layout {
+  std::atomic<std::uint32_t> magic; ///< MAGIC, written last by the creator.
+  std::uint32_t version; ///< LAYOUT_VERSION.
+  std::uint32_t wire_version; ///< wire::VERSION.
+  std::uint32_t size; ///< Size of the layout, in bytes.
+  Slot<wire::STATE_SIZE> state; ///< Latest state.
+  Slot<wire::COMMAND_SIZE> command; ///< Latest command.
+};
+
+
+ShmChannel::ShmChannel(
+  const std::string& name,
+  bool create
+)
+: name_(name)
+, owner_(create)
+, layout_(nullptr)
+, last_state_(0)
+, last_command_(0)
+{
+  const std::string path = "/" + name;
+  int fd;
+  if(create) {
+    // Start from a fresh object, in case a previous interface crashed
+    shm_unlink(path.c_str());
+    fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, PERMISSIONS);
+    if(fd < 0)
+      throw std::runtime_error("ShmChannel: cannot create the shared memory '" + name + "': " + std::strerror(errno));
+    // The umask would prevent clients of the group from sending commands.
+    if(fchmod(fd, PERMISSIONS) != 0 || ftruncate(fd, sizeof(Layout)) != 0) {
+      const int err = errno;
+      close(fd);
+      shm_unlink(path.c_str());
+      throw std::runtime_error("ShmChannel: cannot set up the shared memory '" + name + "': " + std::strerror(err));
+    }
+  }
+  else {
+    fd = shm_open(path.c_str(), O_RDWR, 0);
+    if(fd < 0 && errno == ENOENT)
+      throw NotFound(name);
+    if(fd < 0)
+      throw std::runtime_error("ShmChannel: cannot open the shared memory '" + name + "': " + std::strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Layout)) {
+      close(fd);
+      // The creator did not resize it yet
+      throw NotFound(name);
+    }
+  }
+  void* memory = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  const int err = errno;
+  close(fd);
+  if(memory == MAP_FAILED) {
+    if(create)
+      shm_unlink(path.c_str());
+    throw std::runtime_error("ShmChannel: cannot map the shared memory '" + name + "': " + std::strerror(err));
+  }
+  if(create) {
+    // The memory is zero-filled by ftruncate(): only the header is written.
+    layout_ = new(memory) Layout;
+    layout_->version = LAYOUT_VERSION;
+    layout_->wire_version = wire::VERSION;
+    layout_->size = sizeof(Layout);
+    layout_->magic.store(MAGIC, std::memory_order_release);
+  }
+  else {
+    layout_ = static_cast<Layout*>(memory);
+    if(layout_->magic.load(std::memory_order_acquire) != MAGIC) {
+      munmap(memory, sizeof(Layout));
+      // The creator did not initialize it yet
+      throw NotFound(name);
+    }
+    if(layout_->version != LAYOUT_VERSION || layout_->wire_version != wire::VERSION || layout_->size != sizeof(Layout)) {
+      munmap(memory, sizeof(Layout));
+      throw std::runtime_error("ShmChannel: the shared memory '" + name + "' was created by an incompatible version");
+    }
+  }
+}
+
+
+ShmChannel::~ShmChannel() {
+  munmap(layout_, sizeof(Layout));
+  if(owner_)
+    shm_unlink(("/" + name_).c_str());
+}
+
+
+void ShmChannel::writeState(const wire::StateBuffer& buffer) noexcept {
+  layout_->state.write(buffer);
+}
+
+
+bool ShmChannel::readState(wire::StateBuffer& buffer) noexcept {
+  return layout_->state.read(buffer, last_state_);
+}
+
+
+bool ShmChannel::waitState(long timeout_us) noexcept {
+  return layout_->state.wait(last_state_, timeout_us);
+}
+
+
+void ShmChannel::writeCommand(const wire::CommandBuffer& buffer) noexcept {
+  layout_->command.write(buffer);
+}
+
+
+bool ShmChannel::readCommand(wire::CommandBuffer& buffer) noexcept {
+  return layout_->command.read(buffer, last_command_);
+}
+
+
+bool ShmChannel::waitCommand(long timeout_us) noexcept {
+  return layout_->command.wait(last_command_, timeout_us);
+}
+
+}
@@ -0,0 +1,341 @@
+#include "pendule_pi/simulated_backend.hpp"
+#include <algorithm>
+
+
+namespace pigpio {
+
+SimulatedBackend::SimulatedBackend(
+  std::uint32_t start_tick
+)
+: time_(start_tick)
+, tick_increment_(0)
+, samples_func_(nullptr)
+, samples_bits_(0)
+, samples_userdata_(nullptr)
+, next_batch_(start_tick + SAMPLES_PERIOD_US)
+{
+  // nothing else to do here!
+}
+
+
+int SimulatedBackend::initialise() {
+  return 0;
+}
+
+
+void SimulatedBackend::terminate() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  for(auto& pin : pins_) {
+    pin.alert = nullptr;
+    pin.userdata = nullptr;
+  }
+  samples_func_ = nullptr;
+  pending_samples_.clear();
+}
+
+
+int SimulatedBackend::setMode(
+  unsigned gpio,
+  unsigned mode
+)
+{
+  if(gpio >= N_GPIO)
+    return PI_BAD_GPIO;
+  if(mode > 7)
+    return PI_BAD_MODE;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  pins_[gpio].mode = mode;
+  return 0;
+}
+
+
+int SimulatedBackend::setPullUpDown(
+  unsigned gpio,
+  unsigned pud
+)
+{
+  if(gpio >= N_GPIO)
+    return PI_BAD_GPIO;
+  if(pud > PI_PUD_UP)
+    return PI_BAD_PUD;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  auto& pin = pins_[gpio];
+  pin.pud = pud;
+  // Floating inputs follow their resistor.
+  if(!pin.driven && pin.mode == PI_INPUT && pud != PI_PUD_OFF)
+    changeLevel(gpio, pud == PI_PUD_UP ? PI_HIGH : PI_LOW);
+  return 0;
+}
+
+
+int SimulatedBackend::read(
+  unsigned gpio
+)
+{
+  if(gpio >= N_GPIO)
+    return PI_BAD_GPIO;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_[gpio].level;
+}
+
+
+std::uint32_t SimulatedBackend::readBits0to31() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::uint32_t bits = 0;
+  for(unsigned gpio=0; gpio<32; gpio++)
+    bits |= static_cast<std::uint32_t>(pins_[gpio].level != PI_LOW) << gpio;
+  return bits;
+}
+
+
+int SimulatedBackend::write(
+  unsigned gpio,
+  unsigned level
+)
+{
+  if(gpio >= N_GPIO)
+    return PI_BAD_GPIO;
+  if(level > PI_HIGH)
+    return PI_BAD_LEVEL;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  // Like pigpio, writing a pin switches it to output mode.
+  pins_[gpio].mode = PI_OUTPUT;
+  changeLevel(gpio, level);
+  return 0;
+}
+
+
+int SimulatedBackend::pwm(
+  unsigned gpio,
+  unsigned dutycycle
+)
+{
+  if(gpio > 31)
+    return PI_BAD_USER_GPIO;
+  if(dutycycle > 255)
+    return PI_BAD_DUTYCYCLE;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  pins_[gpio].mode = PI_OUTPUT;
+  pins_[gpio].dutycycle = dutycycle;
+  pwm_writes_.push_back({static_cast<std::uint32_t>(time_), gpio, dutycycle});
+  return 0;
+}
+
+
+int SimulatedBackend::setAlertFuncEx(
+  unsigned gpio,
+  gpioAlertFuncEx_t f,
+  void* userdata
+)
+{
+  if(gpio > 31)
+    return PI_BAD_USER_GPIO;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  pins_[gpio].alert = f;
+  pins_[gpio].userdata = userdata;
+  return 0;
+}
+
+
+int SimulatedBackend::setGetSamplesFuncEx(
+  gpioGetSamplesFuncEx_t f,
+  std::uint32_t bits,
+  void* userdata
+)
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  samples_func_ = f;
+  samples_bits_ = bits;
+  samples_userdata_ = userdata;
+  pending_samples_.clear();
+  return 0;
+}
+
+
+std::uint32_t SimulatedBackend::tick() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  if(tick_increment_ > 0)
+    advanceToLocked(time_ + tick_increment_);
+  return static_cast<std::uint32_t>(time_);
+}
+
+
+void SimulatedBackend::sleepUntil(
+  std::uint32_t tick
+)
+{
+  advanceTo(tick);
+}
+
+
+std::uint32_t SimulatedBackend::now() const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return static_cast<std::uint32_t>(time_);
+}
+
+
+void SimulatedBackend::setTickIncrement(
+  std::uint32_t us
+)
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  tick_increment_ = us;
+}
+
+
+void SimulatedBackend::setLevel(
+  unsigned gpio,
+  int level
+)
+{
+  if(gpio >= N_GPIO)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  pins_[gpio].driven = true;
+  changeLevel(gpio, level);
+}
+
+
+void SimulatedBackend::scheduleLevel(
+  std::uint32_t tick,
+  unsigned gpio,
+  int level
+)
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  events_.emplace(unwrap(tick), Event{gpio, level});
+}
+
+
+void SimulatedBackend::advance(
+  std::uint32_t us
+)
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  advanceToLocked(time_ + us);
+}
+
+
+void SimulatedBackend::advanceTo(
+  std::uint32_t tick
+)
+{
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  advanceToLocked(unwrap(tick));
+}
+
+
+unsigned SimulatedBackend::mode(unsigned gpio) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_.at(gpio).mode;
+}
+
+
+unsigned SimulatedBackend::pullUpDown(unsigned gpio) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_.at(gpio).pud;
+}
+
+
+int SimulatedBackend::level(unsigned gpio) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_.at(gpio).level;
+}
+
+
+unsigned SimulatedBackend::dutycycle(unsigned gpio) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_.at(gpio).dutycycle;
+}
+
+
+bool SimulatedBackend::hasAlert(unsigned gpio) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pins_.at(gpio).alert != nullptr;
+}
+
+
+std::vector<SimulatedBackend::PwmWrite> SimulatedBackend::pwmWrites() const {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  return pwm_writes_;
+}
+
+
+void SimulatedBackend::clearPwmWrites() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  pwm_writes_.clear();
+}
+
+
+void SimulatedBackend::changeLevel(
+  unsigned gpio,
+  int level
+)
+{
+  auto& pin = pins_[gpio];
+  level = level ? PI_HIGH : PI_LOW;
+  if(pin.level == level)
+    return;
+  pin.level = level;
+  if(pin.alert != nullptr)
+    pin.alert(gpio, level, static_cast<std::uint32_t>(time_), pin.userdata);
+  if(samples_func_ != nullptr && gpio < 32 && (samples_bits_ & (1u << gpio))) {
+    // As in pigpio, changes that happen at the same tick belong to the same
+    // sample.
+    const auto tick = static_cast<std::uint32_t>(time_);
+    if(pending_samples_.empty() || pending_samples_.back().tick != tick)
+      pending_samples_.push_back({tick, 0});
+    pending_samples_.back().level = readBits0to31();
+  }
+}
+
+
+void SimulatedBackend::flushSamples(
+  std::uint64_t target
+)
+{
+  if(target < next_batch_)
+    return;
+  // Batches are delivered at multiples of SAMPLES_PERIOD_US.
+  next_batch_ = target - target % SAMPLES_PERIOD_US + SAMPLES_PERIOD_US;
+  if(samples_func_ == nullptr || pending_samples_.empty())
+    return;
+  // The callback might register new samples: deliver a copy.
+  std::vector<gpioSample_t> batch;
+  batch.swap(pending_samples_);
+  samples_func_(batch.data(), static_cast<int>(batch.size()), samples_userdata_);
+}
+
+
+std::uint64_t SimulatedBackend::unwrap(
+  std::uint32_t tick
+) const
+{
+  const std::int32_t delta = static_cast<std::int32_t>(tick - static_cast<std::uint32_t>(time_));
+  if(delta < 0 && static_cast<std::uint64_t>(-static_cast<std::int64_t>(delta)) > time_)
+    return 0;
+  return static_cast<std::uint64_t>(static_cast<std::int64_t>(time_) + delta);
+}
+
+
+void SimulatedBackend::advanceToLocked(
+  std::uint64_t target
+)
+{
+  // Apply all events that are due, in chronological order. Events scheduled
+  // in the past are applied immediately, without moving the clock backward.
+  while(!events_.empty() && events_.begin()->first <= target) {
+    auto event = events_.begin()->second;
+    flushSamples(events_.begin()->first);
+    time_ = std::max(time_, events_.begin()->first);
+    events_.erase(events_.begin());
+    if(event.gpio < N_GPIO) {
+      pins_[event.gpio].driven = true;
+      changeLevel(event.gpio, event.level);
+    }
+  }
+  flushSamples(target);
+  time_ = std::max(time_, target);
+}
+
+} // end of namespace pigpio
@@ -0,0 +1,89 @@
+#include "pendule_pi/state_filter.hpp"
+#include <digital_filters/filters.hpp>
+
+
+namespace pendule_pi {
+
+
+/// Butterworth filters of the four coordinates.
+struct StateFilter::Filters {
+  using Filter = decltype(digital_filters::butterworth<double,double>(4, 1.0, 2.0));
+  Filter position;
+  Filter angle;
+  Filter linvel;
+  Filter angvel;
+};
+
+
+StateFilter::Parameters::Parameters()
+: order(4)
+, cutoff_frequency(12.5)
+, filter_velocities(true)
+{
+  // nothing else to do here
+}
+
+
+StateFilter::StateFilter(
+  const Parameters& params,
+  double period
+)
+: params_(params)
+, filters_(new Filters{
+    digital_filters::butterworth<double,double>(params.order, params.cutoff_frequency, 1.0/period),
+    digital_filters::butterworth<double,double>(params.order, params.cutoff_frequency, 1.0/period),
+    digital_filters::butterworth<double,double>(params.order, params.cutoff_frequency, 1.0/period),
+    digital_filters::butterworth<double,double>(params.order, params.cutoff_frequency, 1.0/period)
+  })
+, position_(0.0)
+, angle_(0.0)
+, linvel_(0.0)
+, angvel_(0.0)
+{
+  // nothing else to do here
+}
+
+
+StateFilter::~StateFilter() = default;
+
+
+void StateFilter::reset(
+  double position,
+  double angle
+)
+{
+  filters_->position.initInput(position);
+  filters_->position.initOutput(position);
+  filters_->angle.initInput(angle);
+  filters_->angle.initOutput(angle);
+  filters_->linvel.initInput(0.0);
+  filters_->linvel.initOutput(0.0);
+  filters_->angvel.initInput(0.0);
+  filters_->angvel.initOutput(0.0);
+  position_ = position;
+  angle_ = angle;
+  linvel_ = 0.0;
+  angvel_ = 0.0;
+}
+
+
+void StateFilter::filter(
+  double position,
+  double angle,
+  double linvel,
+  double angvel
+)
+{
+  position_ = filters_->position.filter(position);
+  angle_ = filters_->angle.filter(angle);
+  // The velocity filters always run, so that their history remains
+  // consistent with the measurements.
+  linvel_ = filters_->linvel.filter(linvel);
+  angvel_ = filters_->angvel.filter(angvel);
+  if(!params_.filter_velocities) {
+    linvel_ = linvel;
+    angvel_ = angvel;
+  }
+}
+
+}
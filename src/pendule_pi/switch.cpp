@@ -18,14 +18,15 @@ Switch::Switch(
 , at_rest_now_(true)
 , has_triggered_(false)
 , with_interrupts_(false)
+, use_alerts_(true)
 , callback_(nullptr)
 {
   PENDULE_PI_DBG("Creating Switch on pin " << pin_ << ". Normal state: " << (normally_up?"UP":"DOWN") << ". Internal resistor: " << (use_internal_pull_resistor?"YES":"NO"));
   // put the pin in input mode
-  PiGPIO_RUN_VOID(gpioSetMode, pin, PI_INPUT);
+  PiGPIO_RUN_VOID(pigpio::backend().setMode, pin, PI_INPUT);
   // (de)activate the pull-up/pull-down resistor as needed
   auto pull_mode = use_internal_pull_resistor ? (normally_up ? PI_PUD_UP : PI_PUD_DOWN) : PI_PUD_OFF;
-  PiGPIO_RUN_VOID(gpioSetPullUpDown, pin, pull_mode);
+  PiGPIO_RUN_VOID(pigpio::backend().setPullUpDown, pin, pull_mode);
   PENDULE_PI_DBG("Switch created");
 }
 
@@ -33,8 +34,8 @@ Switch::Switch(
 Switch::~Switch() {
   PENDULE_PI_DBG("Destroying Switch on pin " << pin_);
   // set the pin in high impedance, just in case
-  gpioSetPullUpDown(pin_, PI_PUD_OFF);
-  gpioSetMode(pin_, PI_INPUT);
+  pigpio::backend().setPullUpDown(pin_, PI_PUD_OFF);
+  pigpio::backend().setMode(pin_, PI_INPUT);
   disableInterrupts();
   PENDULE_PI_DBG("Switch destroyed successfully");
 }
@@ -45,23 +46,45 @@ void Switch::enableInterrupts(
 )
 {
   // set the callback to change the state of the Switch.
-  gpioSetAlertFuncEx(pin_, Switch::onChangeStatic, this);
+  if(use_alerts_)
+    pigpio::backend().setAlertFuncEx(pin_, Switch::onChangeStatic, this);
   callback_ = user_callback;
   with_interrupts_ = true;
 }
 
 
 void Switch::disableInterrupts() {
-  gpioSetAlertFuncEx(pin_, nullptr, nullptr);
+  pigpio::backend().setAlertFuncEx(pin_, nullptr, nullptr);
   callback_ = nullptr;
   with_interrupts_ = false;
 }
 
 
+void Switch::useAlerts(
+  bool enable
+)
+{
+  use_alerts_ = enable;
+  // Update the current alert registration, if needed.
+  if(with_interrupts_)
+    pigpio::backend().setAlertFuncEx(pin_, use_alerts_ ? Switch::onChangeStatic : nullptr, use_alerts_ ? this : nullptr);
+}
+
+
+void Switch::processLevel(
+  int level,
+  unsigned int tick
+)
+{
+  if(with_interrupts_)
+    onChange(pin_, level, tick);
+}
+
+
 bool Switch::atRest() const
 {
   int val;
-  PiGPIO_RUN(val, gpioRead, pin_);
+  PiGPIO_RUN(val, pigpio::backend().read, pin_);
   return val == at_rest_;
 }
 
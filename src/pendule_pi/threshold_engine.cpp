@@ -0,0 +1,118 @@
+#include "pendule_pi/threshold_engine.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+namespace pendule_pi {
+
+
+ThresholdEngine::ThresholdEngine()
+: config_(nullptr)
+, active_(nullptr)
+, lower_(INT_MIN)
+, upper_(INT_MAX)
+, zone_(0)
+, dropped_events_(0)
+{
+  // nothing else to do here!
+}
+
+
+void ThresholdEngine::setZones(
+  std::vector<Zone> zones
+)
+{
+  if(zones.empty())
+    throw std::runtime_error("ThresholdEngine::setZones(): at least one zone is required");
+  auto config = std::make_unique<Config>();
+  config->lower.reserve(zones.size());
+  config->on_enter.reserve(zones.size());
+  for(std::size_t i=0; i<zones.size(); i++) {
+    const int lower = i == 0 ? INT_MIN : zones[i].lower;
+    if(i > 0 && lower <= config->lower.back()) {
+      throw std::runtime_error(
+        "ThresholdEngine::setZones(): the lower bound of zone "
+        + std::to_string(i) + " (" + std::to_string(lower)
+        + ") is not greater than the previous one"
+      );
+    }
+    config->lower.push_back(lower);
+    config->on_enter.push_back(std::move(zones[i].on_enter));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  configs_.push_back(std::move(config));
+  config_.store(configs_.back().get(), std::memory_order_release);
+}
+
+
+void ThresholdEngine::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_.store(nullptr, std::memory_order_release);
+}
+
+
+void ThresholdEngine::setBounds(
+  unsigned int zone
+)
+{
+  if(active_ == nullptr) {
+    lower_ = INT_MIN;
+    upper_ = INT_MAX;
+    zone = 0;
+  }
+  else {
+    lower_ = active_->lower[zone];
+    upper_ = zone + 1 < active_->lower.size() ? active_->lower[zone+1] : INT_MAX;
+  }
+  zone_.store(zone, std::memory_order_relaxed);
+}
+
+
+void ThresholdEngine::changeZone(
+  const Config* config,
+  int steps,
+  unsigned int tick
+)
+{
+  if(config != active_) {
+    // Adopt the new configuration, entering the zone that contains the
+    // current step count.
+    active_ = config;
+    if(active_ == nullptr) {
+      setBounds(0);
+      return;
+    }
+    auto it = std::upper_bound(active_->lower.begin(), active_->lower.end(), steps);
+    const unsigned int zone = static_cast<unsigned int>(it - active_->lower.begin()) - 1;
+    setBounds(zone);
+    enter(Event{tick, steps, zone, zone});
+    return;
+  }
+  if(active_ == nullptr)
+    return;
+
+  // Walk towards the new zone. Edges move the counter by one step, so this
+  // normally takes a single iteration.
+  const unsigned int from = zone_.load(std::memory_order_relaxed);
+  unsigned int to = from;
+  while(steps < active_->lower[to])
+    to--;
+  while(to + 1 < active_->lower.size() && steps >= active_->lower[to+1])
+    to++;
+  setBounds(to);
+  enter(Event{tick, steps, from, to});
+}
+
+
+void ThresholdEngine::enter(
+  const Event& event
+)
+{
+  if(!events_.push(event))
+    dropped_events_.fetch_add(1, std::memory_order_relaxed);
+  if(active_->on_enter[event.to] != nullptr)
+    active_->on_enter[event.to](event);
+}
+
+}
@@ -0,0 +1,183 @@
+#include "pendule_pi/trajectory.hpp"
+#include <cmath>
+
+
+namespace pendule_pi {
+
+
+Trajectory::Trajectory(
+  std::uint64_t blend_us
+)
+: blend_us_(blend_us)
+, current_{}
+, previous_{}
+, loaded_(false)
+, blending_(false)
+, blend_start_us_(0)
+, uploads_(0)
+, rejected_(0)
+, late_(0)
+, evaluations_(0)
+, held_(0)
+{
+  // nothing else to do here
+}
+
+
+bool Trajectory::isValid(
+  const wire::Trajectory& trajectory
+)
+{
+  if(trajectory.kind != wire::Trajectory::Kind::Pwm && trajectory.kind != wire::Trajectory::Kind::Position)
+    return false;
+  if(trajectory.count == 0 || trajectory.count > wire::Trajectory::MAX_POINTS)
+    return false;
+  for(std::size_t i=0; i<trajectory.count; i++) {
+    if(!std::isfinite(trajectory.points[i].value))
+      return false;
+    if(i > 0 && trajectory.points[i].time_us <= trajectory.points[i-1].time_us)
+      return false;
+  }
+  return true;
+}
+
+
+void Trajectory::load(
+  const wire::Trajectory& trajectory,
+  std::uint64_t now_us
+)
+{
+  // Fade from the current segment, unless the setpoints change meaning
+  const bool blend = loaded_ && blend_us_ > 0 && trajectory.kind == current_.kind;
+  if(blend && blending_ && now_us < blend_start_us_ + blend_us_) {
+    // The output is still fading into current_: fading from current_ alone
+    // would make it step. Fade from the output instead, extrapolated along
+    // its current derivative by a straight segment lasting the blend.
+    double derivative;
+    const double value = output(now_us, derivative);
+    previous_ = current_;
+    previous_.count = 2;
+    previous_.points[0] = {now_us, value};
+    previous_.points[1] = {now_us + blend_us_, value + 1e-6 * blend_us_ * derivative};
+  }
+  else if(blend) {
+    previous_ = current_;
+  }
+  blending_ = blend;
+  current_ = trajectory;
+  loaded_ = true;
+  blend_start_us_ = now_us;
+  increment(uploads_);
+  if(trajectory.points[trajectory.count-1].time_us < now_us)
+    increment(late_);
+}
+
+
+double Trajectory::evaluate(
+  std::uint64_t now_us,
+  double* derivative
+)
+{
+  increment(evaluations_);
+  if(now_us >= current_.points[current_.count-1].time_us)
+    increment(held_);
+  if(blending_ && now_us >= blend_start_us_ + blend_us_)
+    blending_ = false;
+  double dvalue;
+  const double value = output(now_us, dvalue);
+  if(derivative != nullptr)
+    *derivative = dvalue;
+  return value;
+}
+
+
+double Trajectory::output(
+  std::uint64_t now_us,
+  double& derivative
+) const
+{
+  double value = interpolate(current_, now_us, derivative);
+  if(!blending_)
+    return value;
+  const double a = now_us > blend_start_us_ ? static_cast<double>(now_us - blend_start_us_) / blend_us_ : 0.0;
+  if(a >= 1.0)
+    return value;
+  // Smoothstep weight, so that the output starts and ends the fade without
+  // a kink.
+  const double w = a * a * (3 - 2 * a);
+  const double dw = 6 * a * (1 - a) / (1e-6 * blend_us_);
+  double dprevious;
+  const double previous = interpolate(previous_, now_us, dprevious);
+  derivative = (1 - w) * dprevious + w * derivative + dw * (value - previous);
+  return (1 - w) * previous + w * value;
+}
+
+
+double Trajectory::interpolate(
+  const wire::Trajectory& trajectory,
+  std::uint64_t now_us,
+  double& derivative
+)
+{
+  const auto& points = trajectory.points;
+  const std::size_t n = trajectory.count;
+  derivative = 0;
+  // Hold the setpoint outside of the segment. The spline starts at the
+  // first point, so that a segment loaded at its first point does not
+  // start with a null derivative.
+  if(now_us < points[0].time_us)
+    return points[0].value;
+  if(now_us >= points[n-1].time_us)
+    return points[n-1].value;
+  // Find the interval [k, k+1] containing the current time.
+  std::size_t k = 0;
+  while(points[k+1].time_us <= now_us)
+    k++;
+  // Tangents: harmonic mean of the slopes of the adjacent intervals, or 0 at
+  // local extrema, so that the spline never overshoots the setpoints (a PWM
+  // plateau remains flat). The slope of the interval is used at the ends.
+  auto slope = [&](std::size_t i) {
+    return (points[i+1].value - points[i].value) / (1e-6 * (points[i+1].time_us - points[i].time_us));
+  };
+  auto tangent = [&](std::size_t i) {
+    if(i == 0)
+      return slope(0);
+    if(i == n-1)
+      return slope(n-2);
+    const double d0 = slope(i-1);
+    const double d1 = slope(i);
+    return d0 * d1 > 0 ? 2 * d0 * d1 / (d0 + d1) : 0.0;
+  };
+  const double h = 1e-6 * (points[k+1].time_us - points[k].time_us);
+  const double s = 1e-6 * (now_us - points[k].time_us) / h;
+  const double s2 = s * s;
+  const double s3 = s2 * s;
+  const double p0 = points[k].value;
+  const double p1 = points[k+1].value;
+  const double m0 = h * tangent(k);
+  const double m1 = h * tangent(k+1);
+  derivative = ((6*s2 - 6*s) * p0 + (3*s2 - 4*s + 1) * m0 + (6*s - 6*s2) * p1 + (3*s2 - 2*s) * m1) / h;
+  return (2*s3 - 3*s2 + 1) * p0 + (s3 - 2*s2 + s) * m0 + (3*s2 - 2*s3) * p1 + (s3 - s2) * m1;
+}
+
+
+Trajectory::Statistics Trajectory::statistics() const {
+  Statistics stats;
+  stats.uploads = uploads_.load(std::memory_order_relaxed);
+  stats.rejected = rejected_.load(std::memory_order_relaxed);
+  stats.late = late_.load(std::memory_order_relaxed);
+  stats.evaluations = evaluations_.load(std::memory_order_relaxed);
+  stats.held = held_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+
+void Trajectory::resetStatistics() {
+  uploads_.store(0, std::memory_order_relaxed);
+  rejected_.store(0, std::memory_order_relaxed);
+  late_.store(0, std::memory_order_relaxed);
+  evaluations_.store(0, std::memory_order_relaxed);
+  held_.store(0, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,97 @@
+#include "pendule_pi/velocity_estimator.hpp"
+#include <algorithm>
+
+
+namespace pendule_pi {
+
+VelocityEstimator::Parameters::Parameters()
+: window_us(10000)
+, min_edges(4)
+, timeout_us(200000)
+{
+  // nothing else to do here
+}
+
+
+VelocityEstimator::VelocityEstimator(
+  const Parameters& params
+)
+: ticks_{}
+, steps_{}
+, count_(0)
+, newest_(HISTORY_SIZE-1)
+{
+  setParameters(params);
+}
+
+
+void VelocityEstimator::setParameters(
+  const Parameters& params
+)
+{
+  params_ = params;
+  params_.min_edges = std::max(2u, params_.min_edges);
+}
+
+
+void VelocityEstimator::addEdge(
+  unsigned int tick,
+  int steps
+)
+{
+  newest_ = (newest_ + 1) % HISTORY_SIZE;
+  ticks_[newest_] = tick;
+  steps_[newest_] = steps;
+  count_ = std::min(count_+1, HISTORY_SIZE);
+}
+
+
+void VelocityEstimator::reset() {
+  count_ = 0;
+}
+
+
+double VelocityEstimator::estimate(
+  unsigned int now
+) const
+{
+  // We need at least two edges to measure a period.
+  if(count_ < 2)
+    return 0.0;
+  const unsigned int last_tick = ticks_[newest_];
+  // An edge timestamped after now (e.g., drained after now was read) would
+  // make the unsigned age wrap around: estimate at the time of that edge.
+  if(static_cast<int>(now - last_tick) < 0)
+    now = last_tick;
+  // If the encoder has been still for too long, the velocity is zero.
+  const unsigned int age = now - last_tick;
+  if(age > params_.timeout_us)
+    return 0.0;
+  // Look for the oldest edge within the window. Note that unsigned
+  // arithmetics makes this robust to the overflow of the tick counter.
+  std::size_t intervals = 0;
+  std::size_t first = newest_;
+  while(intervals+1 < count_) {
+    std::size_t candidate = (first + HISTORY_SIZE - 1) % HISTORY_SIZE;
+    if(now - ticks_[candidate] > params_.window_us)
+      break;
+    first = candidate;
+    intervals++;
+  }
+  // M/T method if there are enough edges in the window, 1/T otherwise.
+  if(intervals+1 < params_.min_edges) {
+    first = (newest_ + HISTORY_SIZE - 1) % HISTORY_SIZE;
+    intervals = 1;
+  }
+  const unsigned int elapsed = last_tick - ticks_[first];
+  if(elapsed == 0)
+    return 0.0;
+  const double displacement = steps_[newest_] - steps_[first];
+  // If we have been waiting for the next edge longer than the average edge
+  // period, the encoder is slowing down: use the waiting time instead.
+  if(age * intervals > elapsed)
+    return 1e6 * displacement / (static_cast<double>(age) * intervals);
+  return 1e6 * displacement / elapsed;
+}
+
+}
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+import numpy as np
+import sys
+
+
+## Layout of the header of flight recorder files (see
+# `include/pendule_pi/flight_recorder.hpp`).
+HEADER_DTYPE = np.dtype([
+  ("magic", "S8"),
+  ("version", "<u4"),
+  ("record_size", "<u4"),
+  ("capacity", "<u8"),
+  ("count", "<u8"),
+  ("period_us", "<u8"),
+  ("start_us", "<u8"),
+  ("reserved", "V16"),
+])
+
+## Layout of the records of flight recorder files.
+RECORD_DTYPE = np.dtype([
+  ("time_us", "<u8"),
+  ("sequence", "<u4"),
+  ("command_sequence", "<u4"),
+  ("position_steps", "<i4"),
+  ("angle_steps", "<i4"),
+  ("position", "<f8"),
+  ("angle", "<f8"),
+  ("linvel", "<f8"),
+  ("angvel", "<f8"),
+  ("filtered_position", "<f8"),
+  ("filtered_angle", "<f8"),
+  ("filtered_linvel", "<f8"),
+  ("filtered_angvel", "<f8"),
+  ("received_pwm", "<i4"),
+  ("applied_pwm", "<i4"),
+  ("period_us", "<u4"),
+  ("busy_us", "<u4"),
+  ("flags", "<u4"),
+  ("reserved", "<u4"),
+])
+
+## Flags of the records.
+COMMAND_VALID = 1
+FEEDBACK_LAW = 2
+TRAJECTORY = 4
+PLUGIN = 8
+
+
+## Load a flight recorder file (ring, archive or snapshot).
+# @param path path of the file.
+# @return the header, and the records as a numpy structured array ordered by
+#   time (the records of the ring are reordered, and unused slots dropped).
+# @throw RuntimeError if the file is not a flight recorder file of a
+#   supported version.
+def load(path):
+  header = np.fromfile(path, dtype=HEADER_DTYPE, count=1)
+  if len(header) != 1 or header[0]["magic"] != b"PPFLIGHT":
+    raise RuntimeError(f"{path} is not a flight recorder file.")
+  header = header[0]
+  if header["version"] != 1 or header["record_size"] != RECORD_DTYPE.itemsize:
+    raise RuntimeError(f"{path} uses an unsupported version ({header['version']}).")
+  records = np.fromfile(path, dtype=RECORD_DTYPE, offset=HEADER_DTYPE.itemsize)
+  if header["capacity"] > 0:
+    # Ring: only the slots written so far are valid, the latest one being at
+    # (count-1) % capacity.
+    count = int(header["count"])
+    capacity = int(header["capacity"])
+    if count <= capacity:
+      records = records[:count]
+    else:
+      records = np.roll(records, -(count % capacity))
+  else:
+    records = records[:int(header["count"])]
+  return header, records
+
+
+if __name__ == "__main__":
+  # Print a summary of the given files.
+  for path in sys.argv[1:]:
+    header, records = load(path)
+    duration = 1e-6 * (records["time_us"][-1] - records["time_us"][0]) if len(records) > 0 else 0
+    print(f"{path}: {len(records)} records over {duration:.3f}s (period: {header['period_us']}us)")
@@ -1,15 +1,54 @@
 #!/usr/bin/env python3
 import zmq
+import struct
+import math
 import time
 
 
 ## Python class that provides a bridge to the low-level interface.
 # This Python class allows one to communicate with the low-level interface
 # using two TCP sockets (one to receive the current state of the pendulum,
-# one to send actuation commands).
+# one to send actuation commands). Both the binary format (see
+# `include/pendule_pi/wire_format.hpp`) and the legacy text format of the state
+# messages are understood. Commands are sent in the format of the last state
+# received.
 class PendulePy:
   ## Number of state coordinates.
   N_STATES = 5
+  ## Magic number at the beginning of binary messages.
+  WIRE_MAGIC = 0x5050
+  ## Version of the binary format.
+  WIRE_VERSION = 2
+  ## Type of binary state messages.
+  WIRE_STATE = 1
+  ## Type of binary command messages.
+  WIRE_COMMAND = 2
+  ## Layout of binary state messages: header (magic, version, type, sequence,
+  # timestamp in microseconds), position, angle, linear and angular velocities.
+  WIRE_STATE_FORMAT = struct.Struct("<HBBIQdddd")
+  ## Layout of binary command messages: header, PWM and sequence number of the
+  # state the command answers.
+  WIRE_COMMAND_FORMAT = struct.Struct("<HBBIQiI")
+  ## Type of binary feedback law messages.
+  WIRE_FEEDBACK_LAW = 3
+  ## Layout of binary feedback law messages: header, gains, setpoint and
+  # limits (four values each), fallback PWM, sequence number of the state the
+  # law answers, lifetime in microseconds and flags.
+  WIRE_FEEDBACK_LAW_FORMAT = struct.Struct("<HBBIQ4d4d4diIII")
+  ## Flag of feedback laws: the angle error is wrapped in [-pi, pi].
+  WIRE_WRAP_ANGLE = 1
+  ## Type of binary trajectory messages.
+  WIRE_TRAJECTORY = 4
+  ## Largest number of points of a trajectory message.
+  WIRE_TRAJECTORY_POINTS = 8
+  ## Layout of binary trajectory messages: header, sequence number of the
+  # state the trajectory answers, kind of setpoints, number of points, two
+  # unused bytes, and the points (time in microseconds, value).
+  WIRE_TRAJECTORY_FORMAT = struct.Struct("<HBBIQIBBxx" + "Qd" * 8)
+  ## Kind of trajectory: PWM setpoints.
+  TRAJECTORY_PWM = 1
+  ## Kind of trajectory: position setpoints of the feedback law in effect.
+  TRAJECTORY_POSITION = 2
 
   ## Constructor, initializes socket connections.
   # Connections are established at `tcp://[host]:[port]`. The
@@ -40,6 +79,10 @@ class PendulePy:
     self._angle = None
     self._linvel = None
     self._angvel = None
+    self._sequence = 0
+    # Format of the last state received, and sequence number of the next command
+    self._binary = False
+    self._command_sequence = 0
     # Wait for the low-level interface to be up and running.
     if wait <= 0:
       # Wait indefinitely for the first message.
@@ -84,27 +127,50 @@ class PendulePy:
   def angvel(self):
     return self._angvel
 
+  ## Allows to access the sequence number of the current state (binary format only).
+  @property
+  def sequence(self):
+    return self._sequence
+
+  ## Tells if the interface uses the binary format.
+  @property
+  def binary(self):
+    return self._binary
+
   ## Tries to read the state of the pendulum from the interface.
   # @param blocking if `True`, do not exit until a message has been received from
   #   the socket. If `False`, exit immediately if no messages are received.
   # @return `True` if a message has been received and processed. Note that if
   #   the call is blocking, the function should always return `True`.
+  # @throw RuntimeError if a malformed message is received.
   # @note While by default the parameter `blocking` is set to `True`, we
   #   recommend to always pass it as keyword argument, *e.g.*,
   #   `p.readState(blocking=True)`. In this way, it is always clear whether
   #   the call is blocking or not.
   def readState(self, blocking=True):
     if blocking:
-      # Wait for a string message from the socket.
-      msg = self._state_sub.recv_string()
+      # Wait for a message from the socket.
+      msg = self._state_sub.recv()
     else:
       try:
-        # Read a string message from the socket - if none is available, throw!
-        msg = self._state_sub.recv_string(flags=zmq.NOBLOCK)
+        # Read a message from the socket - if none is available, throw!
+        msg = self._state_sub.recv(flags=zmq.NOBLOCK)
       except zmq.Again:
         # No message has been received from the socket.
         return False
+    # Binary messages start with the magic number.
+    if len(msg) >= 2 and struct.unpack_from("<H", msg)[0] == PendulePy.WIRE_MAGIC:
+      if len(msg) != PendulePy.WIRE_STATE_FORMAT.size:
+        raise RuntimeError(f"Malformed binary state message received. Expected {PendulePy.WIRE_STATE_FORMAT.size} bytes, got {len(msg)}.")
+      _, version, msg_type, self._sequence, timestamp, self._position, self._angle, self._linvel, self._angvel = PendulePy.WIRE_STATE_FORMAT.unpack(msg)
+      if version != PendulePy.WIRE_VERSION or msg_type != PendulePy.WIRE_STATE:
+        raise RuntimeError(f"Unsupported binary state message received (version {version}, type {msg_type}).")
+      self._time = 1e-6 * timestamp
+      self._binary = True
+      return True
     # Split the string message into parts. Each part should be a float.
+    self._binary = False
+    msg = msg.decode()
     parts = msg.split(" ")
     # Check that the number of parts is correct, and throw otherwise.
     if len(parts) != PendulePy.N_STATES:
@@ -115,7 +181,148 @@ class PendulePy:
     return True
 
   ## Send a PWM command to the low-level interface.
+  # In the binary format, the command carries the sequence number of the last
+  # state read, so that the interface can measure the latency of the control
+  # loop and reject commands computed from states that are too old.
   # @param pwm the PWM signal to be sent. It should be an integer between -255
   #   and 255. The parameter is cast to `int` before being sent.
   def sendCommand(self, pwm):
-    self._command_pub.send_string(str(int(pwm)))
+    if self._binary:
+      timestamp = time.monotonic_ns() // 1000
+      self._command_pub.send(PendulePy.WIRE_COMMAND_FORMAT.pack(PendulePy.WIRE_MAGIC, PendulePy.WIRE_VERSION, PendulePy.WIRE_COMMAND, self._command_sequence, timestamp, int(pwm), self._sequence))
+      self._command_sequence = (self._command_sequence + 1) % 2**32
+    else:
+      self._command_pub.send_string(str(int(pwm)))
+
+  ## Upload a state-feedback law, evaluated by the interface at each period.
+  # The interface applies `u = -K (x - x_ref)`, with `x` the state (position,
+  # angle, linear velocity, angular velocity), until the next command or law.
+  # The control rate is thus the one of the interface, whatever the rate at
+  # which the client sends laws.
+  # @param gains the four gains `K`.
+  # @param setpoint the four coordinates of `x_ref`.
+  # @param limits largest absolute error of each coordinate for which the law
+  #   is used, 0 for no limit. If `None`, the law is used everywhere.
+  # @param pwm PWM applied when the state is outside of these limits.
+  # @param wrap_angle if `True`, the angle error is wrapped in [-pi, pi].
+  # @param lifetime time during which the law remains in effect, in seconds.
+  #   If 0, it expires as a PWM command would.
+  # @throw RuntimeError if the interface does not use the binary format.
+  def sendFeedbackLaw(self, gains, setpoint, limits=None, pwm=0, wrap_angle=True, lifetime=0):
+    if not self._binary:
+      raise RuntimeError("PendulePy: feedback laws require the binary format.")
+    if limits is None:
+      limits = (0, 0, 0, 0)
+    timestamp = time.monotonic_ns() // 1000
+    flags = PendulePy.WIRE_WRAP_ANGLE if wrap_angle else 0
+    lifetime_us = min(max(int(1e6 * lifetime), 0), 2**32 - 1)
+    self._command_pub.send(PendulePy.WIRE_FEEDBACK_LAW_FORMAT.pack(PendulePy.WIRE_MAGIC, PendulePy.WIRE_VERSION, PendulePy.WIRE_FEEDBACK_LAW, self._command_sequence, timestamp, *gains, *setpoint, *limits, int(pwm), self._sequence, lifetime_us, flags))
+    self._command_sequence = (self._command_sequence + 1) % 2**32
+
+  ## Send a segment of time-stamped setpoints, interpolated by the interface.
+  # At each period, the interface interpolates the setpoints smoothly against
+  # its own clock, and fades from the previous segment to this one. Sending
+  # segments that extend a little beyond the time of the next message keeps
+  # the actuation smooth even over jittery links.
+  # @param times times of the setpoints, strictly increasing, in seconds on
+  #   the clock of the interface (i.e., as returned by `time`).
+  # @param values setpoints: PWM signals, or position setpoints of the
+  #   feedback law in effect (see `sendFeedbackLaw`).
+  # @param kind `TRAJECTORY_PWM` or `TRAJECTORY_POSITION`.
+  # @throw RuntimeError if the interface does not use the binary format.
+  # @throw ValueError if there are less than 2 points or too many, if a time
+  #   is negative, if the times are not strictly increasing (once rounded to
+  #   the microsecond), or if a value is not finite.
+  def sendTrajectory(self, times, values, kind=TRAJECTORY_PWM):
+    if not self._binary:
+      raise RuntimeError("PendulePy: trajectories require the binary format.")
+    if len(times) != len(values) or not 2 <= len(times) <= PendulePy.WIRE_TRAJECTORY_POINTS:
+      raise ValueError(f"PendulePy: a trajectory needs between 2 and {PendulePy.WIRE_TRAJECTORY_POINTS} points, with as many times as values.")
+    times_us = [round(1e6 * t) if math.isfinite(t) else -1 for t in times]
+    if min(times_us) < 0 or not all(math.isfinite(v) for v in values):
+      raise ValueError("PendulePy: the times of a trajectory must be non-negative, and its points finite.")
+    if any(t1 <= t0 for t0, t1 in zip(times_us, times_us[1:])):
+      raise ValueError("PendulePy: the times of a trajectory must be strictly increasing (at the microsecond).")
+    points = []
+    for i in range(PendulePy.WIRE_TRAJECTORY_POINTS):
+      if i < len(times):
+        points += [times_us[i], float(values[i])]
+      else:
+        points += [0, 0.0]
+    timestamp = time.monotonic_ns() // 1000
+    self._command_pub.send(PendulePy.WIRE_TRAJECTORY_FORMAT.pack(PendulePy.WIRE_MAGIC, PendulePy.WIRE_VERSION, PendulePy.WIRE_TRAJECTORY, self._command_sequence, timestamp, self._sequence, kind, len(times), *points))
+    self._command_sequence = (self._command_sequence + 1) % 2**32
+
+
+## Python class that receives the burst messages of the low-level interface.
+# When enabled (see 'burst' in `pendule_pi_config.yaml`), the interface samples
+# the encoders at a high rate (typically a few kHz), and publishes the samples
+# in batches, once per period, on a dedicated socket. This allows to identify
+# the pendulum remotely, with full-bandwidth data, while the interface keeps
+# serving PendulePy clients.
+#
+# Unlike states, batches are queued rather than replaced by newer ones: read
+# them regularly, and check `lost` to detect gaps.
+class BurstListener:
+  ## Type of binary burst messages.
+  WIRE_BURST = 5
+  ## Layout of the beginning of burst messages: header, number of samples,
+  # sampling period in microseconds, number of samples lost by the interface,
+  # four unused bytes, and the conversion coefficients of the steps (position
+  # scale and offset, angle scale and offset).
+  WIRE_BURST_FORMAT = struct.Struct("<HBBIQIIIxxxx4d")
+  ## Layout of a sample: time in microseconds, steps of the position and angle
+  # encoders, and applied PWM.
+  WIRE_SAMPLE_FORMAT = struct.Struct("<Qiii")
+
+  ## Constructor, connects to the interface.
+  # @param host host of the interface.
+  # @param burst_port port of the socket publishing the burst messages.
+  def __init__(self, host="localhost", burst_port="10004"):
+    self._context = zmq.Context()
+    self._burst_sub = self._context.socket(zmq.SUB)
+    self._burst_sub.connect(f"tcp://{host}:{burst_port}")
+    self._burst_sub.subscribe("")
+    self._sequence = None
+    self._lost = 0
+    self._missed = 0
+
+  ## Number of samples lost by the interface, because it could not send them.
+  @property
+  def lost(self):
+    return self._lost
+
+  ## Number of batches that were published but not received.
+  @property
+  def missed(self):
+    return self._missed
+
+  ## Read a batch of samples.
+  # @param blocking if `True`, wait for a batch. If `False`, return `None`
+  #   immediately if no batch is available.
+  # @return a list of samples `(time, position, angle, pwm)`, with the time in
+  #   seconds (on the clock of the interface, as `PendulePy.time`), the
+  #   position in meters and the angle in radians.
+  # @throw RuntimeError if a malformed message is received.
+  def read(self, blocking=True):
+    try:
+      msg = self._burst_sub.recv(flags=0 if blocking else zmq.NOBLOCK)
+    except zmq.Again:
+      return None
+    header_size = BurstListener.WIRE_BURST_FORMAT.size
+    sample_size = BurstListener.WIRE_SAMPLE_FORMAT.size
+    if len(msg) < header_size:
+      raise RuntimeError(f"Malformed burst message received ({len(msg)} bytes).")
+    magic, version, msg_type, sequence, _, count, _, lost, position_scale, position_offset, angle_scale, angle_offset = BurstListener.WIRE_BURST_FORMAT.unpack_from(msg)
+    if magic != PendulePy.WIRE_MAGIC or version != PendulePy.WIRE_VERSION or msg_type != BurstListener.WIRE_BURST:
+      raise RuntimeError(f"Unsupported burst message received (version {version}, type {msg_type}).")
+    if len(msg) != header_size + count * sample_size:
+      raise RuntimeError(f"Malformed burst message received. Expected {header_size + count * sample_size} bytes, got {len(msg)}.")
+    if self._sequence is not None:
+      self._missed += (sequence - self._sequence - 1) % 2**32
+    self._sequence = sequence
+    self._lost = lost
+    samples = []
+    for time_us, position_steps, angle_steps, pwm in BurstListener.WIRE_SAMPLE_FORMAT.iter_unpack(msg[header_size:]):
+      samples.append((1e-6 * time_us, position_scale * position_steps + position_offset, angle_scale * angle_steps + angle_offset, pwm))
+    return samples
@@ -0,0 +1,76 @@
+/** @file shm_channel_test.cpp
+  * @brief Recovery of a ShmChannel whose writer died in the middle of a write.
+  *
+  * The test marks the state slot as being written, as a writer killed between
+  * the two updates of the seqlock would leave it, and checks that readers
+  * give up instead of spinning, and that the next write makes the channel
+  * usable again.
+  */
+#include <pendule_pi/shm_channel.hpp>
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace pp = pendule_pi;
+
+/// Print a message and fail the test if the condition does not hold.
+#define CHECK(condition) if(!(condition)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; return 1; }
+
+/// Offset of the sequence of the state slot in the shared memory.
+/** The slot is aligned to a cache line, and comes right after the 16 bytes
+  * of the header.
+  */
+constexpr std::size_t STATE_SEQUENCE_OFFSET = 64;
+
+
+int main() {
+  const std::string name = "pendule_pi_shm_channel_test";
+  pp::ShmChannel server(name, pp::ShmChannel::CREATE);
+  pp::ShmChannel client(name, pp::ShmChannel::OPEN);
+
+  // Map the object a third time to tamper with the seqlock
+  const int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+  CHECK(fd >= 0);
+  void* memory = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(memory != MAP_FAILED);
+  auto* sequence = reinterpret_cast<std::atomic<std::uint32_t>*>(static_cast<std::uint8_t*>(memory) + STATE_SEQUENCE_OFFSET);
+
+  pp::wire::State state{};
+  pp::wire::StateBuffer buffer;
+  state.position = 1.0;
+  pp::wire::encode(state, buffer);
+  server.writeState(buffer);
+  CHECK(client.readState(buffer));
+
+  // The writer died after the first store of a write
+  sequence->store(sequence->load() + 1);
+  CHECK(sequence->load() % 2 == 1);
+  CHECK(!client.readState(buffer));
+  CHECK(!client.waitState(1000));
+
+  // The next write must leave the slot readable
+  state.position = 2.0;
+  pp::wire::encode(state, buffer);
+  server.writeState(buffer);
+  CHECK(sequence->load() % 2 == 0);
+  CHECK(client.readState(buffer));
+  CHECK(pp::wire::decode(buffer.data(), buffer.size(), state));
+  CHECK(state.position == 2.0);
+
+  // And so must the following ones
+  state.position = 3.0;
+  pp::wire::encode(state, buffer);
+  server.writeState(buffer);
+  CHECK(client.waitState(1000));
+  CHECK(client.readState(buffer));
+  CHECK(pp::wire::decode(buffer.data(), buffer.size(), state));
+  CHECK(state.position == 3.0);
+
+  munmap(memory, 4096);
+  std::cout << "shm_channel_test: passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,87 @@
+/** @file trajectory_test.cpp
+  * @brief Continuity of a Trajectory when segments are loaded faster than the blending time.
+  *
+  * Three segments are loaded 20ms apart, with a 50ms blending time, so that
+  * the second and the third ones are loaded while the output is still
+  * fading. The output must remain continuous, and so must its derivative.
+  */
+#include <pendule_pi/trajectory.hpp>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <utility>
+
+namespace pp = pendule_pi;
+
+/// Print a message and fail the test if the condition does not hold.
+#define CHECK(condition) if(!(condition)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; return 1; }
+
+
+/// Build a PWM segment from a list of (time, value) points.
+pp::wire::Trajectory segment(
+  std::initializer_list<std::pair<std::uint64_t,double>> points
+)
+{
+  pp::wire::Trajectory trajectory{};
+  trajectory.kind = pp::wire::Trajectory::Kind::Pwm;
+  for(const auto& point : points)
+    trajectory.points[trajectory.count++] = {point.first, point.second};
+  return trajectory;
+}
+
+
+int main() {
+  const std::uint64_t blend_us = 50000;
+  const std::uint64_t load_period_us = 20000;
+  const std::uint64_t dt_us = 100;
+  // The segments cover the whole test, so that the only discontinuities
+  // that may happen are those caused by the loads.
+  const std::uint64_t start_us = 1000000;
+  const std::uint64_t end_us = start_us + 150000;
+  const pp::wire::Trajectory segments[] = {
+    segment({{start_us - 100000, -100.0}, {end_us + 100000, 150.0}}),
+    segment({{start_us - 100000, -100.0}, {end_us + 100000, -100.0}}),
+    segment({{start_us - 100000, 200.0}, {start_us + 50000, 150.0}, {end_us + 100000, 200.0}})
+  };
+  CHECK(pp::Trajectory::isValid(segments[0]));
+  CHECK(pp::Trajectory::isValid(segments[1]));
+  CHECK(pp::Trajectory::isValid(segments[2]));
+
+  pp::Trajectory trajectory(blend_us);
+  // Largest variations between two evaluations, far above those of a
+  // continuous output, and far below the size of the steps to be detected.
+  const double max_step = 2.0;
+  const double max_derivative_step = 500.0;
+  double value = 0;
+  double derivative = 0;
+  std::size_t loaded = 0;
+  for(std::uint64_t now_us = start_us; now_us <= end_us; now_us += dt_us) {
+    bool reloaded = false;
+    if(loaded < 3 && now_us == start_us + loaded * load_period_us) {
+      trajectory.load(segments[loaded++], now_us);
+      reloaded = loaded > 1;
+    }
+    double new_derivative;
+    const double new_value = trajectory.evaluate(now_us, &new_derivative);
+    CHECK(std::isfinite(new_value) && std::isfinite(new_derivative));
+    if(now_us > start_us) {
+      if(std::fabs(new_value - value) > max_step || std::fabs(new_derivative - derivative) > max_derivative_step) {
+        std::cerr << "discontinuity at " << now_us << "us" << (reloaded ? " (segment loaded)" : "")
+                  << ": " << value << " -> " << new_value
+                  << ", derivative " << derivative << " -> " << new_derivative << std::endl;
+        return 1;
+      }
+    }
+    value = new_value;
+    derivative = new_derivative;
+  }
+  // Once the last fade is over, the output is the last segment.
+  double expected_derivative;
+  const double expected = trajectory.evaluate(end_us, &expected_derivative);
+  CHECK(std::fabs(value - expected) < 1e-9);
+  CHECK(trajectory.statistics().uploads == 3);
+
+  std::cout << "trajectory_test: passed" << std::endl;
+  return 0;
+}